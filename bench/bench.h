@@ -0,0 +1,42 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/* Small helpers shared by the benchmarks. Everything here is `static` since each benchmark is its own executable. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Returns the current time of the monotonic clock in seconds. */
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Reads the given file into a null-terminated, heap-allocated buffer. Exits on failure. */
+static char *bench_readFile(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "error: could not open file: %s\n", path);
+		exit(74);
+	}
+
+	fseek(file, 0L, SEEK_END);
+	size_t size = ftell(file);
+	rewind(file);
+
+	char *buffer = malloc(size + 1);
+	if (buffer == NULL || fread(buffer, sizeof(char), size, file) < size) {
+		fprintf(stderr, "error: could not read file: %s\n", path);
+		exit(74);
+	}
+	buffer[size] = '\0';
+
+	fclose(file);
+	return buffer;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#!/usr/bin/env sh
+
+# Builds and runs the Hoshi benchmarks. Run it from the repository's root:
+#   sh bench/bench.sh [benchmark...]
+# With no arguments, every benchmark is run.
+
+set -e
+
+mkdir -p target/bench
+
+libhoshi_sources="
+	src/hoshi/binio/binio.c
+	src/hoshi/chunk_loader.c
+	src/hoshi/chunk_writer.c
+	src/hoshi/chunk.c
+	src/hoshi/common.c
+	src/hoshi/debug.c
+	src/hoshi/fusion.c
+	src/hoshi/gc.c
+	src/hoshi/hash_table.c
+	src/hoshi/jit.c
+	src/hoshi/memory.c
+	src/hoshi/object.c
+	src/hoshi/optimizer.c
+	src/hoshi/program.c
+	src/hoshi/siphash.c
+	src/hoshi/ssa.c
+	src/hoshi/value.c
+	src/hoshi/verifier.c
+	src/hoshi/vm.c"
+hir_sources="
+	src/hir/compiler.c
+	src/hir/regions.c
+	src/hir/lexer.c"
+bench_flags="-O3 -pthread -DHOSHI_ENABLE_GLOBAL_NAME_DUMP=0"
+
+cc () {
+	echo "-> gcc $@"
+	gcc $@
+}
+
+dispatch () {
+	for goto in 0 1
+	do
+		cc "-o target/bench/dispatch-$goto $bench_flags
+			-DHOSHI_ENABLE_INSTRUCTION_COUNTING=1
+			-DHOSHI_ENABLE_COMPUTED_GOTO=$goto
+			-DHOSHI_ENABLE_QUICKENING=0
+			bench/dispatch.c $libhoshi_sources $hir_sources"
+		./target/bench/dispatch-$goto tests/hir/loops.hir tests/hir/count.hir > /dev/null
+	done
+}
+
+quickening () {
+	for quicken in 0 1
+	do
+		cc "-o target/bench/quickening-$quicken $bench_flags
+			-DHOSHI_ENABLE_INSTRUCTION_COUNTING=1
+			-DHOSHI_ENABLE_QUICKENING=$quicken
+			bench/dispatch.c $libhoshi_sources $hir_sources"
+		./target/bench/quickening-$quicken tests/hir/count.hir tests/hir/quicken.hir > /dev/null
+	done
+}
+
+values () {
+	for nanboxing in 0 1
+	do
+		cc "-o target/bench/values-$nanboxing $bench_flags
+			-DHOSHI_ENABLE_NAN_BOXING=$nanboxing
+			bench/values.c $libhoshi_sources $hir_sources"
+		./target/bench/values-$nanboxing tests/hir/count.hir > /dev/null
+	done
+}
+
+integers () {
+	for jit in 0 1
+	do
+		cc "-o target/bench/integers-$jit $bench_flags
+			-DHOSHI_ENABLE_JIT=$jit
+			bench/integers.c $libhoshi_sources $hir_sources"
+		./target/bench/integers-$jit tests/hir/loops.hir tests/hir/count.hir tests/hir/quicken.hir > /dev/null
+	done
+}
+
+fusion () {
+	cc "-o target/bench/fusion $bench_flags
+		-DHOSHI_ENABLE_INSTRUCTION_COUNTING=1
+		bench/fusion.c $libhoshi_sources $hir_sources"
+	./target/bench/fusion tests/hir/loops.hir tests/hir/count.hir tests/hir/fusion.hir > /dev/null
+}
+
+decode () {
+	cc "-o target/bench/decode $bench_flags
+		bench/decode.c $libhoshi_sources $hir_sources"
+	./target/bench/decode tests/hir/*.hir > /dev/null
+}
+
+verify () {
+	cc "-o target/bench/verify $bench_flags
+		bench/verify.c $libhoshi_sources $hir_sources"
+	./target/bench/verify tests/hir/loops.hir tests/hir/count.hir tests/hir/quicken.hir > /dev/null
+}
+
+slice () {
+	cc "-o target/bench/slice $bench_flags
+		bench/slice.c $libhoshi_sources $hir_sources"
+	./target/bench/slice tests/hir/loops.hir tests/hir/count.hir > /dev/null
+}
+
+parallel () {
+	cc "-o target/bench/parallel $bench_flags
+		bench/parallel.c $libhoshi_sources $hir_sources"
+	./target/bench/parallel tests/hir/count.hir tests/hir/quicken.hir > /dev/null
+}
+
+suspend () {
+	cc "-o target/bench/suspend $bench_flags
+		bench/suspend.c $libhoshi_sources $hir_sources"
+	./target/bench/suspend
+}
+
+tables () {
+	cc "-o target/bench/tables $bench_flags
+		bench/tables.c $libhoshi_sources"
+	./target/bench/tables
+}
+
+strings () {
+	for ropes in 0 1
+	do
+		cc "-o target/bench/strings-$ropes $bench_flags
+			-DHOSHI_ENABLE_ROPES=$ropes
+			bench/strings.c $libhoshi_sources $hir_sources"
+		./target/bench/strings-$ropes > /dev/null
+	done
+}
+
+heap () {
+	for slabs in 0 1
+	do
+		cc "-o target/bench/heap-$slabs $bench_flags
+			-DHOSHI_ENABLE_SLABS=$slabs
+			bench/heap.c $libhoshi_sources"
+		./target/bench/heap-$slabs
+	done
+}
+
+hashing () {
+	for hash in 0 1 2
+	do
+		cc "-o target/bench/hashing-$hash $bench_flags
+			-DHOSHI_STRING_HASH=$hash
+			bench/hashing.c $libhoshi_sources"
+		./target/bench/hashing-$hash
+	done
+}
+
+gc () {
+	for gc in 0 1
+	do
+		cc "-o target/bench/gc-$gc $bench_flags
+			-DHOSHI_ENABLE_GC=$gc
+			bench/gc.c $libhoshi_sources $hir_sources"
+		./target/bench/gc-$gc
+	done
+}
+
+jit () {
+	cc "-o target/bench/jit $bench_flags
+		-DHOSHI_ENABLE_JIT=1
+		bench/jit.c $libhoshi_sources $hir_sources"
+	./target/bench/jit tests/hir/loops.hir tests/hir/count.hir tests/hir/quicken.hir > /dev/null
+}
+
+if [ $# -eq 0 ]
+then
+	set -- dispatch quickening values integers fusion decode verify slice parallel suspend strings tables hashing heap gc jit
+fi
+
+for arg in "$@"
+do
+	case "$arg" in
+		"dispatch"  ) dispatch ;;
+		"quickening") quickening ;;
+		"values"    ) values ;;
+		"integers"  ) integers ;;
+		"fusion"    ) fusion ;;
+		"decode"    ) decode ;;
+		"verify"    ) verify ;;
+		"slice"     ) slice ;;
+		"parallel"  ) parallel ;;
+		"suspend"   ) suspend ;;
+		"strings"   ) strings ;;
+		"tables"    ) tables ;;
+		"hashing"   ) hashing ;;
+		"heap"      ) heap ;;
+		"gc"        ) gc ;;
+		"jit"       ) jit ;;
+		*           ) echo "Unknown benchmark: $arg" ;;
+	esac
+done
@@ -0,0 +1,71 @@
+/* Decode benchmark: what hoshi_decodeChunk adds to startup, next to what it takes to compile and run HIR programs.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_ITERATIONS 20
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: decode <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		char *source = bench_readFile(argv[i]);
+		double compiling = 0, decoding = 0, running = 0;
+		int instructions = 0;
+
+		for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++) {
+			hoshi_VM vm;
+			hoshi_initVM(&vm);
+			hoshi_Chunk chunk;
+			hoshi_initChunk(&chunk, &vm.allocator);
+
+			double start = bench_now();
+			if (!hir_compileString(&vm, &chunk, source)) {
+				fprintf(stderr, "error: failed to compile %s\n", argv[i]);
+				return 1;
+			}
+			hoshi_fuseChunk(&chunk, NULL);
+			compiling += bench_now() - start;
+
+			start = bench_now();
+			if (!hoshi_decodeChunk(&chunk)) {
+				fprintf(stderr, "error: failed to decode %s\n", argv[i]);
+				return 1;
+			}
+			decoding += bench_now() - start;
+			instructions = chunk.instructionCount;
+
+			start = bench_now();
+			hoshi_runChunk(&vm, &chunk);
+			running += bench_now() - start;
+
+			hoshi_freeChunk(&chunk);
+			hoshi_freeVM(&vm);
+		}
+
+		fprintf(
+			stderr,
+			"%-24s %6d instructions: compile %9.2fus, decode %9.2fus (%5.1f%% of compile), run %10.2fus\n",
+			argv[i],
+			instructions,
+			compiling / BENCH_ITERATIONS * 1e6,
+			decoding / BENCH_ITERATIONS * 1e6,
+			decoding / compiling * 100,
+			running / BENCH_ITERATIONS * 1e6
+		);
+		free(source);
+	}
+
+	return 0;
+}
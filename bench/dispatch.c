@@ -0,0 +1,76 @@
+/* Dispatch benchmark: instructions per second of hoshi_runNext on HIR programs.
+ * bench.sh builds this once per dispatch mode (HOSHI_ENABLE_COMPUTED_GOTO) and once per HOSHI_ENABLE_QUICKENING setting so they can be compared.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/vm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !HOSHI_ENABLE_INSTRUCTION_COUNTING
+	#error "the dispatch benchmark must be built with -DHOSHI_ENABLE_INSTRUCTION_COUNTING=1"
+#endif
+
+#if HOSHI_ENABLE_COMPUTED_GOTO
+	#define BENCH_DISPATCH "computed-goto"
+#else
+	#define BENCH_DISPATCH "switch"
+#endif
+
+#if HOSHI_ENABLE_QUICKENING
+	#define BENCH_MODE BENCH_DISPATCH "+quicken"
+#else
+	#define BENCH_MODE BENCH_DISPATCH
+#endif
+
+#define BENCH_ITERATIONS 20
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: dispatch <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		char *source = bench_readFile(argv[i]);
+		uint64_t instructions = 0;
+		double seconds = 0;
+
+		for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++) {
+			hoshi_VM vm;
+			hoshi_initVM(&vm);
+			hoshi_Chunk chunk;
+			hoshi_initChunk(&chunk, &vm.allocator);
+			if (!hir_compileString(&vm, &chunk, source)) {
+				fprintf(stderr, "error: failed to compile %s\n", argv[i]);
+				return 1;
+			}
+
+			double start = bench_now();
+			hoshi_runChunk(&vm, &chunk);
+			seconds += bench_now() - start;
+			instructions += vm.instructionCount;
+
+			hoshi_freeChunk(&chunk);
+			hoshi_freeVM(&vm);
+		}
+
+		fprintf(
+			stderr,
+			"%-22s %-24s %12llu instructions in %8.4fs = %8.2f M instructions/s\n",
+			BENCH_MODE,
+			argv[i],
+			(unsigned long long)instructions,
+			seconds,
+			instructions / seconds / 1e6
+		);
+		free(source);
+	}
+
+	return 0;
+}
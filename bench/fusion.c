@@ -0,0 +1,79 @@
+/* Fusion benchmark: runs HIR programs with and without hoshi_fuseChunk and compares dispatches and time.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !HOSHI_ENABLE_INSTRUCTION_COUNTING
+	#error "the fusion benchmark must be built with -DHOSHI_ENABLE_INSTRUCTION_COUNTING=1"
+#endif
+
+#define BENCH_ITERATIONS 20
+
+/* Runs `source` BENCH_ITERATIONS times and returns the total time spent in hoshi_runChunk. */
+static double bench_run(const char *path, const char *source, bool fuse, uint64_t *instructions)
+{
+	double seconds = 0;
+	*instructions = 0;
+
+	for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++) {
+		hoshi_VM vm;
+		hoshi_initVM(&vm);
+		hoshi_Chunk chunk;
+		hoshi_initChunk(&chunk, &vm.allocator);
+		if (!hir_compileString(&vm, &chunk, source)) {
+			fprintf(stderr, "error: failed to compile %s\n", path);
+			exit(1);
+		}
+		if (fuse) {
+			hoshi_fuseChunk(&chunk, NULL);
+		}
+
+		double start = bench_now();
+		hoshi_runChunk(&vm, &chunk);
+		seconds += bench_now() - start;
+		*instructions += vm.instructionCount;
+
+		hoshi_freeChunk(&chunk);
+		hoshi_freeVM(&vm);
+	}
+
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: fusion <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		char *source = bench_readFile(argv[i]);
+		uint64_t plainInstructions, fusedInstructions;
+		double plain = bench_run(argv[i], source, false, &plainInstructions);
+		double fused = bench_run(argv[i], source, true, &fusedInstructions);
+
+		fprintf(
+			stderr,
+			"%-24s %12llu -> %12llu dispatches, %8.4fs -> %8.4fs (%.2fx)\n",
+			argv[i],
+			(unsigned long long)plainInstructions,
+			(unsigned long long)fusedInstructions,
+			plain,
+			fused,
+			plain / fused
+		);
+		free(source);
+	}
+
+	return 0;
+}
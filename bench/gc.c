@@ -0,0 +1,208 @@
+/* GC benchmark: how long the collector holds a running chunk up, and how much memory the chunk takes once it has been running for a while.
+ * The chunk first builds a rope BENCH_GC_LIVE pieces deep that it keeps to the end, so every collection has something to mark,
+ * and then concatenates in a loop, throwing each string it builds away after BENCH_GC_ROUND pieces. Every iteration makes a host call,
+ * which takes the time since the last one, so the slowest iterations are the ones a collector step ran in.
+ * It runs with the default HOSHI_GC_STEP_WORK, and again with steps that finish a whole collection at once, which is what a collector that is not
+ * incremental would do. RSS is read from /proc/self/status halfway through the loop and at its end, which stay the same once memory is being reused.
+ * bench.sh builds this with and without HOSHI_ENABLE_GC. Results are written to stderr. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/vm.h"
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HOSHI_ENABLE_GC
+	#define BENCH_GC "gc"
+#else
+	#define BENCH_GC "no gc"
+#endif
+
+#define BENCH_GC_LIVE 100000
+#define BENCH_GC_ROUND 1000
+#define BENCH_GC_ROUNDS 2000
+#define BENCH_GC_ITERATIONS (BENCH_GC_ROUND * BENCH_GC_ROUNDS)
+
+/* Iteration times go in buckets of 32 per power of two, which is within 3% of the real time */
+#define BENCH_GC_SUB_BUCKETS 32
+#define BENCH_GC_BUCKETS (64 * BENCH_GC_SUB_BUCKETS)
+
+typedef struct {
+	uint64_t last; /* When the last host call was made, 0 before the first one */
+	uint64_t longest;
+	long calls;
+	long buckets[BENCH_GC_BUCKETS];
+	long rssHalfway;
+	long rssEnd;
+} bench_Latencies;
+
+static int bench_bucketOf(uint64_t nanos)
+{
+	if (nanos < BENCH_GC_SUB_BUCKETS) {
+		return (int)nanos;
+	}
+	int exponent = 63 - __builtin_clzll(nanos) - 5;
+	return exponent * BENCH_GC_SUB_BUCKETS + (int)(nanos >> exponent);
+}
+
+/* The smallest time in a bucket */
+static uint64_t bench_bucketStart(int bucket)
+{
+	if (bucket < 2 * BENCH_GC_SUB_BUCKETS) {
+		return (uint64_t)bucket;
+	}
+	int exponent = bucket / BENCH_GC_SUB_BUCKETS - 1;
+	return (uint64_t)(bucket - exponent * BENCH_GC_SUB_BUCKETS) << exponent;
+}
+
+/* Resident memory of the process in KB, from /proc/self/status, or -1 where there is none */
+static long bench_rss(void)
+{
+	FILE *file = fopen("/proc/self/status", "r");
+	if (file == NULL) {
+		return -1;
+	}
+	char line[256];
+	long rss = -1;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (strncmp(line, "VmRSS:", 6) == 0) {
+			rss = strtol(line + 6, NULL, 10);
+			break;
+		}
+	}
+	fclose(file);
+	return rss;
+}
+
+static hoshi_HostResult bench_tick(hoshi_VM *vm, hoshi_Value argument, hoshi_Value *result)
+{
+	bench_Latencies *latencies = vm->hostData;
+	uint64_t now = hoshi_clockNanos();
+	if (latencies->last != 0) {
+		uint64_t nanos = now - latencies->last;
+		latencies->buckets[bench_bucketOf(nanos)]++;
+		if (nanos > latencies->longest) {
+			latencies->longest = nanos;
+		}
+	}
+	latencies->calls++;
+	if (latencies->calls == BENCH_GC_ITERATIONS / 2) {
+		latencies->rssHalfway = bench_rss();
+	}
+	/* The RSS is read outside of the timing, so it does not show up as a slow iteration */
+	latencies->last = hoshi_clockNanos();
+	*result = argument;
+	return HOSHI_HOST_OK;
+}
+
+/* The time `fraction` of the iterations took at most */
+static double bench_percentile(bench_Latencies *latencies, double fraction)
+{
+	long total = 0;
+	for (int i = 0; i < BENCH_GC_BUCKETS; i++) {
+		total += latencies->buckets[i];
+	}
+	long seen = 0;
+	for (int i = 0; i < BENCH_GC_BUCKETS; i++) {
+		seen += latencies->buckets[i];
+		if (seen >= total * fraction) {
+			return (double)bench_bucketStart(i + 1) / 1000.0;
+		}
+	}
+	return (double)latencies->longest / 1000.0;
+}
+
+static char *bench_source(void)
+{
+	size_t capacity = 1024;
+	char *source = malloc(capacity);
+	snprintf(
+		source,
+		capacity,
+		"\"0123456789abcdefghijklmnopqrstuvwxyz\" deflocal $piece\n"
+		"\"\" deflocal $live\n"
+		"\"\" deflocal $s\n"
+		"0 deflocal $i\n"
+		"0 deflocal $j\n"
+		":build\n"
+		"getlocal $live getlocal $piece concat setlocal $live pop\n"
+		"getlocal $i 1 add setlocal $i %d lt goto_if :build\n"
+		"0 setlocal $i pop\n"
+		":outer\n"
+		"\"\" setlocal $s pop\n"
+		"0 setlocal $j pop\n"
+		":inner\n"
+		"getlocal $s getlocal $piece concat setlocal $s pop\n"
+		"0 hostcall 0 pop\n"
+		"getlocal $j 1 add setlocal $j %d lt goto_if :inner\n"
+		"getlocal $i 1 add setlocal $i %d lt goto_if :outer\n"
+		"0 exit\n",
+		BENCH_GC_LIVE,
+		BENCH_GC_ROUND,
+		BENCH_GC_ROUNDS
+	);
+	return source;
+}
+
+static void bench_run(const char *name, int stepWork)
+{
+	hoshi_VM vm;
+	hoshi_initVM(&vm);
+	vm.gc.stepWork = stepWork;
+	bench_Latencies *latencies = calloc(1, sizeof(bench_Latencies));
+	vm.hostData = latencies;
+	hoshi_setHostFunction(&vm, 0, bench_tick);
+
+	char *source = bench_source();
+	hoshi_Chunk chunk;
+	hoshi_initChunk(&chunk, &vm.allocator);
+	if (!hir_compileString(&vm, &chunk, source)) {
+		fputs("error: failed to compile the benchmark's source\n", stderr);
+		exit(1);
+	}
+	hoshi_fuseChunk(&chunk, NULL);
+
+	double start = bench_now();
+	hoshi_runChunk(&vm, &chunk);
+	double seconds = bench_now() - start;
+	latencies->rssEnd = bench_rss();
+
+	fprintf(
+		stderr,
+		"[%s] %-14s %7.4fs, iterations p50 %6.2fus p99 %6.2fus p99.9 %6.2fus p99.99 %8.2fus max %8.2fus, "
+		"%3" PRIu64 " collections in %5" PRIu64 " steps, RSS %6ld KB halfway %6ld KB at the end\n",
+		BENCH_GC,
+		name,
+		seconds,
+		bench_percentile(latencies, 0.5),
+		bench_percentile(latencies, 0.99),
+		bench_percentile(latencies, 0.999),
+		bench_percentile(latencies, 0.9999),
+		(double)latencies->longest / 1000.0,
+		vm.gc.cycles,
+		vm.gc.steps,
+		latencies->rssHalfway,
+		latencies->rssEnd
+	);
+
+	hoshi_freeChunk(&chunk);
+	hoshi_freeVM(&vm);
+	free(source);
+	free(latencies);
+}
+
+int main(int argc, char *argv[])
+{
+	bench_run("incremental", HOSHI_GC_STEP_WORK);
+#if HOSHI_ENABLE_GC
+	bench_run("stop the world", INT_MAX);
+#endif
+	return 0;
+}
@@ -0,0 +1,116 @@
+/* Hashing benchmark: how fast hoshi_hashString is, and what a table does when its keys all have the same hash.
+ *   lengths - hashes strings of 4 to 4096 bytes over and over, and reports the time per hash and the bytes hashed per second.
+ *   flood   - puts BENCH_FLOOD_KEYS keys that all have the same hash in a table, which is what someone picking keys to collide would do,
+ *             next to the same amount of keys with their own hashes. Once probing for a free slot takes more than HOSHI_TABLE_MAX_PROBE groups
+ *             the table switches to SipHash under a key of its own, which spreads the flood out again.
+ * bench.sh builds this once for every HOSHI_STRING_HASH. Results are written to stderr. */
+
+#include "bench.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/hash_table.h"
+#include "../src/hoshi/memory.h"
+#include "../src/hoshi/object.h"
+#include "../src/hoshi/vm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HOSHI_STRING_HASH == HOSHI_HASH_WORDS
+	#define BENCH_HASH "words"
+#elif HOSHI_STRING_HASH == HOSHI_HASH_SIPHASH
+	#define BENCH_HASH "siphash"
+#else
+	#define BENCH_HASH "fnv1a"
+#endif
+
+/* Every length hashes about this many bytes in total */
+#define BENCH_HASH_BYTES (256 * 1024 * 1024)
+#define BENCH_FLOOD_KEYS 20000
+
+static const int bench_lengths[] = { 4, 8, 16, 32, 64, 256, 1024, 4096 };
+
+/* Keeps the work from being optimized away */
+static uint32_t bench_sink = 0;
+
+static double bench_hashLength(hoshi_VM *vm, const char *buffer, int length)
+{
+	int rounds = BENCH_HASH_BYTES / length;
+	double start = bench_now();
+	for (int i = 0; i < rounds; i++) {
+		/* Starting somewhere else every time keeps the hash from being worked out once for every round */
+		bench_sink += hoshi_hashString(vm->hashKey, buffer + (i & 7), length);
+	}
+	return bench_now() - start;
+}
+
+/* Puts BENCH_FLOOD_KEYS keys in a table and looks all of them up again. With `collide`, all of them get the hash of the first one. */
+static double bench_flood(hoshi_VM *vm, bool collide, bool *keyed)
+{
+	hoshi_ObjectString **keys = malloc(sizeof(hoshi_ObjectString *) * BENCH_FLOOD_KEYS);
+	for (int i = 0; i < BENCH_FLOOD_KEYS; i++) {
+		char buffer[32];
+		int length = snprintf(buffer, sizeof(buffer), "flood%d", i);
+		char *chars;
+		keys[i] = hoshi_allocateString(vm, length, &chars);
+		memcpy(chars, buffer, length);
+		hoshi_stringHash(vm, keys[i]);
+		if (collide) {
+			keys[i]->hash = keys[0]->hash;
+		}
+	}
+
+	hoshi_Table table;
+	hoshi_initTable(&table, &vm->allocator);
+	double start = bench_now();
+	for (int i = 0; i < BENCH_FLOOD_KEYS; i++) {
+		hoshi_tableSet(&table, keys[i], HOSHI_NUMBER(i));
+	}
+	for (int i = 0; i < BENCH_FLOOD_KEYS; i++) {
+		hoshi_Value value;
+		bench_sink += hoshi_tableGet(&table, keys[i], &value);
+	}
+	double seconds = bench_now() - start;
+	*keyed = table.keyed;
+	hoshi_freeTable(&table);
+	free(keys);
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	hoshi_VM vm;
+	hoshi_initVM(&vm);
+
+	int longest = bench_lengths[sizeof(bench_lengths) / sizeof(bench_lengths[0]) - 1];
+	char *buffer = malloc(longest + 8);
+	for (int i = 0; i < longest + 8; i++) {
+		buffer[i] = (char)('a' + i % 26);
+	}
+	for (size_t i = 0; i < sizeof(bench_lengths) / sizeof(bench_lengths[0]); i++) {
+		int length = bench_lengths[i];
+		double seconds = bench_hashLength(&vm, buffer, length);
+		double hashes = (double)(BENCH_HASH_BYTES / length);
+		fprintf(
+			stderr,
+			"[%s] %4d bytes %8.2f ns/hash %8.2f GB/s\n",
+			BENCH_HASH,
+			length,
+			seconds * 1e9 / hashes,
+			hashes * length / seconds / 1e9
+		);
+	}
+	free(buffer);
+
+	bool keyed;
+	double seconds = bench_flood(&vm, false, &keyed);
+	fprintf(stderr, "[%s] %d keys, own hashes  %8.4fs, keyed: %s\n", BENCH_HASH, BENCH_FLOOD_KEYS, seconds, keyed ? "yes" : "no");
+	seconds = bench_flood(&vm, true, &keyed);
+	fprintf(stderr, "[%s] %d keys, same hash   %8.4fs, keyed: %s\n", BENCH_HASH, BENCH_FLOOD_KEYS, seconds, keyed ? "yes" : "no");
+	if (bench_sink == 1) {
+		fputs("unlikely\n", stderr);
+	}
+
+	hoshi_freeVM(&vm);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/* Heap benchmark: how fast a VM allocates strings, and how fast it frees them all again.
+ *   allocate - makes BENCH_HEAP_STRINGS strings of 4 to 35 characters, all of them kept alive.
+ *   teardown - frees the VM holding all of them.
+ * bench.sh builds this with and without HOSHI_ENABLE_SLABS. Without slabs, every string is allocated on its own and freed on its own,
+ * with slabs they come out of the VM's pages, which are freed a page at a time. Results are written to stderr. */
+
+#include "bench.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/memory.h"
+#include "../src/hoshi/object.h"
+#include "../src/hoshi/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HOSHI_ENABLE_SLABS
+	#define BENCH_HEAP "slabs"
+#else
+	#define BENCH_HEAP "malloc"
+#endif
+
+#define BENCH_HEAP_STRINGS 1000000
+#define BENCH_HEAP_ROUNDS 5
+
+int main(int argc, char *argv[])
+{
+	static const char letters[] = "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz";
+	double allocateFirst = 0, teardownFirst = 0, allocateBest = 0, teardownBest = 0;
+	int pages = 0;
+	for (int round = 0; round < BENCH_HEAP_ROUNDS; round++) {
+		hoshi_VM vm;
+		hoshi_initVM(&vm);
+
+		double start = bench_now();
+		for (int i = 0; i < BENCH_HEAP_STRINGS; i++) {
+			int length = 4 + i % 32;
+			char *chars;
+			hoshi_allocateString(&vm, length, &chars);
+			memcpy(chars, letters + i % 26, length);
+		}
+		double allocate = bench_now() - start;
+
+		pages = 0;
+		for (hoshi_SlabPage *page = vm.tracker.pages; page != NULL; page = page->next) {
+			pages++;
+		}
+
+		start = bench_now();
+		hoshi_freeVM(&vm);
+		double teardown = bench_now() - start;
+
+		if (round == 0) {
+			allocateFirst = allocate;
+			teardownFirst = teardown;
+		}
+		if (round == 0 || allocate < allocateBest) {
+			allocateBest = allocate;
+		}
+		if (round == 0 || teardown < teardownBest) {
+			teardownBest = teardown;
+		}
+	}
+
+	/* The first VM gets all of its memory from the OS, later ones may get some of it back from the C library, which differs between the two */
+	fprintf(
+		stderr,
+		"[%s] %d strings, first VM:  allocate %8.4fs (%5.1f ns/string), teardown %8.4fs\n",
+		BENCH_HEAP,
+		BENCH_HEAP_STRINGS,
+		allocateFirst,
+		allocateFirst * 1e9 / BENCH_HEAP_STRINGS,
+		teardownFirst
+	);
+	fprintf(
+		stderr,
+		"[%s] %d strings, best VM:   allocate %8.4fs (%5.1f ns/string), teardown %8.4fs, %d pages\n",
+		BENCH_HEAP,
+		BENCH_HEAP_STRINGS,
+		allocateBest,
+		allocateBest * 1e9 / BENCH_HEAP_STRINGS,
+		teardownBest,
+		pages
+	);
+	return 0;
+}
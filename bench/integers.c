@@ -0,0 +1,115 @@
+/* Integers benchmark: runs HIR programs as written, where literals without a decimal point are integers,
+ * and again with every such literal turned into a number (`1` into `1.0`), which is how they ran before integers existed.
+ * bench.sh builds this with and without the JIT. Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/vm.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HOSHI_ENABLE_JIT
+	#define BENCH_MODE "jit"
+#else
+	#define BENCH_MODE "interpreter"
+#endif
+
+#define BENCH_ITERATIONS 20
+
+/* Returns a copy of `source` with `.0` after every integer literal. Strings, identifiers, and labels are left alone. */
+static char *bench_toNumbers(const char *source)
+{
+	size_t length = strlen(source);
+	/* At worst every other character is a one digit literal */
+	char *result = malloc(length * 2 + 1);
+	size_t at = 0;
+	bool inString = false;
+	for (size_t i = 0; i < length; i++) {
+		char c = source[i];
+		result[at++] = c;
+		if (c == '"' && (i == 0 || source[i - 1] != '\\')) {
+			inString = !inString;
+		}
+		if (inString || !isdigit((unsigned char)c)) {
+			continue;
+		}
+		/* Only whole literals count, `$x1` and `:loop2` do not */
+		size_t start = i;
+		while (start > 0 && isdigit((unsigned char)source[start - 1])) {
+			start--;
+		}
+		bool standalone = start == 0 || isspace((unsigned char)source[start - 1]);
+		bool last = i + 1 == length || !(isdigit((unsigned char)source[i + 1]) || source[i + 1] == '.');
+		if (standalone && last) {
+			result[at++] = '.';
+			result[at++] = '0';
+		}
+	}
+	result[at] = '\0';
+	return result;
+}
+
+/* Runs `source` once and returns the time spent running it */
+static double bench_run(const char *path, const char *source)
+{
+	hoshi_VM vm;
+	hoshi_initVM(&vm);
+	hoshi_Chunk chunk;
+	hoshi_initChunk(&chunk, &vm.allocator);
+	if (!hir_compileString(&vm, &chunk, source)) {
+		fprintf(stderr, "error: failed to compile %s\n", path);
+		exit(1);
+	}
+	hoshi_fuseChunk(&chunk, NULL);
+
+	double start = bench_now();
+	hoshi_runChunk(&vm, &chunk);
+	double seconds = bench_now() - start;
+
+	hoshi_freeChunk(&chunk);
+	hoshi_freeVM(&vm);
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: integers <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		char *source = bench_readFile(argv[i]);
+		char *numbers = bench_toNumbers(source);
+		/* The two take turns going first, so neither gets a warmer machine than the other */
+		double integerSeconds = 0;
+		double numberSeconds = 0;
+		for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++) {
+			if (iteration % 2 == 0) {
+				integerSeconds += bench_run(argv[i], source);
+				numberSeconds += bench_run(argv[i], numbers);
+			} else {
+				numberSeconds += bench_run(argv[i], numbers);
+				integerSeconds += bench_run(argv[i], source);
+			}
+		}
+		fprintf(
+			stderr,
+			"[%s] %-24s integers %8.4fs, numbers %8.4fs (%.2fx)\n",
+			BENCH_MODE,
+			argv[i],
+			integerSeconds,
+			numberSeconds,
+			numberSeconds / integerSeconds
+		);
+		free(numbers);
+		free(source);
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+/* JIT benchmark: runs HIR programs with the JIT turned off and on and compares the time spent in them.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !HOSHI_ENABLE_JIT
+	#error "the jit benchmark must be built with -DHOSHI_ENABLE_JIT=1"
+#endif
+
+#define BENCH_ITERATIONS 20
+
+/* Runs `source` BENCH_ITERATIONS times and returns the total time spent in hoshi_runChunk, including compiling hot chunks. */
+static double bench_run(const char *path, const char *source, bool jit)
+{
+	double seconds = 0;
+
+	for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++) {
+		hoshi_VM vm;
+		hoshi_initVM(&vm);
+		vm.jit = jit;
+		hoshi_Chunk chunk;
+		hoshi_initChunk(&chunk, &vm.allocator);
+		if (!hir_compileString(&vm, &chunk, source)) {
+			fprintf(stderr, "error: failed to compile %s\n", path);
+			exit(1);
+		}
+		hoshi_fuseChunk(&chunk, NULL);
+
+		double start = bench_now();
+		hoshi_runChunk(&vm, &chunk);
+		seconds += bench_now() - start;
+
+		hoshi_freeChunk(&chunk);
+		hoshi_freeVM(&vm);
+	}
+
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: jit <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		char *source = bench_readFile(argv[i]);
+		double interpreted = bench_run(argv[i], source, false);
+		double compiled = bench_run(argv[i], source, true);
+
+		fprintf(
+			stderr,
+			"%-24s %8.4fs -> %8.4fs (%.2fx)\n",
+			argv[i],
+			interpreted,
+			compiled,
+			interpreted / compiled
+		);
+		free(source);
+	}
+
+	return 0;
+}
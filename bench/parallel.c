@@ -0,0 +1,78 @@
+/* Parallel benchmark: runs one shared program many times with hoshi_runParallel on 1 to 64 threads, to show how it scales.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/program.h"
+#include "../src/hoshi/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Runs per measurement, the same for every thread count so that the time shows the speedup */
+#define BENCH_RUNS 64
+#define BENCH_MAX_THREADS 64
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: parallel <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		/* The source has to outlive the program, HIR's identifiers point into it */
+		char *source = bench_readFile(argv[i]);
+
+		hoshi_VM vm;
+		hoshi_initVM(&vm);
+		hoshi_Chunk chunk;
+		hoshi_initChunk(&chunk, &vm.allocator);
+		if (!hir_compileString(&vm, &chunk, source)) {
+			fprintf(stderr, "error: failed to compile %s\n", argv[i]);
+			return 1;
+		}
+		hoshi_fuseChunk(&chunk, NULL);
+
+		hoshi_Program program;
+		if (!hoshi_initProgram(&program, &vm, &chunk)) {
+			fprintf(stderr, "error: failed to decode %s\n", argv[i]);
+			return 1;
+		}
+		hoshi_freeChunk(&chunk);
+		hoshi_freeVM(&vm);
+
+		hoshi_RunResult results[BENCH_RUNS];
+		double single = 0;
+		for (int threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2) {
+			double start = bench_now();
+			hoshi_runParallel(&program, BENCH_RUNS, threads, results);
+			double seconds = bench_now() - start;
+			if (threads == 1) {
+				single = seconds;
+			}
+
+			int failed = 0;
+			for (int run = 0; run < BENCH_RUNS; run++) {
+				failed += results[run].result != HOSHI_INTERPRET_OK;
+			}
+
+			fprintf(
+				stderr,
+				"%-24s %2d threads %8.4fs (%5.2fx), %8.1f runs/s, %d failed\n",
+				argv[i],
+				threads,
+				seconds,
+				single / seconds,
+				BENCH_RUNS / seconds,
+				failed
+			);
+		}
+
+		hoshi_freeProgram(&program);
+		free(source);
+	}
+
+	return 0;
+}
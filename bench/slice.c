@@ -0,0 +1,77 @@
+/* Slice benchmark: what running HIR programs through hoshi_runSlice costs next to hoshi_runNext, for a few budgets.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/vm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_ITERATIONS 20
+
+/* Instruction budgets to try, 0 runs without slicing */
+static const int64_t bench_budgets[] = { 0, 100, 10000, 1000000 };
+
+/* Runs `source` BENCH_ITERATIONS times in slices of `budget` instructions and returns the total time spent running. `slices` is set to the slices per run. */
+static double bench_run(const char *path, const char *source, int64_t budget, int *slices)
+{
+	double seconds = 0;
+
+	for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++) {
+		hoshi_VM vm;
+		hoshi_initVM(&vm);
+		hoshi_Chunk chunk;
+		hoshi_initChunk(&chunk, &vm.allocator);
+		if (!hir_compileString(&vm, &chunk, source)) {
+			fprintf(stderr, "error: failed to compile %s\n", path);
+			exit(1);
+		}
+		hoshi_fuseChunk(&chunk, NULL);
+
+		double start = bench_now();
+		*slices = 1;
+		if (budget == 0) {
+			hoshi_runChunk(&vm, &chunk);
+		} else if (hoshi_enterChunk(&vm, &chunk) == HOSHI_INTERPRET_OK) {
+			while (hoshi_runSlice(&vm, (hoshi_Budget){ budget, 0 }) == HOSHI_INTERPRET_PAUSED) {
+				(*slices)++;
+			}
+		}
+		seconds += bench_now() - start;
+
+		hoshi_freeChunk(&chunk);
+		hoshi_freeVM(&vm);
+	}
+
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: slice <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		char *source = bench_readFile(argv[i]);
+		double baseline = 0;
+
+		for (size_t b = 0; b < sizeof(bench_budgets) / sizeof(bench_budgets[0]); b++) {
+			int slices;
+			double seconds = bench_run(argv[i], source, bench_budgets[b], &slices);
+			if (bench_budgets[b] == 0) {
+				baseline = seconds;
+				fprintf(stderr, "%-24s unsliced         %8.4fs\n", argv[i], seconds);
+			} else {
+				fprintf(stderr, "%-24s budget %-9lld %8.4fs (%.2fx), %d slices\n", argv[i], (long long)bench_budgets[b], seconds, seconds / baseline, slices);
+			}
+		}
+		free(source);
+	}
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+/* Strings benchmark: how CONCAT does on string-building work.
+ *   append - builds a 1 MB string by appending to it in a loop, then prints it.
+ *   short  - concatenates short strings and prints them, so each one is thrown away right after it is made.
+ * bench.sh builds this with and without HOSHI_ENABLE_ROPES. Without ropes every CONCAT copies the whole string so far, hashes the copy, and interns it,
+ * with them nothing is copied until PRINT flattens the string once, and nothing made by CONCAT is hashed or interned.
+ * Along with the time, each run reports how many strings are still interned once it ends, the collector takes the ones nothing holds out of the table. Results are written to stderr, so the printed strings can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HOSHI_ENABLE_ROPES
+	#define BENCH_STRINGS "ropes"
+#else
+	#define BENCH_STRINGS "copies"
+#endif
+
+#define BENCH_STRING_SIZE (1024 * 1024)
+#define BENCH_SHORT_LOOPS 1000000
+
+/* How many bytes each CONCAT appends. Without ropes, the copies add up to BENCH_STRING_SIZE squared over twice the piece size. */
+static const int bench_pieceSizes[] = { 16384, 4096, 1024 };
+
+/* Builds a program that appends a `pieceSize` byte string until it has BENCH_STRING_SIZE bytes, and prints the result */
+static char *bench_appendSource(int pieceSize)
+{
+	size_t capacity = pieceSize + 256;
+	char *source = malloc(capacity);
+	size_t length = 0;
+	source[length++] = '"';
+	memset(source + length, 'x', pieceSize);
+	length += pieceSize;
+	snprintf(
+		source + length,
+		capacity - length,
+		"\" deflocal $piece\n"
+		"\"\" deflocal $s\n"
+		"0 deflocal $i\n"
+		":loop\n"
+		"getlocal $s getlocal $piece concat setlocal $s pop\n"
+		"getlocal $i 1 add setlocal $i %d lt goto_if :loop\n"
+		"getlocal $s print\n"
+		"0 exit\n",
+		BENCH_STRING_SIZE / pieceSize
+	);
+	return source;
+}
+
+/* Builds a program that makes and prints a 16 and a 24 byte string BENCH_SHORT_LOOPS times */
+static char *bench_shortSource(void)
+{
+	size_t capacity = 256;
+	char *source = malloc(capacity);
+	snprintf(
+		source,
+		capacity,
+		"\"abcdefgh\" deflocal $piece\n"
+		"0 deflocal $i\n"
+		":loop\n"
+		"getlocal $piece getlocal $piece concat getlocal $piece concat print\n"
+		"getlocal $i 1 add setlocal $i %d lt goto_if :loop\n"
+		"0 exit\n",
+		BENCH_SHORT_LOOPS
+	);
+	return source;
+}
+
+/* Returns the time it takes to run `source` once, and how many strings the VM has interned once it ends in `interned` */
+static double bench_runSource(const char *source, int *interned)
+{
+	hoshi_VM vm;
+	hoshi_initVM(&vm);
+	hoshi_Chunk chunk;
+	hoshi_initChunk(&chunk, &vm.allocator);
+	if (!hir_compileString(&vm, &chunk, source)) {
+		fputs("error: failed to compile the benchmark's source\n", stderr);
+		exit(1);
+	}
+	hoshi_fuseChunk(&chunk, NULL);
+
+	double start = bench_now();
+	hoshi_runChunk(&vm, &chunk);
+	fflush(stdout);
+	double seconds = bench_now() - start;
+	*interned = vm.strings.count;
+
+	hoshi_freeChunk(&chunk);
+	hoshi_freeVM(&vm);
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	int interned;
+	for (size_t i = 0; i < sizeof(bench_pieceSizes) / sizeof(bench_pieceSizes[0]); i++) {
+		int pieceSize = bench_pieceSizes[i];
+		char *source = bench_appendSource(pieceSize);
+		double seconds = bench_runSource(source, &interned);
+		fprintf(
+			stderr,
+			"[%s] append 1 MB in %5d byte pieces (%4d concats) %8.4fs, %7d strings interned\n",
+			BENCH_STRINGS,
+			pieceSize,
+			BENCH_STRING_SIZE / pieceSize,
+			seconds,
+			interned
+		);
+		free(source);
+	}
+
+	char *source = bench_shortSource();
+	double seconds = bench_runSource(source, &interned);
+	fprintf(stderr, "[%s] short, %d concats %22.4fs, %7d strings interned\n", BENCH_STRINGS, BENCH_SHORT_LOOPS * 2, seconds, interned);
+	free(source);
+	return 0;
+}
@@ -0,0 +1,118 @@
+/* Suspend benchmark: multiplexes many VMs on one thread, the way a host would drive them from an event loop.
+ * Every VM runs a loop of host calls. The host either answers them right away, or suspends the VM and only answers once every other VM
+ * has had its turn, which is what waiting on I/O looks like from the VM's side. The difference between the two is what suspending costs.
+ * Results are written to stderr. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/program.h"
+#include "../src/hoshi/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Host calls per VM */
+#define BENCH_CALLS 1000
+
+/* Sums up what the host hands back for 0 to BENCH_CALLS - 1 */
+static const char *bench_source =
+	"0 deflocal $i\n"
+	"0 deflocal $sum\n"
+	":loop\n"
+	"getlocal $i hostcall 0 getlocal $sum add setlocal $sum pop\n"
+	"getlocal $i 1 add setlocal $i\n"
+	"1000 lt goto_if :loop\n"
+	"0 exit\n";
+
+/* How many VMs are in flight at once */
+static const int bench_vmCounts[] = { 1, 100, 1000 };
+
+static hoshi_HostResult bench_answer(hoshi_VM *vm, hoshi_Value argument, hoshi_Value *result)
+{
+	*result = argument;
+	return HOSHI_HOST_OK;
+}
+
+static hoshi_HostResult bench_wait(hoshi_VM *vm, hoshi_Value argument, hoshi_Value *result)
+{
+	return HOSHI_HOST_SUSPEND;
+}
+
+/* Runs `count` VMs to the end, round-robin, answering every suspended host call with its own argument. Returns the time it took. */
+static double bench_run(hoshi_Program *program, int count, hoshi_HostFunction function, long *suspensions)
+{
+	hoshi_VM *vms = malloc(sizeof(hoshi_VM) * count);
+	for (int i = 0; i < count; i++) {
+		hoshi_initVMForProgram(&vms[i], program);
+		hoshi_setHostFunction(&vms[i], 0, function);
+	}
+
+	double start = bench_now();
+	*suspensions = 0;
+	int running = 0;
+	for (int i = 0; i < count; i++) {
+		if (hoshi_runProgram(&vms[i]) == HOSHI_INTERPRET_SUSPENDED) {
+			running++;
+		}
+	}
+	while (running > 0) {
+		for (int i = 0; i < count; i++) {
+			if (!vms[i].suspended) {
+				continue;
+			}
+			(*suspensions)++;
+			hoshi_resume(&vms[i], vms[i].suspendValue);
+			if (hoshi_runNext(&vms[i]) != HOSHI_INTERPRET_SUSPENDED) {
+				running--;
+			}
+		}
+	}
+	double seconds = bench_now() - start;
+
+	for (int i = 0; i < count; i++) {
+		hoshi_freeVM(&vms[i]);
+	}
+	free(vms);
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	hoshi_VM vm;
+	hoshi_initVM(&vm);
+	hoshi_Chunk chunk;
+	hoshi_initChunk(&chunk, &vm.allocator);
+	if (!hir_compileString(&vm, &chunk, bench_source)) {
+		fputs("error: failed to compile the benchmark's source\n", stderr);
+		return 1;
+	}
+	hoshi_fuseChunk(&chunk, NULL);
+
+	hoshi_Program program;
+	if (!hoshi_initProgram(&program, &vm, &chunk)) {
+		fputs("error: failed to decode the benchmark's source\n", stderr);
+		return 1;
+	}
+	hoshi_freeChunk(&chunk);
+	hoshi_freeVM(&vm);
+
+	for (size_t i = 0; i < sizeof(bench_vmCounts) / sizeof(bench_vmCounts[0]); i++) {
+		int count = bench_vmCounts[i];
+		long suspensions;
+		double answered = bench_run(&program, count, &bench_answer, &suspensions);
+		double suspended = bench_run(&program, count, &bench_wait, &suspensions);
+		fprintf(
+			stderr,
+			"%5d VMs: answered %8.4fs, suspended %8.4fs, %ld suspensions (%.1fns each)\n",
+			count,
+			answered,
+			suspended,
+			suspensions,
+			(suspended - answered) / suspensions * 1e9
+		);
+	}
+
+	hoshi_freeProgram(&program);
+	return 0;
+}
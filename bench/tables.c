@@ -0,0 +1,328 @@
+/* Tables benchmark: the Swiss table in hash_table.c against the linear probing table it replaced, which is kept here as `bench_LinearTable`.
+ *   intern  - what hoshi_makeString does: looks a string up by its characters and adds it when it is missing,
+ *             first for BENCH_INTERN_KEYS new strings, then again for all of them, which are all found.
+ *   globals - what hoshi_addGlobal does when a file is loaded: looks up a few hundred names by pointer, over and over.
+ *   churn   - sets and deletes keys at random, which leaves tombstones (or deleted slots) behind.
+ * Results are written to stderr. */
+
+#include "bench.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/hash_table.h"
+#include "../src/hoshi/memory.h"
+#include "../src/hoshi/object.h"
+#include "../src/hoshi/vm.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_INTERN_KEYS 200000
+#define BENCH_GLOBAL_KEYS 300
+#define BENCH_GLOBAL_ROUNDS 20000
+#define BENCH_CHURN_KEYS 4096
+#define BENCH_CHURN_STEPS 10000000
+
+/* The old table: linear probing on `% capacity`, a 32 byte entry per slot, and tombstones marked by a key of NULL and a value that is not nil.
+ * The functions hoshi_Table has are kept out of line, like they are when they come from libhoshi. */
+
+#define BENCH_LINEAR_MAX_LOAD 0.75
+
+typedef struct bench_LinearEntry {
+	hoshi_ObjectString *key;
+	hoshi_Value value;
+	struct bench_LinearEntry *next;
+} bench_LinearEntry;
+
+typedef struct {
+	int count;
+	int capacity;
+	bench_LinearEntry *entries;
+} bench_LinearTable;
+
+static void bench_initLinear(bench_LinearTable *table)
+{
+	table->count = 0;
+	table->capacity = 0;
+	table->entries = NULL;
+}
+
+static void bench_freeLinear(bench_LinearTable *table)
+{
+	free(table->entries);
+	bench_initLinear(table);
+}
+
+static bench_LinearEntry *bench_linearFind(bench_LinearEntry *entries, int capacity, hoshi_ObjectString *key)
+{
+	uint32_t index = key->hash % capacity;
+	bench_LinearEntry *tombstone = NULL;
+	for (;;) {
+		bench_LinearEntry *entry = &entries[index];
+		if (entry->key == NULL) {
+			if (HOSHI_IS_NIL(entry->value)) {
+				return tombstone != NULL ? tombstone : entry;
+			} else if (tombstone == NULL) {
+				tombstone = entry;
+			}
+		} else if (entry->key == key) {
+			return entry;
+		}
+		index = (index + 1) % capacity;
+	}
+}
+
+static void bench_linearAdjustCapacity(bench_LinearTable *table, int capacity)
+{
+	bench_LinearEntry *entries = malloc(sizeof(bench_LinearEntry) * capacity);
+	for (int i = 0; i < capacity; i++) {
+		entries[i].key = NULL;
+		entries[i].value = HOSHI_NIL;
+	}
+	table->count = 0;
+	for (int i = 0; i < table->capacity; i++) {
+		bench_LinearEntry *entry = &table->entries[i];
+		if (entry->key == NULL) {
+			continue;
+		}
+		bench_LinearEntry *dest = bench_linearFind(entries, capacity, entry->key);
+		dest->key = entry->key;
+		dest->value = entry->value;
+		table->count++;
+	}
+	free(table->entries);
+	table->entries = entries;
+	table->capacity = capacity;
+}
+
+__attribute__((noinline)) static bool bench_linearSet(bench_LinearTable *table, hoshi_ObjectString *key, hoshi_Value value)
+{
+	if (table->count + 1 > table->capacity * BENCH_LINEAR_MAX_LOAD) {
+		bench_linearAdjustCapacity(table, HOSHI_GROW_CAPACITY(table->capacity));
+	}
+	bench_LinearEntry *entry = bench_linearFind(table->entries, table->capacity, key);
+	bool isNewKey = entry->key == NULL;
+	if (isNewKey && HOSHI_IS_NIL(entry->value)) {
+		table->count++;
+	}
+	entry->key = key;
+	entry->value = value;
+	return isNewKey;
+}
+
+__attribute__((noinline)) static bool bench_linearGet(bench_LinearTable *table, hoshi_ObjectString *key, hoshi_Value *value)
+{
+	if (table->count == 0) {
+		return false;
+	}
+	bench_LinearEntry *entry = bench_linearFind(table->entries, table->capacity, key);
+	if (entry->key == NULL) {
+		return false;
+	}
+	*value = entry->value;
+	return true;
+}
+
+__attribute__((noinline)) static bool bench_linearDelete(bench_LinearTable *table, hoshi_ObjectString *key)
+{
+	if (table->count == 0) {
+		return false;
+	}
+	bench_LinearEntry *entry = bench_linearFind(table->entries, table->capacity, key);
+	if (entry->key == NULL) {
+		return false;
+	}
+	entry->key = NULL;
+	entry->value = HOSHI_BOOL(true);
+	return true;
+}
+
+__attribute__((noinline)) static hoshi_ObjectString *bench_linearFindString(bench_LinearTable *table, const char *chars, int length, uint32_t hash)
+{
+	if (table->count == 0) {
+		return NULL;
+	}
+	uint32_t index = hash % table->capacity;
+	for (;;) {
+		bench_LinearEntry *entry = &table->entries[index];
+		if (entry->key == NULL) {
+			if (HOSHI_IS_NIL(entry->value)) {
+				return NULL;
+			}
+		} else if (entry->key->length == length && entry->key->hash == hash && memcmp(entry->key->chars, chars, length) == 0) {
+			return entry->key;
+		}
+		index = (index + 1) % table->capacity;
+	}
+}
+
+/* Strings that are hashed like interned ones, but belong to no table, so both tables can be handed the same keys */
+static hoshi_ObjectString **bench_makeKeys(hoshi_VM *vm, int count, const char *prefix)
+{
+	hoshi_ObjectString **keys = malloc(sizeof(hoshi_ObjectString *) * count);
+	for (int i = 0; i < count; i++) {
+		char buffer[32];
+		int length = snprintf(buffer, sizeof(buffer), "%s%d", prefix, i);
+		char *chars;
+		keys[i] = hoshi_allocateString(vm, length, &chars);
+		memcpy(chars, buffer, length);
+		hoshi_stringHash(vm, keys[i]);
+	}
+	return keys;
+}
+
+/* Keeps the work from being optimized away */
+static long bench_sink = 0;
+
+static double bench_internSwiss(hoshi_ObjectString **keys)
+{
+	hoshi_Table table;
+	hoshi_initTable(&table, &hoshi_defaultAllocator);
+	double start = bench_now();
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < BENCH_INTERN_KEYS; i++) {
+			hoshi_ObjectString *key = keys[i];
+			hoshi_ObjectString *found = hoshi_tableFindString(&table, key->chars, key->length, key->hash);
+			if (found == NULL) {
+				hoshi_tableSet(&table, key, HOSHI_NIL);
+			} else {
+				bench_sink += found->length;
+			}
+		}
+	}
+	double seconds = bench_now() - start;
+	hoshi_freeTable(&table);
+	return seconds;
+}
+
+static double bench_internLinear(hoshi_ObjectString **keys)
+{
+	bench_LinearTable table;
+	bench_initLinear(&table);
+	double start = bench_now();
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < BENCH_INTERN_KEYS; i++) {
+			hoshi_ObjectString *key = keys[i];
+			hoshi_ObjectString *found = bench_linearFindString(&table, key->chars, key->length, key->hash);
+			if (found == NULL) {
+				bench_linearSet(&table, key, HOSHI_NIL);
+			} else {
+				bench_sink += found->length;
+			}
+		}
+	}
+	double seconds = bench_now() - start;
+	bench_freeLinear(&table);
+	return seconds;
+}
+
+static double bench_globalsSwiss(hoshi_ObjectString **keys)
+{
+	hoshi_Table table;
+	hoshi_initTable(&table, &hoshi_defaultAllocator);
+	for (int i = 0; i < BENCH_GLOBAL_KEYS; i++) {
+		hoshi_tableSet(&table, keys[i], HOSHI_NUMBER(i));
+	}
+	double start = bench_now();
+	for (int round = 0; round < BENCH_GLOBAL_ROUNDS; round++) {
+		for (int i = 0; i < BENCH_GLOBAL_KEYS; i++) {
+			hoshi_Value index;
+			if (hoshi_tableGet(&table, keys[i], &index)) {
+				bench_sink += (long)HOSHI_AS_NUMBER(index);
+			}
+		}
+	}
+	double seconds = bench_now() - start;
+	hoshi_freeTable(&table);
+	return seconds;
+}
+
+static double bench_globalsLinear(hoshi_ObjectString **keys)
+{
+	bench_LinearTable table;
+	bench_initLinear(&table);
+	for (int i = 0; i < BENCH_GLOBAL_KEYS; i++) {
+		bench_linearSet(&table, keys[i], HOSHI_NUMBER(i));
+	}
+	double start = bench_now();
+	for (int round = 0; round < BENCH_GLOBAL_ROUNDS; round++) {
+		for (int i = 0; i < BENCH_GLOBAL_KEYS; i++) {
+			hoshi_Value index;
+			if (bench_linearGet(&table, keys[i], &index)) {
+				bench_sink += (long)HOSHI_AS_NUMBER(index);
+			}
+		}
+	}
+	double seconds = bench_now() - start;
+	bench_freeLinear(&table);
+	return seconds;
+}
+
+/* Both tables see the same steps, since the generator starts over for each */
+static uint32_t bench_nextRandom(uint32_t *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+static double bench_churnSwiss(hoshi_ObjectString **keys)
+{
+	hoshi_Table table;
+	hoshi_initTable(&table, &hoshi_defaultAllocator);
+	uint32_t state = 1;
+	double start = bench_now();
+	for (int step = 0; step < BENCH_CHURN_STEPS; step++) {
+		uint32_t random = bench_nextRandom(&state);
+		hoshi_ObjectString *key = keys[random % BENCH_CHURN_KEYS];
+		if (random & 0x100000) {
+			hoshi_tableSet(&table, key, HOSHI_NUMBER(step));
+		} else {
+			bench_sink += hoshi_tableDelete(&table, key);
+		}
+	}
+	double seconds = bench_now() - start;
+	hoshi_freeTable(&table);
+	return seconds;
+}
+
+static double bench_churnLinear(hoshi_ObjectString **keys)
+{
+	bench_LinearTable table;
+	bench_initLinear(&table);
+	uint32_t state = 1;
+	double start = bench_now();
+	for (int step = 0; step < BENCH_CHURN_STEPS; step++) {
+		uint32_t random = bench_nextRandom(&state);
+		hoshi_ObjectString *key = keys[random % BENCH_CHURN_KEYS];
+		if (random & 0x100000) {
+			bench_linearSet(&table, key, HOSHI_NUMBER(step));
+		} else {
+			bench_sink += bench_linearDelete(&table, key);
+		}
+	}
+	double seconds = bench_now() - start;
+	bench_freeLinear(&table);
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	hoshi_VM vm;
+	hoshi_initVM(&vm);
+	hoshi_ObjectString **internKeys = bench_makeKeys(&vm, BENCH_INTERN_KEYS, "string");
+	hoshi_ObjectString **globalKeys = bench_makeKeys(&vm, BENCH_GLOBAL_KEYS, "global");
+	hoshi_ObjectString **churnKeys = bench_makeKeys(&vm, BENCH_CHURN_KEYS, "key");
+
+	fprintf(stderr, "%-8s %10s %10s\n", "", "linear", "swiss");
+	fprintf(stderr, "%-8s %9.4fs %9.4fs\n", "intern", bench_internLinear(internKeys), bench_internSwiss(internKeys));
+	fprintf(stderr, "%-8s %9.4fs %9.4fs\n", "globals", bench_globalsLinear(globalKeys), bench_globalsSwiss(globalKeys));
+	fprintf(stderr, "%-8s %9.4fs %9.4fs\n", "churn", bench_churnLinear(churnKeys), bench_churnSwiss(churnKeys));
+	if (bench_sink == -1) {
+		fputs("impossible\n", stderr);
+	}
+
+	free(internKeys);
+	free(globalKeys);
+	free(churnKeys);
+	hoshi_freeVM(&vm);
+	return 0;
+}
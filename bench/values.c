@@ -0,0 +1,131 @@
+/* Values benchmark: how the value layout (HOSHI_ENABLE_NAN_BOXING) does on stack-heavy and table-heavy work.
+ * bench.sh builds this once per layout so they can be compared.
+ *   stack - runs a generated program that keeps the stack deep, plus any HIR programs given on the command line.
+ *   table - sets and gets numbers under a few thousand string keys in a hoshi_Table.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/config.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/hash_table.h"
+#include "../src/hoshi/memory.h"
+#include "../src/hoshi/object.h"
+#include "../src/hoshi/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if HOSHI_ENABLE_NAN_BOXING
+	#define BENCH_LAYOUT "nan-boxed"
+#else
+	#define BENCH_LAYOUT "tagged"
+#endif
+
+#define BENCH_ITERATIONS 20
+/* How deep the generated program takes the stack, and how often it does so */
+#define BENCH_STACK_DEPTH 200
+#define BENCH_STACK_LOOPS 5000
+#define BENCH_TABLE_KEYS 4096
+#define BENCH_TABLE_ROUNDS 2000
+
+/* Builds a program that pushes BENCH_STACK_DEPTH numbers and adds them all back up, BENCH_STACK_LOOPS times */
+static char *bench_stackSource(void)
+{
+	size_t capacity = BENCH_STACK_DEPTH * 8 + 256;
+	char *source = malloc(capacity);
+	size_t length = 0;
+	length += snprintf(source + length, capacity - length, "0 deflocal $i\n:loop\n");
+	for (int i = 0; i < BENCH_STACK_DEPTH; i++) {
+		length += snprintf(source + length, capacity - length, "%d ", i % 10);
+	}
+	for (int i = 1; i < BENCH_STACK_DEPTH; i++) {
+		length += snprintf(source + length, capacity - length, "add ");
+	}
+	snprintf(source + length, capacity - length, "pop\ngetlocal $i 1 add setlocal $i\n%d lt goto_if :loop\n0 exit\n", BENCH_STACK_LOOPS);
+	return source;
+}
+
+/* Runs `source` BENCH_ITERATIONS times and returns the time spent running it */
+static double bench_runSource(const char *name, const char *source)
+{
+	double seconds = 0;
+	for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++) {
+		hoshi_VM vm;
+		hoshi_initVM(&vm);
+		hoshi_Chunk chunk;
+		hoshi_initChunk(&chunk, &vm.allocator);
+		if (!hir_compileString(&vm, &chunk, source)) {
+			fprintf(stderr, "error: failed to compile %s\n", name);
+			exit(1);
+		}
+		hoshi_fuseChunk(&chunk, NULL);
+
+		double start = bench_now();
+		hoshi_runChunk(&vm, &chunk);
+		seconds += bench_now() - start;
+
+		hoshi_freeChunk(&chunk);
+		hoshi_freeVM(&vm);
+	}
+	return seconds;
+}
+
+/* Returns the time BENCH_TABLE_ROUNDS rounds of setting and getting every key take */
+static double bench_runTable(void)
+{
+	hoshi_VM vm;
+	hoshi_initVM(&vm);
+	hoshi_ObjectString **keys = malloc(sizeof(hoshi_ObjectString *) * BENCH_TABLE_KEYS);
+	for (int i = 0; i < BENCH_TABLE_KEYS; i++) {
+		char buffer[16];
+		int length = snprintf(buffer, sizeof(buffer), "key%d", i);
+		keys[i] = hoshi_makeString(&vm, buffer, length);
+	}
+
+	hoshi_Table table;
+	hoshi_initTable(&table, &vm.allocator);
+	double sum = 0;
+	double start = bench_now();
+	for (int round = 0; round < BENCH_TABLE_ROUNDS; round++) {
+		for (int i = 0; i < BENCH_TABLE_KEYS; i++) {
+			hoshi_tableSet(&table, keys[i], HOSHI_NUMBER(round + i));
+		}
+		for (int i = 0; i < BENCH_TABLE_KEYS; i++) {
+			hoshi_Value value;
+			if (hoshi_tableGet(&table, keys[i], &value)) {
+				sum += HOSHI_AS_NUMBER(value);
+			}
+		}
+	}
+	double seconds = bench_now() - start;
+
+	/* Keeps the loop from being optimized away */
+	if (sum < 0) {
+		fputs("impossible\n", stderr);
+	}
+
+	hoshi_freeTable(&table);
+	free(keys);
+	hoshi_freeVM(&vm);
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	fprintf(stderr, "[%s] sizeof(hoshi_Value) = %zu, bytes per table slot = %zu\n", BENCH_LAYOUT, sizeof(hoshi_Value), 1 + sizeof(hoshi_ObjectString *) + sizeof(hoshi_Value));
+
+	char *stack = bench_stackSource();
+	fprintf(stderr, "[%s] %-24s %8.4fs\n", BENCH_LAYOUT, "stack (generated)", bench_runSource("the generated program", stack));
+	free(stack);
+
+	for (int i = 1; i < argc; i++) {
+		char *source = bench_readFile(argv[i]);
+		fprintf(stderr, "[%s] %-24s %8.4fs\n", BENCH_LAYOUT, argv[i], bench_runSource(argv[i], source));
+		free(source);
+	}
+
+	fprintf(stderr, "[%s] %-24s %8.4fs\n", BENCH_LAYOUT, "table", bench_runTable());
+	return 0;
+}
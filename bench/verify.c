@@ -0,0 +1,71 @@
+/* Verify benchmark: runs HIR programs in the checked and the unchecked interpreter loop and compares their time.
+ * The checked runs verify the chunk like usual and then throw the result away, so both run the exact same instructions.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "bench.h"
+#include "../src/hir/compiler.h"
+#include "../src/hoshi/chunk.h"
+#include "../src/hoshi/fusion.h"
+#include "../src/hoshi/verifier.h"
+#include "../src/hoshi/vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_ITERATIONS 20
+
+/* Runs `source` BENCH_ITERATIONS times and returns the total time spent in hoshi_runChunk. Sets `verified` to whether the chunk could run unchecked. */
+static double bench_run(const char *path, const char *source, bool checked, bool *verified)
+{
+	double seconds = 0;
+
+	for (int iteration = 0; iteration < BENCH_ITERATIONS; iteration++) {
+		hoshi_VM vm;
+		hoshi_initVM(&vm);
+		hoshi_Chunk chunk;
+		hoshi_initChunk(&chunk, &vm.allocator);
+		if (!hir_compileString(&vm, &chunk, source)) {
+			fprintf(stderr, "error: failed to compile %s\n", path);
+			exit(1);
+		}
+		hoshi_fuseChunk(&chunk, NULL);
+		hoshi_verifyChunk(&vm, &chunk, NULL);
+		*verified = chunk.verified;
+		if (checked) {
+			chunk.verified = false;
+		}
+
+		double start = bench_now();
+		hoshi_runChunk(&vm, &chunk);
+		seconds += bench_now() - start;
+
+		hoshi_freeChunk(&chunk);
+		hoshi_freeVM(&vm);
+	}
+
+	return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: verify <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		char *source = bench_readFile(argv[i]);
+		bool verified;
+		double checked = bench_run(argv[i], source, true, &verified);
+		double unchecked = bench_run(argv[i], source, false, &verified);
+
+		if (verified) {
+			fprintf(stderr, "%-24s checked %8.4fs, unchecked %8.4fs (%.2fx)\n", argv[i], checked, unchecked, checked / unchecked);
+		} else {
+			fprintf(stderr, "%-24s checked %8.4fs, not verified so it can not run unchecked\n", argv[i], checked);
+		}
+		free(source);
+	}
+
+	return 0;
+}
@@ -4,7 +4,7 @@ set -e
 
 mkdir -p target
 
-libhoshi_flags="-o target/libhoshi.so -fPIC -shared"
+libhoshi_flags="-o target/libhoshi.so -fPIC -shared -pthread"
 libhoshi_debug_flags="
 	-DHOSHI_ENABLE_TRACE_EXECUTION_DEBUGGING=1
 	-DHOSHI_DISASSEMBLER_ENABLE_RAW_CODE_DUMP=1
@@ -18,10 +18,20 @@ libhoshi_sources="
 	src/hoshi/chunk_loader.c
 	src/hoshi/chunk_writer.c
 	src/hoshi/chunk.c
+	src/hoshi/common.c
 	src/hoshi/debug.c
+	src/hoshi/fusion.c
+	src/hoshi/gc.c
+	src/hoshi/hash_table.c
+	src/hoshi/jit.c
 	src/hoshi/memory.c
 	src/hoshi/object.c
+	src/hoshi/optimizer.c
+	src/hoshi/program.c
+	src/hoshi/siphash.c
+	src/hoshi/ssa.c
 	src/hoshi/value.c
+	src/hoshi/verifier.c
 	src/hoshi/vm.c"
 
 hoshi_flags="-o target/hoshi"
@@ -40,6 +50,7 @@ hir_prod_flags="-O3"
 hir_sources="
 	src/hir/main.c
 	src/hir/compiler.c
+	src/hir/regions.c
 	src/hir/lexer.c
 	src/common/thirdparty/asprintf.c
 	./libhoshi.so"
@@ -4,9 +4,11 @@
 #include "compiler.h"
 #include "lexer.h"
 #include "config.h"
+#include "regions.h"
 #include "../hoshi/value.h"
 #include "../hoshi/object.h"
 #include "../hoshi/common.h"
+#include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -109,6 +111,17 @@ static void hir_emitBytes3(hir_Parser *parser, uint8_t byte1, uint8_t byte2, uin
 	hir_emitByte(parser, byte3);
 }
 
+/* Emits a global or local instruction, with a WIDE prefix when `index` does not fit in one byte */
+static void hir_emitIndexed(hir_Parser *parser, hoshi_OpCode op, int index)
+{
+	if (index <= UINT8_MAX) {
+		hir_emitBytes2(parser, op, index);
+	} else {
+		hir_emitBytes2(parser, HOSHI_OP_WIDE, op);
+		hir_emitBytes2(parser, index & 0xFF, (index >> 8) & 0xFF);
+	}
+}
+
 static void hir_emitLong(hir_Parser *parser, uint64_t value)
 {
 	hir_emitByte(parser, value & 0xFF);
@@ -163,17 +176,22 @@ static bool hir_identifiersEqual(hir_Token *a, hir_Token *b)
 	return memcmp(a->start, b->start, a->length) == 0;
 }
 
-static uint8_t hir_globalId(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer)
+static int hir_globalId(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer)
 {
 	hir_consume(parser, lexer, HIR_TOKEN_ID, "expected identifier");
 
 	/* This key gets freed at the end of compilation. */
-	hoshi_ObjectString *key = hoshi_makeString(vm, false, (char *)parser->previous.start, parser->previous.length);
+	hoshi_ObjectString *key = hoshi_makeBorrowedString(vm, parser->previous.start, parser->previous.length);
 
-	return hoshi_addGlobal(vm, key);
+	int index = hoshi_addGlobal(vm, key);
+	if (index < 0) {
+		hir_error(parser, "too many globals");
+		return 0;
+	}
+	return index;
 }
 
-static uint8_t hir_localId(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer, bool define)
+static int hir_localId(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer, bool define)
 {
 	hir_consume(parser, lexer, HIR_TOKEN_ID, "expected identifier");
 
@@ -185,7 +203,7 @@ static uint8_t hir_localId(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer, b
 				hir_error(parser, "variable already exists in this scope.");
 				return -1;
 			}
-			return parser->currentCompiler->locals[i].index;
+			return i;
 		}
 	}
 
@@ -194,20 +212,67 @@ static uint8_t hir_localId(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer, b
 		hir_error(parser, "variable does not exist");
 	}
 
-	/* Add the variable */
-	hir_LocalVariable *local = &parser->currentCompiler->locals[parser->currentCompiler->localCount++];
+	if (parser->currentCompiler->localCount == HIR_LOCAL_STACK_SIZE) {
+		hir_error(parser, "too many locals in scope");
+		return -1;
+	}
+
+	/* Add the variable, it gets the first slot no local in scope is using */
+	hir_Compiler *compiler = parser->currentCompiler;
+	hir_LocalVariable *local = &compiler->locals[compiler->localCount];
 	local->name = parser->previous;
-	local->depth = parser->currentCompiler->scopeDepth;
-	local->index = hoshi_addLocal(vm);
-	return local->index;
+	local->depth = compiler->scopeDepth;
+	if (compiler->declarationCount + 1 > compiler->declarationCapacity) {
+		int oldCapacity = compiler->declarationCapacity;
+		compiler->declarationCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		compiler->declarations = HOSHI_GROW_ARRAY(compiler->allocator, int, compiler->declarations, oldCapacity, compiler->declarationCapacity);
+	}
+	local->declaration = compiler->declarationCount;
+	compiler->declarations[compiler->declarationCount++] = compiler->currentScope;
+	if (compiler->currentScope != -1 && compiler->localCount + 1 > compiler->scopes[compiler->currentScope].slotEnd) {
+		compiler->scopes[compiler->currentScope].slotEnd = compiler->localCount + 1;
+	}
+	return compiler->localCount++;
+}
+
+/* Emits a local instruction like hir_emitIndexed, and remembers which local it was for */
+static void hir_emitLocal(hir_Parser *parser, hoshi_OpCode op, int slot)
+{
+	hir_Compiler *compiler = parser->currentCompiler;
+	if (slot >= 0) {
+		if (compiler->localUseCount + 1 > compiler->localUseCapacity) {
+			int oldCapacity = compiler->localUseCapacity;
+			compiler->localUseCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
+			compiler->localUses = HOSHI_GROW_ARRAY(compiler->allocator, hir_LocalUse, compiler->localUses, oldCapacity, compiler->localUseCapacity);
+		}
+		compiler->localUses[compiler->localUseCount++] = (hir_LocalUse){ (int)parser->bytePos, compiler->locals[slot].declaration };
+	}
+	hir_emitIndexed(parser, op, slot);
 }
 
 static uint64_t hir_label(hoshi_VM *vm, hir_Parser *parser, bool define)
 {
+	hir_Compiler *compiler = parser->currentCompiler;
 	if (define) {
-		hir_Label *label = &parser->currentCompiler->labels[parser->currentCompiler->labelCount++];
+		if (compiler->labelCount == HIR_MAX_LABELS) {
+			hir_error(parser, "too many labels");
+			return -1;
+		}
+		hir_Label *label = &compiler->labels[compiler->labelCount++];
 		label->name = parser->previous;
 		label->pos = parser->bytePos;
+
+		/* Fill in the GOTOs that got here before the label did */
+		for (int i = compiler->forwardLabelCount - 1; i >= 0; i--) {
+			hir_Label *forward = &compiler->forwardLabels[i];
+			if (!hir_identifiersEqual(&forward->name, &label->name)) {
+				continue;
+			}
+			for (int byte = 0; byte < 4; byte++) {
+				parser->currentChunk->code[forward->pos + byte] = (parser->bytePos >> (byte * 8)) & 0xFF;
+			}
+			*forward = compiler->forwardLabels[--compiler->forwardLabelCount];
+		}
 		return parser->bytePos;
 	} else {
 		/* find the label by name
@@ -220,8 +285,16 @@ static uint64_t hir_label(hoshi_VM *vm, hir_Parser *parser, bool define)
 				return label->pos;
 			}
 		}
-		hir_error(parser, "undefined label");
-		return -1;
+
+		/* The label may come later, the GOTO is filled in once it does */
+		if (compiler->forwardLabelCount == HIR_MAX_LABELS) {
+			hir_error(parser, "too many uses of labels that are not defined yet");
+			return -1;
+		}
+		hir_Label *forward = &compiler->forwardLabels[compiler->forwardLabelCount++];
+		forward->name = *name;
+		forward->pos = parser->bytePos;
+		return 0;
 	}
 }
 
@@ -230,15 +303,23 @@ static void hir_number(hoshi_VM *vm, hir_Parser *parser)
 	hir_emitConstant(vm, parser, HOSHI_NUMBER(strtod(parser->previous.start, NULL)));
 }
 
+static void hir_integer(hoshi_VM *vm, hir_Parser *parser)
+{
+	errno = 0;
+	long long value = strtoll(parser->previous.start, NULL, 10);
+	if (errno == ERANGE || !HOSHI_INTEGER_FITS((int64_t)value)) {
+		hir_error(parser, "integer literal out of range");
+		return;
+	}
+	hir_emitConstant(vm, parser, HOSHI_INTEGER((int64_t)value));
+}
+
 static void hir_string(hoshi_VM *vm, hir_Parser *parser)
 {
 	char *string = hoshi_formatString(vm, (char *)parser->previous.start, parser->previous.length);
-	hir_emitConstant(vm, parser, HOSHI_OBJECT(hoshi_makeString(
-		vm,
-		true,
-		string,
-		strlen(string)
-	)));
+	int length = strlen(string);
+	hir_emitConstant(vm, parser, HOSHI_OBJECT(hoshi_makeString(vm, string, length)));
+	HOSHI_FREE_ARRAY(&vm->allocator, char, string, length + 1);
 }
 
 static void hir_expression(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer)
@@ -248,6 +329,7 @@ static void hir_expression(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer)
 		/* Values */
 		case HIR_TOKEN_LABEL: hir_label(vm, parser, true); break;
 		case HIR_TOKEN_NUMBER: hir_number(vm, parser); break;
+		case HIR_TOKEN_INTEGER: hir_integer(vm, parser); break;
 		case HIR_TOKEN_STRING: hir_string(vm, parser); break;
 		case HIR_TOKEN_TRUE: hir_emitByte(parser, HOSHI_OP_TRUE); break;
 		case HIR_TOKEN_FALSE: hir_emitByte(parser, HOSHI_OP_FALSE); break;
@@ -260,40 +342,71 @@ static void hir_expression(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer)
 		case HIR_TOKEN_DIV: hir_emitByte(parser, HOSHI_OP_DIV); break;
 		case HIR_TOKEN_NEGATE: hir_emitByte(parser, HOSHI_OP_NEGATE); break;
 		case HIR_TOKEN_DEFGLOBAL:
-			hir_emitBytes2(parser, HOSHI_OP_DEFGLOBAL, hir_globalId(vm, parser, lexer));
+			hir_emitIndexed(parser, HOSHI_OP_DEFGLOBAL, hir_globalId(vm, parser, lexer));
 			break;
 		case HIR_TOKEN_SETGLOBAL:
-			hir_emitBytes2(parser, HOSHI_OP_SETGLOBAL, hir_globalId(vm, parser, lexer));
+			hir_emitIndexed(parser, HOSHI_OP_SETGLOBAL, hir_globalId(vm, parser, lexer));
 			break;
 		case HIR_TOKEN_GETGLOBAL:
-			hir_emitBytes2(parser, HOSHI_OP_GETGLOBAL, hir_globalId(vm, parser, lexer));
+			hir_emitIndexed(parser, HOSHI_OP_GETGLOBAL, hir_globalId(vm, parser, lexer));
 			break;
 		case HIR_TOKEN_DEFLOCAL:
-			hir_emitBytes2(parser, HOSHI_OP_DEFLOCAL, hir_localId(vm, parser, lexer, true));
+			hir_emitLocal(parser, HOSHI_OP_DEFLOCAL, hir_localId(vm, parser, lexer, true));
 			break;
 		case HIR_TOKEN_SETLOCAL:
-			hir_emitBytes2(parser, HOSHI_OP_SETLOCAL, hir_localId(vm, parser, lexer, false));
+			hir_emitLocal(parser, HOSHI_OP_SETLOCAL, hir_localId(vm, parser, lexer, false));
 			break;
 		case HIR_TOKEN_GETLOCAL:
-			hir_emitBytes2(parser, HOSHI_OP_GETLOCAL, hir_localId(vm, parser, lexer, false));
+			hir_emitLocal(parser, HOSHI_OP_GETLOCAL, hir_localId(vm, parser, lexer, false));
 			break;
-		case HIR_TOKEN_NEWSCOPE:
-			hir_emitByte(parser, HOSHI_OP_NEWSCOPE);
-			parser->currentCompiler->scopeDepth++;
+		/* Locals already have their slots, so scopes are not emitted here, only a CLEARLOCALS of the slots a scope gives back when it ends.
+		 * hir_allocateRegions puts NEWSCOPE and ENDSCOPE back in around the scopes that get a region, where they are recorded for. */
+		case HIR_TOKEN_NEWSCOPE: {
+			hir_Compiler *compiler = parser->currentCompiler;
+			if (compiler->scopeCount + 1 > compiler->scopeCapacity) {
+				int oldCapacity = compiler->scopeCapacity;
+				compiler->scopeCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
+				compiler->scopes = HOSHI_GROW_ARRAY(compiler->allocator, hir_Scope, compiler->scopes, oldCapacity, compiler->scopeCapacity);
+			}
+			compiler->scopes[compiler->scopeCount] = (hir_Scope){ (int)parser->bytePos, -1, compiler->currentScope, compiler->localCount, compiler->localCount };
+			compiler->currentScope = compiler->scopeCount++;
+			compiler->scopeDepth++;
 			break;
-		case HIR_TOKEN_ENDSCOPE:
-			hir_emitByte(parser, HOSHI_OP_ENDSCOPE);
-			parser->currentCompiler->scopeDepth--;
+		}
+		case HIR_TOKEN_ENDSCOPE: {
+			hir_Compiler *compiler = parser->currentCompiler;
+			if (compiler->scopeDepth == 0) {
+				hir_error(parser, "endscope without a newscope");
+				break;
+			}
+			compiler->scopeDepth--;
+			hir_Scope *scope = &compiler->scopes[compiler->currentScope];
+			if (scope->parent != -1 && scope->slotEnd > compiler->scopes[scope->parent].slotEnd) {
+				compiler->scopes[scope->parent].slotEnd = scope->slotEnd;
+			}
+			compiler->currentScope = scope->parent;
 
-			/* Remove old locals */
+			/* Remove old locals, freeing their slots */
+			int freed = parser->currentCompiler->localCount;
 			while (
 				parser->currentCompiler->localCount > 0 &&
 				parser->currentCompiler->locals[parser->currentCompiler->localCount - 1].depth > parser->currentCompiler->scopeDepth
 			) {
 				parser->currentCompiler->localCount--;
 			}
+			/* Set them to nil, so the collector does not keep what they held alive until the slots are used again.
+			 * This counts as part of the scope, so its end, where a region's ENDSCOPE goes, is still where a jump to right after `endscope` lands. */
+			for (int first = parser->currentCompiler->localCount; first < freed; first += UINT8_MAX) {
+				int count = freed - first < UINT8_MAX ? freed - first : UINT8_MAX;
+				hir_emitByte(parser, HOSHI_OP_CLEARLOCALS);
+				hir_emitByte(parser, first & 0xFF);
+				hir_emitByte(parser, (first >> 8) & 0xFF);
+				hir_emitByte(parser, count);
+			}
+			scope->end = parser->bytePos;
 
 			break;
+		}
 		case HIR_TOKEN_JUMP: {
 			long offset = strtol(parser->current.start, (char **)&parser->current.start[parser->current.length], 10);
 			hir_advance(parser, lexer);
@@ -335,11 +448,13 @@ static void hir_expression(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer)
 			break;
 		}
 		case HIR_TOKEN_GOTO: {
+			hir_consume(parser, lexer, HIR_TOKEN_LABEL, "expected label");
 			hir_emitByte(parser, HOSHI_OP_GOTO);
 			hir_emitLong(parser, hir_label(vm, parser, false));
 			break;
 		}
 		case HIR_TOKEN_GOTO_IF: {
+			hir_consume(parser, lexer, HIR_TOKEN_LABEL, "expected label");
 			hir_emitByte(parser, HOSHI_OP_GOTO_IF);
 			hir_emitLong(parser, hir_label(vm, parser, false));
 			break;
@@ -358,6 +473,25 @@ static void hir_expression(hoshi_VM *vm, hir_Parser *parser, hir_Lexer *lexer)
 		case HIR_TOKEN_PRINT: hir_emitByte(parser, HOSHI_OP_PRINT); break;
 		case HIR_TOKEN_RETURN: hir_emitByte(parser, HOSHI_OP_RETURN); break;
 		case HIR_TOKEN_EXIT: hir_emitByte(parser, HOSHI_OP_EXIT); break;
+		case HIR_TOKEN_YIELD: hir_emitByte(parser, HOSHI_OP_YIELD); break;
+		case HIR_TOKEN_MOD: hir_emitByte(parser, HOSHI_OP_MOD); break;
+		case HIR_TOKEN_BAND: hir_emitByte(parser, HOSHI_OP_BAND); break;
+		case HIR_TOKEN_BOR: hir_emitByte(parser, HOSHI_OP_BOR); break;
+		case HIR_TOKEN_BXOR: hir_emitByte(parser, HOSHI_OP_BXOR); break;
+		case HIR_TOKEN_BNOT: hir_emitByte(parser, HOSHI_OP_BNOT); break;
+		case HIR_TOKEN_SHL: hir_emitByte(parser, HOSHI_OP_SHL); break;
+		case HIR_TOKEN_SHR: hir_emitByte(parser, HOSHI_OP_SHR); break;
+		case HIR_TOKEN_TOINT: hir_emitByte(parser, HOSHI_OP_TOINT); break;
+		case HIR_TOKEN_TONUM: hir_emitByte(parser, HOSHI_OP_TONUM); break;
+		case HIR_TOKEN_HOSTCALL: {
+			hir_consume(parser, lexer, HIR_TOKEN_INTEGER, "expected host function index");
+			long index = strtol(parser->previous.start, NULL, 10);
+			if (index < 0 || index > UINT8_MAX) {
+				hir_error(parser, "host function index out of range (max is UINT8_MAX)");
+			}
+			hir_emitBytes2(parser, HOSHI_OP_HOSTCALL, index & 0xFF);
+			break;
+		}
 		default:
 			hir_errorAtCurrent(parser, "invalid token type for expression: %d (this error should never happen, please report it)", parser->previous.type);
         }
@@ -367,10 +501,33 @@ static void hir_initCompiler(hir_Parser *parser, hir_Compiler *compiler)
 {
 	compiler->localCount = 0;
 	compiler->scopeDepth = 0;
-	compiler->labels = HOSHI_ALLOCATE(hir_Label, 256);
+	compiler->allocator = parser->currentChunk->allocator;
+	compiler->labels = HOSHI_ALLOCATE(compiler->allocator, hir_Label, HIR_MAX_LABELS);
+	compiler->labelCount = 0;
+	compiler->forwardLabels = HOSHI_ALLOCATE(compiler->allocator, hir_Label, HIR_MAX_LABELS);
+	compiler->forwardLabelCount = 0;
+	compiler->scopes = NULL;
+	compiler->scopeCount = 0;
+	compiler->scopeCapacity = 0;
+	compiler->currentScope = -1;
+	compiler->declarations = NULL;
+	compiler->declarationCount = 0;
+	compiler->declarationCapacity = 0;
+	compiler->localUses = NULL;
+	compiler->localUseCount = 0;
+	compiler->localUseCapacity = 0;
 	parser->currentCompiler = compiler;
 }
 
+static void hir_freeCompiler(hir_Compiler *compiler)
+{
+	HOSHI_FREE_ARRAY(compiler->allocator, hir_Label, compiler->labels, HIR_MAX_LABELS);
+	HOSHI_FREE_ARRAY(compiler->allocator, hir_Label, compiler->forwardLabels, HIR_MAX_LABELS);
+	HOSHI_FREE_ARRAY(compiler->allocator, hir_Scope, compiler->scopes, compiler->scopeCapacity);
+	HOSHI_FREE_ARRAY(compiler->allocator, int, compiler->declarations, compiler->declarationCapacity);
+	HOSHI_FREE_ARRAY(compiler->allocator, hir_LocalUse, compiler->localUses, compiler->localUseCapacity);
+}
+
 bool hir_compileString(hoshi_VM *vm, hoshi_Chunk *chunk, const char *string)
 {
 	hir_Lexer lexer;
@@ -382,7 +539,7 @@ bool hir_compileString(hoshi_VM *vm, hoshi_Chunk *chunk, const char *string)
 	parser.hadError = false;
 	parser.panicMode = false;
 	parser.currentChunk = chunk;
-	hoshi_initTable(&parser.identifiers);
+	hoshi_initTable(&parser.identifiers, &vm->allocator);
 	hir_Compiler compiler;
 	hir_initCompiler(&parser, &compiler);
 
@@ -397,7 +554,17 @@ bool hir_compileString(hoshi_VM *vm, hoshi_Chunk *chunk, const char *string)
 		}
 	}
 
-	HOSHI_FREE_ARRAY(hir_Label, compiler.labels, compiler.labelCount);
+	/* Whatever is left was never defined */
+	for (int i = 0; i < compiler.forwardLabelCount; i++) {
+		hir_errorAt(&parser, &compiler.forwardLabels[i].name, "undefined label");
+	}
+
+#if HIR_ENABLE_REGIONS
+	if (!parser.hadError) {
+		hir_allocateRegions(&compiler, chunk);
+	}
+#endif
+	hir_freeCompiler(&compiler);
 
 	hir_endCompiler(&parser);
 	hoshi_freeTable(&parser.identifiers);
@@ -413,9 +580,6 @@ hoshi_InterpretResult hir_runString(hoshi_VM *vm, const char *string)
 		return HOSHI_INTERPRET_COMPILE_ERROR;
 	}
 
-	vm->chunk = &chunk;
-	vm->ip = vm->chunk->code;
-
 	hoshi_InterpretResult result = hoshi_runChunk(vm, &chunk);
 
 	hoshi_freeChunk(&chunk);
@@ -7,12 +7,29 @@
 #include "lexer.h"
 #include <stdbool.h>
 
+/* A local's slot in `hoshi_VM.locals` is its index in `hir_Compiler.locals`, so slots are handed out and taken back like a stack as scopes open and end. */
 typedef struct {
 	hir_Token name;
 	int depth;
-	int index;
+	int declaration; /* Which of the chunk's locals this is, in the order they were declared, since slots are reused */
 } hir_LocalVariable;
 
+/* A scope, as hir_allocateRegions (regions.h) sees it once the whole chunk is compiled */
+typedef struct {
+	int start; /* Offset of the first instruction in the scope */
+	int end; /* Offset right after the last one, -1 if the scope never ended */
+	int parent; /* The scope it is in, -1 at the top level */
+	int firstSlot; /* The first slot its locals got */
+	int slotEnd; /* One past the last slot any local in it or the scopes in it got */
+} hir_Scope;
+
+/* Where a local instruction was emitted, and which local it is for */
+typedef struct {
+	int offset;
+	int declaration;
+} hir_LocalUse;
+
+/* A label, or a use of one that is not defined yet, in which case `pos` is where the GOTO's operand goes once it is */
 typedef struct {
 	hir_Token name;
 	int pos;
@@ -24,6 +41,20 @@ typedef struct {
 	int scopeDepth;
 	hir_Label *labels;
 	int labelCount;
+	hir_Label *forwardLabels;
+	int forwardLabelCount;
+	/* Everything hir_allocateRegions needs to know that is not in the bytecode */
+	hir_Scope *scopes;
+	int scopeCount;
+	int scopeCapacity;
+	int currentScope; /* The innermost open scope, -1 at the top level */
+	int *declarations; /* The scope each local was declared in, by `hir_LocalVariable.declaration` */
+	int declarationCount;
+	int declarationCapacity;
+	hir_LocalUse *localUses;
+	int localUseCount;
+	int localUseCapacity;
+	const hoshi_Allocator *allocator; /* The chunk's */
 } hir_Compiler;
 
 typedef struct {
@@ -1,10 +1,24 @@
 #ifndef __HIR_CONFIG_H__
 #define __HIR_CONFIG_H__
 
+#include "../hoshi/config.h"
+
 /* Compiler Configuration */
 
 #ifndef HIR_LOCAL_STACK_SIZE
-	#define HIR_LOCAL_STACK_SIZE (UINT8_MAX + 1)
+	/* Locals in scope at once, each one needs its own slot in the VM (see HOSHI_LOCALS_SIZE) */
+	#define HIR_LOCAL_STACK_SIZE HOSHI_LOCALS_SIZE
+#endif
+
+#ifndef HIR_MAX_LABELS
+	/* Labels in one chunk, and separately, uses of labels that are not defined yet */
+	#define HIR_MAX_LABELS 256
+#endif
+
+#ifndef HIR_ENABLE_REGIONS
+	/* Set to `0` to allocate every string CONCAT makes on the VM's heap. Otherwise strings that never outlive the scope they are made in
+	 * are made by SCOPED_CONCAT in a region that ENDSCOPE frees all at once (see regions.h). */
+	#define HIR_ENABLE_REGIONS 1
 #endif
 
 /* Debugging */
@@ -118,6 +118,7 @@ static hir_Token hir_string(hir_Lexer *lexer)
 	return token;
 }
 
+/* Literals with a decimal point are numbers, everything else is an integer */
 static hir_Token hir_number(hir_Lexer *lexer)
 {
 	while (isDigit(hir_peek(lexer))) {
@@ -131,9 +132,11 @@ static hir_Token hir_number(hir_Lexer *lexer)
 		while (isDigit(hir_peek(lexer))) {
 			hir_skip(lexer);
 		}
+
+		return hir_makeToken(lexer, HIR_TOKEN_NUMBER);
 	}
 
-	return hir_makeToken(lexer, HIR_TOKEN_NUMBER);
+	return hir_makeToken(lexer, HIR_TOKEN_INTEGER);
 }
 
 static hir_Token hir_identifier(hir_Lexer *lexer)
@@ -157,7 +160,7 @@ static hir_Token hir_label(hir_Lexer *lexer)
 		hir_skip(lexer);
 	}
 
-	return hir_makeToken(lexer, HIR_TOKEN_ID);
+	return hir_makeToken(lexer, HIR_TOKEN_LABEL);
 }
 
 static hir_TokenType hir_checkKeyword(hir_Lexer *lexer, int start, int length, const char *rest, hir_TokenType type)
@@ -189,6 +192,14 @@ static hir_TokenType hir_operatorType(hir_Lexer *lexer)
 			} else if (hir_checkKeyword(lexer, 1, 11, "ack_jump_if", HIR_TOKEN_BACK_JUMP_IF) == HIR_TOKEN_BACK_JUMP_IF) {
 				return HIR_TOKEN_BACK_JUMP_IF;
 			}
+			if (lexer->current - lexer->start > 1) {
+				switch (lexer->start[1]) {
+					case 'a': return hir_checkKeyword(lexer, 2, 2, "nd", HIR_TOKEN_BAND);
+					case 'o': return hir_checkKeyword(lexer, 2, 1, "r", HIR_TOKEN_BOR);
+					case 'x': return hir_checkKeyword(lexer, 2, 2, "or", HIR_TOKEN_BXOR);
+					case 'n': return hir_checkKeyword(lexer, 2, 2, "ot", HIR_TOKEN_BNOT);
+				}
+			}
 			break;
 		}
 		case 'c': return hir_checkKeyword(lexer, 1, 5, "oncat", HIR_TOKEN_CONCAT);
@@ -262,6 +273,7 @@ static hir_TokenType hir_operatorType(hir_Lexer *lexer)
 			}
 			break;
 		}
+		case 'h': return hir_checkKeyword(lexer, 1, 7, "ostcall", HIR_TOKEN_HOSTCALL);
 		case 'j': {
 			if (hir_checkKeyword(lexer, 1, 3, "ump", HIR_TOKEN_JUMP) == HIR_TOKEN_JUMP) {
 				return HIR_TOKEN_JUMP;
@@ -279,7 +291,15 @@ static hir_TokenType hir_operatorType(hir_Lexer *lexer)
 			}
 			break;
 		}
-		case 'm': return hir_checkKeyword(lexer, 1, 2, "ul", HIR_TOKEN_MUL);
+		case 'm': {
+			if (lexer->current - lexer->start > 1) {
+				switch (lexer->start[1]) {
+					case 'u': return hir_checkKeyword(lexer, 2, 1, "l", HIR_TOKEN_MUL);
+					case 'o': return hir_checkKeyword(lexer, 2, 1, "d", HIR_TOKEN_MOD);
+				}
+			}
+			break;
+		}
 		case 'n': {
 			if (lexer->current - lexer->start > 1) {
 				switch (lexer->start[1]) {
@@ -310,7 +330,7 @@ static hir_TokenType hir_operatorType(hir_Lexer *lexer)
 			}
 			break;
 		}
-		case 'r': return hir_checkKeyword(lexer, 1, 4, "turn", HIR_TOKEN_RETURN);
+		case 'r': return hir_checkKeyword(lexer, 1, 5, "eturn", HIR_TOKEN_RETURN);
 		case 's': {
 			if (lexer->current - lexer->start > 1) {
 				switch (lexer->start[1]) {
@@ -331,12 +351,32 @@ static hir_TokenType hir_operatorType(hir_Lexer *lexer)
 						break;
 					}
 					case 'u': return hir_checkKeyword(lexer, 2, 1, "b", HIR_TOKEN_SUB);
+					case 'h': {
+						if (hir_checkKeyword(lexer, 2, 1, "l", HIR_TOKEN_SHL) == HIR_TOKEN_SHL) {
+							return HIR_TOKEN_SHL;
+						}
+						return hir_checkKeyword(lexer, 2, 1, "r", HIR_TOKEN_SHR);
+					}
+				}
+			}
+			break;
+		}
+		case 't': {
+			if (lexer->current - lexer->start > 1) {
+				switch (lexer->start[1]) {
+					case 'r': return hir_checkKeyword(lexer, 2, 2, "ue", HIR_TOKEN_TRUE);
+					case 'o': {
+						if (hir_checkKeyword(lexer, 2, 3, "int", HIR_TOKEN_TOINT) == HIR_TOKEN_TOINT) {
+							return HIR_TOKEN_TOINT;
+						}
+						return hir_checkKeyword(lexer, 2, 3, "num", HIR_TOKEN_TONUM);
+					}
 				}
 			}
 			break;
 		}
-		case 't': return hir_checkKeyword(lexer, 1, 3, "rue", HIR_TOKEN_TRUE);
 		case 'x': return hir_checkKeyword(lexer, 1, 2, "or", HIR_TOKEN_XOR);
+		case 'y': return hir_checkKeyword(lexer, 1, 4, "ield", HIR_TOKEN_YIELD);
 	}
 	return HIR_TOKEN_ERROR;
 }
@@ -388,6 +428,7 @@ void hir_printToken(hir_Token *token)
 		case HIR_TOKEN_FALSE: fputs("FALSE", stdout); break;
 		case HIR_TOKEN_NIL: fputs("NIL", stdout); break;
 		case HIR_TOKEN_NUMBER: fputs("NUMBER", stdout); break;
+		case HIR_TOKEN_INTEGER: fputs("INTEGER", stdout); break;
 		case HIR_TOKEN_STRING: fputs("STRING", stdout); break;
 		/* Operations */
                 case HIR_TOKEN_PUSH: fputs("PUSH", stdout); break;
@@ -425,6 +466,17 @@ void hir_printToken(hir_Token *token)
                 case HIR_TOKEN_PRINT: fputs("PRINT", stdout); break;
                 case HIR_TOKEN_RETURN: fputs("RETURN", stdout); break;
                 case HIR_TOKEN_EXIT: fputs("EXIT", stdout); break;
+		case HIR_TOKEN_YIELD: fputs("YIELD", stdout); break;
+		case HIR_TOKEN_HOSTCALL: fputs("HOSTCALL", stdout); break;
+		case HIR_TOKEN_MOD: fputs("MOD", stdout); break;
+		case HIR_TOKEN_BAND: fputs("BAND", stdout); break;
+		case HIR_TOKEN_BOR: fputs("BOR", stdout); break;
+		case HIR_TOKEN_BXOR: fputs("BXOR", stdout); break;
+		case HIR_TOKEN_BNOT: fputs("BNOT", stdout); break;
+		case HIR_TOKEN_SHL: fputs("SHL", stdout); break;
+		case HIR_TOKEN_SHR: fputs("SHR", stdout); break;
+		case HIR_TOKEN_TOINT: fputs("TOINT", stdout); break;
+		case HIR_TOKEN_TONUM: fputs("TONUM", stdout); break;
 		// Misc
 		case HIR_TOKEN_ERROR: fputs("ERROR", stdout); break;
 		case HIR_TOKEN_EOF: fputs("EOF", stdout); break;
@@ -6,6 +6,7 @@ typedef enum {
 	HIR_TOKEN_ID,
 	HIR_TOKEN_LABEL,
 	HIR_TOKEN_NUMBER,
+	HIR_TOKEN_INTEGER,
 	HIR_TOKEN_STRING,
 	HIR_TOKEN_TRUE,
 	HIR_TOKEN_FALSE,
@@ -46,6 +47,17 @@ typedef enum {
 	HIR_TOKEN_PRINT,
 	HIR_TOKEN_RETURN,
 	HIR_TOKEN_EXIT,
+	HIR_TOKEN_YIELD,
+	HIR_TOKEN_HOSTCALL,
+	HIR_TOKEN_MOD,
+	HIR_TOKEN_BAND,
+	HIR_TOKEN_BOR,
+	HIR_TOKEN_BXOR,
+	HIR_TOKEN_BNOT,
+	HIR_TOKEN_SHL,
+	HIR_TOKEN_SHR,
+	HIR_TOKEN_TOINT,
+	HIR_TOKEN_TONUM,
 	/* Misc */
 	HIR_TOKEN_ERROR,
 	HIR_TOKEN_EOF,
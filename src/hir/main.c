@@ -4,6 +4,10 @@
 #include "config.h"
 #include "../hoshi/debug.h"
 #include "../hoshi/chunk_writer.h"
+#include "../hoshi/fusion.h"
+#include "../hoshi/jit.h"
+#include "../hoshi/optimizer.h"
+#include "../hoshi/verifier.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
@@ -24,6 +28,14 @@ static const char *help =
 "  -C, --cc=<cc>         Set the C compiler [default: gcc].\n"
 "  -f, --flags=<flags>   Provide flags to the C compiler.\n"
 "  -o, --output=<path>   Set output path [default: a.out for -c, out.c for -t].\n"
+"  -n, --no-optimize     Leave the bytecode as it was compiled, without optimizing it.\n"
+"  -O, --optimizer-stats Print what the optimizer folded and removed.\n"
+"  -F, --fusion-stats    Print how many superinstructions were fused before running (-r only).\n"
+"  -V, --verify          Print what the bytecode verifier found before running (-r only).\n"
+"  -S, --slice=<budget>  Run in slices of roughly <budget> instructions, using hoshi_runSlice (-r only).\n"
+#if HOSHI_ENABLE_JIT
+"  -J, --jit-verify      Run the file with the interpreter and again with the JIT, then compare their stacks and globals (-r only).\n"
+#endif
 "  -h, --help            Show this message.\n"
 "Arguments:\n"
 "  file                  Input file to compile/transpile/run."
@@ -47,8 +59,19 @@ static char *outputFile = "";
 static char *cc = "gcc";
 static char *ccFlags = "";
 static bool printDisasm = false;
+static bool optimize = true;
+static bool printOptimizerStats = false;
+static bool printFusionStats = false;
+static bool printVerifierStats = false;
+static int64_t sliceBudget = 0;
+#if HOSHI_ENABLE_JIT
+static bool jitVerify = false;
+#endif
 
 static void runFile(const char *path);
+#if HOSHI_ENABLE_JIT
+static void verifyFile(const char *path);
+#endif
 static void compileFileToHoshi(const char *inputFilePath, const char *outputFilePath);
 
 static void quit(int code)
@@ -62,7 +85,7 @@ static void quit(int code)
 
 static void setflag(char **flag)
 {
-	*flag = malloc(strlen(optarg) * sizeof(char));
+	*flag = malloc((strlen(optarg) + 1) * sizeof(char));
 	strcpy(*flag, optarg);
 }
 
@@ -80,6 +103,14 @@ int main(int argc, char *argv[])
 		{ "cc",            required_argument, NULL, 'C' },
 		{ "flags",         required_argument, NULL, 'f' },
 		{ "output",        required_argument, NULL, 'o' },
+		{ "no-optimize",   no_argument,       NULL, 'n' },
+		{ "optimizer-stats", no_argument,     NULL, 'O' },
+		{ "fusion-stats",  no_argument,       NULL, 'F' },
+		{ "verify",        no_argument,       NULL, 'V' },
+		{ "slice",         required_argument, NULL, 'S' },
+#if HOSHI_ENABLE_JIT
+		{ "jit-verify",    no_argument,       NULL, 'J' },
+#endif
 		{ "help",          no_argument,       NULL, 'h' },
 		{ NULL,            0,                 NULL, 0 }
 	};
@@ -91,7 +122,7 @@ int main(int argc, char *argv[])
 	}
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, ":rcdb:C:f:o:h", longopts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, ":rcdb:C:f:o:nOFVS:Jh", longopts, NULL)) != -1) {
 		switch (opt) {
 			/* Actions */
 			case 'r':
@@ -129,6 +160,33 @@ int main(int argc, char *argv[])
 			case 'o':
 				setflag(&outputFile);
 				break;
+			case 'n':
+				optimize = false;
+				break;
+			case 'O':
+				printOptimizerStats = true;
+				break;
+			case 'F':
+				printFusionStats = true;
+				break;
+			case 'V':
+				printVerifierStats = true;
+				break;
+			case 'S':
+				sliceBudget = atoll(optarg);
+				if (sliceBudget <= 0) {
+					fputs("error: -S needs a budget above 0.\n", stderr);
+					quit(2);
+				}
+				break;
+			case 'J':
+#if HOSHI_ENABLE_JIT
+				jitVerify = true;
+#else
+				fputs("error: -J needs a Hoshi built with HOSHI_ENABLE_JIT.\n", stderr);
+				quit(2);
+#endif
+				break;
 			/* Help */
 			case 'h':
 				puts(help);
@@ -152,7 +210,6 @@ int main(int argc, char *argv[])
 		int len = strlen(*arg) + 1;
 		inputFile = malloc(sizeof(char) * len);
 		memcpy(inputFile, *arg, len);
-		inputFile[len + 1] = '\0';
 	} else {
 		fputs("error: no input file specified.\n", stderr);
 		quit(2);
@@ -163,6 +220,12 @@ int main(int argc, char *argv[])
 			fputs("error: no mode specified. pass --help for usage.\n", stderr);
 			quit(2);
 		case RUN:
+#if HOSHI_ENABLE_JIT
+			if (jitVerify) {
+				verifyFile(inputFile);
+				break;
+			}
+#endif
 			runFile(inputFile);
 			break;
 		case COMPILE:
@@ -211,6 +274,70 @@ static void handleError(hoshi_VM *vm)
 	quit(vm->exitCode);
 }
 
+/* Optimizes a freshly compiled chunk, unless -n was given */
+static void optimizeChunk(hoshi_Chunk *chunk)
+{
+	if (!optimize) {
+		return;
+	}
+	hoshi_OptimizerStats stats;
+	hoshi_initOptimizerStats(&stats);
+	hoshi_optimizeChunk(chunk, &stats);
+	if (printOptimizerStats) {
+		hoshi_printOptimizerStats(&stats, stderr);
+	}
+}
+
+/* Compiles, optimizes, and fuses a chunk for running it, quits if compilation fails. */
+static void compileForRun(hoshi_VM *vm, hoshi_Chunk *chunk, const char *source)
+{
+	if (!hir_compileString(vm, chunk, source)) {
+		fprintf(stderr, "compilation failed, see above error(s)\n");
+		quit(1);
+	}
+	optimizeChunk(chunk);
+
+	/* Fuse superinstructions. This is skipped for -c so that written files stay portable between configurations. */
+	hoshi_FusionStats stats;
+	hoshi_initFusionStats(&stats);
+	hoshi_fuseChunk(chunk, &stats);
+	if (printFusionStats) {
+		hoshi_printFusionStats(&stats, stderr);
+	}
+
+	/* Verifying here instead of in hoshi_runChunk lets us report problems */
+	if (printVerifierStats) {
+		hoshi_verifyChunk(vm, chunk, stderr);
+		hoshi_printVerifierStats(chunk, stderr);
+	}
+}
+
+/* Runs the chunk, in slices of `sliceBudget` instructions when -S was given.
+ * There is no host here to wait on, so a YIELD gets the value it yielded right back. */
+static hoshi_InterpretResult runChunk(hoshi_VM *vm, hoshi_Chunk *chunk)
+{
+	hoshi_InterpretResult result = hoshi_enterChunk(vm, chunk);
+	if (result != HOSHI_INTERPRET_OK) {
+		return result;
+	}
+
+	int slices = 1;
+	for (;;) {
+		result = sliceBudget == 0 ? hoshi_runNext(vm) : hoshi_runSlice(vm, (hoshi_Budget){ sliceBudget, 0 });
+		if (result == HOSHI_INTERPRET_PAUSED) {
+			slices++;
+		} else if (result == HOSHI_INTERPRET_SUSPENDED) {
+			hoshi_resume(vm, vm->suspendValue);
+		} else {
+			break;
+		}
+	}
+	if (sliceBudget != 0) {
+		fprintf(stderr, "slices: %d\n", slices);
+	}
+	return result;
+}
+
 static void runFile(const char *path)
 {
 	char *source = hir_readFile(path);
@@ -230,14 +357,11 @@ static void runFile(const char *path)
 
 	/* Compile code */
 	hoshi_Chunk chunk;
-	hoshi_initChunk(&chunk);
-	if (!hir_compileString(&vm, &chunk, source)) {
-		fprintf(stderr, "compilation failed, see above error(s)\n");
-		quit(1);
-	}
+	hoshi_initChunk(&chunk, &vm.allocator);
+	compileForRun(&vm, &chunk, source);
 
 	/* Execute code */
-	hoshi_InterpretResult result = hoshi_runChunk(&vm, &chunk);
+	hoshi_InterpretResult result = runChunk(&vm, &chunk);
 
 	/* Clean up */
 	int code = vm.exitCode;
@@ -252,6 +376,48 @@ static void runFile(const char *path)
 	}
 }
 
+#if HOSHI_ENABLE_JIT
+static void verifyFile(const char *path)
+{
+	char *source = hir_readFile(path);
+
+	/* Both VMs get their own chunk, since running a chunk changes it (see HOSHI_ENABLE_QUICKENING).
+	 * Neither has an error handler, so a runtime error is compared like everything else instead of quitting. */
+	hoshi_VM interpreted;
+	hoshi_initVM(&interpreted);
+	interpreted.jit = false;
+	hoshi_Chunk interpretedChunk;
+	hoshi_initChunk(&interpretedChunk, &interpreted.allocator);
+	compileForRun(&interpreted, &interpretedChunk, source);
+
+	hoshi_VM compiled;
+	hoshi_initVM(&compiled);
+	compiled.jitThreshold = 0;
+	hoshi_Chunk compiledChunk;
+	hoshi_initChunk(&compiledChunk, &compiled.allocator);
+	compileForRun(&compiled, &compiledChunk, source);
+
+	hoshi_InterpretResult interpretedResult = hoshi_runChunk(&interpreted, &interpretedChunk);
+	hoshi_InterpretResult compiledResult = hoshi_runChunk(&compiled, &compiledChunk);
+
+	bool match = hoshi_jitCompareVMs(&interpreted, &compiled);
+	if (interpretedResult != compiledResult) {
+		fprintf(stderr, "jit-verify: result differs: interpreter has %d, jit has %d\n", interpretedResult, compiledResult);
+		match = false;
+	}
+	fputs(match ? "jit-verify: ok\n" : "jit-verify: mismatch\n", stderr);
+
+	/* Clean up */
+	hoshi_freeChunk(&interpretedChunk);
+	hoshi_freeVM(&interpreted);
+	hoshi_freeChunk(&compiledChunk);
+	hoshi_freeVM(&compiled);
+	free(source);
+
+	quit(match ? 0 : 1);
+}
+#endif
+
 static void compileFileToHoshi(const char *inputFilePath, const char *outputFilePath)
 {
 	printf("--| %s\n", inputFilePath);
@@ -272,12 +438,15 @@ static void compileFileToHoshi(const char *inputFilePath, const char *outputFile
 	/* Compile code */
 	puts("  | Compiling");
 	hoshi_Chunk chunk;
-	hoshi_initChunk(&chunk);
+	hoshi_initChunk(&chunk, &vm.allocator);
 	if (!hir_compileString(&vm, &chunk, source)) {
 		fprintf(stderr, "compilation failed, see above error(s)\n");
 		quit(1);
 	}
 
+	/* Optimize */
+	optimizeChunk(&chunk);
+
 	/* Disassembly */
 	if (printDisasm) {
 		hoshi_disassembleChunk(&chunk, "hoshi");
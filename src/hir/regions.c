@@ -0,0 +1,637 @@
+#ifndef __HIR_REGIONS_C__
+#define __HIR_REGIONS_C__
+
+#include "regions.h"
+#include "compiler.h"
+#include "config.h"
+#include "../hoshi/chunk.h"
+#include "../hoshi/memory.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* How long the strings a node stands for have to live: the scope they can not be used past the end of, or one of these */
+#define HIR_TOP_LEVEL -1 /* Until the chunk ends */
+#define HIR_ESCAPED -2 /* Until the collector finds nothing holds them any more */
+
+/* The nodes are the chunk's locals, which stand for the strings stored in them, and the places a CONCAT makes strings.
+ * The first `compiler->declarationCount` nodes are the locals, the rest are CONCATs. */
+typedef struct {
+	hir_Compiler *compiler;
+	hoshi_Chunk *chunk;
+	int *lifetime;
+	int *siteOffset; /* CONCATs: where the instruction is */
+	int nodeCount;
+	int nodeCapacity;
+	/* Pairs of nodes where the first has to live as long as the second: a string and what it is stored in, or a rope's pieces and the rope */
+	int *outlives;
+	int outlivesCount;
+	int outlivesCapacity;
+	/* What the stack holds as far as the analysis knows: the node of each value, or -1 for anything that is not a node's string */
+	int *stack;
+	int stackCount;
+	int stackCapacity;
+	/* By offset */
+	int *scopeAt; /* The innermost scope the instruction there is in, -1 at the top level */
+	bool *starts; /* Whether an instruction starts there, which the end of the chunk counts as */
+	bool *boundaries; /* Whether the stack is not followed past it: jump targets, and where scopes start and end */
+	int *jumps; /* Offsets of the chunk's jumps */
+	int jumpCount;
+	int jumpCapacity;
+} hir_Escapes;
+
+/* A NEWSCOPE or ENDSCOPE to put in at `offset`. At the same offset, ENDSCOPEs go first, innermost first, then NEWSCOPEs, outermost first. */
+typedef struct {
+	int offset;
+	int order; /* -depth for ENDSCOPEs, depth for NEWSCOPEs */
+	int scope;
+} hir_Insertion;
+
+static int hir_addNode(hir_Escapes *escapes, int offset, int lifetime)
+{
+	if (escapes->nodeCount + 1 > escapes->nodeCapacity) {
+		int oldCapacity = escapes->nodeCapacity;
+		escapes->nodeCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		escapes->lifetime = HOSHI_GROW_ARRAY(escapes->chunk->allocator, int, escapes->lifetime, oldCapacity, escapes->nodeCapacity);
+		escapes->siteOffset = HOSHI_GROW_ARRAY(escapes->chunk->allocator, int, escapes->siteOffset, oldCapacity, escapes->nodeCapacity);
+	}
+	int node = escapes->nodeCount++;
+	escapes->lifetime[node] = lifetime;
+	escapes->siteOffset[node] = offset;
+	return node;
+}
+
+/* `outer` has to live as long as `inner` */
+static void hir_outlive(hir_Escapes *escapes, int outer, int inner)
+{
+	if (outer == -1 || inner == -1) {
+		return;
+	}
+	if (escapes->outlivesCount + 2 > escapes->outlivesCapacity) {
+		int oldCapacity = escapes->outlivesCapacity;
+		escapes->outlivesCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		escapes->outlives = HOSHI_GROW_ARRAY(escapes->chunk->allocator, int, escapes->outlives, oldCapacity, escapes->outlivesCapacity);
+	}
+	escapes->outlives[escapes->outlivesCount++] = outer;
+	escapes->outlives[escapes->outlivesCount++] = inner;
+}
+
+static void hir_escape(hir_Escapes *escapes, int node)
+{
+	if (node != -1) {
+		escapes->lifetime[node] = HIR_ESCAPED;
+	}
+}
+
+static void hir_push(hir_Escapes *escapes, int node)
+{
+	if (escapes->stackCount + 1 > escapes->stackCapacity) {
+		int oldCapacity = escapes->stackCapacity;
+		escapes->stackCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		escapes->stack = HOSHI_GROW_ARRAY(escapes->chunk->allocator, int, escapes->stack, oldCapacity, escapes->stackCapacity);
+	}
+	escapes->stack[escapes->stackCount++] = node;
+}
+
+/* Values from before the last boundary have already escaped, so popping past what the analysis knows of gives -1 */
+static int hir_pop(hir_Escapes *escapes)
+{
+	return escapes->stackCount > 0 ? escapes->stack[--escapes->stackCount] : -1;
+}
+
+static int hir_peek(hir_Escapes *escapes)
+{
+	return escapes->stackCount > 0 ? escapes->stack[escapes->stackCount - 1] : -1;
+}
+
+/* Everything on the stack escapes, and the analysis forgets about it */
+static void hir_flush(hir_Escapes *escapes)
+{
+	for (int i = 0; i < escapes->stackCount; i++) {
+		hir_escape(escapes, escapes->stack[i]);
+	}
+	escapes->stackCount = 0;
+}
+
+static bool hir_isJump(hoshi_OpCode op)
+{
+	switch (op) {
+		case HOSHI_OP_JUMP:
+		case HOSHI_OP_BACK_JUMP:
+		case HOSHI_OP_JUMP_IF:
+		case HOSHI_OP_BACK_JUMP_IF:
+		case HOSHI_OP_GOTO:
+		case HOSHI_OP_GOTO_IF:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static int hir_scopeEnd(hir_Escapes *escapes, int scope)
+{
+	int end = escapes->compiler->scopes[scope].end;
+	return end == -1 ? escapes->chunk->count : end;
+}
+
+/* Finds the instructions, the jumps and where they go, and the scope each instruction is in. Returns false if a jump goes nowhere. */
+static bool hir_findJumps(hir_Escapes *escapes)
+{
+	hir_Compiler *compiler = escapes->compiler;
+	hoshi_Chunk *chunk = escapes->chunk;
+	for (int offset = 0; offset < chunk->count; offset += hoshi_instructionLength(chunk->code[offset])) {
+		hoshi_OpCode op = chunk->code[offset];
+		if (offset + hoshi_instructionLength(op) > chunk->count) {
+			return false;
+		}
+		escapes->starts[offset] = true;
+		if (hir_isJump(op)) {
+			int64_t target = hoshi_jumpTarget(chunk, offset);
+			if (target < 0 || target > chunk->count) {
+				return false;
+			}
+			escapes->boundaries[target] = true;
+			if (escapes->jumpCount + 1 > escapes->jumpCapacity) {
+				int oldCapacity = escapes->jumpCapacity;
+				escapes->jumpCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
+				escapes->jumps = HOSHI_GROW_ARRAY(escapes->chunk->allocator, int, escapes->jumps, oldCapacity, escapes->jumpCapacity);
+			}
+			escapes->jumps[escapes->jumpCount++] = offset;
+		}
+	}
+	escapes->starts[chunk->count] = true;
+	for (int i = 0; i < escapes->jumpCount; i++) {
+		if (!escapes->starts[hoshi_jumpTarget(chunk, escapes->jumps[i])]) {
+			return false;
+		}
+	}
+
+	/* Scopes come in the order they start in, so the ones inside of a scope overwrite it afterwards */
+	for (int i = 0; i < compiler->scopeCount; i++) {
+		int end = hir_scopeEnd(escapes, i);
+		for (int offset = compiler->scopes[i].start; offset < end; offset++) {
+			escapes->scopeAt[offset] = i;
+		}
+		escapes->boundaries[compiler->scopes[i].start] = true;
+		escapes->boundaries[end] = true;
+	}
+	return true;
+}
+
+/* Follows values through the stack and locals, and works out which ones escape. Returns false for instructions it does not know. */
+static bool hir_followValues(hir_Escapes *escapes)
+{
+	hir_Compiler *compiler = escapes->compiler;
+	hoshi_Chunk *chunk = escapes->chunk;
+	int use = 0;
+	for (int offset = 0; offset < chunk->count; offset += hoshi_instructionLength(chunk->code[offset])) {
+		if (escapes->boundaries[offset]) {
+			hir_flush(escapes);
+		}
+
+		hoshi_OpCode op = chunk->code[offset];
+		if (op == HOSHI_OP_WIDE) {
+			op = chunk->code[offset + 1];
+		}
+		int declaration = -1;
+		if (op == HOSHI_OP_DEFLOCAL || op == HOSHI_OP_SETLOCAL || op == HOSHI_OP_GETLOCAL) {
+			while (use < compiler->localUseCount && compiler->localUses[use].offset < offset) {
+				use++;
+			}
+			if (use == compiler->localUseCount || compiler->localUses[use].offset != offset) {
+				return false;
+			}
+			declaration = compiler->localUses[use].declaration;
+		}
+
+		switch (op) {
+			case HOSHI_OP_CONSTANT:
+			case HOSHI_OP_CONSTANT_LONG:
+			case HOSHI_OP_TRUE:
+			case HOSHI_OP_FALSE:
+			case HOSHI_OP_NIL:
+			case HOSHI_OP_GETGLOBAL:
+				hir_push(escapes, -1);
+				break;
+			case HOSHI_OP_GETLOCAL:
+				hir_push(escapes, declaration);
+				break;
+			case HOSHI_OP_DEFLOCAL:
+				hir_outlive(escapes, hir_pop(escapes), declaration);
+				break;
+			case HOSHI_OP_SETLOCAL:
+				hir_outlive(escapes, hir_peek(escapes), declaration);
+				break;
+			case HOSHI_OP_DEFGLOBAL:
+				hir_escape(escapes, hir_pop(escapes));
+				break;
+			case HOSHI_OP_SETGLOBAL:
+				hir_escape(escapes, hir_peek(escapes));
+				break;
+			case HOSHI_OP_POP:
+			case HOSHI_OP_PRINT:
+				hir_pop(escapes);
+				break;
+			case HOSHI_OP_CLEARLOCALS:
+				break;
+			case HOSHI_OP_JUMP:
+			case HOSHI_OP_BACK_JUMP:
+			case HOSHI_OP_GOTO:
+			case HOSHI_OP_RETURN:
+				hir_flush(escapes);
+				break;
+			case HOSHI_OP_JUMP_IF:
+			case HOSHI_OP_BACK_JUMP_IF:
+			case HOSHI_OP_GOTO_IF:
+			case HOSHI_OP_EXIT:
+				hir_escape(escapes, hir_pop(escapes));
+				hir_flush(escapes);
+				break;
+			case HOSHI_OP_YIELD:
+			case HOSHI_OP_HOSTCALL:
+				hir_escape(escapes, hir_pop(escapes));
+				hir_push(escapes, -1);
+				break;
+			case HOSHI_OP_NEGATE:
+			case HOSHI_OP_NOT:
+			case HOSHI_OP_BNOT:
+			case HOSHI_OP_TOINT:
+			case HOSHI_OP_TONUM:
+				hir_pop(escapes);
+				hir_push(escapes, -1);
+				break;
+			/* Everything else that takes two values leaves a number, integer, or bool behind */
+			case HOSHI_OP_ADD:
+			case HOSHI_OP_SUB:
+			case HOSHI_OP_MUL:
+			case HOSHI_OP_DIV:
+			case HOSHI_OP_AND:
+			case HOSHI_OP_OR:
+			case HOSHI_OP_XOR:
+			case HOSHI_OP_EQ:
+			case HOSHI_OP_NEQ:
+			case HOSHI_OP_GT:
+			case HOSHI_OP_LT:
+			case HOSHI_OP_GTEQ:
+			case HOSHI_OP_LTEQ:
+			case HOSHI_OP_MOD:
+			case HOSHI_OP_BAND:
+			case HOSHI_OP_BOR:
+			case HOSHI_OP_BXOR:
+			case HOSHI_OP_SHL:
+			case HOSHI_OP_SHR:
+				hir_pop(escapes);
+				hir_pop(escapes);
+				hir_push(escapes, -1);
+				break;
+			/* A CONCAT can hand back either of its operands as it is, and a rope keeps both, so they have to live as long as what it makes */
+			case HOSHI_OP_CONCAT: {
+				int site = hir_addNode(escapes, offset, escapes->scopeAt[offset]);
+				hir_outlive(escapes, hir_pop(escapes), site);
+				hir_outlive(escapes, hir_pop(escapes), site);
+				hir_push(escapes, site);
+				break;
+			}
+			default:
+				return false;
+		}
+	}
+	hir_flush(escapes);
+	return true;
+}
+
+static int hir_scopeDepth(hir_Compiler *compiler, int scope)
+{
+	int depth = 0;
+	for (; scope != -1; scope = compiler->scopes[scope].parent) {
+		depth++;
+	}
+	return depth;
+}
+
+/* The shorter of two lifetimes that covers both: the innermost scope `a` and `b` are both in */
+static int hir_longerLifetime(hir_Compiler *compiler, int a, int b)
+{
+	if (a == HIR_ESCAPED || b == HIR_ESCAPED) {
+		return HIR_ESCAPED;
+	}
+	int depthA = hir_scopeDepth(compiler, a);
+	int depthB = hir_scopeDepth(compiler, b);
+	for (; depthA > depthB; depthA--) {
+		a = compiler->scopes[a].parent;
+	}
+	for (; depthB > depthA; depthB--) {
+		b = compiler->scopes[b].parent;
+	}
+	while (a != b) {
+		a = compiler->scopes[a].parent;
+		b = compiler->scopes[b].parent;
+	}
+	return a;
+}
+
+/* Makes every node live as long as the nodes it has to outlive, until nothing changes */
+static void hir_propagateLifetimes(hir_Escapes *escapes)
+{
+	hir_Compiler *compiler = escapes->compiler;
+	int pairCount = escapes->outlivesCount / 2;
+	/* The pairs by their inner node: the outer nodes of node `n` are `outers[first[n]..first[n + 1])` */
+	int *first = HOSHI_ALLOCATE(escapes->chunk->allocator, int, (escapes->nodeCount + 1));
+	int *outers = HOSHI_ALLOCATE(escapes->chunk->allocator, int, pairCount);
+	for (int node = 0; node <= escapes->nodeCount; node++) {
+		first[node] = 0;
+	}
+	for (int i = 0; i < pairCount; i++) {
+		first[escapes->outlives[i * 2 + 1] + 1]++;
+	}
+	for (int node = 0; node < escapes->nodeCount; node++) {
+		first[node + 1] += first[node];
+	}
+	int *filled = HOSHI_ALLOCATE(escapes->chunk->allocator, int, escapes->nodeCount);
+	for (int node = 0; node < escapes->nodeCount; node++) {
+		filled[node] = first[node];
+	}
+	for (int i = 0; i < pairCount; i++) {
+		outers[filled[escapes->outlives[i * 2 + 1]]++] = escapes->outlives[i * 2];
+	}
+
+	/* Every node starts on the work list, and goes back on it whenever its lifetime gets longer */
+	int *work = HOSHI_ALLOCATE(escapes->chunk->allocator, int, escapes->nodeCount);
+	bool *waiting = HOSHI_ALLOCATE(escapes->chunk->allocator, bool, escapes->nodeCount);
+	int workCount = 0;
+	for (int node = escapes->nodeCount - 1; node >= 0; node--) {
+		work[workCount++] = node;
+		waiting[node] = true;
+	}
+	while (workCount > 0) {
+		int inner = work[--workCount];
+		waiting[inner] = false;
+		for (int i = first[inner]; i < first[inner + 1]; i++) {
+			int outer = outers[i];
+			int lifetime = hir_longerLifetime(compiler, escapes->lifetime[outer], escapes->lifetime[inner]);
+			if (lifetime != escapes->lifetime[outer]) {
+				escapes->lifetime[outer] = lifetime;
+				if (!waiting[outer]) {
+					work[workCount++] = outer;
+					waiting[outer] = true;
+				}
+			}
+		}
+	}
+
+	HOSHI_FREE_ARRAY(escapes->chunk->allocator, int, first, escapes->nodeCount + 1);
+	HOSHI_FREE_ARRAY(escapes->chunk->allocator, int, outers, pairCount);
+	HOSHI_FREE_ARRAY(escapes->chunk->allocator, int, filled, escapes->nodeCount);
+	HOSHI_FREE_ARRAY(escapes->chunk->allocator, int, work, escapes->nodeCount);
+	HOSHI_FREE_ARRAY(escapes->chunk->allocator, bool, waiting, escapes->nodeCount);
+}
+
+/* Marks the scopes a region can be given to: ones that end, are not nested too deeply for the VM, have few enough slots for ENDSCOPE to clear,
+ * and that no jump goes into or out of, so every run through them starts at NEWSCOPE and ends at ENDSCOPE */
+static void hir_findClosedScopes(hir_Escapes *escapes, bool *closed)
+{
+	hir_Compiler *compiler = escapes->compiler;
+	for (int i = 0; i < compiler->scopeCount; i++) {
+		hir_Scope *scope = &compiler->scopes[i];
+		closed[i] = scope->end != -1 && hir_scopeDepth(compiler, i) < HOSHI_MAX_SCOPE_DEPTH
+			&& scope->firstSlot <= UINT16_MAX && scope->slotEnd - scope->firstSlot <= UINT8_MAX;
+	}
+	for (int i = 0; i < escapes->jumpCount; i++) {
+		int source = escapes->jumps[i];
+		int target = (int)hoshi_jumpTarget(escapes->chunk, source);
+		/* A jump may go anywhere in the scopes it is in, including to their end */
+		for (int scope = escapes->scopeAt[source]; scope != -1; scope = compiler->scopes[scope].parent) {
+			if (target < compiler->scopes[scope].start || target > hir_scopeEnd(escapes, scope)) {
+				closed[scope] = false;
+			}
+		}
+		/* and to the start of other scopes, but not past it */
+		int inner = target < escapes->chunk->count ? escapes->scopeAt[target] : -1;
+		for (int scope = inner; scope != -1; scope = compiler->scopes[scope].parent) {
+			hir_Scope *outer = &compiler->scopes[scope];
+			if (outer->start < target && (source < outer->start || source >= hir_scopeEnd(escapes, scope))) {
+				closed[scope] = false;
+			}
+		}
+	}
+}
+
+static int hir_compareInsertions(const void *a, const void *b)
+{
+	const hir_Insertion *x = a;
+	const hir_Insertion *y = b;
+	if (x->offset != y->offset) {
+		return x->offset < y->offset ? -1 : 1;
+	}
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* Whether a jump from `source` runs the insertion it lands on, or goes past it */
+static bool hir_jumpRuns(hir_Compiler *compiler, hir_Insertion *insertion, int source)
+{
+	hir_Scope *scope = &compiler->scopes[insertion->scope];
+	bool inside = source >= scope->start && source < scope->end;
+	return insertion->order < 0 ? inside : !inside;
+}
+
+/* Writes the chunk back out with NEWSCOPE and ENDSCOPE around the scopes in `region`, and SCOPED_CONCAT at the offsets in `scoped`.
+ * Returns false, leaving the chunk alone, if a relative jump gets too far to reach its target. */
+static bool hir_rewriteChunk(hir_Escapes *escapes, bool *region, bool *scoped)
+{
+	hir_Compiler *compiler = escapes->compiler;
+	hoshi_Chunk *chunk = escapes->chunk;
+	int oldCount = chunk->count;
+
+	int insertionCount = 0;
+	for (int i = 0; i < compiler->scopeCount; i++) {
+		insertionCount += region[i] ? 2 : 0;
+	}
+	hir_Insertion *insertions = HOSHI_ALLOCATE(escapes->chunk->allocator, hir_Insertion, insertionCount);
+	int count = 0;
+	for (int i = 0; i < compiler->scopeCount; i++) {
+		if (region[i]) {
+			int depth = hir_scopeDepth(compiler, i);
+			insertions[count++] = (hir_Insertion){ compiler->scopes[i].start, depth, i };
+			insertions[count++] = (hir_Insertion){ compiler->scopes[i].end, -depth, i };
+		}
+	}
+	qsort(insertions, insertionCount, sizeof(hir_Insertion), hir_compareInsertions);
+
+	/* `inserted[offset]` is how many bytes go in before `offset`, `firstInsertion[offset]` the first insertion at `offset`, or -1 */
+	int *inserted = HOSHI_ALLOCATE(escapes->chunk->allocator, int, (chunk->count + 2));
+	int *firstInsertion = HOSHI_ALLOCATE(escapes->chunk->allocator, int, (chunk->count + 1));
+	for (int offset = 0; offset <= chunk->count; offset++) {
+		inserted[offset + 1] = 0;
+		firstInsertion[offset] = -1;
+	}
+	inserted[0] = 0;
+	for (int i = insertionCount - 1; i >= 0; i--) {
+		inserted[insertions[i].offset + 1] += insertions[i].order < 0 ? hoshi_instructionLength(HOSHI_OP_ENDSCOPE) : 1;
+		firstInsertion[insertions[i].offset] = i;
+	}
+	for (int offset = 0; offset <= chunk->count; offset++) {
+		inserted[offset + 1] += inserted[offset];
+	}
+
+	int newCount = chunk->count + inserted[chunk->count + 1];
+	uint8_t *code = HOSHI_ALLOCATE(escapes->chunk->allocator, uint8_t, newCount);
+	int written = 0;
+	int next = 0;
+	bool success = true;
+	for (int offset = 0; success; ) {
+		for (; next < insertionCount && insertions[next].offset == offset; next++) {
+			hir_Scope *scope = &compiler->scopes[insertions[next].scope];
+			if (insertions[next].order > 0) {
+				code[written++] = HOSHI_OP_NEWSCOPE;
+			} else {
+				code[written++] = HOSHI_OP_ENDSCOPE;
+				code[written++] = scope->firstSlot & 0xFF;
+				code[written++] = (scope->firstSlot >> 8) & 0xFF;
+				code[written++] = scope->slotEnd - scope->firstSlot;
+			}
+		}
+		if (offset == chunk->count) {
+			break;
+		}
+
+		hoshi_OpCode op = chunk->code[offset];
+		int length = hoshi_instructionLength(op);
+		memcpy(&code[written], &chunk->code[offset], length);
+		if (scoped[offset]) {
+			code[written] = HOSHI_OP_SCOPED_CONCAT;
+		}
+		if (hir_isJump(op)) {
+			/* A jump lands on the first insertion at its target that it has to run, the ones before it are for code that falls through */
+			int target = (int)hoshi_jumpTarget(chunk, offset);
+			int newTarget = target + inserted[target];
+			for (int i = firstInsertion[target]; i != -1 && i < insertionCount && insertions[i].offset == target; i++) {
+				if (hir_jumpRuns(compiler, &insertions[i], offset)) {
+					break;
+				}
+				newTarget += insertions[i].order < 0 ? hoshi_instructionLength(HOSHI_OP_ENDSCOPE) : 1;
+			}
+			int distance = 0;
+			switch (op) {
+				case HOSHI_OP_JUMP:
+				case HOSHI_OP_JUMP_IF:
+					distance = newTarget - (written + length);
+					break;
+				case HOSHI_OP_BACK_JUMP:
+				case HOSHI_OP_BACK_JUMP_IF:
+					distance = (written + length) - newTarget;
+					break;
+				default:
+					for (int byte = 0; byte < 4; byte++) {
+						code[written + 1 + byte] = (newTarget >> (byte * 8)) & 0xFF;
+					}
+					break;
+			}
+			if (op != HOSHI_OP_GOTO && op != HOSHI_OP_GOTO_IF) {
+				if (distance < 0 || distance > UINT16_MAX) {
+					success = false;
+				}
+				code[written + 1] = distance & 0xFF;
+				code[written + 2] = (distance >> 8) & 0xFF;
+			}
+		}
+		written += length;
+		offset += length;
+	}
+
+	if (success) {
+		/* What goes in before an instruction is on its line */
+		for (int i = 0; i < chunk->lineCount; i++) {
+			chunk->lines[i].offset += inserted[chunk->lines[i].offset];
+		}
+		HOSHI_FREE_ARRAY(escapes->chunk->allocator, uint8_t, chunk->code, chunk->capacity);
+		chunk->code = code;
+		chunk->count = newCount;
+		chunk->capacity = newCount;
+	} else {
+		HOSHI_FREE_ARRAY(escapes->chunk->allocator, uint8_t, code, newCount);
+	}
+	HOSHI_FREE_ARRAY(escapes->chunk->allocator, hir_Insertion, insertions, insertionCount);
+	HOSHI_FREE_ARRAY(escapes->chunk->allocator, int, inserted, oldCount + 2);
+	HOSHI_FREE_ARRAY(escapes->chunk->allocator, int, firstInsertion, oldCount + 1);
+	return success;
+}
+
+void hir_allocateRegions(hir_Compiler *compiler, hoshi_Chunk *chunk)
+{
+	if (compiler->scopeCount == 0) {
+		return;
+	}
+
+	int count = chunk->count;
+	hir_Escapes escapes;
+	escapes.compiler = compiler;
+	escapes.chunk = chunk;
+	escapes.lifetime = NULL;
+	escapes.siteOffset = NULL;
+	escapes.nodeCount = 0;
+	escapes.nodeCapacity = 0;
+	escapes.outlives = NULL;
+	escapes.outlivesCount = 0;
+	escapes.outlivesCapacity = 0;
+	escapes.stack = NULL;
+	escapes.stackCount = 0;
+	escapes.stackCapacity = 0;
+	escapes.scopeAt = HOSHI_ALLOCATE(chunk->allocator, int, (count + 1));
+	escapes.starts = HOSHI_ALLOCATE(chunk->allocator, bool, (count + 1));
+	escapes.boundaries = HOSHI_ALLOCATE(chunk->allocator, bool, (count + 1));
+	escapes.jumps = NULL;
+	escapes.jumpCount = 0;
+	escapes.jumpCapacity = 0;
+	for (int offset = 0; offset <= count; offset++) {
+		escapes.scopeAt[offset] = -1;
+		escapes.starts[offset] = false;
+		escapes.boundaries[offset] = false;
+	}
+	for (int i = 0; i < compiler->declarationCount; i++) {
+		hir_addNode(&escapes, -1, compiler->declarations[i]);
+	}
+
+	if (hir_findJumps(&escapes) && hir_followValues(&escapes)) {
+		bool *closed = HOSHI_ALLOCATE(chunk->allocator, bool, compiler->scopeCount);
+		hir_findClosedScopes(&escapes, closed);
+		hir_propagateLifetimes(&escapes);
+
+		bool *region = HOSHI_ALLOCATE(chunk->allocator, bool, compiler->scopeCount);
+		bool *scoped = HOSHI_ALLOCATE(chunk->allocator, bool, (count + 1));
+		for (int i = 0; i < compiler->scopeCount; i++) {
+			region[i] = false;
+		}
+		for (int offset = 0; offset <= count; offset++) {
+			scoped[offset] = false;
+		}
+		/* A CONCAT goes in a region if nothing it makes has to outlive the scope it is in */
+		bool any = false;
+		for (int node = compiler->declarationCount; node < escapes.nodeCount; node++) {
+			int scope = escapes.scopeAt[escapes.siteOffset[node]];
+			if (scope != HIR_TOP_LEVEL && closed[scope] && escapes.lifetime[node] == scope) {
+				scoped[escapes.siteOffset[node]] = true;
+				region[scope] = true;
+				any = true;
+			}
+		}
+		if (any) {
+			hir_rewriteChunk(&escapes, region, scoped);
+		}
+
+		HOSHI_FREE_ARRAY(chunk->allocator, bool, closed, compiler->scopeCount);
+		HOSHI_FREE_ARRAY(chunk->allocator, bool, region, compiler->scopeCount);
+		HOSHI_FREE_ARRAY(chunk->allocator, bool, scoped, count + 1);
+	}
+
+	HOSHI_FREE_ARRAY(chunk->allocator, int, escapes.lifetime, escapes.nodeCapacity);
+	HOSHI_FREE_ARRAY(chunk->allocator, int, escapes.siteOffset, escapes.nodeCapacity);
+	HOSHI_FREE_ARRAY(chunk->allocator, int, escapes.outlives, escapes.outlivesCapacity);
+	HOSHI_FREE_ARRAY(chunk->allocator, int, escapes.stack, escapes.stackCapacity);
+	HOSHI_FREE_ARRAY(chunk->allocator, int, escapes.scopeAt, count + 1);
+	HOSHI_FREE_ARRAY(chunk->allocator, bool, escapes.starts, count + 1);
+	HOSHI_FREE_ARRAY(chunk->allocator, bool, escapes.boundaries, count + 1);
+	HOSHI_FREE_ARRAY(chunk->allocator, int, escapes.jumps, escapes.jumpCapacity);
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __HIR_REGIONS_H__
+#define __HIR_REGIONS_H__
+
+#include "../hoshi/chunk.h"
+#include "compiler.h"
+
+/* Region allocation.
+ * Escape analysis over a compiled chunk finds the strings CONCAT makes that can never be used once the scope they are made in ends:
+ * nothing stores them in a global, hands them to the host, exits with them, or keeps them in a local declared outside of that scope,
+ * and they are never on the stack when the scope ends or at a jump, where the analysis stops following the stack.
+ * A string has to live as long as the locals it is stored in, which live until their scope ends, and the pieces of a rope as long as the rope.
+ * A scope that makes such a string is wrapped in NEWSCOPE and an ENDSCOPE that clears its locals, and its CONCATs become SCOPED_CONCATs,
+ * which allocate in the scope's region instead of the heap. The collector never looks at those strings, and ENDSCOPE frees them all at once.
+ * Scopes that something jumps into or out of are left alone, as are scopes with more than UINT8_MAX slots. */
+
+/* Rewrites `chunk` to allocate strings in regions where it can. Leaves the chunk as it is if it can not work out where its jumps go. */
+void hir_allocateRegions(hir_Compiler *compiler, hoshi_Chunk *chunk);
+
+#endif
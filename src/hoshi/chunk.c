@@ -5,13 +5,17 @@
 #include "memory.h"
 #include "value.h"
 #include "common.h"
+#if HOSHI_ENABLE_JIT
+#include "jit.h"
+#endif
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void hoshi_initValueArray(hoshi_ValueArray *va)
+void hoshi_initValueArray(hoshi_ValueArray *va, const hoshi_Allocator *allocator)
 {
+	va->allocator = allocator;
 	va->count = 0;
 	va->capacity = 0;
 	va->values = NULL;
@@ -19,31 +23,43 @@ void hoshi_initValueArray(hoshi_ValueArray *va)
 
 void hoshi_freeValueArray(hoshi_ValueArray *va)
 {
-	HOSHI_FREE_ARRAY(hoshi_Value, va->values, va->capacity);
-	hoshi_initValueArray(va);
+	HOSHI_FREE_ARRAY(va->allocator, hoshi_Value, va->values, va->capacity);
+	hoshi_initValueArray(va, va->allocator);
 }
 
 void hoshi_writeValueArray(hoshi_ValueArray *va, hoshi_Value value)
 {
 	if (va->capacity < va->count + 1) {
 		int oldCapacity = va->capacity;
-		va->capacity = HOSHI_GROW_CAPACITY(oldCapacity);
-		va->values = HOSHI_GROW_ARRAY(hoshi_Value, va->values, oldCapacity, va->capacity);
+		/* `capacity` is only set once growing worked, so the array is still freed with the right size after a failed allocation */
+		int capacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		va->values = HOSHI_GROW_ARRAY(va->allocator, hoshi_Value, va->values, oldCapacity, capacity);
+		va->capacity = capacity;
 	}
 
 	va->values[va->count] = value;
 	va->count++;
 }
 
-void hoshi_initChunk(hoshi_Chunk *chunk)
+void hoshi_initChunk(hoshi_Chunk *chunk, const hoshi_Allocator *allocator)
 {
+	chunk->allocator = allocator;
 	chunk->count = 0;
 	chunk->capacity = 0;
 	chunk->code = NULL;
-	hoshi_initValueArray(&chunk->constants);
+	hoshi_initValueArray(&chunk->constants, allocator);
 	chunk->lineCount = 0;
 	chunk->lineCapacity = 0;
 	chunk->lines = NULL;
+	chunk->instructionCount = 0;
+	chunk->instructions = NULL;
+	chunk->verified = false;
+	chunk->maxStack = 0;
+	chunk->maxScopes = 0;
+#if HOSHI_ENABLE_JIT
+	chunk->jit = NULL;
+	chunk->hotness = 0;
+#endif
 	/* Add the first line line */
 	// HOSHI_GROW_ARRAY(hoshi_LineStart, chunk->code, 0, 8);
 	// chunk->lines[0].offset = 0;
@@ -52,18 +68,23 @@ void hoshi_initChunk(hoshi_Chunk *chunk)
 
 void hoshi_freeChunk(hoshi_Chunk *chunk)
 {
-	HOSHI_FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+	HOSHI_FREE_ARRAY(chunk->allocator, uint8_t, chunk->code, chunk->capacity);
 	hoshi_freeValueArray(&chunk->constants);
-	HOSHI_FREE_ARRAY(int, chunk->lines, chunk->lineCapacity);
-	hoshi_initChunk(chunk);
+	HOSHI_FREE_ARRAY(chunk->allocator, hoshi_LineStart, chunk->lines, chunk->lineCapacity);
+	HOSHI_FREE_ARRAY(chunk->allocator, hoshi_Instruction, chunk->instructions, chunk->instructionCount);
+#if HOSHI_ENABLE_JIT
+	hoshi_freeJitCode(chunk->jit);
+#endif
+	hoshi_initChunk(chunk, chunk->allocator);
 }
 
 void hoshi_writeChunk(hoshi_Chunk *chunk, uint8_t byte, int line)
 {
 	if (chunk->capacity < chunk->count + 1) {
 		int oldCapacity = chunk->capacity;
-		chunk->capacity = HOSHI_GROW_CAPACITY(oldCapacity);
-		chunk->code = HOSHI_GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
+		int capacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		chunk->code = HOSHI_GROW_ARRAY(chunk->allocator, uint8_t, chunk->code, oldCapacity, capacity);
+		chunk->capacity = capacity;
 	}
 
 	chunk->code[chunk->count] = byte;
@@ -77,14 +98,15 @@ void hoshi_writeChunk(hoshi_Chunk *chunk, uint8_t byte, int line)
 	/* Append a hoshi_LineStart */
 	if (chunk->lineCapacity < chunk->lineCount + 1) {
 		int oldCapacity = chunk->lineCapacity;
-		chunk->lineCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
-		chunk->lines = HOSHI_GROW_ARRAY(hoshi_LineStart, chunk->lines, oldCapacity, chunk->lineCapacity);
+		int capacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		chunk->lines = HOSHI_GROW_ARRAY(chunk->allocator, hoshi_LineStart, chunk->lines, oldCapacity, capacity);
+		chunk->lineCapacity = capacity;
 	}
 
-	chunk->lineCount++;
 	hoshi_LineStart *lineStart = &chunk->lines[chunk->lineCount];
 	lineStart->offset = chunk->count - 1;
 	lineStart->line = line;
+	chunk->lineCount++;
 }
 
 void hoshi_writeConstant(hoshi_Chunk *chunk, hoshi_Value value, int line)
@@ -109,6 +131,225 @@ int hoshi_addConstant(hoshi_Chunk *chunk, hoshi_Value value)
 	return chunk->constants.count - 1;
 }
 
+int hoshi_instructionLength(hoshi_OpCode op)
+{
+	switch (op) {
+		case HOSHI_OP_CONSTANT:
+		case HOSHI_OP_PUSH:
+		case HOSHI_OP_DEFGLOBAL:
+		case HOSHI_OP_SETGLOBAL:
+		case HOSHI_OP_GETGLOBAL:
+		case HOSHI_OP_DEFLOCAL:
+		case HOSHI_OP_SETLOCAL:
+		case HOSHI_OP_GETLOCAL:
+		case HOSHI_OP_HOSTCALL:
+			return 2;
+		case HOSHI_OP_JUMP:
+		case HOSHI_OP_BACK_JUMP:
+		case HOSHI_OP_JUMP_IF:
+		case HOSHI_OP_BACK_JUMP_IF:
+			return 3;
+		case HOSHI_OP_ENDSCOPE:
+		case HOSHI_OP_CLEARLOCALS:
+		case HOSHI_OP_CONSTANT_LONG:
+		case HOSHI_OP_WIDE:
+			return 4;
+		case HOSHI_OP_GOTO:
+		case HOSHI_OP_GOTO_IF:
+			return 5;
+		/* Superinstructions span their whole sequence */
+		case HOSHI_OP_GETLOCAL_CONSTANT_ADD_SETLOCAL: return 7;
+		case HOSHI_OP_CONSTANT_EQ_GOTO_IF: return 8;
+		case HOSHI_OP_CONSTANT_NEQ_GOTO_IF: return 8;
+		case HOSHI_OP_CONSTANT_LT_GOTO_IF: return 8;
+		case HOSHI_OP_GETLOCAL_GETLOCAL_CONCAT: return 5;
+		default:
+			return 1;
+	}
+}
+
+hoshi_OpCode hoshi_genericOpcode(hoshi_OpCode op)
+{
+	switch (op) {
+		case HOSHI_OP_GETLOCAL_CONSTANT_ADD_SETLOCAL: return HOSHI_OP_GETLOCAL;
+		case HOSHI_OP_CONSTANT_EQ_GOTO_IF: return HOSHI_OP_CONSTANT;
+		case HOSHI_OP_CONSTANT_NEQ_GOTO_IF: return HOSHI_OP_CONSTANT;
+		case HOSHI_OP_CONSTANT_LT_GOTO_IF: return HOSHI_OP_CONSTANT;
+		case HOSHI_OP_GETLOCAL_GETLOCAL_CONCAT: return HOSHI_OP_GETLOCAL;
+		case HOSHI_OP_ADD_NUM_NUM: return HOSHI_OP_ADD;
+		case HOSHI_OP_SUB_NUM_NUM: return HOSHI_OP_SUB;
+		case HOSHI_OP_MUL_NUM_NUM: return HOSHI_OP_MUL;
+		case HOSHI_OP_DIV_NUM_NUM: return HOSHI_OP_DIV;
+		case HOSHI_OP_EQ_NUM_NUM: return HOSHI_OP_EQ;
+		case HOSHI_OP_NEQ_NUM_NUM: return HOSHI_OP_NEQ;
+		case HOSHI_OP_GT_NUM_NUM: return HOSHI_OP_GT;
+		case HOSHI_OP_LT_NUM_NUM: return HOSHI_OP_LT;
+		case HOSHI_OP_GTEQ_NUM_NUM: return HOSHI_OP_GTEQ;
+		case HOSHI_OP_LTEQ_NUM_NUM: return HOSHI_OP_LTEQ;
+		case HOSHI_OP_ADD_INT_INT: return HOSHI_OP_ADD;
+		case HOSHI_OP_SUB_INT_INT: return HOSHI_OP_SUB;
+		case HOSHI_OP_MUL_INT_INT: return HOSHI_OP_MUL;
+		case HOSHI_OP_EQ_INT_INT: return HOSHI_OP_EQ;
+		case HOSHI_OP_NEQ_INT_INT: return HOSHI_OP_NEQ;
+		case HOSHI_OP_GT_INT_INT: return HOSHI_OP_GT;
+		case HOSHI_OP_LT_INT_INT: return HOSHI_OP_LT;
+		case HOSHI_OP_GTEQ_INT_INT: return HOSHI_OP_GTEQ;
+		case HOSHI_OP_LTEQ_INT_INT: return HOSHI_OP_LTEQ;
+		default:
+			return op;
+	}
+}
+
+int64_t hoshi_jumpTarget(hoshi_Chunk *chunk, int offset)
+{
+	hoshi_OpCode op = hoshi_genericOpcode(chunk->code[offset]);
+	uint8_t *operands = &chunk->code[offset + 1];
+	int next = offset + hoshi_instructionLength(op);
+
+	switch (op) {
+		case HOSHI_OP_JUMP:
+		case HOSHI_OP_JUMP_IF:
+			return next + (operands[0] | (operands[1] << 8));
+		case HOSHI_OP_BACK_JUMP:
+		case HOSHI_OP_BACK_JUMP_IF:
+			return next - (operands[0] | (operands[1] << 8));
+		case HOSHI_OP_GOTO:
+		case HOSHI_OP_GOTO_IF:
+			return operands[0] | (operands[1] << 8) | (operands[2] << 16) | ((int64_t)operands[3] << 24);
+		default:
+			return -1;
+	}
+}
+
+/* The instruction of the `count` in `instructions` that starts at `offset`, or NULL if `offset` is in the middle of one. They are in order of their offsets. */
+static hoshi_Instruction *hoshi_instructionAt(hoshi_Instruction *instructions, int count, int64_t offset)
+{
+	int low = 0;
+	int high = count - 1;
+	while (low <= high) {
+		int middle = low + (high - low) / 2;
+		if ((int64_t)instructions[middle].offset < offset) {
+			low = middle + 1;
+		} else if ((int64_t)instructions[middle].offset > offset) {
+			high = middle - 1;
+		} else {
+			return &instructions[middle];
+		}
+	}
+	return NULL;
+}
+
+bool hoshi_decodeChunk(hoshi_Chunk *chunk)
+{
+	HOSHI_FREE_ARRAY(chunk->allocator, hoshi_Instruction, chunk->instructions, chunk->instructionCount);
+	chunk->instructions = NULL;
+	chunk->instructionCount = 0;
+	chunk->verified = false;
+
+	/* Count the instructions first, so the array that is kept is the only thing allocated and running out of memory can not leak anything */
+	int count = 0;
+	for (int offset = 0; offset < chunk->count; offset += hoshi_instructionLength(hoshi_genericOpcode(chunk->code[offset]))) {
+		if (offset + hoshi_instructionLength(hoshi_genericOpcode(chunk->code[offset])) > chunk->count) {
+			fprintf(stderr, "error: failed to decode chunk: instruction at %d is cut off\n", offset);
+			return false;
+		}
+		count++;
+	}
+
+	/* Jumps are looked up by the offset they land at, so every offset is filled in before anything else.
+	 * Falling off the end of the chunk, or jumping right past it, returns. */
+	hoshi_Instruction *instructions = HOSHI_ALLOCATE(chunk->allocator, hoshi_Instruction, (count + 1));
+	int index = 0;
+	for (int offset = 0; offset < chunk->count; offset += hoshi_instructionLength(hoshi_genericOpcode(chunk->code[offset]))) {
+		instructions[index++].offset = offset;
+	}
+	instructions[count] = (hoshi_Instruction){ HOSHI_OP_RETURN, 0, chunk->count, { NULL } };
+
+	bool success = true;
+	index = 0;
+	for (int offset = 0; offset < chunk->count && success; offset += hoshi_instructionLength(hoshi_genericOpcode(chunk->code[offset]))) {
+		hoshi_Instruction *instruction = &instructions[index++];
+		uint8_t *operands = &chunk->code[offset + 1];
+		instruction->op = chunk->code[offset];
+		instruction->index = 0;
+		instruction->as.target = NULL;
+
+		switch (hoshi_genericOpcode(chunk->code[offset])) {
+			case HOSHI_OP_CONSTANT:
+			case HOSHI_OP_CONSTANT_LONG: {
+				int constant = operands[0];
+				if (chunk->code[offset] == HOSHI_OP_CONSTANT_LONG) {
+					constant |= (operands[1] << 8) | (operands[2] << 16);
+				}
+				if (constant >= chunk->constants.count) {
+					fprintf(stderr, "error: failed to decode chunk: instruction at %d uses constant %d, but there are only %d\n", offset, constant, chunk->constants.count);
+					success = false;
+					break;
+				}
+				instruction->as.constant = &chunk->constants.values[constant];
+				break;
+			}
+			case HOSHI_OP_PUSH:
+			case HOSHI_OP_DEFGLOBAL:
+			case HOSHI_OP_SETGLOBAL:
+			case HOSHI_OP_GETGLOBAL:
+			case HOSHI_OP_DEFLOCAL:
+			case HOSHI_OP_SETLOCAL:
+			case HOSHI_OP_GETLOCAL:
+			case HOSHI_OP_HOSTCALL:
+				instruction->index = operands[0];
+				break;
+			case HOSHI_OP_ENDSCOPE:
+			case HOSHI_OP_CLEARLOCALS:
+				instruction->index = operands[0] | (operands[1] << 8);
+				instruction->as.count = operands[2];
+				break;
+			case HOSHI_OP_WIDE:
+				switch (operands[0]) {
+					case HOSHI_OP_DEFGLOBAL:
+					case HOSHI_OP_SETGLOBAL:
+					case HOSHI_OP_GETGLOBAL:
+					case HOSHI_OP_DEFLOCAL:
+					case HOSHI_OP_SETLOCAL:
+					case HOSHI_OP_GETLOCAL:
+						instruction->op = operands[0];
+						instruction->index = operands[1] | (operands[2] << 8);
+						break;
+					default:
+						fprintf(stderr, "error: failed to decode chunk: WIDE at %d prefixes opcode %d, which has no wide form\n", offset, operands[0]);
+						success = false;
+						break;
+				}
+				break;
+			case HOSHI_OP_JUMP:
+			case HOSHI_OP_BACK_JUMP:
+			case HOSHI_OP_JUMP_IF:
+			case HOSHI_OP_BACK_JUMP_IF:
+			case HOSHI_OP_GOTO:
+			case HOSHI_OP_GOTO_IF: {
+				int64_t target = hoshi_jumpTarget(chunk, offset);
+				instruction->as.target = hoshi_instructionAt(instructions, count + 1, target);
+				if (instruction->as.target == NULL) {
+					fprintf(stderr, "error: failed to decode chunk: jump at %d lands at %lld, which is not the start of an instruction\n", offset, (long long)target);
+					success = false;
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	if (!success) {
+		HOSHI_FREE_ARRAY(chunk->allocator, hoshi_Instruction, instructions, count + 1);
+		return false;
+	}
+
+	chunk->instructions = instructions;
+	chunk->instructionCount = count + 1;
+	return true;
+}
+
 int hoshi_getLine(hoshi_Chunk *chunk, int offset)
 {
 	int start = 0;
@@ -1,6 +1,7 @@
 #ifndef __HOSHI_CHUNK_H__
 #define __HOSHI_CHUNK_H__
 
+#include "config.h"
 #include "value.h"
 #include "memory.h"
 #include <stdint.h>
@@ -25,7 +26,8 @@ typedef enum {
 	HOSHI_OP_DEFLOCAL,
 	HOSHI_OP_SETLOCAL,
 	HOSHI_OP_GETLOCAL,
-	/*       Scopes */
+	/*       Scopes. ENDSCOPE has a two byte slot, little endian, and a one byte count: it sets that many locals from the slot on to nil,
+	 *       and frees everything allocated in the scope's region (see SCOPED_CONCAT). */
 	HOSHI_OP_NEWSCOPE,
 	HOSHI_OP_ENDSCOPE,
 	/* Control Flow */
@@ -56,13 +58,62 @@ typedef enum {
 	HOSHI_OP_LTEQ,
 	/* String ops */
 	HOSHI_OP_CONCAT,
+	HOSHI_OP_SCOPED_CONCAT, /* CONCAT, but the new string goes in the innermost scope's region, which ENDSCOPE frees all at once */
 	/* Misc */
 	HOSHI_OP_PRINT,
 	HOSHI_OP_RETURN,
 	HOSHI_OP_EXIT,
+	/* Suspension */
+	HOSHI_OP_YIELD,
+	HOSHI_OP_HOSTCALL,
+	/* Modulo and bitwise ops */
+	HOSHI_OP_MOD,
+	HOSHI_OP_BAND,
+	HOSHI_OP_BOR,
+	HOSHI_OP_BXOR,
+	HOSHI_OP_BNOT,
+	HOSHI_OP_SHL,
+	HOSHI_OP_SHR,
+	/* Conversions */
+	HOSHI_OP_TOINT,
+	HOSHI_OP_TONUM,
+	/* Prefixes. WIDE gives the global or local instruction right after it a two byte index, little endian, instead of one. */
+	HOSHI_OP_WIDE,
+	/* Locals, continued. CLEARLOCALS has ENDSCOPE's operands and sets those locals to nil the same way, but ends no scope and frees no region.
+	 * HIR puts one where each scope ends, so the collector does not keep what a local held alive until its slot is used again. */
+	HOSHI_OP_CLEARLOCALS,
+	/* Superinstructions. These are never written to files, hoshi_fuseChunk (fusion.c) creates them in memory after a chunk is loaded.
+	 * A superinstruction only replaces the first opcode of the sequence it stands for, the operands and the rest of the sequence stay where they were. */
+	HOSHI_OP_GETLOCAL_CONSTANT_ADD_SETLOCAL,
+	HOSHI_OP_CONSTANT_EQ_GOTO_IF,
+	HOSHI_OP_CONSTANT_NEQ_GOTO_IF,
+	HOSHI_OP_CONSTANT_LT_GOTO_IF,
+	HOSHI_OP_GETLOCAL_GETLOCAL_CONCAT,
+	/* Quickened instructions. Like superinstructions these only exist in memory, the VM rewrites a generic instruction into one of these
+	 * once it has seen the types it is specialized for (see HOSHI_ENABLE_QUICKENING), and rewrites it back if those types change. */
+	HOSHI_OP_ADD_NUM_NUM,
+	HOSHI_OP_SUB_NUM_NUM,
+	HOSHI_OP_MUL_NUM_NUM,
+	HOSHI_OP_DIV_NUM_NUM,
+	HOSHI_OP_EQ_NUM_NUM,
+	HOSHI_OP_NEQ_NUM_NUM,
+	HOSHI_OP_GT_NUM_NUM,
+	HOSHI_OP_LT_NUM_NUM,
+	HOSHI_OP_GTEQ_NUM_NUM,
+	HOSHI_OP_LTEQ_NUM_NUM,
+	HOSHI_OP_ADD_INT_INT,
+	HOSHI_OP_SUB_INT_INT,
+	HOSHI_OP_MUL_INT_INT,
+	HOSHI_OP_EQ_INT_INT,
+	HOSHI_OP_NEQ_INT_INT,
+	HOSHI_OP_GT_INT_INT,
+	HOSHI_OP_LT_INT_INT,
+	HOSHI_OP_GTEQ_INT_INT,
+	HOSHI_OP_LTEQ_INT_INT,
 } hoshi_OpCode;
 
 typedef struct {
+	const hoshi_Allocator *allocator;
 	int count;
 	int capacity;
 	hoshi_Value *values;
@@ -73,7 +124,21 @@ typedef struct {
 	int line;
 } hoshi_LineStart;
 
+/* An instruction decoded from a chunk's `code` by hoshi_decodeChunk. hoshi_runNext runs these instead of the raw bytes,
+ * so it never has to put operands back together or turn jump distances into addresses while running. */
+typedef struct hoshi_Instruction {
+	uint8_t op; /* The hoshi_OpCode. Quickening rewrites this, `code` itself is left alone. */
+	uint16_t index; /* Global or local index, WIDE instructions decode into the instruction they prefix */
+	uint32_t offset; /* Where the instruction starts in `code`, for line numbers and the JIT */
+	union {
+		hoshi_Value *constant; /* CONSTANT and CONSTANT_LONG */
+		struct hoshi_Instruction *target; /* Jumps */
+		uint32_t count; /* ENDSCOPE and CLEARLOCALS, how many locals from `index` on they clear */
+	} as;
+} hoshi_Instruction;
+
 typedef struct {
+	const hoshi_Allocator *allocator; /* What everything the chunk owns is allocated with, which has to outlive it */
 	int count;
 	int capacity;
 	uint8_t *code;
@@ -81,18 +146,43 @@ typedef struct {
 	int lineCount;
 	int lineCapacity;
 	hoshi_LineStart *lines;
+	/* Decoded instructions, NULL until hoshi_decodeChunk runs. There is one more than there are instructions in `code`, a RETURN at the end. */
+	int instructionCount;
+	hoshi_Instruction *instructions;
+	/* Set by hoshi_verifyChunk (verifier.h). Verified chunks run without most runtime checks, as long as the VM has room for `maxStack` more values and `maxScopes` more scopes. */
+	bool verified;
+	int maxStack;
+	int maxScopes;
+#if HOSHI_ENABLE_JIT
+	/* Machine code for this chunk (see jit.h), NULL until the chunk gets hot */
+	struct hoshi_JitCode *jit;
+	/* Backwards jumps taken so far */
+	uint32_t hotness;
+#endif
 } hoshi_Chunk;
 
 static const char hoshi_magicNumber[7] = { 0x7f, 'H', 'O', 'S', 'H', 'I', 0x7f };
 
-void hoshi_initValueArray(hoshi_ValueArray *va);
+void hoshi_initValueArray(hoshi_ValueArray *va, const hoshi_Allocator *allocator);
 void hoshi_freeValueArray(hoshi_ValueArray *va);
 void hoshi_writeValueArray(hoshi_ValueArray *va, hoshi_Value value);
-void hoshi_initChunk(hoshi_Chunk *chunk);
+/* Sets up an empty chunk that allocates with `allocator`, which is usually the VM's (`&vm->allocator`) or hoshi_defaultAllocator. */
+void hoshi_initChunk(hoshi_Chunk *chunk, const hoshi_Allocator *allocator);
 void hoshi_freeChunk(hoshi_Chunk *chunk);
 void hoshi_writeChunk(hoshi_Chunk *chunk, uint8_t byte, int line);
 void hoshi_writeConstant(hoshi_Chunk *chunk, hoshi_Value value, int line);
 int hoshi_addConstant(hoshi_Chunk *chunk, hoshi_Value value);
 int hoshi_getLine(hoshi_Chunk *chunk, int instruction);
+/* Returns the size of the given instruction in bytes, including its operands. Returns 1 for unknown opcodes.
+ * WIDE's size includes the instruction it prefixes. */
+int hoshi_instructionLength(hoshi_OpCode op);
+/* Turns superinstructions and quickened instructions back into the instruction they started as.
+ * For superinstructions that is the first instruction of their sequence. */
+hoshi_OpCode hoshi_genericOpcode(hoshi_OpCode op);
+/* Returns the offset that the jump at `offset` goes to, or -1 if the instruction there is not a jump. */
+int64_t hoshi_jumpTarget(hoshi_Chunk *chunk, int offset);
+/* Decodes `code` into `instructions`. This has to happen after the last change to `code` (i.e, after hoshi_fuseChunk), hoshi_runChunk does it when needed.
+ * Returns false and prints an error if an instruction is cut off, or refers to a constant or jump target that does not exist. */
+bool hoshi_decodeChunk(hoshi_Chunk *chunk);
 
 #endif
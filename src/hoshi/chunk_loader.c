@@ -11,6 +11,8 @@
 #include "config.h"
 #include "value.h"
 #include "vm.h"
+#include <inttypes.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -24,6 +26,17 @@
 	#define READ_CHUNK_FLAG(len, file) ;
 #endif
 
+/* Reads `length` characters and returns the interned string of them */
+static hoshi_ObjectString *hoshi_readString(hoshi_VM *vm, FILE *file, size_t length)
+{
+	char *chars = HOSHI_ALLOCATE(&vm->allocator, char, length + 1);
+	fread(chars, sizeof(char), length, file);
+	chars[length] = '\0';
+	hoshi_ObjectString *string = hoshi_makeString(vm, chars, length);
+	HOSHI_FREE_ARRAY(&vm->allocator, char, chars, length + 1);
+	return string;
+}
+
 hoshi_Object *hoshi_readObjectFromFile(hoshi_VM *vm, FILE *file)
 {
 	/* Read object type */
@@ -35,10 +48,7 @@ hoshi_Object *hoshi_readObjectFromFile(hoshi_VM *vm, FILE *file)
 	switch (type) {
 		case HOSHI_OBJTYPE_STRING: {
 			size_t length = binio_readU32(file);
-			char *chars = HOSHI_ALLOCATE(char, length + 1);
-			fread(chars, sizeof(char), length, file);
-			chars[length] = '\0';
-			return (hoshi_Object *)hoshi_makeString(vm, true, chars, length);
+			return (hoshi_Object *)hoshi_readString(vm, file, length);
 		}
 	}
 	fprintf(stderr, "internal error: hoshi_readObjectFromFile got a value of an unknown type: %d", type);
@@ -68,15 +78,21 @@ hoshi_Value hoshi_readValueFromFile(hoshi_VM *vm, FILE *file)
 			hoshi_Object *object = hoshi_readObjectFromFile(vm, file);
 			return HOSHI_OBJECT(object);
 		}
+		case HOSHI_TYPE_INTEGER: {
+			int64_t value = binio_readI64(file);
+			if (!HOSHI_INTEGER_FITS(value)) {
+				fprintf(stderr, "error: integer constant does not fit in this build's integers: %" PRId64 "\n", value);
+				return HOSHI_NIL;
+			}
+			return HOSHI_INTEGER(value);
+		}
 	}
 	fprintf(stderr, "internal error: hoshi_readValueFromFile got a value of an unknown type: %d", type);
 	return HOSHI_NIL;
 }
 
-bool hoshi_readChunkFromFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file, hoshi_Version expectedVersion)
+static bool hoshi_readChunk(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file, hoshi_Version expectedVersion)
 {
-	hoshi_initChunk(chunk);
-
 #if HOSHI_ENABLE_CHUNK_READ_DEBUG_INFO
 	#define DBG(format, ...) printf("[CHUNK_READ_DEBUG_INFO] (offset: %06zu bytes) " format , ftell(file) __VA_OPT__(,) __VA_ARGS__)
 #else
@@ -132,14 +148,20 @@ bool hoshi_readChunkFromFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file, hoshi
 	{
 		DBG("Reading constant count\n");
 		READ_CHUNK_FLAG(".consts", file);
-		uint16_t constantCount = binio_readU16(file);
+		uint32_t constantCount = binio_readU32(file);
+		/* CONSTANT_LONG has three bytes for the index */
+		if (constantCount > UINT24_MAX + 1) {
+			fprintf(stderr, "error: failed to read chunk: too many constants (%" PRIu32 ")\n", constantCount);
+			return false;
+		}
 		DBG("Constant count: %d\n", constantCount);
 		/* grow constant pool if needed */
 		if (chunk->constants.capacity < constantCount + 1) {
 			DBG("Growing constant pool\n");
 			int oldCapacity = chunk->constants.capacity;
-			chunk->constants.capacity = constantCount;
-			chunk->constants.values = HOSHI_GROW_ARRAY(hoshi_Value, chunk->constants.values, oldCapacity, chunk->constants.capacity);
+			int capacity = constantCount;
+			chunk->constants.values = HOSHI_GROW_ARRAY(chunk->allocator, hoshi_Value, chunk->constants.values, oldCapacity, capacity);
+			chunk->constants.capacity = capacity;
 		}
 		chunk->constants.count = constantCount;
 #if HOSHI_ENABLE_CHUNK_READ_DEBUG_INFO
@@ -164,21 +186,24 @@ bool hoshi_readChunkFromFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file, hoshi
 	{
 		DBG("Reading global variable names\n");
 		READ_CHUNK_FLAG(".globalVariableNames", file);
-		uint16_t nameCount = binio_readU16(file);
+		uint32_t nameCount = binio_readU32(file);
+		/* WIDE has two bytes for the index */
+		if (nameCount > UINT16_MAX + 1) {
+			fprintf(stderr, "error: failed to read chunk: too many globals (%" PRIu32 ")\n", nameCount);
+			return false;
+		}
 		DBG("Global variable name count: %d\n", nameCount);
 		/* grow pool if needed */
 		if (vm->globalNames.capacity < nameCount + 1) {
 			DBG("Growing constant pool\n");
 			hoshi_tableAdjustCapacity(&vm->globalNames, nameCount);
 		}
-		vm->globalNames.count = nameCount;
 		DBG("Reading global variable names\n");
 		for (size_t i = 0; i < nameCount; i++) {
 			uint32_t length = binio_readU32(file);
-			char *chars = HOSHI_ALLOCATE(char, length);
-			fread(chars, sizeof(char), length, file);
-			hoshi_addGlobal(vm, hoshi_makeString(vm, true, chars, length));
-			DBG("  | Read global variable name %zu: %.*s\n", i, length, chars);
+			hoshi_ObjectString *name = hoshi_readString(vm, file, length);
+			hoshi_addGlobal(vm, name);
+			DBG("  | Read global variable name %zu: %.*s\n", i, name->length, name->chars);
 		}
 	}
 
@@ -186,14 +211,15 @@ bool hoshi_readChunkFromFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file, hoshi
 	{
 		DBG("Reading instruction count\n");
 		READ_CHUNK_FLAG(".code", file);
-		uint16_t instructionCount = binio_readU32(file);
+		uint32_t instructionCount = binio_readU32(file);
 		DBG("Instruction count: %d\n", instructionCount);
 		/* grow instruction array if needed */
 		if (chunk->capacity < instructionCount + 1) {
 			DBG("Growing instruction array\n");
 			int oldCapacity = chunk->capacity;
-			chunk->capacity = instructionCount;
-			chunk->code = HOSHI_GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
+			int capacity = instructionCount;
+			chunk->code = HOSHI_GROW_ARRAY(chunk->allocator, uint8_t, chunk->code, oldCapacity, capacity);
+			chunk->capacity = capacity;
 		}
 		chunk->count = instructionCount;
 		DBG("Reading instructions\n");
@@ -206,20 +232,21 @@ bool hoshi_readChunkFromFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file, hoshi
 	{
 		DBG("Reading line count\n");
 		READ_CHUNK_FLAG(".lines", file);
-		uint16_t lineCount = binio_readU32(file);
+		uint32_t lineCount = binio_readU32(file);
 		DBG("Line count: %d\n", lineCount);
 		/* grow line marker capacity if needed */
 		if (chunk->lineCapacity < lineCount + 1) {
 			DBG("Growing line marker array\n");
 			int oldCapacity = chunk->lineCapacity;
-			chunk->lineCapacity = lineCount;
-			chunk->lines = HOSHI_GROW_ARRAY(hoshi_LineStart, chunk->lines, oldCapacity, chunk->lineCapacity);
+			int capacity = lineCount;
+			chunk->lines = HOSHI_GROW_ARRAY(chunk->allocator, hoshi_LineStart, chunk->lines, oldCapacity, capacity);
+			chunk->lineCapacity = capacity;
 		}
 		chunk->lineCount = lineCount;
 		DBG("Reading line markers\n");
 		for (size_t i = 0; i < lineCount; i++) {
-			chunk->lines[i].offset = binio_readU16(file);
-			chunk->lines[i].line = binio_readU16(file);
+			chunk->lines[i].offset = binio_readU32(file);
+			chunk->lines[i].line = binio_readU32(file);
 			DBG("  | Read line marker %zu: O:%d L:%d\n", i, chunk->lines[i].offset, chunk->lines[i].line);
 		}
 	}
@@ -231,6 +258,23 @@ bool hoshi_readChunkFromFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file, hoshi
 #undef DBG
 }
 
+bool hoshi_readChunkFromFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file, hoshi_Version expectedVersion)
+{
+	hoshi_initChunk(chunk, &vm->allocator);
+
+	/* Sizes come from the file, so a broken one can ask for more memory than there is, which only fails the load */
+	jmp_buf outOfMemory;
+	jmp_buf *outer = hoshi_catchOutOfMemory(&outOfMemory);
+	if (setjmp(outOfMemory) != 0) {
+		hoshi_catchOutOfMemory(outer);
+		fprintf(stderr, "error: failed to read chunk: out of memory\n");
+		return false;
+	}
+	bool success = hoshi_readChunk(vm, chunk, file, expectedVersion);
+	hoshi_catchOutOfMemory(outer);
+	return success;
+}
+
 #undef READ_CHUNK_FLAG
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define __HOSHI_CHUNK_WRITER_C__
 
 #include "chunk.h"
+#include "memory.h"
 #include "object.h"
 #include "common.h"
 #include "config.h"
@@ -28,7 +29,7 @@ void hoshi_writeObjectToFile(hoshi_Object *object, FILE *file)
 		case HOSHI_OBJTYPE_STRING: {
 			hoshi_ObjectString *string = (hoshi_ObjectString *)object;
 			binio_writeU32(string->length, file); /* TODO: LEB128 */
-			fwrite(string->chars, sizeof(char), string->length, file);
+			fwrite(hoshi_stringChars(string), sizeof(char), string->length, file);
 			break;
 		}
 	}
@@ -38,22 +39,25 @@ void hoshi_writeValueToFile(hoshi_Value *value, FILE *file)
 {
 	/* Write the type identifier */
 	WRITE_CHUNK_FLAG("#", file);
-	binio_writeU8(value->type, file);
+	binio_writeU8(HOSHI_VALUE_TYPE(*value), file);
 
 	/* Write data */
 	WRITE_CHUNK_FLAG("=", file);
-	switch (value->type) {
+	switch (HOSHI_VALUE_TYPE(*value)) {
 		case HOSHI_TYPE_NUMBER:
-			binio_writeF64(value->as.number, file);
+			binio_writeF64(HOSHI_AS_NUMBER(*value), file);
 			break;
 		case HOSHI_TYPE_BOOL:
-			binio_writeU8(value->as.boolean, file);
+			binio_writeU8(HOSHI_AS_BOOL(*value), file);
 			break;
 		case HOSHI_TYPE_NIL:
 			/* nop */
 			break;
 		case HOSHI_TYPE_OBJECT:
-			hoshi_writeObjectToFile(value->as.object, file);
+			hoshi_writeObjectToFile(HOSHI_AS_OBJECT(*value), file);
+			break;
+		case HOSHI_TYPE_INTEGER:
+			binio_writeI64(HOSHI_AS_INTEGER(*value), file);
 			break;
 	}
 }
@@ -79,7 +83,7 @@ void hoshi_writeChunkToFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file)
 
 	/* constant pool */
 	WRITE_CHUNK_FLAG(".consts", file);
-	binio_writeU16(chunk->constants.count, file);
+	binio_writeU32(chunk->constants.count, file);
 	DBG("Wrote constant pool count (%d)\n", chunk->constants.count);
 	for (size_t i = 0; i < chunk->constants.count; i++) {
 		DBG("  | Writing constant %zu: ", i);
@@ -94,16 +98,24 @@ void hoshi_writeChunkToFile(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *file)
 
 	/* global variable names */
 	WRITE_CHUNK_FLAG(".globalVariableNames", file);
-	binio_writeU16(vm->globalNames.count, file);
-	DBG("Wrote global variable name count (%d)\n", vm->globalNames.count);
-	for (size_t i = 0; i < vm->globalNames.capacity; i++) {
-		hoshi_ObjectString *name = vm->globalNames.entries[i].key;
-		if (name != NULL) {
-			DBG("  | Writing global variable name %zu: %.*s\n", i, name->length, name->chars);
-			binio_writeU32(name->length, file);
-			fwrite(name->chars, sizeof(char), name->length, file);
+	/* Names are written in index order, since the loader hands out indices in the order it reads names.
+	 * The table maps names to indices, so it is turned around once instead of looking each index up. */
+	int globalCount = vm->globalValues.count;
+	hoshi_ObjectString **names = HOSHI_ALLOCATE(&vm->allocator, hoshi_ObjectString *, (globalCount > 0 ? globalCount : 1));
+	for (int i = 0; i < vm->globalNames.capacity; i++) {
+		if (vm->globalNames.keys[i] != NULL) {
+			names[(int)HOSHI_AS_NUMBER(vm->globalNames.values[i])] = vm->globalNames.keys[i];
 		}
 	}
+	binio_writeU32(globalCount, file);
+	DBG("Wrote global variable name count (%d)\n", globalCount);
+	for (int i = 0; i < globalCount; i++) {
+		hoshi_ObjectString *name = names[i];
+		DBG("  | Writing global variable name %d: %.*s\n", i, name->length, name->chars);
+		binio_writeU32(name->length, file);
+		fwrite(name->chars, sizeof(char), name->length, file);
+	}
+	HOSHI_FREE_ARRAY(&vm->allocator, hoshi_ObjectString *, names, (globalCount > 0 ? globalCount : 1));
 	DBG("Wrote global variable names\n");
 
 	/* instructions */
@@ -3,6 +3,12 @@
 
 #include "common.h"
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/random.h>
+#endif
 
 #if MEMWATCH
 #include "memwatch.h"
@@ -23,4 +29,34 @@ HOSHI_CHECK_FUNC(hoshi_versionOlderThanOrEquals, <=)
 
 #undef HOSHI_CHECK_FUNC
 
+/* SplitMix64, for when the OS has no random bytes to give */
+static uint64_t hoshi_mixBits(uint64_t bits)
+{
+	bits += UINT64_C(0x9e3779b97f4a7c15);
+	bits = (bits ^ (bits >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+	bits = (bits ^ (bits >> 27)) * UINT64_C(0x94d049bb133111eb);
+	return bits ^ (bits >> 31);
+}
+
+void hoshi_randomBytes(void *buffer, size_t size)
+{
+#ifdef __linux__
+	if (getrandom(buffer, size, GRND_NONBLOCK) == (ssize_t)size) {
+		return;
+	}
+#endif
+	static uint64_t counter = 0;
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	uint64_t state = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ (uint64_t)(uintptr_t)buffer ^ (uint64_t)(uintptr_t)&now;
+	state ^= __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED) << 48;
+
+	unsigned char *bytes = buffer;
+	for (size_t i = 0; i < size; i += sizeof(state)) {
+		state = hoshi_mixBits(state);
+		size_t left = size - i;
+		memcpy(bytes + i, &state, left < sizeof(state) ? left : sizeof(state));
+	}
+}
+
 #endif
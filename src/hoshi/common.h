@@ -1,14 +1,18 @@
 #ifndef __HOSHI_COMMON_H__
 #define __HOSHI_COMMON_H__
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #define UINT24_MAX 16777215
 
+/* Size of the keys strings are hashed under */
+#define HOSHI_HASH_KEY_SIZE 16
+
 #define HOSHI_VERSION_MAJOR 1
-#define HOSHI_VERSION_MINOR 0
-#define HOSHI_VERSION_STRING "1.0"
+#define HOSHI_VERSION_MINOR 1
+#define HOSHI_VERSION_STRING "1.1"
 #define HOSHI_VERSION ((hoshi_Version){ HOSHI_VERSION_MAJOR, HOSHI_VERSION_MINOR })
 
 typedef struct {
@@ -23,4 +27,7 @@ bool hoshi_versionOlderThan(hoshi_Version a, hoshi_Version b);
 bool hoshi_versionNewerThanOrEquals(hoshi_Version a, hoshi_Version b);
 bool hoshi_versionOlderThanOrEquals(hoshi_Version a, hoshi_Version b);
 
+/* Fills `buffer` with random bytes from the OS, or, if it has none to give, with bytes mixed from the time and addresses that differ from run to run. */
+void hoshi_randomBytes(void *buffer, size_t size);
+
 #endif
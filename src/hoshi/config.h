@@ -8,14 +8,143 @@
 	#define HOSHI_ENABLE_TRACE_EXECUTION_DEBUGGING 0
 #endif
 
+#ifndef HOSHI_ENABLE_COMPUTED_GOTO
+	/* Set to `1` to dispatch instructions with computed gotos (a GNU C extension) instead of a `switch`.
+	 * Each instruction then ends in its own indirect jump, which branch predictors handle far better than the single shared jump of a `switch`.
+	 * Defaults to `1` on compilers that support it, the `switch` is kept as a portable fallback. */
+	#if defined(__GNUC__)
+		#define HOSHI_ENABLE_COMPUTED_GOTO 1
+	#else
+		#define HOSHI_ENABLE_COMPUTED_GOTO 0
+	#endif
+#endif
+
+#ifndef HOSHI_ENABLE_INSTRUCTION_COUNTING
+	/* Set to `1` to count every executed instruction in `vm->instructionCount`. Used by the benchmarks in `bench/`. */
+	#define HOSHI_ENABLE_INSTRUCTION_COUNTING 0
+#endif
+
+#ifndef HOSHI_ENABLE_SUPERINSTRUCTIONS
+	/* Set to `0` to make hoshi_fuseChunk (fusion.c) a no-op, so loaded chunks run exactly as they were written. */
+	#define HOSHI_ENABLE_SUPERINSTRUCTIONS 1
+#endif
+
+#ifndef HOSHI_ENABLE_QUICKENING
+	/* Set to `0` to stop the VM from rewriting instructions into type-specialized variants (i.e, `ADD` into `ADD_NUM_NUM`) while running.
+	 * This only changes the chunk in memory, compiled files are never quickened. */
+	#define HOSHI_ENABLE_QUICKENING 1
+#endif
+
+#ifndef HOSHI_ENABLE_NAN_BOXING
+	/* Set to `1` to pack values into 8 bytes by hiding everything that is not a number inside of NaNs (see value.h), instead of a 16 byte tagged struct.
+	 * Halves the memory the stack, locals, globals, constants, and hash tables take up, at the cost of a few bit operations per type check.
+	 * Integers then only have 49 bits (HOSHI_INTEGER_MIN to HOSHI_INTEGER_MAX), and anything past that is an overflow error instead of a 64-bit result. */
+	#define HOSHI_ENABLE_NAN_BOXING 0
+#endif
+
+#ifndef HOSHI_ENABLE_JIT
+	/* Set to `1` to compile hot chunks into x86-64 machine code (jit.c). Only works on x86-64 systems with mmap().
+	 * hoshi_runNext is still used for everything the JIT can not handle, so both are always built. */
+	#define HOSHI_ENABLE_JIT 0
+#endif
+
+#ifndef HOSHI_JIT_THRESHOLD
+	/* How many backwards jumps a chunk takes before the JIT compiles it. */
+	#define HOSHI_JIT_THRESHOLD 1000
+#endif
+
+#ifndef HOSHI_SLICE_CLOCK_INTERVAL
+	/* How many instructions hoshi_runSlice runs between looking at the clock, when it was given a deadline. */
+	#define HOSHI_SLICE_CLOCK_INTERVAL 4096
+#endif
+
 #ifndef HOSHI_STACK_SIZE
 	#define HOSHI_STACK_SIZE 256
 #endif
 
 #ifndef HOSHI_LOCALS_SIZE
+	/* Slots for locals, every VM has its own. Up to UINT16_MAX + 1, the slots past 255 are reached through HOSHI_OP_WIDE. */
 	#define HOSHI_LOCALS_SIZE 256
 #endif
 
+#ifndef HOSHI_SSA_MAX_CELLS
+	/* How big the optimizer's SSA form of a chunk may get, in blocks times variables (see ssa.c). Bigger chunks skip the SSA passes. */
+	#define HOSHI_SSA_MAX_CELLS 4194304
+#endif
+
+#ifndef HOSHI_ENABLE_SLABS
+	/* Set to `0` to allocate every object and every string's characters on their own with hoshi_realloc, instead of out of the slab pages
+	 * of the VM they belong to (see memory.h). Either way, all of it is freed with the VM. */
+	#define HOSHI_ENABLE_SLABS 1
+#endif
+
+#ifndef HOSHI_SLAB_PAGE_SIZE
+	/* Size of a slab page, which has to be a power of two. Pages are aligned to their size, so the page a block is in can be found from its address. */
+	#define HOSHI_SLAB_PAGE_SIZE (64 * 1024)
+#endif
+
+#ifndef HOSHI_ENABLE_ROPES
+	/* Set to `0` to have CONCAT copy both strings into a new one, hash it, and intern it right away, instead of making a rope (see object.h).
+	 * Ropes make building a string out of k pieces O(n) instead of O(n * k), since nothing is copied until the characters are needed,
+	 * and nothing is hashed or interned until something needs that either. */
+	#define HOSHI_ENABLE_ROPES 1
+#endif
+
+#ifndef HOSHI_ROPE_MIN_LENGTH
+	/* CONCATs that make shorter strings than this still copy (without interning), which is cheaper for short strings than a rope that has to be flattened later. */
+	#define HOSHI_ROPE_MIN_LENGTH 64
+#endif
+
+#ifndef HOSHI_ENABLE_GC
+	/* Set to `0` to never collect garbage, so every object lives until its VM is freed. Otherwise strings nothing can reach any more
+	 * are freed while the VM runs (see gc.h). */
+	#define HOSHI_ENABLE_GC 1
+#endif
+
+#ifndef HOSHI_GC_GROWTH
+	/* A collection starts once the VM's heap has grown to this many percent of what was live after the last one, `200` lets it double. */
+	#define HOSHI_GC_GROWTH 200
+#endif
+
+#ifndef HOSHI_GC_MIN_HEAP
+	/* Collections never start before the VM's heap is at least this many bytes, so small scripts never collect at all. */
+	#define HOSHI_GC_MIN_HEAP (1024 * 1024)
+#endif
+
+#ifndef HOSHI_GC_STEP_SIZE
+	/* While a collection is going on, the collector takes a step every time the VM has allocated this many bytes. */
+	#define HOSHI_GC_STEP_SIZE (32 * 1024)
+#endif
+
+#ifndef HOSHI_GC_STEP_WORK
+	/* How many objects one step marks or sweeps at most, which is what keeps each pause short.
+	 * A step has to get through more objects than the VM makes between two steps, or collections would never end. */
+	#define HOSHI_GC_STEP_WORK 4096
+#endif
+
+/* The hashes HOSHI_STRING_HASH can pick */
+#define HOSHI_HASH_FNV1A 0
+#define HOSHI_HASH_WORDS 1
+#define HOSHI_HASH_SIPHASH 2
+
+#ifndef HOSHI_STRING_HASH
+	/* How strings are hashed: HOSHI_HASH_FNV1A (a byte at a time, unseeded), HOSHI_HASH_WORDS (8 bytes at a time, seeded with the VM's hash key),
+	 * or HOSHI_HASH_SIPHASH (SipHash-2-4 keyed with the VM's hash key, the slowest but hard to find collisions for even knowing how it works). */
+	#define HOSHI_STRING_HASH HOSHI_HASH_WORDS
+#endif
+
+#ifndef HOSHI_ENABLE_RANDOM_HASH_SEED
+	/* Set to `0` to give every VM the same hash key, so hashes (and the order of tables) are the same on every run. */
+	#define HOSHI_ENABLE_RANDOM_HASH_SEED 1
+#endif
+
+#ifndef HOSHI_TABLE_MAX_PROBE
+	/* A table that has to look through more groups than this to find a free slot switches to hashing its keys with SipHash under a key of its own (see hash_table.h),
+	 * so strings picked to collide under one hash can not keep a table slow. Keys with hashes that do not collide on purpose
+	 * take more than 16 or so groups now and then once a table has a million of them, so this is kept well above that. */
+	#define HOSHI_TABLE_MAX_PROBE 32
+#endif
+
 #ifndef HOSHI_MAX_SCOPE_DEPTH
 	#define HOSHI_MAX_SCOPE_DEPTH 256
 #endif
@@ -80,7 +80,7 @@ static int hoshi_longArgInstruction(const char *name, hoshi_Chunk *chunk, int of
 		(chunk->code[offset + 3] << 16) |
 		(chunk->code[offset + 4] << 24)
 	);
-	printf("%-16s      '%zu'", name, arg);
+	printf("%-16s      '%zu'\n", name, arg);
 	return offset + 5;
 }
 
@@ -90,7 +90,7 @@ static int hoshi_shortArgInstruction(const char *name, hoshi_Chunk *chunk, int o
 		chunk->code[offset + 1] |
 		(chunk->code[offset + 2] << 8)
 	);
-	printf("%-16s      '%d'", name, arg);
+	printf("%-16s      '%d'\n", name, arg);
 	return offset + 3;
 }
 
@@ -100,6 +100,54 @@ static int hoshi_byteArgInstruction(const char *name, hoshi_Chunk *chunk, int of
 	return offset + 2;
 }
 
+/* Shows a WIDE instruction as the instruction it prefixes, with its two byte index */
+static int hoshi_wideInstruction(hoshi_Chunk *chunk, int offset)
+{
+	const char *name;
+	switch (chunk->code[offset + 1]) {
+		case HOSHI_OP_DEFGLOBAL: name = "WIDE DEFGLOBAL"; break;
+		case HOSHI_OP_SETGLOBAL: name = "WIDE SETGLOBAL"; break;
+		case HOSHI_OP_GETGLOBAL: name = "WIDE GETGLOBAL"; break;
+		case HOSHI_OP_DEFLOCAL: name = "WIDE DEFLOCAL"; break;
+		case HOSHI_OP_SETLOCAL: name = "WIDE SETLOCAL"; break;
+		case HOSHI_OP_GETLOCAL: name = "WIDE GETLOCAL"; break;
+		default: name = "WIDE [INVALID]"; break;
+	}
+	uint16_t arg = (
+		chunk->code[offset + 2] |
+		(chunk->code[offset + 3] << 8)
+	);
+	printf("%-16s      '%d'\n", name, arg);
+	return offset + 4;
+}
+
+/* Shows an ENDSCOPE or CLEARLOCALS with the locals it clears */
+static int hoshi_clearInstruction(const char *name, hoshi_Chunk *chunk, int offset)
+{
+	uint16_t first = (
+		chunk->code[offset + 1] |
+		(chunk->code[offset + 2] << 8)
+	);
+	printf("%-16s      '%d' '%d'\n", name, first, chunk->code[offset + 3]);
+	return offset + 4;
+}
+
+static int hoshi_disassembleOp(hoshi_Chunk *chunk, int offset, uint8_t instruction);
+
+static int hoshi_superInstruction(const char *name, hoshi_OpCode first, hoshi_Chunk *chunk, int offset)
+{
+	printf("%s\n", name);
+
+	/* Superinstructions keep the rest of their sequence in place, so we can show what they stand for.
+	 * Only the first opcode was overwritten, which is why it gets passed in. */
+	int end = offset + hoshi_instructionLength(chunk->code[offset]);
+	for (int i = offset; i < end; ) {
+		printf("%04d    > ", i);
+		i = hoshi_disassembleOp(chunk, i, i == offset ? first : chunk->code[i]);
+	}
+	return end;
+}
+
 int hoshi_disassembleInstruction(hoshi_Chunk *chunk, int offset)
 {
 	printf("%04d ", offset);
@@ -111,7 +159,11 @@ int hoshi_disassembleInstruction(hoshi_Chunk *chunk, int offset)
 		printf("%4d ", line);
 	}
 
-	uint8_t instruction = chunk->code[offset];
+	return hoshi_disassembleOp(chunk, offset, chunk->code[offset]);
+}
+
+static int hoshi_disassembleOp(hoshi_Chunk *chunk, int offset, uint8_t instruction)
+{
 	switch (instruction) {
 		/* Stack ops */
 		case HOSHI_OP_PUSH: return hoshi_byteArgInstruction("PUSH", chunk, offset);
@@ -129,7 +181,7 @@ int hoshi_disassembleInstruction(hoshi_Chunk *chunk, int offset)
 		case HOSHI_OP_SETLOCAL: return hoshi_byteArgInstruction("SETLOCAL", chunk, offset);
 		case HOSHI_OP_GETLOCAL: return hoshi_byteArgInstruction("GETLOCAL", chunk, offset);
 		case HOSHI_OP_NEWSCOPE: return hoshi_simpleInstruction("NEWSCOPE", offset);
-		case HOSHI_OP_ENDSCOPE: return hoshi_simpleInstruction("ENDSCOPE", offset);
+		case HOSHI_OP_ENDSCOPE: return hoshi_clearInstruction("ENDSCOPE", chunk, offset);
 		/* Control Flow */
 		case HOSHI_OP_JUMP: return hoshi_shortArgInstruction("JUMP", chunk, offset);
 		case HOSHI_OP_BACK_JUMP: return hoshi_shortArgInstruction("BACK_JUMP", chunk, offset);
@@ -157,10 +209,54 @@ int hoshi_disassembleInstruction(hoshi_Chunk *chunk, int offset)
 		case HOSHI_OP_LTEQ: return hoshi_simpleInstruction("LTEQ", offset);
 		/* String ops */
 		case HOSHI_OP_CONCAT: return hoshi_simpleInstruction("CONCAT", offset);
+		case HOSHI_OP_SCOPED_CONCAT: return hoshi_simpleInstruction("SCOPED_CONCAT", offset);
 		/* Misc */
 		case HOSHI_OP_PRINT: return hoshi_simpleInstruction("PRINT", offset);
 		case HOSHI_OP_RETURN: return hoshi_simpleInstruction("RETURN", offset);
 		case HOSHI_OP_EXIT: return hoshi_simpleInstruction("EXIT", offset);
+		/* Suspension */
+		case HOSHI_OP_YIELD: return hoshi_simpleInstruction("YIELD", offset);
+		case HOSHI_OP_HOSTCALL: return hoshi_byteArgInstruction("HOSTCALL", chunk, offset);
+		/* Modulo and bitwise ops */
+		case HOSHI_OP_MOD: return hoshi_simpleInstruction("MOD", offset);
+		case HOSHI_OP_BAND: return hoshi_simpleInstruction("BAND", offset);
+		case HOSHI_OP_BOR: return hoshi_simpleInstruction("BOR", offset);
+		case HOSHI_OP_BXOR: return hoshi_simpleInstruction("BXOR", offset);
+		case HOSHI_OP_BNOT: return hoshi_simpleInstruction("BNOT", offset);
+		case HOSHI_OP_SHL: return hoshi_simpleInstruction("SHL", offset);
+		case HOSHI_OP_SHR: return hoshi_simpleInstruction("SHR", offset);
+		/* Conversions */
+		case HOSHI_OP_TOINT: return hoshi_simpleInstruction("TOINT", offset);
+		case HOSHI_OP_TONUM: return hoshi_simpleInstruction("TONUM", offset);
+		/* Prefixes */
+		case HOSHI_OP_WIDE: return hoshi_wideInstruction(chunk, offset);
+		case HOSHI_OP_CLEARLOCALS: return hoshi_clearInstruction("CLEARLOCALS", chunk, offset);
+		/* Superinstructions */
+		case HOSHI_OP_GETLOCAL_CONSTANT_ADD_SETLOCAL: return hoshi_superInstruction("GETLOCAL_CONSTANT_ADD_SETLOCAL", HOSHI_OP_GETLOCAL, chunk, offset);
+		case HOSHI_OP_CONSTANT_EQ_GOTO_IF: return hoshi_superInstruction("CONSTANT_EQ_GOTO_IF", HOSHI_OP_CONSTANT, chunk, offset);
+		case HOSHI_OP_CONSTANT_NEQ_GOTO_IF: return hoshi_superInstruction("CONSTANT_NEQ_GOTO_IF", HOSHI_OP_CONSTANT, chunk, offset);
+		case HOSHI_OP_CONSTANT_LT_GOTO_IF: return hoshi_superInstruction("CONSTANT_LT_GOTO_IF", HOSHI_OP_CONSTANT, chunk, offset);
+		case HOSHI_OP_GETLOCAL_GETLOCAL_CONCAT: return hoshi_superInstruction("GETLOCAL_GETLOCAL_CONCAT", HOSHI_OP_GETLOCAL, chunk, offset);
+		/* Quickened instructions */
+		case HOSHI_OP_ADD_NUM_NUM: return hoshi_simpleInstruction("ADD_NUM_NUM", offset);
+		case HOSHI_OP_SUB_NUM_NUM: return hoshi_simpleInstruction("SUB_NUM_NUM", offset);
+		case HOSHI_OP_MUL_NUM_NUM: return hoshi_simpleInstruction("MUL_NUM_NUM", offset);
+		case HOSHI_OP_DIV_NUM_NUM: return hoshi_simpleInstruction("DIV_NUM_NUM", offset);
+		case HOSHI_OP_EQ_NUM_NUM: return hoshi_simpleInstruction("EQ_NUM_NUM", offset);
+		case HOSHI_OP_NEQ_NUM_NUM: return hoshi_simpleInstruction("NEQ_NUM_NUM", offset);
+		case HOSHI_OP_GT_NUM_NUM: return hoshi_simpleInstruction("GT_NUM_NUM", offset);
+		case HOSHI_OP_LT_NUM_NUM: return hoshi_simpleInstruction("LT_NUM_NUM", offset);
+		case HOSHI_OP_GTEQ_NUM_NUM: return hoshi_simpleInstruction("GTEQ_NUM_NUM", offset);
+		case HOSHI_OP_LTEQ_NUM_NUM: return hoshi_simpleInstruction("LTEQ_NUM_NUM", offset);
+		case HOSHI_OP_ADD_INT_INT: return hoshi_simpleInstruction("ADD_INT_INT", offset);
+		case HOSHI_OP_SUB_INT_INT: return hoshi_simpleInstruction("SUB_INT_INT", offset);
+		case HOSHI_OP_MUL_INT_INT: return hoshi_simpleInstruction("MUL_INT_INT", offset);
+		case HOSHI_OP_EQ_INT_INT: return hoshi_simpleInstruction("EQ_INT_INT", offset);
+		case HOSHI_OP_NEQ_INT_INT: return hoshi_simpleInstruction("NEQ_INT_INT", offset);
+		case HOSHI_OP_GT_INT_INT: return hoshi_simpleInstruction("GT_INT_INT", offset);
+		case HOSHI_OP_LT_INT_INT: return hoshi_simpleInstruction("LT_INT_INT", offset);
+		case HOSHI_OP_GTEQ_INT_INT: return hoshi_simpleInstruction("GTEQ_INT_INT", offset);
+		case HOSHI_OP_LTEQ_INT_INT: return hoshi_simpleInstruction("LTEQ_INT_INT", offset);
 		default:
 			printf("Unknown opcode: %d\n", instruction);
 			return offset + 1;
@@ -170,10 +266,10 @@ int hoshi_disassembleInstruction(hoshi_Chunk *chunk, int offset)
 void hoshi_printStack(hoshi_VM *vm)
 {
 	fputs("stack: ", stdout);
-	if (vm->stackTop == vm->stack) {
+	if (vm->stackTop == HOSHI_STACK_BOTTOM(vm)) {
 		puts("empty");
 	} else {
-		for (hoshi_Value *value = vm->stack; value < vm->stackTop; value++) {
+		for (hoshi_Value *value = HOSHI_STACK_BOTTOM(vm); value < vm->stackTop; value++) {
 			fputs("[ ", stdout);
 			hoshi_printValue(*value);
 			fputs(" ]", stdout);
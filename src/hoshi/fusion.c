@@ -0,0 +1,105 @@
+#ifndef __HOSHI_FUSION_C__
+#define __HOSHI_FUSION_C__
+
+#include "fusion.h"
+#include "chunk.h"
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#if MEMWATCH
+#include "memwatch.h"
+#endif
+
+typedef struct {
+	const char *name;
+	hoshi_OpCode superinstruction;
+	int length; /* Amount of opcodes in `sequence` */
+	hoshi_OpCode sequence[4];
+} hoshi_FusionPattern;
+
+/* When two patterns could match at the same offset, the first one in this list wins. */
+static const hoshi_FusionPattern hoshi_fusionPatterns[HOSHI_FUSION_COUNT] = {
+	[HOSHI_FUSION_GETLOCAL_CONSTANT_ADD_SETLOCAL] = {
+		"GETLOCAL CONSTANT ADD SETLOCAL",
+		HOSHI_OP_GETLOCAL_CONSTANT_ADD_SETLOCAL,
+		4, { HOSHI_OP_GETLOCAL, HOSHI_OP_CONSTANT, HOSHI_OP_ADD, HOSHI_OP_SETLOCAL }
+	},
+	[HOSHI_FUSION_CONSTANT_EQ_GOTO_IF] = {
+		"CONSTANT EQ GOTO_IF",
+		HOSHI_OP_CONSTANT_EQ_GOTO_IF,
+		3, { HOSHI_OP_CONSTANT, HOSHI_OP_EQ, HOSHI_OP_GOTO_IF }
+	},
+	[HOSHI_FUSION_CONSTANT_NEQ_GOTO_IF] = {
+		"CONSTANT NEQ GOTO_IF",
+		HOSHI_OP_CONSTANT_NEQ_GOTO_IF,
+		3, { HOSHI_OP_CONSTANT, HOSHI_OP_NEQ, HOSHI_OP_GOTO_IF }
+	},
+	[HOSHI_FUSION_CONSTANT_LT_GOTO_IF] = {
+		"CONSTANT LT GOTO_IF",
+		HOSHI_OP_CONSTANT_LT_GOTO_IF,
+		3, { HOSHI_OP_CONSTANT, HOSHI_OP_LT, HOSHI_OP_GOTO_IF }
+	},
+	[HOSHI_FUSION_GETLOCAL_GETLOCAL_CONCAT] = {
+		"GETLOCAL GETLOCAL CONCAT",
+		HOSHI_OP_GETLOCAL_GETLOCAL_CONCAT,
+		3, { HOSHI_OP_GETLOCAL, HOSHI_OP_GETLOCAL, HOSHI_OP_CONCAT }
+	},
+};
+
+void hoshi_initFusionStats(hoshi_FusionStats *stats)
+{
+	for (int i = 0; i < HOSHI_FUSION_COUNT; i++) {
+		stats->counts[i] = 0;
+	}
+}
+
+#if HOSHI_ENABLE_SUPERINSTRUCTIONS
+/* Checks if `pattern` starts at `offset`. */
+static bool hoshi_fusionMatches(hoshi_Chunk *chunk, int offset, const hoshi_FusionPattern *pattern)
+{
+	for (int i = 0; i < pattern->length; i++) {
+		if (offset >= chunk->count || chunk->code[offset] != pattern->sequence[i]) {
+			return false;
+		}
+		offset += hoshi_instructionLength(chunk->code[offset]);
+	}
+	/* The last instruction's operands must be in the chunk too */
+	return offset <= chunk->count;
+}
+#endif
+
+void hoshi_fuseChunk(hoshi_Chunk *chunk, hoshi_FusionStats *stats)
+{
+#if HOSHI_ENABLE_SUPERINSTRUCTIONS
+	for (int offset = 0; offset < chunk->count; ) {
+		for (int i = 0; i < HOSHI_FUSION_COUNT; i++) {
+			const hoshi_FusionPattern *pattern = &hoshi_fusionPatterns[i];
+			if (hoshi_fusionMatches(chunk, offset, pattern)) {
+				chunk->code[offset] = pattern->superinstruction;
+				if (stats != NULL) {
+					stats->counts[i]++;
+				}
+				break;
+			}
+		}
+
+		/* A superinstruction's length covers its whole sequence, so we never fuse into the middle of one.
+		 * The instructions inside of it are left as they were, so jumps can still land on them. */
+		offset += hoshi_instructionLength(chunk->code[offset]);
+	}
+#else
+	(void)chunk;
+	(void)stats;
+#endif
+}
+
+void hoshi_printFusionStats(hoshi_FusionStats *stats, FILE *file)
+{
+	fputs("-- Fusion Stats --\n", file);
+	for (int i = 0; i < HOSHI_FUSION_COUNT; i++) {
+		fprintf(file, "  %6d  %s\n", stats->counts[i], hoshi_fusionPatterns[i].name);
+	}
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __HOSHI_FUSION_H__
+#define __HOSHI_FUSION_H__
+
+#include "chunk.h"
+#include <stdio.h>
+
+/* Superinstruction fusion.
+ * hoshi_fuseChunk is a peephole pass that looks for common opcode sequences in a loaded chunk and marks them as a single superinstruction,
+ * so the VM dispatches once for the whole sequence instead of once per instruction. */
+
+typedef enum {
+	HOSHI_FUSION_GETLOCAL_CONSTANT_ADD_SETLOCAL,
+	HOSHI_FUSION_CONSTANT_EQ_GOTO_IF,
+	HOSHI_FUSION_CONSTANT_NEQ_GOTO_IF,
+	HOSHI_FUSION_CONSTANT_LT_GOTO_IF,
+	HOSHI_FUSION_GETLOCAL_GETLOCAL_CONCAT,
+	HOSHI_FUSION_COUNT,
+} hoshi_Fusion;
+
+/* How many times each fusion fired. */
+typedef struct {
+	int counts[HOSHI_FUSION_COUNT];
+} hoshi_FusionStats;
+
+void hoshi_initFusionStats(hoshi_FusionStats *stats);
+
+/* Fuses common opcode sequences in the chunk into superinstructions.
+ * This only rewrites the first opcode of each sequence, so offsets, jump targets, and the line table are left untouched.
+ * `stats` may be NULL. Chunks that went through this must not be written to a file. */
+void hoshi_fuseChunk(hoshi_Chunk *chunk, hoshi_FusionStats *stats);
+
+/* Prints which fusions fired and how often. */
+void hoshi_printFusionStats(hoshi_FusionStats *stats, FILE *file);
+
+#endif
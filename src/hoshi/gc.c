@@ -0,0 +1,211 @@
+#ifndef __HOSHI_GC_C__
+#define __HOSHI_GC_C__
+
+#include "gc.h"
+#include "config.h"
+#include "hash_table.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <limits.h>
+#include <stdint.h>
+
+#if MEMWATCH
+#include "memwatch.h"
+#endif
+
+void hoshi_initCollector(hoshi_Collector *gc, const hoshi_Allocator *allocator)
+{
+	gc->allocator = allocator;
+	gc->phase = HOSHI_GC_IDLE;
+	gc->running = false;
+	gc->white = 0;
+	gc->growth = HOSHI_GC_GROWTH;
+	gc->minHeap = HOSHI_GC_MIN_HEAP;
+	gc->stepSize = HOSHI_GC_STEP_SIZE;
+	gc->stepWork = HOSHI_GC_STEP_WORK;
+#if HOSHI_ENABLE_GC
+	gc->stepAt = gc->minHeap;
+#else
+	gc->stepAt = SIZE_MAX;
+#endif
+	gc->gray = NULL;
+	gc->grayCount = 0;
+	gc->grayCapacity = 0;
+	gc->sweep = NULL;
+	gc->live = 0;
+	gc->cycles = 0;
+	gc->steps = 0;
+}
+
+void hoshi_freeCollector(hoshi_Collector *gc)
+{
+	HOSHI_FREE_ARRAY(gc->allocator, hoshi_Object *, gc->gray, gc->grayCapacity);
+	hoshi_initCollector(gc, gc->allocator);
+}
+
+static void hoshi_markObject(hoshi_Collector *gc, hoshi_Object *object)
+{
+	/* Black and pinned objects are never looked at again, which is what keeps collectors from writing to a program's objects */
+	if (object->mark != gc->white) {
+		return;
+	}
+	object->mark = HOSHI_GC_BLACK;
+	/* Ropes are the only objects that point at others. Their pieces are marked in a later step. */
+	if (object->type == HOSHI_OBJTYPE_STRING && ((hoshi_ObjectString *)object)->storage == HOSHI_STRING_ROPE) {
+		if (gc->grayCount + 1 > gc->grayCapacity) {
+			int oldCapacity = gc->grayCapacity;
+			int capacity = HOSHI_GROW_CAPACITY(oldCapacity);
+			gc->gray = HOSHI_GROW_ARRAY(gc->allocator, hoshi_Object *, gc->gray, oldCapacity, capacity);
+			gc->grayCapacity = capacity;
+		}
+		gc->gray[gc->grayCount++] = object;
+	}
+}
+
+static void hoshi_markValue(hoshi_Collector *gc, hoshi_Value value)
+{
+	if (HOSHI_IS_OBJECT(value)) {
+		hoshi_markObject(gc, HOSHI_AS_OBJECT(value));
+	}
+}
+
+static void hoshi_markValues(hoshi_Collector *gc, hoshi_Value *values, int count)
+{
+	for (int i = 0; i < count; i++) {
+		hoshi_markValue(gc, values[i]);
+	}
+}
+
+/* Marks everything the roots hold, all at once, so the roots can change freely while the rest is marked */
+static void hoshi_markRoots(hoshi_VM *vm)
+{
+	hoshi_Collector *gc = &vm->gc;
+	hoshi_markValues(gc, HOSHI_STACK_BOTTOM(vm), (int)(vm->stackTop - HOSHI_STACK_BOTTOM(vm)));
+	hoshi_markValues(gc, vm->locals, HOSHI_LOCALS_SIZE);
+	hoshi_markValues(gc, vm->globalValues.values, vm->globalValues.count);
+	for (int i = 0; i < vm->globalNames.capacity; i++) {
+		if (vm->globalNames.keys[i] != NULL) {
+			hoshi_markObject(gc, &vm->globalNames.keys[i]->object);
+		}
+	}
+	if (vm->chunk != NULL) {
+		hoshi_markValues(gc, vm->chunk->constants.values, vm->chunk->constants.count);
+	}
+	hoshi_markValue(gc, vm->suspendValue);
+	/* Strings in regions are pinned, so nothing ever marks the pieces of a rope in one. The ones the open scopes have are marked here instead. */
+	for (int i = 0; i < vm->scopeDepth; i++) {
+		for (hoshi_Object *object = vm->regions[i]->objects; object != NULL; object = object->next) {
+			hoshi_ObjectString *string = (hoshi_ObjectString *)object;
+			if (string->storage == HOSHI_STRING_ROPE) {
+				hoshi_markObject(gc, &hoshi_ropePieces(string)[0]->object);
+				hoshi_markObject(gc, &hoshi_ropePieces(string)[1]->object);
+			}
+		}
+	}
+}
+
+/* Marks the pieces of up to `*work` gray ropes. Returns true once there are none left. */
+static bool hoshi_markGray(hoshi_Collector *gc, int *work)
+{
+	while (gc->grayCount > 0 && *work > 0) {
+		hoshi_ObjectString *rope = (hoshi_ObjectString *)gc->gray[--gc->grayCount];
+		(*work)--;
+		/* A rope flattened since it was marked does not need its pieces any more */
+		if (rope->storage == HOSHI_STRING_ROPE) {
+			hoshi_markObject(gc, &hoshi_ropePieces(rope)[0]->object);
+			hoshi_markObject(gc, &hoshi_ropePieces(rope)[1]->object);
+		}
+	}
+	return gc->grayCount == 0;
+}
+
+/* Frees up to `*work` of the objects left to sweep that are the old white, and puts the rest back on the tracker's list. Returns true once all are swept. */
+static bool hoshi_sweep(hoshi_VM *vm, int *work)
+{
+	hoshi_Collector *gc = &vm->gc;
+	uint8_t dead = gc->white ^ 1;
+	size_t before = vm->tracker.bytes;
+	while (gc->sweep != NULL && *work > 0) {
+		hoshi_Object *object = gc->sweep;
+		gc->sweep = object->next;
+		(*work)--;
+		if (object->mark == dead) {
+			/* The intern table does not keep its strings alive, it only forgets them */
+			if (object->type == HOSHI_OBJTYPE_STRING && ((hoshi_ObjectString *)object)->interned) {
+				hoshi_tableDelete(&vm->strings, (hoshi_ObjectString *)object);
+			}
+			hoshi_freeObject(object);
+			continue;
+		}
+		if (object->mark == HOSHI_GC_BLACK) {
+			object->mark = gc->white;
+		}
+		object->next = vm->tracker.objects;
+		vm->tracker.objects = object;
+	}
+	gc->live -= before - vm->tracker.bytes;
+	return gc->sweep == NULL;
+}
+
+static void hoshi_step(hoshi_VM *vm, int work)
+{
+	hoshi_Collector *gc = &vm->gc;
+	if (gc->phase == HOSHI_GC_IDLE) {
+		hoshi_markRoots(vm);
+		gc->phase = HOSHI_GC_MARK;
+	}
+	if (gc->phase == HOSHI_GC_MARK && hoshi_markGray(gc, &work)) {
+		/* Whatever is still white now is garbage. Flipping makes that the old white, and objects made from now on the one the next collection starts with. */
+		gc->white ^= 1;
+		gc->live = vm->tracker.bytes;
+		gc->sweep = vm->tracker.objects;
+		vm->tracker.objects = NULL;
+		gc->phase = HOSHI_GC_SWEEP;
+	}
+	if (gc->phase == HOSHI_GC_SWEEP && hoshi_sweep(vm, &work)) {
+		gc->phase = HOSHI_GC_IDLE;
+		gc->cycles++;
+	}
+	gc->steps++;
+
+#if HOSHI_ENABLE_GC
+	size_t bytes = vm->tracker.bytes;
+	if (gc->phase == HOSHI_GC_IDLE) {
+		/* Going by what is allocated now would count what was made while sweeping as live, and let the heap creep up with every collection */
+		size_t next = gc->live / 100 * (size_t)gc->growth;
+		gc->stepAt = next > gc->minHeap ? next : gc->minHeap;
+	} else {
+		gc->stepAt = bytes + gc->stepSize;
+	}
+#endif
+}
+
+void hoshi_collectStep(hoshi_VM *vm)
+{
+	/* Every step has to get somewhere, or a collection would never end */
+	hoshi_step(vm, vm->gc.stepWork > 0 ? vm->gc.stepWork : 1);
+}
+
+void hoshi_finishCollection(hoshi_VM *vm)
+{
+	if (vm->gc.phase != HOSHI_GC_IDLE) {
+		hoshi_step(vm, INT_MAX);
+	}
+}
+
+void hoshi_collectGarbage(hoshi_VM *vm)
+{
+	hoshi_finishCollection(vm);
+	hoshi_step(vm, INT_MAX);
+}
+
+void hoshi_pinObjects(hoshi_ObjectTracker *tracker)
+{
+	for (hoshi_Object *object = tracker->objects; object != NULL; object = object->next) {
+		object->mark = HOSHI_GC_PINNED;
+	}
+}
+
+#endif
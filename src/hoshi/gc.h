@@ -0,0 +1,76 @@
+#ifndef __HOSHI_GC_H__
+#define __HOSHI_GC_H__
+
+#include "config.h"
+#include "memory.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Garbage collection.
+ * The collector is an incremental, precise mark-and-sweep one. Its roots are the VM's stack, locals, global values and names,
+ * the constants of the chunk it runs, `suspendValue`, and the pieces of ropes in the regions of open scopes, whose strings are pinned (see `hoshi_VM.regions`). `vm->strings` is not one of them: a string only it holds is swept and taken out of it.
+ * A collection starts by marking everything the roots hold at once, then each step marks at most `stepWork` of the ropes reached so far,
+ * or sweeps at most `stepWork` objects, and steps are spaced out by `stepSize` bytes of allocation.
+ * Strings never change and ropes only point at strings older than them, so nothing that was unreachable when marking started can be reached again,
+ * except through the intern table, which marks the strings it hands out while a collection is going on (see hoshi_findInternedString).
+ * Objects made while marking are made marked, objects made while sweeping are made with the color the next collection starts with.
+ * Steps only run where everything the VM may still use is in a root (see hoshi_collectIfDue): after CONCAT and after host calls.
+ * Objects made while the VM is not running a chunk, like the constants a compiler or loader makes, are pinned and never freed before the VM is,
+ * since chunks that are not running yet may use them. Host functions must not keep objects of their own across calls, only the VM's roots keep them alive. */
+
+/* What `hoshi_Object.mark` is besides the two whites, 0 and 1. Which white is which flips with every collection (see `hoshi_Collector.white`). */
+#define HOSHI_GC_BLACK 2
+#define HOSHI_GC_PINNED 3
+
+typedef enum {
+	HOSHI_GC_IDLE, /* No collection going on */
+	HOSHI_GC_MARK,
+	HOSHI_GC_SWEEP,
+} hoshi_GCPhase;
+
+typedef struct {
+	const hoshi_Allocator *allocator; /* What `gray` is allocated with */
+	hoshi_GCPhase phase;
+	bool running; /* Whether the VM is running a chunk, objects made while it is not are pinned */
+	uint8_t white; /* The mark of objects marking has not reached yet. Once marking is done it flips, and the other white is garbage. */
+	/* Tuning, set to HOSHI_GC_GROWTH, HOSHI_GC_MIN_HEAP, HOSHI_GC_STEP_SIZE, and HOSHI_GC_STEP_WORK by hoshi_initCollector */
+	int growth;
+	size_t minHeap;
+	size_t stepSize;
+	int stepWork;
+	size_t stepAt; /* The `tracker.bytes` the next step is due at */
+	/* Marked ropes whose pieces have not been marked yet */
+	hoshi_Object **gray;
+	int grayCount;
+	int grayCapacity;
+	hoshi_Object *sweep; /* The objects left to sweep, taken off the tracker's list when sweeping starts. Live ones are put back. */
+	size_t live; /* Bytes that were allocated when sweeping started, less what it has freed since, which the next collection is scheduled by */
+	/* Statistics */
+	uint64_t cycles; /* Collections finished */
+	uint64_t steps;
+} hoshi_Collector;
+
+struct hoshi_VM;
+
+void hoshi_initCollector(hoshi_Collector *gc, const hoshi_Allocator *allocator);
+void hoshi_freeCollector(hoshi_Collector *gc);
+/* Takes the next step of the collection going on, starting one if there is none. */
+void hoshi_collectStep(struct hoshi_VM *vm);
+/* Finishes the collection going on, if there is one. */
+void hoshi_finishCollection(struct hoshi_VM *vm);
+/* Finishes the collection going on and runs a whole new one. Objects the host holds that are not pinned or in a root are freed. */
+void hoshi_collectGarbage(struct hoshi_VM *vm);
+/* Pins every object of a tracker no VM collects, like a program's, so collectors never write to them. */
+void hoshi_pinObjects(hoshi_ObjectTracker *tracker);
+
+/* The mark an object made now gets */
+static inline uint8_t hoshi_gcNewMark(const hoshi_Collector *gc)
+{
+	if (!gc->running) {
+		return HOSHI_GC_PINNED;
+	}
+	return gc->phase == HOSHI_GC_MARK ? HOSHI_GC_BLACK : gc->white;
+}
+
+#endif
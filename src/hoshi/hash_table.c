@@ -5,149 +5,294 @@
 #include "memory.h"
 #include "value.h"
 #include "object.h"
+#include "siphash.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void hoshi_initTable(hoshi_Table *table)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* What goes in the control byte of a slot holding a key with this hash. The rest of the hash picks the group lookups start in. */
+#define HOSHI_TABLE_H2(hash) ((uint8_t)((hash) & 0x7f))
+#define HOSHI_TABLE_H1(hash) ((hash) >> 7)
+
+/* The hash a table files a key's characters under */
+static uint32_t hoshi_keyedHash(hoshi_Table *table, const char *chars, int length)
+{
+	return (uint32_t)siphash24(chars, length, table->key);
+}
+
+/* Tables keep their keys interned, and interned strings are always hashed */
+static inline uint32_t hoshi_keyHash(hoshi_Table *table, hoshi_ObjectString *key)
+{
+	if (table->keyed) {
+		return hoshi_keyedHash(table, hoshi_stringChars(key), key->length);
+	}
+	return key->hash;
+}
+
+/* Returns a bit mask of the slots in the group starting at `control` whose control byte is `byte` */
+static inline uint32_t hoshi_groupMatch(const uint8_t *control, uint8_t byte)
+{
+#if defined(__SSE2__)
+	__m128i group = _mm_loadu_si128((const __m128i *)control);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < HOSHI_TABLE_GROUP_SIZE; i++) {
+		if (control[i] == byte) {
+			mask |= (uint32_t)1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+/* Returns a bit mask of the slots in the group starting at `control` that are empty or deleted, which are the only control bytes with the high bit set */
+static inline uint32_t hoshi_groupMatchFree(const uint8_t *control)
+{
+#if defined(__SSE2__)
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)control));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < HOSHI_TABLE_GROUP_SIZE; i++) {
+		if (control[i] & 0x80) {
+			mask |= (uint32_t)1 << i;
+		}
+	}
+	return mask;
+#endif
+}
+
+static inline int hoshi_lowestBit(uint32_t mask)
 {
+#if defined(__GNUC__)
+	return __builtin_ctz(mask);
+#else
+	int bit = 0;
+	while ((mask & 1) == 0) {
+		mask >>= 1;
+		bit++;
+	}
+	return bit;
+#endif
+}
+
+/* The control bytes, keys, and values of a table share one allocation */
+static size_t hoshi_tableBytes(int capacity)
+{
+	return (size_t)capacity * (sizeof(uint8_t) + sizeof(hoshi_ObjectString *) + sizeof(hoshi_Value));
+}
+
+void hoshi_initTable(hoshi_Table *table, const hoshi_Allocator *allocator)
+{
+	table->allocator = allocator;
 	table->count = 0;
+	table->deleted = 0;
 	table->capacity = 0;
-	table->entries = NULL;
+	table->control = NULL;
+	table->keys = NULL;
+	table->values = NULL;
+	table->keyed = false;
 }
 
 void hoshi_freeTable(hoshi_Table *table)
 {
-	HOSHI_FREE_ARRAY(hoshi_TableEntry, table->entries, table->capacity);
-	hoshi_initTable(table);
+	if (table->control != NULL) {
+		HOSHI_FREE_ARRAY(table->allocator, uint8_t, table->control, hoshi_tableBytes(table->capacity));
+	}
+	hoshi_initTable(table, table->allocator);
 }
 
 void hoshi_printTable(hoshi_Table *table)
 {
 	puts("{");
 	for (int i = 0; i < table->capacity; i++) {
-		hoshi_TableEntry *entry = &table->entries[i];
-		if (entry->key != NULL) {
-			printf("\t [%d] \"%.*s\" = ", i, entry->key->length, entry->key->chars);
-			hoshi_printValue(entry->value);
+		hoshi_ObjectString *key = table->keys[i];
+		if (key != NULL) {
+			printf("\t [%d] \"%.*s\" = ", i, key->length, hoshi_stringChars(key));
+			hoshi_printValue(table->values[i]);
 			puts(",");
 		}
 	}
 	puts("}");
 }
 
-hoshi_TableEntry *hoshi_tableFind(hoshi_TableEntry *entries, int capacity, hoshi_ObjectString *key)
-{
-	uint32_t index = key->hash % capacity;
-	hoshi_TableEntry *tombstone = NULL;
-	for (;;) {
-		hoshi_TableEntry *entry = &entries[index];
-		if (entry->key == NULL) {
-			if (HOSHI_IS_NIL(entry->value)) {
-				/* Empty entry */
-				return tombstone != NULL ? tombstone : entry;
-			} else {
-				/* We found a tombstone */
-				if (tombstone == NULL) {
-					tombstone = entry;
-				}
+/* Groups are probed in triangular steps (1, 2, 3, ... groups further each time), which visits every group once since there is a power of two of them.
+ * There is always an empty slot somewhere, since tables grow before they fill up, so these loops end. */
+
+/* Inlined into every lookup, hoshi_tableFind is the same thing for everyone else */
+static inline int hoshi_tableFindSlot(hoshi_Table *table, hoshi_ObjectString *key)
+{
+	if (table->count == 0) {
+		return -1;
+	}
+
+	uint32_t hash = hoshi_keyHash(table, key);
+	uint8_t h2 = HOSHI_TABLE_H2(hash);
+	uint32_t groupMask = (uint32_t)(table->capacity / HOSHI_TABLE_GROUP_SIZE) - 1;
+	uint32_t group = HOSHI_TABLE_H1(hash) & groupMask;
+	for (uint32_t step = 1;; step++) {
+		const uint8_t *control = table->control + group * HOSHI_TABLE_GROUP_SIZE;
+		for (uint32_t match = hoshi_groupMatch(control, h2); match != 0; match &= match - 1) {
+			int slot = group * HOSHI_TABLE_GROUP_SIZE + hoshi_lowestBit(match);
+			if (table->keys[slot] == key) {
+				return slot;
 			}
-		} else if (entry->key == key) {
-			/* We found the key */
-			return entry;
 		}
-		index = (index + 1) % capacity;
+		/* Keys are only ever put past a group once it has no empty slots left */
+		if (hoshi_groupMatch(control, HOSHI_TABLE_EMPTY) != 0) {
+			return -1;
+		}
+		group = (group + step) & groupMask;
 	}
-	// return NULL;
 }
 
-void hoshi_tableAdjustCapacity(hoshi_Table *table, int capacity)
+int hoshi_tableFind(hoshi_Table *table, hoshi_ObjectString *key)
 {
-	hoshi_TableEntry *entries = HOSHI_ALLOCATE(hoshi_TableEntry, capacity);
+	return hoshi_tableFindSlot(table, key);
+}
+
+/* Returns the first empty or deleted slot on the way a lookup of `hash` goes, which is where a new key with that hash belongs.
+ * `groups` is set to how many groups were looked through to find it. */
+static int hoshi_tableFindFree(hoshi_Table *table, uint32_t hash, uint32_t *groups)
+{
+	uint32_t groupMask = (uint32_t)(table->capacity / HOSHI_TABLE_GROUP_SIZE) - 1;
+	uint32_t group = HOSHI_TABLE_H1(hash) & groupMask;
+	for (uint32_t step = 1;; step++) {
+		uint32_t match = hoshi_groupMatchFree(table->control + group * HOSHI_TABLE_GROUP_SIZE);
+		if (match != 0) {
+			*groups = step;
+			return group * HOSHI_TABLE_GROUP_SIZE + hoshi_lowestBit(match);
+		}
+		group = (group + step) & groupMask;
+	}
+}
+
+/* Moves every key into new arrays of `capacity` slots, which also drops every deleted slot */
+static void hoshi_tableRehash(hoshi_Table *table, int capacity)
+{
+	hoshi_Table rehashed;
+	rehashed.allocator = table->allocator;
+	rehashed.count = 0;
+	rehashed.deleted = 0;
+	rehashed.capacity = capacity;
+	rehashed.control = HOSHI_ALLOCATE(table->allocator, uint8_t, hoshi_tableBytes(capacity));
+	rehashed.keys = (hoshi_ObjectString **)(rehashed.control + capacity);
+	rehashed.values = (hoshi_Value *)(rehashed.keys + capacity);
+	rehashed.keyed = table->keyed;
+	memcpy(rehashed.key, table->key, HOSHI_HASH_KEY_SIZE);
+	memset(rehashed.control, HOSHI_TABLE_EMPTY, capacity);
 	for (int i = 0; i < capacity; i++) {
-		entries[i].key = NULL;
-		entries[i].value = HOSHI_NIL;
+		rehashed.keys[i] = NULL;
 	}
 
-	/* Reinsert old elements */
-	table->count = 0;
 	for (int i = 0; i < table->capacity; i++) {
-		hoshi_TableEntry *entry = &table->entries[i];
-		if (entry->key == NULL) {
+		hoshi_ObjectString *key = table->keys[i];
+		if (key == NULL) {
 			continue;
 		}
-
-		hoshi_TableEntry *dest = hoshi_tableFind(entries, capacity, entry->key);
-		dest->key = entry->key;
-		dest->value = entry->value;
-		table->count++;
+		uint32_t hash = hoshi_keyHash(&rehashed, key);
+		uint32_t groups;
+		int slot = hoshi_tableFindFree(&rehashed, hash, &groups);
+		rehashed.control[slot] = HOSHI_TABLE_H2(hash);
+		rehashed.keys[slot] = key;
+		rehashed.values[slot] = table->values[i];
+		rehashed.count++;
 	}
 
-	/* Free old entry array */
-	HOSHI_FREE_ARRAY(hoshi_TableEntry, table->entries, table->capacity);
+	hoshi_freeTable(table);
+	*table = rehashed;
+}
 
-	/* Update table */
-	table->entries = entries;
-	table->capacity = capacity;
+void hoshi_tableAdjustCapacity(hoshi_Table *table, int count)
+{
+	int capacity = HOSHI_TABLE_GROUP_SIZE;
+	while (count > capacity * HOSHI_TABLE_MAX_LOAD) {
+		capacity *= 2;
+	}
+	if (capacity > table->capacity) {
+		hoshi_tableRehash(table, capacity);
+	}
 }
 
 bool hoshi_tableSet(hoshi_Table *table, hoshi_ObjectString *key, hoshi_Value value)
 {
-	if (table->count + 1 > table->capacity * HOSHI_TABLE_MAX_LOAD) {
-		int capacity = HOSHI_GROW_CAPACITY(table->capacity);
-		hoshi_tableAdjustCapacity(table, capacity);
+	int slot = hoshi_tableFindSlot(table, key);
+	if (slot != -1) {
+		table->values[slot] = value;
+		return false;
+	}
+
+	if (table->count + table->deleted + 1 > table->capacity * HOSHI_TABLE_MAX_LOAD) {
+		/* A table that is mostly deleted slots is cleaned up instead of grown */
+		if (table->count + 1 <= table->capacity * HOSHI_TABLE_MAX_LOAD / 2) {
+			hoshi_tableRehash(table, table->capacity);
+		} else {
+			hoshi_tableRehash(table, table->capacity == 0 ? HOSHI_TABLE_GROUP_SIZE : table->capacity * 2);
+		}
 	}
 
-	hoshi_TableEntry *entry = hoshi_tableFind(table->entries, table->capacity, key);
-	bool isNewKey = entry->key == NULL;
-	if (isNewKey && HOSHI_IS_NIL(entry->value)) {
-		table->count++;
+	uint32_t hash = hoshi_keyHash(table, key);
+	uint32_t groups;
+	slot = hoshi_tableFindFree(table, hash, &groups);
+	if (groups > HOSHI_TABLE_MAX_PROBE && !table->keyed) {
+		table->keyed = true;
+		hoshi_makeHashKey(table->key);
+		hoshi_tableRehash(table, table->capacity);
+		hash = hoshi_keyHash(table, key);
+		slot = hoshi_tableFindFree(table, hash, &groups);
 	}
-	entry->key = key;
-	entry->value = value;
-	return isNewKey;
+	if (table->control[slot] == HOSHI_TABLE_DELETED) {
+		table->deleted--;
+	}
+	table->control[slot] = HOSHI_TABLE_H2(hash);
+	table->keys[slot] = key;
+	table->values[slot] = value;
+	table->count++;
+	return true;
 }
 
 bool hoshi_tableGet(hoshi_Table *table, hoshi_ObjectString *key, hoshi_Value *value)
 {
-	if (table->count == 0) {
-		return false;
-	}
-
-	hoshi_TableEntry *entry = hoshi_tableFind(table->entries, table->capacity, key);
-	if (entry->key == NULL) {
+	int slot = hoshi_tableFindSlot(table, key);
+	if (slot == -1) {
 		return false;
 	}
 
-	*value = entry->value;
+	*value = table->values[slot];
 	return true;
 }
 
 bool hoshi_tableDelete(hoshi_Table *table, hoshi_ObjectString *key)
 {
-	if (table->count == 0) {
+	int slot = hoshi_tableFindSlot(table, key);
+	if (slot == -1) {
 		return false;
 	}
 
-	hoshi_TableEntry *entry = hoshi_tableFind(table->entries, table->capacity, key);
-	if (entry->key == NULL) {
-		return false;
+	/* A group with an empty slot left ends every lookup that reaches it, so no key was ever put past it and the slot can be empty again.
+	 * Otherwise lookups have to keep going past it, which is what a deleted slot tells them. */
+	const uint8_t *control = table->control + (slot / HOSHI_TABLE_GROUP_SIZE) * HOSHI_TABLE_GROUP_SIZE;
+	if (hoshi_groupMatch(control, HOSHI_TABLE_EMPTY) != 0) {
+		table->control[slot] = HOSHI_TABLE_EMPTY;
+	} else {
+		table->control[slot] = HOSHI_TABLE_DELETED;
+		table->deleted++;
 	}
-
-	/* Place a tombstone */
-	entry->key = NULL;
-	entry->value = HOSHI_BOOL(true);
-
+	table->keys[slot] = NULL;
+	table->count--;
 	return true;
 }
 
 void hoshi_tableCopyAllFrom(hoshi_Table *from, hoshi_Table *to)
 {
 	for (int i = 0; i < from->capacity; i++) {
-		hoshi_TableEntry *entry = &from->entries[i];
-		if (entry->key != NULL) {
-			hoshi_tableSet(to, entry->key, entry->value);
+		if (from->keys[i] != NULL) {
+			hoshi_tableSet(to, from->keys[i], from->values[i]);
 		}
 	}
 }
@@ -158,20 +303,23 @@ hoshi_ObjectString *hoshi_tableFindString(hoshi_Table *table, const char *chars,
 		return NULL;
 	}
 
-	uint32_t index = hash % table->capacity;
-	for (;;) {
-		hoshi_TableEntry *entry = &table->entries[index];
-		if (entry->key == NULL) {
-			/* stop if we find an empty non-tombstone entry */
-			if (HOSHI_IS_NIL(entry->value)) {
-				return NULL;
+	/* `hash` is the one the string would get, which is not the one a keyed table filed it under */
+	uint32_t probeHash = table->keyed ? hoshi_keyedHash(table, chars, length) : (uint32_t)hash;
+	uint8_t h2 = HOSHI_TABLE_H2(probeHash);
+	uint32_t groupMask = (uint32_t)(table->capacity / HOSHI_TABLE_GROUP_SIZE) - 1;
+	uint32_t group = HOSHI_TABLE_H1(probeHash) & groupMask;
+	for (uint32_t step = 1;; step++) {
+		const uint8_t *control = table->control + group * HOSHI_TABLE_GROUP_SIZE;
+		for (uint32_t match = hoshi_groupMatch(control, h2); match != 0; match &= match - 1) {
+			hoshi_ObjectString *key = table->keys[group * HOSHI_TABLE_GROUP_SIZE + hoshi_lowestBit(match)];
+			if (key->length == length && key->hash == (uint32_t)hash && memcmp(key->chars, chars, length) == 0) {
+				return key;
 			}
-		} else if (entry->key->length == length && entry->key->hash == hash && memcmp(entry->key->chars, chars, length) == 0) {
-			/* found it! */
-			return entry->key;
 		}
-
-		index = (index + 1) % table->capacity;
+		if (hoshi_groupMatch(control, HOSHI_TABLE_EMPTY) != 0) {
+			return NULL;
+		}
+		group = (group + step) & groupMask;
 	}
 }
 
@@ -1,28 +1,45 @@
 #ifndef __HOSHI_HASH_TABLE_H__
 #define __HOSHI_HASH_TABLE_H__
 
+#include "common.h"
+#include "memory.h"
 #include "value.h"
 #include <stdint.h>
 
-#define HOSHI_TABLE_MAX_LOAD 0.75
+/* Tables are Swiss tables: every slot has a control byte, which is HOSHI_TABLE_EMPTY, HOSHI_TABLE_DELETED,
+ * or the low 7 bits of the hash of the key in it. Lookups compare the control bytes of a whole group of slots at once (with SSE2 where there is SSE2),
+ * and only look at the keys whose control byte matched, so the keys and values are kept in their own arrays.
+ * A slot is in use exactly when its key is not NULL, which is what code looping over a table looks at.
+ * Keys are found by the hash their VM gave them (see hoshi_hashString), until putting a key in takes looking through more than HOSHI_TABLE_MAX_PROBE groups.
+ * That only happens when a lot of keys have the same hash, i.e, someone picked them to, so the table then gets a random key of its own and from then on
+ * hashes its keys with SipHash under it. Those hashes are not kept in the strings, which may be shared with other threads. */
 
-typedef struct hoshi_TableEntry {
-	hoshi_ObjectString *key;
-	hoshi_Value value;
-	struct hoshi_TableEntry *next;
-} hoshi_TableEntry;
+#define HOSHI_TABLE_GROUP_SIZE 16
+/* How full a table may get, counting deleted slots, before it grows */
+#define HOSHI_TABLE_MAX_LOAD 0.875
+
+#define HOSHI_TABLE_EMPTY ((uint8_t)0x80)
+#define HOSHI_TABLE_DELETED ((uint8_t)0xfe)
 
 typedef struct {
-	int count;
-	int capacity;
-	hoshi_TableEntry *entries;
+	const hoshi_Allocator *allocator;
+	int count; /* Keys in the table */
+	int deleted; /* Slots marked HOSHI_TABLE_DELETED */
+	int capacity; /* Slots, 0 or a power of two that is at least HOSHI_TABLE_GROUP_SIZE */
+	uint8_t *control; /* The control bytes, `keys` and `values` are in the same allocation */
+	hoshi_ObjectString **keys;
+	hoshi_Value *values;
+	bool keyed; /* Whether keys are hashed with SipHash under `key` instead of by their own hash */
+	char key[HOSHI_HASH_KEY_SIZE];
 } hoshi_Table;
 
-void hoshi_initTable(hoshi_Table *table);
+void hoshi_initTable(hoshi_Table *table, const hoshi_Allocator *allocator);
 void hoshi_freeTable(hoshi_Table *table);
 void hoshi_printTable(hoshi_Table *table);
-hoshi_TableEntry *hoshi_tableFind(hoshi_TableEntry *entries, int capacity, hoshi_ObjectString *key);
-void hoshi_tableAdjustCapacity(hoshi_Table *table, int capacity);
+/* Returns the slot `key` is in, or -1. Keys are compared by pointer, so they have to be interned. */
+int hoshi_tableFind(hoshi_Table *table, hoshi_ObjectString *key);
+/* Makes room for at least `count` keys without growing again. */
+void hoshi_tableAdjustCapacity(hoshi_Table *table, int count);
 bool hoshi_tableSet(hoshi_Table *table, hoshi_ObjectString *key, hoshi_Value value);
 bool hoshi_tableGet(hoshi_Table *table, hoshi_ObjectString *key, hoshi_Value *value);
 bool hoshi_tableDelete(hoshi_Table *table, hoshi_ObjectString *key);
@@ -6,6 +6,7 @@
 #include "config.h"
 #include "debug.h"
 #include "memory.h"
+#include "program.h"
 #include "value.h"
 #include "vm.h"
 
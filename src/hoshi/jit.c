@@ -0,0 +1,1025 @@
+#ifndef __HOSHI_JIT_C__
+#define __HOSHI_JIT_C__
+
+/* MAP_ANONYMOUS is not in C11 or older POSIX, so this has to come before anything includes a system header */
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+#include "config.h"
+
+#if HOSHI_ENABLE_JIT
+
+#if !defined(__x86_64__)
+	#error "HOSHI_ENABLE_JIT only supports x86-64"
+#endif
+
+#include "chunk.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if MEMWATCH
+#include "memwatch.h"
+#endif
+
+/* Register usage in machine code:
+ *   rbx - the VM's stack pointer (`vm->stackTop`), so the top of the stack is at [rbx - VALUE_SIZE].
+ *   r12 - the VM.
+ *   rax, rcx, rdx - scratch.
+ *   xmm0, xmm1 - copies of the top two values' payloads, see `cached` in hoshi_JitCompiler.
+ * rbx and r12 are callee-saved, so they survive calls into C helpers. */
+
+/* Templates are written for both value layouts (see HOSHI_ENABLE_NAN_BOXING). NaN-boxed values are their own payload, so AS_OFFSET is 0 for them. */
+#if HOSHI_ENABLE_NAN_BOXING
+	_Static_assert(sizeof(hoshi_Value) == 8, "the JIT's templates expect 8 byte NaN-boxed values");
+	#define AS_OFFSET 0
+	/* The register hoshi_emitCopyValue leaves the payload of the copied value in */
+	#define COPY_PAYLOAD RAX
+#else
+	_Static_assert(sizeof(hoshi_Value) == 16, "the JIT's templates expect 16 byte values");
+	#define TYPE_OFFSET ((int)offsetof(hoshi_Value, type))
+	#define AS_OFFSET ((int)offsetof(hoshi_Value, as))
+	#define COPY_PAYLOAD RCX
+#endif
+
+#define VALUE_SIZE ((int)sizeof(hoshi_Value))
+/* Offsets of the top two stack values from rbx */
+#define TOP (-VALUE_SIZE)
+#define BELOW_TOP (-2 * VALUE_SIZE)
+
+#define VM_IP ((int32_t)offsetof(hoshi_VM, ip))
+#define VM_STACK_TOP ((int32_t)offsetof(hoshi_VM, stackTop))
+#define VM_STACK_BOTTOM ((int32_t)(offsetof(hoshi_VM, stack) + sizeof(hoshi_Value)))
+#define VM_GLOBAL_VALUES ((int32_t)offsetof(hoshi_VM, globalValues.values))
+#define VM_LOCAL(index) ((int32_t)(offsetof(hoshi_VM, locals) + sizeof(hoshi_Value) * (index)))
+
+/* A rel32 that is patched once its target is known. `offset` is a bytecode offset. */
+typedef struct {
+	int at;
+	int offset;
+} hoshi_JitFixup;
+
+typedef struct {
+	int count;
+	int capacity;
+	hoshi_JitFixup *fixups;
+	const hoshi_Allocator *allocator;
+} hoshi_JitFixupArray;
+
+typedef struct {
+	hoshi_Chunk *chunk;
+	/* Machine code */
+	int count;
+	int capacity;
+	uint8_t *code;
+	/* Where the shared exit sequence starts */
+	int exit;
+	/* Offset into `code` for each bytecode offset, -1 if no instruction starts there */
+	int *targets;
+	/* Bytecode offsets that are jumped to, from machine code or from the interpreter */
+	bool *labels;
+	/* How many of the top stack values also have their payload in a register, 0 to 2. xmm0 holds the top's, xmm1 the one below it.
+	 * Templates read these instead of the stack, which would otherwise have to wait for the value's store to land.
+	 * Stores to the stack still happen, so nothing has to be written back when leaving machine code. */
+	int cached;
+	/* Jumps to other instructions */
+	hoshi_JitFixupArray jumps;
+	/* Jumps to exits, which hand control back to the interpreter at the instruction in `offset` */
+	hoshi_JitFixupArray exits;
+} hoshi_JitCompiler;
+
+static void hoshi_writeFixup(hoshi_JitFixupArray *array, int at, int offset)
+{
+	if (array->capacity < array->count + 1) {
+		int oldCapacity = array->capacity;
+		array->capacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		array->fixups = HOSHI_GROW_ARRAY(array->allocator, hoshi_JitFixup, array->fixups, oldCapacity, array->capacity);
+	}
+	array->fixups[array->count++] = (hoshi_JitFixup){ at, offset };
+}
+
+/* Emitters */
+
+static void hoshi_emitByte(hoshi_JitCompiler *compiler, uint8_t byte)
+{
+	if (compiler->capacity < compiler->count + 1) {
+		int oldCapacity = compiler->capacity;
+		compiler->capacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		compiler->code = HOSHI_GROW_ARRAY(compiler->chunk->allocator, uint8_t, compiler->code, oldCapacity, compiler->capacity);
+	}
+	compiler->code[compiler->count++] = byte;
+}
+
+static void hoshi_emitBytes(hoshi_JitCompiler *compiler, const uint8_t *bytes, int count)
+{
+	for (int i = 0; i < count; i++) {
+		hoshi_emitByte(compiler, bytes[i]);
+	}
+}
+
+#define EMIT(...) \
+	do { \
+		const uint8_t bytes[] = { __VA_ARGS__ }; \
+		hoshi_emitBytes(compiler, bytes, sizeof(bytes)); \
+	} while (0)
+
+static void hoshi_emitU32(hoshi_JitCompiler *compiler, uint32_t value)
+{
+	for (int i = 0; i < 4; i++) {
+		hoshi_emitByte(compiler, (value >> (i * 8)) & 0xFF);
+	}
+}
+
+static void hoshi_emitU64(hoshi_JitCompiler *compiler, uint64_t value)
+{
+	for (int i = 0; i < 8; i++) {
+		hoshi_emitByte(compiler, (value >> (i * 8)) & 0xFF);
+	}
+}
+
+static void hoshi_patchRel32(hoshi_JitCompiler *compiler, int at, int target)
+{
+	int32_t rel = target - (at + 4);
+	memcpy(&compiler->code[at], &rel, sizeof(rel));
+}
+
+/* jmp rel32 to the instruction at `offset` */
+static void hoshi_emitJump(hoshi_JitCompiler *compiler, int offset)
+{
+	EMIT(0xE9);
+	hoshi_writeFixup(&compiler->jumps, compiler->count, offset);
+	hoshi_emitU32(compiler, 0);
+}
+
+/* jcc rel32 to the instruction at `offset`, `condition` is the low nibble of the opcode (i.e, 0x5 for jne) */
+static void hoshi_emitJumpIf(hoshi_JitCompiler *compiler, uint8_t condition, int offset)
+{
+	EMIT(0x0F, 0x80 | condition);
+	hoshi_writeFixup(&compiler->jumps, compiler->count, offset);
+	hoshi_emitU32(compiler, 0);
+}
+
+/* jcc rel32 to an exit for the instruction at `offset` */
+static void hoshi_emitExitIf(hoshi_JitCompiler *compiler, uint8_t condition, int offset)
+{
+	EMIT(0x0F, 0x80 | condition);
+	hoshi_writeFixup(&compiler->exits, compiler->count, offset);
+	hoshi_emitU32(compiler, 0);
+}
+
+/* jmp rel32 to an exit for the instruction at `offset` */
+static void hoshi_emitExit(hoshi_JitCompiler *compiler, int offset)
+{
+	EMIT(0xE9);
+	hoshi_writeFixup(&compiler->exits, compiler->count, offset);
+	hoshi_emitU32(compiler, 0);
+}
+
+/* jcc rel32 to somewhere later in the same template. Returns where the rel32 is, so hoshi_patchRel32 can point it there once it is known. */
+static int hoshi_emitLocalJumpIf(hoshi_JitCompiler *compiler, uint8_t condition)
+{
+	EMIT(0x0F, 0x80 | condition);
+	int at = compiler->count;
+	hoshi_emitU32(compiler, 0);
+	return at;
+}
+
+/* Same as hoshi_emitLocalJumpIf, but always jumps */
+static int hoshi_emitLocalJump(hoshi_JitCompiler *compiler)
+{
+	EMIT(0xE9);
+	int at = compiler->count;
+	hoshi_emitU32(compiler, 0);
+	return at;
+}
+
+#define CC_O 0x0
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define R12 12
+
+/* mov `reg`, [`base` + `disp`] or, when `store` is set, mov [`base` + `disp`], `reg`. `reg` must be one of rax through rbx. */
+static void hoshi_emitMove(hoshi_JitCompiler *compiler, bool store, int reg, int base, int32_t disp)
+{
+	EMIT(0x48 | (base >= 8), store ? 0x89 : 0x8B, 0x80 | (reg << 3) | (base & 7));
+	if ((base & 7) == 4) {
+		EMIT(0x24); /* SIB for r12 */
+	}
+	hoshi_emitU32(compiler, disp);
+}
+
+/* Checks if the value at [rbx + at] is of `type`, which must be a number, a bool, or an integer.
+ * Returns the condition code that is set when it is not. Clobbers rax and rcx. */
+static uint8_t hoshi_emitTypeCheck(hoshi_JitCompiler *compiler, int8_t at, hoshi_ValueType type)
+{
+#if HOSHI_ENABLE_NAN_BOXING
+	hoshi_emitMove(compiler, false, RAX, RBX, at);
+	if (type == HOSHI_TYPE_NUMBER) {
+		EMIT(0x48, 0xB9);       /* mov rcx, HOSHI_QNAN */
+		hoshi_emitU64(compiler, HOSHI_QNAN);
+		EMIT(0x48, 0x21, 0xC8); /* and rax, rcx */
+		EMIT(0x48, 0x39, 0xC8); /* cmp rax, rcx */
+		return CC_E;
+	} else if (type == HOSHI_TYPE_INTEGER) {
+		EMIT(0x48, 0xB9);       /* mov rcx, HOSHI_SIGN_BIT | HOSHI_QNAN | HOSHI_INTEGER_BIT */
+		hoshi_emitU64(compiler, HOSHI_SIGN_BIT | HOSHI_QNAN | HOSHI_INTEGER_BIT);
+		EMIT(0x48, 0x21, 0xC8); /* and rax, rcx */
+		EMIT(0x48, 0xB9);       /* mov rcx, HOSHI_QNAN | HOSHI_INTEGER_BIT */
+		hoshi_emitU64(compiler, HOSHI_QNAN | HOSHI_INTEGER_BIT);
+		EMIT(0x48, 0x39, 0xC8); /* cmp rax, rcx */
+		return CC_NE;
+	} else {
+		EMIT(0x48, 0x83, 0xC8, 0x01); /* or rax, 1 */
+		EMIT(0x48, 0xB9);             /* mov rcx, HOSHI_TRUE_VALUE */
+		hoshi_emitU64(compiler, HOSHI_TRUE_VALUE);
+		EMIT(0x48, 0x39, 0xC8);       /* cmp rax, rcx */
+		return CC_NE;
+	}
+#else
+	EMIT(0x83, 0x7B, (uint8_t)(at + TYPE_OFFSET), (uint8_t)type); /* cmp dword [rbx + at + type], type */
+	return CC_NE;
+#endif
+}
+
+/* Exits if the value at [rbx + at] is not of `type`, see hoshi_emitTypeCheck */
+static void hoshi_emitTypeGuard(hoshi_JitCompiler *compiler, int8_t at, hoshi_ValueType type, int offset)
+{
+	hoshi_emitExitIf(compiler, hoshi_emitTypeCheck(compiler, at, type), offset);
+}
+
+/* Guards that the top two values are both of `type` */
+static void hoshi_emitBinaryGuard(hoshi_JitCompiler *compiler, hoshi_ValueType type, int offset)
+{
+	hoshi_emitTypeGuard(compiler, TOP, type, offset);
+	hoshi_emitTypeGuard(compiler, BELOW_TOP, type, offset);
+}
+
+/* Copies a value through rax and rcx, leaving its payload in COPY_PAYLOAD.
+ * Tagged values are always moved as two 8 byte halves, since a 16 byte load of a value that was written in halves (or the other way around)
+ * can not be forwarded from the store buffer and stalls for a good while. */
+static void hoshi_emitCopyValue(hoshi_JitCompiler *compiler, int fromBase, int32_t from, int toBase, int32_t to)
+{
+#if HOSHI_ENABLE_NAN_BOXING
+	hoshi_emitMove(compiler, false, RAX, fromBase, from);
+	hoshi_emitMove(compiler, true, RAX, toBase, to);
+#else
+	hoshi_emitMove(compiler, false, RAX, fromBase, from);
+	hoshi_emitMove(compiler, false, RCX, fromBase, from + 8);
+	hoshi_emitMove(compiler, true, RAX, toBase, to);
+	hoshi_emitMove(compiler, true, RCX, toBase, to + 8);
+#endif
+}
+
+/* Copies a value onto the stack and bumps rbx */
+static void hoshi_emitPushValue(hoshi_JitCompiler *compiler, int base, int32_t disp)
+{
+	hoshi_emitCopyValue(compiler, base, disp, RBX, 0);
+	EMIT(0x48, 0x83, 0xC3, VALUE_SIZE); /* add rbx, VALUE_SIZE */
+}
+
+static void hoshi_emitDrop(hoshi_JitCompiler *compiler)
+{
+	EMIT(0x48, 0x83, 0xEB, VALUE_SIZE); /* sub rbx, VALUE_SIZE */
+}
+
+/* Stores al as a bool into the value below the top, then drops the top */
+static void hoshi_emitBoolResult(hoshi_JitCompiler *compiler)
+{
+	EMIT(0x0F, 0xB6, 0xC0); /* movzx eax, al */
+#if HOSHI_ENABLE_NAN_BOXING
+	EMIT(0x48, 0xB9);       /* mov rcx, HOSHI_FALSE_VALUE */
+	hoshi_emitU64(compiler, HOSHI_FALSE_VALUE);
+	EMIT(0x48, 0x09, 0xC8); /* or rax, rcx */
+#else
+	EMIT(0x48, 0xC7, 0x43, (uint8_t)(BELOW_TOP + TYPE_OFFSET)); /* mov qword [rbx - 32], HOSHI_TYPE_BOOL */
+	hoshi_emitU32(compiler, HOSHI_TYPE_BOOL);
+#endif
+	EMIT(0x48, 0x89, 0x43, (uint8_t)(BELOW_TOP + AS_OFFSET)); /* mov [rbx + below top], rax */
+	hoshi_emitDrop(compiler);
+}
+
+/* Records that the value just pushed has its payload in `reg`, moving the cached top into xmm1 */
+static void hoshi_emitCachePush(hoshi_JitCompiler *compiler, int cached, int reg)
+{
+	if (cached > 0) {
+		EMIT(0x66, 0x0F, 0x28, 0xC8);             /* movapd xmm1, xmm0 */
+	}
+	EMIT(0x66, 0x48, 0x0F, 0x6E, 0xC0 | reg); /* movq xmm0, reg */
+	compiler->cached = cached > 0 ? 2 : 1;
+}
+
+/* Loads the top two numbers into xmm1 (below the top) and xmm0 (the top), skipping the ones that are already cached */
+static void hoshi_emitLoadNumbers(hoshi_JitCompiler *compiler, int cached)
+{
+	if (cached < 2) {
+		EMIT(0xF2, 0x0F, 0x10, 0x4B, (uint8_t)(BELOW_TOP + AS_OFFSET)); /* movsd xmm1, [rbx - 24] */
+	}
+	if (cached < 1) {
+		EMIT(0xF2, 0x0F, 0x10, 0x43, (uint8_t)(TOP + AS_OFFSET));       /* movsd xmm0, [rbx - 8] */
+	}
+}
+
+/* Loads the top two integers into rax (below the top) and rcx (the top) */
+static void hoshi_emitLoadIntegers(hoshi_JitCompiler *compiler)
+{
+	hoshi_emitMove(compiler, false, RAX, RBX, BELOW_TOP + AS_OFFSET);
+	hoshi_emitMove(compiler, false, RCX, RBX, TOP + AS_OFFSET);
+#if HOSHI_ENABLE_NAN_BOXING
+	/* Sign-extends the 49 bit integers, see HOSHI_AS_INTEGER */
+	EMIT(0x48, 0xC1, 0xE0, 15); /* shl rax, 15 */
+	EMIT(0x48, 0xC1, 0xF8, 15); /* sar rax, 15 */
+	EMIT(0x48, 0xC1, 0xE1, 15); /* shl rcx, 15 */
+	EMIT(0x48, 0xC1, 0xF9, 15); /* sar rcx, 15 */
+#endif
+}
+
+/* Templates that take numbers or integers start with the integer version of `op`, which is ADD, SUB, MUL, or a comparison,
+ * since integers are what literals without a decimal point become. When either operand is not an integer, it jumps to the number version right after it.
+ * Returns where the integer version's jump over the number version is, so it can be patched once the template is done. Overflows exit, so the interpreter can report them. */
+static int hoshi_emitIntegerPath(hoshi_JitCompiler *compiler, hoshi_OpCode op, int offset)
+{
+	int notIntegers[2];
+	notIntegers[0] = hoshi_emitLocalJumpIf(compiler, hoshi_emitTypeCheck(compiler, TOP, HOSHI_TYPE_INTEGER));
+	notIntegers[1] = hoshi_emitLocalJumpIf(compiler, hoshi_emitTypeCheck(compiler, BELOW_TOP, HOSHI_TYPE_INTEGER));
+	hoshi_emitLoadIntegers(compiler);
+
+	switch (op) {
+		case HOSHI_OP_ADD:
+		case HOSHI_OP_SUB:
+		case HOSHI_OP_MUL:
+			if (op == HOSHI_OP_ADD) {
+				EMIT(0x48, 0x01, 0xC8);       /* add rax, rcx */
+			} else if (op == HOSHI_OP_SUB) {
+				EMIT(0x48, 0x29, 0xC8);       /* sub rax, rcx */
+			} else {
+				EMIT(0x48, 0x0F, 0xAF, 0xC1); /* imul rax, rcx */
+			}
+			hoshi_emitExitIf(compiler, CC_O, offset);
+#if HOSHI_ENABLE_NAN_BOXING
+			/* The result only fits if sign-extending its low 49 bits gives it back */
+			EMIT(0x48, 0x89, 0xC2);       /* mov rdx, rax */
+			EMIT(0x48, 0xC1, 0xE2, 15);   /* shl rdx, 15 */
+			EMIT(0x48, 0xC1, 0xFA, 15);   /* sar rdx, 15 */
+			EMIT(0x48, 0x39, 0xC2);       /* cmp rdx, rax */
+			hoshi_emitExitIf(compiler, CC_NE, offset);
+			EMIT(0x48, 0xB9);             /* mov rcx, HOSHI_INTEGER_MASK */
+			hoshi_emitU64(compiler, HOSHI_INTEGER_MASK);
+			EMIT(0x48, 0x21, 0xC8);       /* and rax, rcx */
+			EMIT(0x48, 0xB9);             /* mov rcx, HOSHI_QNAN | HOSHI_INTEGER_BIT */
+			hoshi_emitU64(compiler, HOSHI_QNAN | HOSHI_INTEGER_BIT);
+			EMIT(0x48, 0x09, 0xC8);       /* or rax, rcx */
+#endif
+			hoshi_emitMove(compiler, true, RAX, RBX, BELOW_TOP + AS_OFFSET);
+			hoshi_emitDrop(compiler);
+			/* Both versions leave the result's payload in xmm0 */
+			EMIT(0x66, 0x48, 0x0F, 0x6E, 0xC0); /* movq xmm0, rax */
+			break;
+		default: {
+			static const uint8_t setcc[] = {
+				[HOSHI_OP_EQ - HOSHI_OP_EQ] = 0x94,
+				[HOSHI_OP_NEQ - HOSHI_OP_EQ] = 0x95,
+				[HOSHI_OP_GT - HOSHI_OP_EQ] = 0x9F,
+				[HOSHI_OP_LT - HOSHI_OP_EQ] = 0x9C,
+				[HOSHI_OP_GTEQ - HOSHI_OP_EQ] = 0x9D,
+				[HOSHI_OP_LTEQ - HOSHI_OP_EQ] = 0x9E,
+			};
+			EMIT(0x48, 0x39, 0xC8);                   /* cmp rax, rcx */
+			EMIT(0x0F, setcc[op - HOSHI_OP_EQ], 0xC0); /* setcc al */
+			hoshi_emitBoolResult(compiler);
+			break;
+		}
+	}
+
+	int done = hoshi_emitLocalJump(compiler);
+	hoshi_patchRel32(compiler, notIntegers[0], compiler->count);
+	hoshi_patchRel32(compiler, notIntegers[1], compiler->count);
+	return done;
+}
+
+/* Calls a C helper with the VM as its first argument. The stack pointer is stored before and reloaded after, since helpers push and pop. */
+static void hoshi_emitCall(hoshi_JitCompiler *compiler, void *function)
+{
+	EMIT(0x49, 0x89, 0x9C, 0x24); /* mov [r12 + stackTop], rbx */
+	hoshi_emitU32(compiler, VM_STACK_TOP);
+	EMIT(0x4C, 0x89, 0xE7);       /* mov rdi, r12 */
+	EMIT(0x48, 0xB8);             /* mov rax, function */
+	hoshi_emitU64(compiler, (uint64_t)(uintptr_t)function);
+	EMIT(0xFF, 0xD0);             /* call rax */
+	EMIT(0x49, 0x8B, 0x9C, 0x24); /* mov rbx, [r12 + stackTop] */
+	hoshi_emitU32(compiler, VM_STACK_TOP);
+}
+
+/* Same as hoshi_emitCall, but exits at `offset` if the helper returns false */
+static void hoshi_emitCheckedCall(hoshi_JitCompiler *compiler, void *function, int offset)
+{
+	hoshi_emitCall(compiler, function);
+	EMIT(0x84, 0xC0); /* test al, al */
+	hoshi_emitExitIf(compiler, CC_E, offset);
+}
+
+/* C helpers. These return false without touching the VM when the interpreter should run the instruction instead. */
+
+static bool hoshi_jitConcat(hoshi_VM *vm)
+{
+	if (!HOSHI_IS_STRING(hoshi_peek(vm, 0)) || !HOSHI_IS_STRING(hoshi_peek(vm, 1))) {
+		return false;
+	}
+	hoshi_ObjectString *b = HOSHI_AS_STRING(hoshi_pop(vm));
+	hoshi_ObjectString *a = HOSHI_AS_STRING(hoshi_pop(vm));
+	hoshi_push(vm, HOSHI_OBJECT(hoshi_concatenate(vm, a, b)));
+	hoshi_collectIfDue(vm);
+	return true;
+}
+
+static bool hoshi_jitScopedConcat(hoshi_VM *vm)
+{
+	if (vm->scopeDepth == 0 || !HOSHI_IS_STRING(hoshi_peek(vm, 0)) || !HOSHI_IS_STRING(hoshi_peek(vm, 1))) {
+		return false;
+	}
+	hoshi_ObjectString *b = HOSHI_AS_STRING(hoshi_pop(vm));
+	hoshi_ObjectString *a = HOSHI_AS_STRING(hoshi_pop(vm));
+	hoshi_push(vm, HOSHI_OBJECT(hoshi_concatenateIn(vm, vm->regions[vm->scopeDepth - 1], a, b)));
+	return true;
+}
+
+static bool hoshi_jitPrint(hoshi_VM *vm)
+{
+	hoshi_printValue(hoshi_pop(vm));
+	return true;
+}
+
+/* Templates */
+
+/* Checks that a jump lands on an instruction */
+static bool hoshi_isJitTarget(hoshi_JitCompiler *compiler, int64_t target)
+{
+	return target >= 0 && target < compiler->chunk->count && compiler->targets[target] != -1;
+}
+
+static void hoshi_emitConditionalJump(hoshi_JitCompiler *compiler, int offset, int64_t target)
+{
+	if (!hoshi_isJitTarget(compiler, target)) {
+		hoshi_emitExit(compiler, offset);
+		return;
+	}
+	hoshi_emitDrop(compiler);
+#if HOSHI_ENABLE_NAN_BOXING
+	EMIT(0x48, 0xB8);       /* mov rax, HOSHI_TRUE_VALUE */
+	hoshi_emitU64(compiler, HOSHI_TRUE_VALUE);
+	EMIT(0x48, 0x39, 0x03); /* cmp [rbx], rax */
+	hoshi_emitJumpIf(compiler, CC_E, (int)target);
+#else
+	EMIT(0x83, 0x7B, TYPE_OFFSET, HOSHI_TYPE_BOOL); /* cmp dword [rbx], HOSHI_TYPE_BOOL */
+	EMIT(0x75, 0x0A);                               /* jne over the next two instructions */
+	EMIT(0x80, 0x7B, AS_OFFSET, 0x00);              /* cmp byte [rbx + 8], 0 */
+	hoshi_emitJumpIf(compiler, CC_NE, (int)target);
+#endif
+}
+
+/* Emits the template for the instruction at `offset`. */
+static void hoshi_emitInstruction(hoshi_JitCompiler *compiler, int offset)
+{
+	uint8_t *operands = &compiler->chunk->code[offset + 1];
+	hoshi_OpCode op = hoshi_genericOpcode(compiler->chunk->code[offset]);
+	int next = offset + hoshi_instructionLength(op);
+
+	/* The constant, global, or local the instruction uses. Wide forms get the same template as the narrow ones.
+	 * Instructions without operands may be the last thing in `code`, so there is nothing after them to read. */
+	int index = next - offset > 1 ? operands[0] : 0;
+	if (op == HOSHI_OP_WIDE) {
+		op = operands[0];
+		index = operands[1] | (operands[2] << 8);
+	} else if (op == HOSHI_OP_CONSTANT_LONG) {
+		op = HOSHI_OP_CONSTANT;
+		index |= (operands[1] << 8) | (operands[2] << 16);
+	}
+
+	/* The registers only hold what the previous template left in them if there is no other way to get here */
+	int cached = compiler->labels[offset] ? 0 : compiler->cached;
+	compiler->cached = 0;
+
+	/* A wide index can point past the locals, that is reported by the interpreter */
+	if ((op == HOSHI_OP_DEFLOCAL || op == HOSHI_OP_SETLOCAL || op == HOSHI_OP_GETLOCAL) && index >= HOSHI_LOCALS_SIZE) {
+		hoshi_emitExit(compiler, offset);
+		return;
+	}
+
+	switch (op) {
+		/* Stack ops */
+		case HOSHI_OP_POP:
+			EMIT(0x49, 0x8D, 0x84, 0x24); /* lea rax, [r12 + stack bottom] */
+			hoshi_emitU32(compiler, VM_STACK_BOTTOM);
+			EMIT(0x48, 0x39, 0xC3);       /* cmp rbx, rax */
+			hoshi_emitExitIf(compiler, CC_BE, offset);
+			hoshi_emitDrop(compiler);
+			break;
+		case HOSHI_OP_CONSTANT:
+		case HOSHI_OP_TRUE:
+		case HOSHI_OP_FALSE:
+		case HOSHI_OP_NIL: {
+			/* Constants never change once a chunk is loaded, so they are baked into the code */
+			hoshi_Value value = op == HOSHI_OP_CONSTANT ? compiler->chunk->constants.values[index] : op == HOSHI_OP_NIL ? HOSHI_NIL : HOSHI_BOOL(op == HOSHI_OP_TRUE);
+#if HOSHI_ENABLE_NAN_BOXING
+			EMIT(0x48, 0xB8);                   /* mov rax, value */
+			hoshi_emitU64(compiler, value);
+			EMIT(0x48, 0x89, 0x03);             /* mov [rbx], rax */
+#else
+			uint64_t as = 0;
+			memcpy(&as, &value.as, sizeof(value.as));
+			EMIT(0x48, 0xC7, 0x03);             /* mov qword [rbx], type */
+			hoshi_emitU32(compiler, value.type);
+			EMIT(0x48, 0xB8);                   /* mov rax, as */
+			hoshi_emitU64(compiler, as);
+			EMIT(0x48, 0x89, 0x43, AS_OFFSET);  /* mov [rbx + 8], rax */
+#endif
+			EMIT(0x48, 0x83, 0xC3, VALUE_SIZE); /* add rbx, VALUE_SIZE */
+			hoshi_emitCachePush(compiler, cached, RAX);
+			break;
+		}
+		/* Globals */
+		case HOSHI_OP_DEFGLOBAL:
+		case HOSHI_OP_SETGLOBAL:
+		case HOSHI_OP_GETGLOBAL: {
+			int32_t global = index * VALUE_SIZE;
+			hoshi_emitMove(compiler, false, RDX, R12, VM_GLOBAL_VALUES);
+			if (op != HOSHI_OP_DEFGLOBAL) {
+				/* Undefined globals are reported by the interpreter */
+#if HOSHI_ENABLE_NAN_BOXING
+				EMIT(0x48, 0xB8);         /* mov rax, HOSHI_NIL */
+				hoshi_emitU64(compiler, HOSHI_NIL);
+				EMIT(0x48, 0x39, 0x82);   /* cmp [rdx + global], rax */
+				hoshi_emitU32(compiler, global);
+#else
+				EMIT(0x83, 0xBA);         /* cmp dword [rdx + global], HOSHI_TYPE_NIL */
+				hoshi_emitU32(compiler, global + TYPE_OFFSET);
+				EMIT(HOSHI_TYPE_NIL);
+#endif
+				hoshi_emitExitIf(compiler, CC_E, offset);
+			}
+			if (op == HOSHI_OP_GETGLOBAL) {
+				hoshi_emitPushValue(compiler, RDX, global);
+				hoshi_emitCachePush(compiler, cached, COPY_PAYLOAD);
+			} else {
+				hoshi_emitCopyValue(compiler, RBX, TOP, RDX, global);
+				if (op == HOSHI_OP_DEFGLOBAL) {
+					hoshi_emitDrop(compiler);
+				}
+			}
+			break;
+		}
+		/* Locals */
+		case HOSHI_OP_DEFLOCAL:
+			/* Locals are plain slots, so this is SETLOCAL then POP */
+			EMIT(0x49, 0x8D, 0x84, 0x24); /* lea rax, [r12 + stack bottom] */
+			hoshi_emitU32(compiler, VM_STACK_BOTTOM);
+			EMIT(0x48, 0x39, 0xC3);       /* cmp rbx, rax */
+			hoshi_emitExitIf(compiler, CC_BE, offset);
+			hoshi_emitCopyValue(compiler, RBX, TOP, R12, VM_LOCAL(index));
+			hoshi_emitDrop(compiler);
+			break;
+		case HOSHI_OP_SETLOCAL:
+			if (cached > 0) {
+#if !HOSHI_ENABLE_NAN_BOXING
+				hoshi_emitMove(compiler, false, RAX, RBX, TOP + TYPE_OFFSET);
+				hoshi_emitMove(compiler, true, RAX, R12, VM_LOCAL(index) + TYPE_OFFSET);
+#endif
+				EMIT(0xF2, 0x41, 0x0F, 0x11, 0x84, 0x24); /* movsd [r12 + local + payload], xmm0 */
+				hoshi_emitU32(compiler, VM_LOCAL(index) + AS_OFFSET);
+			} else {
+				hoshi_emitCopyValue(compiler, RBX, TOP, R12, VM_LOCAL(index));
+			}
+			compiler->cached = cached;
+			break;
+		case HOSHI_OP_GETLOCAL:
+			hoshi_emitPushValue(compiler, R12, VM_LOCAL(index));
+			hoshi_emitCachePush(compiler, cached, COPY_PAYLOAD);
+			break;
+		case HOSHI_OP_NEWSCOPE:
+			hoshi_emitCall(compiler, (void *)&hoshi_pushScope);
+			break;
+		case HOSHI_OP_ENDSCOPE:
+		case HOSHI_OP_CLEARLOCALS: {
+			int first = index | (operands[1] << 8);
+			if (first + operands[2] > HOSHI_LOCALS_SIZE) {
+				hoshi_emitExit(compiler, offset);
+				return;
+			}
+			EMIT(0xBE);                   /* mov esi, first */
+			hoshi_emitU32(compiler, (uint32_t)first);
+			EMIT(0xBA);                   /* mov edx, count */
+			hoshi_emitU32(compiler, operands[2]);
+			hoshi_emitCall(compiler, op == HOSHI_OP_ENDSCOPE ? (void *)&hoshi_popScope : (void *)&hoshi_clearLocals);
+			break;
+		}
+		/* Control flow */
+		case HOSHI_OP_JUMP:
+		case HOSHI_OP_BACK_JUMP:
+		case HOSHI_OP_GOTO: {
+			int64_t target = hoshi_jumpTarget(compiler->chunk, offset);
+			if (hoshi_isJitTarget(compiler, target)) {
+				hoshi_emitJump(compiler, (int)target);
+			} else {
+				hoshi_emitExit(compiler, offset);
+			}
+			break;
+		}
+		case HOSHI_OP_JUMP_IF:
+		case HOSHI_OP_BACK_JUMP_IF:
+		case HOSHI_OP_GOTO_IF:
+			hoshi_emitConditionalJump(compiler, offset, hoshi_jumpTarget(compiler->chunk, offset));
+			break;
+		/* Math */
+		case HOSHI_OP_ADD:
+		case HOSHI_OP_SUB:
+		case HOSHI_OP_MUL:
+		case HOSHI_OP_DIV: {
+			static const uint8_t arithmetic[] = {
+				[HOSHI_OP_ADD - HOSHI_OP_ADD] = 0x58,
+				[HOSHI_OP_SUB - HOSHI_OP_ADD] = 0x5C,
+				[HOSHI_OP_MUL - HOSHI_OP_ADD] = 0x59,
+				[HOSHI_OP_DIV - HOSHI_OP_ADD] = 0x5E,
+			};
+			/* Integer division has to check for zero, that one is left to the interpreter */
+			int done = op == HOSHI_OP_DIV ? -1 : hoshi_emitIntegerPath(compiler, op, offset);
+			hoshi_emitBinaryGuard(compiler, HOSHI_TYPE_NUMBER, offset);
+			hoshi_emitLoadNumbers(compiler, cached);
+			EMIT(0xF2, 0x0F, arithmetic[op - HOSHI_OP_ADD], 0xC8);          /* op xmm1, xmm0 */
+			EMIT(0xF2, 0x0F, 0x11, 0x4B, (uint8_t)(BELOW_TOP + AS_OFFSET)); /* movsd [rbx - 24], xmm1 */
+			EMIT(0x66, 0x0F, 0x28, 0xC1);                                   /* movapd xmm0, xmm1 */
+			hoshi_emitDrop(compiler);
+			if (done != -1) {
+				hoshi_patchRel32(compiler, done, compiler->count);
+			}
+			compiler->cached = 1;
+			break;
+		}
+		case HOSHI_OP_NEGATE:
+			hoshi_emitTypeGuard(compiler, TOP, HOSHI_TYPE_NUMBER, offset);
+			EMIT(0x48, 0x0F, 0xBA, 0x7B, (uint8_t)(TOP + AS_OFFSET), 63); /* btc qword [rbx - 8], 63 */
+			break;
+		/* Boolean ops */
+		case HOSHI_OP_NOT:
+			hoshi_emitTypeGuard(compiler, TOP, HOSHI_TYPE_BOOL, offset);
+			EMIT(0x80, 0x73, (uint8_t)(TOP + AS_OFFSET), 0x01); /* xor byte [rbx - 8], 1 */
+			break;
+		case HOSHI_OP_AND:
+		case HOSHI_OP_OR:
+		case HOSHI_OP_XOR: {
+			uint8_t opcode = op == HOSHI_OP_AND ? 0x20 : op == HOSHI_OP_OR ? 0x08 : 0x30;
+			hoshi_emitBinaryGuard(compiler, HOSHI_TYPE_BOOL, offset);
+			EMIT(0x8A, 0x43, (uint8_t)(TOP + AS_OFFSET));         /* mov al, [rbx - 8] */
+			EMIT(opcode, 0x43, (uint8_t)(BELOW_TOP + AS_OFFSET)); /* and/or/xor [rbx - 24], al */
+#if HOSHI_ENABLE_NAN_BOXING
+			if (op == HOSHI_OP_XOR) {
+				/* true and false only differ in their lowest bit, xor clears the one above it that every bool has */
+				EMIT(0x80, 0x4B, (uint8_t)BELOW_TOP, HOSHI_TAG_FALSE); /* or byte [rbx + below top], HOSHI_TAG_FALSE */
+			}
+#endif
+			hoshi_emitDrop(compiler);
+			break;
+		}
+		/* Comparisons. Only numbers and integers are compiled, anything else is left to the interpreter. */
+		case HOSHI_OP_EQ: {
+			int done = hoshi_emitIntegerPath(compiler, op, offset);
+			hoshi_emitBinaryGuard(compiler, HOSHI_TYPE_NUMBER, offset);
+			hoshi_emitLoadNumbers(compiler, cached);
+			EMIT(0x66, 0x0F, 0x2E, 0xC8); /* ucomisd xmm1, xmm0 */
+			EMIT(0x0F, 0x94, 0xC0);       /* sete al */
+			EMIT(0x0F, 0x9B, 0xC1);       /* setnp cl */
+			EMIT(0x20, 0xC8);             /* and al, cl */
+			hoshi_emitBoolResult(compiler);
+			hoshi_patchRel32(compiler, done, compiler->count);
+			break;
+		}
+		case HOSHI_OP_NEQ: {
+			int done = hoshi_emitIntegerPath(compiler, op, offset);
+			hoshi_emitBinaryGuard(compiler, HOSHI_TYPE_NUMBER, offset);
+			hoshi_emitLoadNumbers(compiler, cached);
+			EMIT(0x66, 0x0F, 0x2E, 0xC8); /* ucomisd xmm1, xmm0 */
+			EMIT(0x0F, 0x95, 0xC0);       /* setne al */
+			EMIT(0x0F, 0x9A, 0xC1);       /* setp cl */
+			EMIT(0x08, 0xC8);             /* or al, cl */
+			hoshi_emitBoolResult(compiler);
+			hoshi_patchRel32(compiler, done, compiler->count);
+			break;
+		}
+		case HOSHI_OP_GT:
+		case HOSHI_OP_GTEQ:
+		case HOSHI_OP_LT:
+		case HOSHI_OP_LTEQ: {
+			/* NaN must compare false, which seta and setae get right as long as the larger side is on the left */
+			int done = hoshi_emitIntegerPath(compiler, op, offset);
+			hoshi_emitBinaryGuard(compiler, HOSHI_TYPE_NUMBER, offset);
+			hoshi_emitLoadNumbers(compiler, cached);
+			if (op == HOSHI_OP_GT || op == HOSHI_OP_GTEQ) {
+				EMIT(0x66, 0x0F, 0x2E, 0xC8); /* ucomisd xmm1, xmm0 */
+			} else {
+				EMIT(0x66, 0x0F, 0x2E, 0xC1); /* ucomisd xmm0, xmm1 */
+			}
+			if (op == HOSHI_OP_GT || op == HOSHI_OP_LT) {
+				EMIT(0x0F, 0x97, 0xC0);       /* seta al */
+			} else {
+				EMIT(0x0F, 0x93, 0xC0);       /* setae al */
+			}
+			hoshi_emitBoolResult(compiler);
+			hoshi_patchRel32(compiler, done, compiler->count);
+			break;
+		}
+		/* String ops */
+		case HOSHI_OP_CONCAT:
+			hoshi_emitCheckedCall(compiler, (void *)&hoshi_jitConcat, offset);
+			break;
+		case HOSHI_OP_SCOPED_CONCAT:
+			hoshi_emitCheckedCall(compiler, (void *)&hoshi_jitScopedConcat, offset);
+			break;
+		/* Misc */
+		case HOSHI_OP_PRINT:
+			hoshi_emitCall(compiler, (void *)&hoshi_jitPrint);
+			break;
+		/* PUSH, CONSTANT_LONG, RETURN, EXIT, YIELD, HOSTCALL, modulo, bitwise ops, conversions, and anything unknown are left to the interpreter */
+		default:
+			hoshi_emitExit(compiler, offset);
+			return;
+	}
+
+	/* Fall through into the next instruction, or hand back to the interpreter if the chunk ends here */
+	if (next >= compiler->chunk->count) {
+		hoshi_emitExit(compiler, next);
+	}
+}
+
+#undef EMIT
+
+static void hoshi_freeJitCompiler(hoshi_JitCompiler *compiler)
+{
+	const hoshi_Allocator *allocator = compiler->chunk->allocator;
+	HOSHI_FREE_ARRAY(allocator, uint8_t, compiler->code, compiler->capacity);
+	HOSHI_FREE_ARRAY(allocator, bool, compiler->labels, compiler->chunk->count > 0 ? compiler->chunk->count : 1);
+	HOSHI_FREE_ARRAY(allocator, hoshi_JitFixup, compiler->jumps.fixups, compiler->jumps.capacity);
+	HOSHI_FREE_ARRAY(allocator, hoshi_JitFixup, compiler->exits.fixups, compiler->exits.capacity);
+}
+
+hoshi_JitCode *hoshi_jitCompile(hoshi_Chunk *chunk)
+{
+	hoshi_JitCode *jit = HOSHI_ALLOCATE(chunk->allocator, hoshi_JitCode, 1);
+	jit->allocator = chunk->allocator;
+	jit->entry = NULL;
+	jit->code = NULL;
+	jit->size = 0;
+	jit->count = chunk->count;
+	jit->targets = HOSHI_ALLOCATE(chunk->allocator, int, (chunk->count > 0 ? chunk->count : 1));
+
+	hoshi_JitCompiler compiler = { 0 };
+	compiler.chunk = chunk;
+	compiler.targets = jit->targets;
+	compiler.jumps.allocator = chunk->allocator;
+	compiler.exits.allocator = chunk->allocator;
+	compiler.labels = HOSHI_ALLOCATE(chunk->allocator, bool, (chunk->count > 0 ? chunk->count : 1));
+
+	/* Find where each instruction starts. Superinstructions are compiled as the sequence they stand for, so jumps into them still work. */
+	for (int offset = 0; offset < chunk->count; offset++) {
+		jit->targets[offset] = -1;
+		compiler.labels[offset] = false;
+	}
+	for (int offset = 0; offset < chunk->count; offset += hoshi_instructionLength(hoshi_genericOpcode(chunk->code[offset]))) {
+		jit->targets[offset] = 0;
+	}
+	for (int offset = 0; offset < chunk->count; offset += hoshi_instructionLength(hoshi_genericOpcode(chunk->code[offset]))) {
+		int64_t target = hoshi_jumpTarget(chunk, offset);
+		if (hoshi_isJitTarget(&compiler, target)) {
+			compiler.labels[target] = true;
+		}
+	}
+
+	/* Entry: push rbp; push rbx; push r12; mov r12, rdi; mov rbx, [r12 + stackTop]; jmp rsi */
+	const uint8_t entry[] = { 0x55, 0x53, 0x41, 0x54, 0x49, 0x89, 0xFC, 0x49, 0x8B, 0x9C, 0x24 };
+	hoshi_emitBytes(&compiler, entry, sizeof(entry));
+	hoshi_emitU32(&compiler, VM_STACK_TOP);
+	hoshi_emitByte(&compiler, 0xFF);
+	hoshi_emitByte(&compiler, 0xE6);
+
+	/* Exit, with the instruction to continue at in rax: mov [r12 + ip], rax; mov [r12 + stackTop], rbx; pop r12; pop rbx; pop rbp; ret */
+	compiler.exit = compiler.count;
+	const uint8_t storeIp[] = { 0x49, 0x89, 0x84, 0x24 };
+	hoshi_emitBytes(&compiler, storeIp, sizeof(storeIp));
+	hoshi_emitU32(&compiler, VM_IP);
+	const uint8_t storeStackTop[] = { 0x49, 0x89, 0x9C, 0x24 };
+	hoshi_emitBytes(&compiler, storeStackTop, sizeof(storeStackTop));
+	hoshi_emitU32(&compiler, VM_STACK_TOP);
+	const uint8_t leave[] = { 0x41, 0x5C, 0x5B, 0x5D, 0xC3 };
+	hoshi_emitBytes(&compiler, leave, sizeof(leave));
+
+	/* Instructions */
+	for (int offset = 0; offset < chunk->count; offset += hoshi_instructionLength(hoshi_genericOpcode(chunk->code[offset]))) {
+		jit->targets[offset] = compiler.count;
+		hoshi_emitInstruction(&compiler, offset);
+	}
+
+	/* Exits, each one loads the address of its decoded instruction and jumps to the shared exit */
+	int *indices = HOSHI_ALLOCATE(chunk->allocator, int, (chunk->count + 1));
+	for (int i = 0; i < chunk->instructionCount; i++) {
+		indices[chunk->instructions[i].offset] = i;
+	}
+	for (int i = 0; i < compiler.exits.count; i++) {
+		hoshi_JitFixup *fixup = &compiler.exits.fixups[i];
+		hoshi_patchRel32(&compiler, fixup->at, compiler.count);
+		hoshi_emitByte(&compiler, 0x48); /* mov rax, &instructions[index] */
+		hoshi_emitByte(&compiler, 0xB8);
+		hoshi_emitU64(&compiler, (uint64_t)(uintptr_t)&chunk->instructions[indices[fixup->offset]]);
+		hoshi_emitByte(&compiler, 0xE9); /* jmp exit */
+		hoshi_emitU32(&compiler, 0);
+		hoshi_patchRel32(&compiler, compiler.count - 4, compiler.exit);
+	}
+	HOSHI_FREE_ARRAY(chunk->allocator, int, indices, chunk->count + 1);
+
+	/* Jumps between instructions */
+	for (int i = 0; i < compiler.jumps.count; i++) {
+		hoshi_JitFixup *fixup = &compiler.jumps.fixups[i];
+		hoshi_patchRel32(&compiler, fixup->at, jit->targets[fixup->offset]);
+	}
+
+	/* The interpreter only enters machine code after a jump, and only labels are safe to enter at */
+	for (int offset = 0; offset < chunk->count; offset++) {
+		if (!compiler.labels[offset]) {
+			jit->targets[offset] = -1;
+		}
+	}
+
+	/* Copy into executable memory */
+	void *memory = mmap(NULL, compiler.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		hoshi_freeJitCompiler(&compiler);
+		return jit;
+	}
+	memcpy(memory, compiler.code, compiler.count);
+	if (mprotect(memory, compiler.count, PROT_READ | PROT_EXEC) != 0) {
+		munmap(memory, compiler.count);
+		hoshi_freeJitCompiler(&compiler);
+		return jit;
+	}
+
+	jit->code = memory;
+	jit->size = compiler.count;
+	jit->entry = (hoshi_JitEntry)memory;
+	hoshi_freeJitCompiler(&compiler);
+	return jit;
+}
+
+void hoshi_freeJitCode(hoshi_JitCode *jit)
+{
+	if (jit == NULL) {
+		return;
+	}
+	if (jit->code != NULL) {
+		munmap(jit->code, jit->size);
+	}
+	HOSHI_FREE_ARRAY(jit->allocator, int, jit->targets, jit->count > 0 ? jit->count : 1);
+	HOSHI_FREE(jit->allocator, hoshi_JitCode, jit);
+}
+
+bool hoshi_jitRun(hoshi_VM *vm)
+{
+	hoshi_Chunk *chunk = vm->chunk;
+	if (chunk->jit == NULL) {
+		chunk->jit = hoshi_jitCompile(chunk);
+	}
+
+	hoshi_JitCode *jit = chunk->jit;
+	ptrdiff_t offset = vm->ip->offset;
+	if (jit->entry == NULL || offset < 0 || offset >= jit->count || jit->targets[offset] == -1) {
+		return false;
+	}
+
+	jit->entry(vm, jit->code + jit->targets[offset]);
+	return true;
+}
+
+/* Values from two VMs can not be compared with hoshi_valuesEqual, since each VM interns its own strings. */
+static bool hoshi_jitValuesMatch(hoshi_Value a, hoshi_Value b)
+{
+	if (HOSHI_VALUE_TYPE(a) != HOSHI_VALUE_TYPE(b)) {
+		return false;
+	}
+	switch (HOSHI_VALUE_TYPE(a)) {
+		case HOSHI_TYPE_NUMBER:
+			return HOSHI_AS_NUMBER(a) == HOSHI_AS_NUMBER(b) || (isnan(HOSHI_AS_NUMBER(a)) && isnan(HOSHI_AS_NUMBER(b)));
+		case HOSHI_TYPE_OBJECT:
+			if (HOSHI_IS_STRING(a) && HOSHI_IS_STRING(b)) {
+				hoshi_ObjectString *x = HOSHI_AS_STRING(a);
+				hoshi_ObjectString *y = HOSHI_AS_STRING(b);
+				return x->length == y->length && memcmp(hoshi_stringChars(x), hoshi_stringChars(y), x->length) == 0;
+			}
+			return false;
+		default:
+			return hoshi_valuesEqual(a, b);
+	}
+}
+
+/* hoshi_printValue only prints to stdout, which is where the program's own output goes. */
+static void hoshi_jitPrintValue(hoshi_Value value)
+{
+	switch (HOSHI_VALUE_TYPE(value)) {
+		case HOSHI_TYPE_NUMBER: fprintf(stderr, "%g", HOSHI_AS_NUMBER(value)); break;
+		case HOSHI_TYPE_INTEGER: fprintf(stderr, "%" PRId64, HOSHI_AS_INTEGER(value)); break;
+		case HOSHI_TYPE_BOOL: fputs(HOSHI_AS_BOOL(value) ? "true" : "false", stderr); break;
+		case HOSHI_TYPE_NIL: fputs("nil", stderr); break;
+		case HOSHI_TYPE_OBJECT:
+			if (HOSHI_IS_STRING(value)) {
+				fprintf(stderr, "\"%.*s\"", HOSHI_AS_STRING(value)->length, HOSHI_AS_CSTRING(value));
+			} else {
+				fputs("<object>", stderr);
+			}
+			break;
+	}
+}
+
+static void hoshi_jitPrintMismatch(const char *what, int index, hoshi_Value interpreted, hoshi_Value compiled)
+{
+	fprintf(stderr, "jit-verify: %s[%d] differs: interpreter has ", what, index);
+	hoshi_jitPrintValue(interpreted);
+	fputs(", jit has ", stderr);
+	hoshi_jitPrintValue(compiled);
+	fputs("\n", stderr);
+}
+
+bool hoshi_jitCompareVMs(hoshi_VM *interpreted, hoshi_VM *compiled)
+{
+	bool match = true;
+
+	int interpretedDepth = interpreted->stackTop - HOSHI_STACK_BOTTOM(interpreted);
+	int compiledDepth = compiled->stackTop - HOSHI_STACK_BOTTOM(compiled);
+	if (interpretedDepth != compiledDepth) {
+		fprintf(stderr, "jit-verify: stack depth differs: interpreter has %d, jit has %d\n", interpretedDepth, compiledDepth);
+		match = false;
+	} else {
+		for (int i = 0; i < interpretedDepth; i++) {
+			hoshi_Value a = HOSHI_STACK_BOTTOM(interpreted)[i];
+			hoshi_Value b = HOSHI_STACK_BOTTOM(compiled)[i];
+			if (!hoshi_jitValuesMatch(a, b)) {
+				hoshi_jitPrintMismatch("stack", i, a, b);
+				match = false;
+			}
+		}
+	}
+
+	if (interpreted->globalValues.count != compiled->globalValues.count) {
+		fprintf(stderr, "jit-verify: global count differs: interpreter has %d, jit has %d\n", interpreted->globalValues.count, compiled->globalValues.count);
+		match = false;
+	} else {
+		for (int i = 0; i < interpreted->globalValues.count; i++) {
+			hoshi_Value a = interpreted->globalValues.values[i];
+			hoshi_Value b = compiled->globalValues.values[i];
+			if (!hoshi_jitValuesMatch(a, b)) {
+				hoshi_jitPrintMismatch("global", i, a, b);
+				match = false;
+			}
+		}
+	}
+
+	if (interpreted->exitCode != compiled->exitCode) {
+		fprintf(stderr, "jit-verify: exit code differs: interpreter has %d, jit has %d\n", interpreted->exitCode, compiled->exitCode);
+		match = false;
+	}
+
+	return match;
+}
+
+#undef VALUE_SIZE
+#if !HOSHI_ENABLE_NAN_BOXING
+	#undef TYPE_OFFSET
+#endif
+#undef AS_OFFSET
+#undef COPY_PAYLOAD
+#undef TOP
+#undef BELOW_TOP
+#undef VM_IP
+#undef VM_STACK_TOP
+#undef VM_STACK_BOTTOM
+#undef VM_GLOBAL_VALUES
+#undef VM_LOCAL
+#undef CC_E
+#undef CC_NE
+#undef CC_BE
+#undef RAX
+#undef RCX
+#undef RDX
+#undef RBX
+#undef R12
+
+#endif
+
+#endif
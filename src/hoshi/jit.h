@@ -0,0 +1,44 @@
+#ifndef __HOSHI_JIT_H__
+#define __HOSHI_JIT_H__
+
+#include "chunk.h"
+#include "config.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Baseline JIT.
+ * Once a chunk has taken enough backwards jumps (see HOSHI_JIT_THRESHOLD), the whole chunk is translated into x86-64 machine code, one template per opcode.
+ * The machine code works on the VM's own stack, locals, and globals, so it can hand control back to hoshi_runNext at any instruction.
+ * It does so whenever it meets an instruction it has no template for or a template's type checks fail, and hoshi_runNext then runs that instruction itself. */
+
+#if HOSHI_ENABLE_JIT
+
+/* Machine code is entered with the VM and the address to start at, and returns once it has stored `ip` and `stackTop` back into the VM. */
+typedef void (*hoshi_JitEntry)(hoshi_VM *vm, uint8_t *target);
+
+typedef struct hoshi_JitCode {
+	hoshi_JitEntry entry; /* NULL when the chunk could not be compiled */
+	uint8_t *code; /* mmap'd, executable */
+	size_t size;
+	int count; /* Amount of entries in `targets`, same as the chunk's count */
+	int *targets; /* Offset into `code` for each bytecode offset, or -1 if nothing jumps there */
+	const hoshi_Allocator *allocator; /* The chunk's, which this and `targets` come from */
+} hoshi_JitCode;
+
+/* Compiles the chunk, which must already be decoded (see hoshi_decodeChunk). Never returns NULL, if compiling fails `entry` is NULL and the chunk stays interpreted. */
+hoshi_JitCode *hoshi_jitCompile(hoshi_Chunk *chunk);
+void hoshi_freeJitCode(hoshi_JitCode *jit);
+
+/* Compiles the VM's chunk if needed, then runs machine code from `vm->ip` until it hands control back.
+ * The VM's state must be saved before calling this. Returns false if no machine code ran. */
+bool hoshi_jitRun(hoshi_VM *vm);
+
+/* Compares the stacks and globals of two VMs that ran the same chunk, used to check the JIT against the interpreter.
+ * Each difference is printed to stderr. Returns true when there were none. */
+bool hoshi_jitCompareVMs(hoshi_VM *interpreted, hoshi_VM *compiled);
+
+#endif
+
+#endif
@@ -1,6 +1,10 @@
 #include "chunk.h"
 #include "chunk_loader.h"
 #include "debug.h"
+#include "fusion.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "verifier.h"
 #include "vm.h"
 #include "config.h"
 #include "common.h"
@@ -20,6 +24,14 @@ static const char *help =
 "Options:\n"
 "  -r, --run             Run the provided file.\n"
 "  -d, --disassemble     Disassemble the input file.\n"
+"  -n, --no-optimize     Run the bytecode as it is, without optimizing it first.\n"
+"  -O, --optimizer-stats Print what the optimizer folded and removed before running.\n"
+"  -F, --fusion-stats    Print how many superinstructions were fused before running.\n"
+"  -V, --verify          Print what the bytecode verifier found before running.\n"
+"  -S, --slice=<budget>  Run in slices of roughly <budget> instructions, using hoshi_runSlice.\n"
+#if HOSHI_ENABLE_JIT
+"  -J, --jit-verify      Run the file with the interpreter and again with the JIT, then compare their stacks and globals.\n"
+#endif
 #if HOSHI_ENABLE_NOP_MODE
 "  -N, --nop             A third *secret* mode which does nothing, used for testing purposes.\n"
 #endif
@@ -40,11 +52,22 @@ typedef enum {
 
 static Mode mode = NONE;
 static char *inputFile = "";
+static bool optimize = true;
+static bool printOptimizerStats = false;
+static bool printFusionStats = false;
+static bool printVerifierStats = false;
+static int64_t sliceBudget = 0;
+#if HOSHI_ENABLE_JIT
+static bool jitVerify = false;
+#endif
 
 #if HOSHI_ENABLE_NOP_MODE
 static void nop();
 #endif
 static void runFile(const char *path);
+#if HOSHI_ENABLE_JIT
+static void verifyFile(const char *path);
+#endif
 static void disassembleFile(const char *path);
 
 static void quit(int code)
@@ -57,6 +80,14 @@ int main(int argc, char *argv[])
 	static struct option longOptions[] = {
 		{ "run",         no_argument, NULL, 'r' },
 		{ "disassemble", no_argument, NULL, 'd' },
+		{ "no-optimize", no_argument, NULL, 'n' },
+		{ "optimizer-stats", no_argument, NULL, 'O' },
+		{ "fusion-stats", no_argument, NULL, 'F' },
+		{ "verify",      no_argument, NULL, 'V' },
+		{ "slice",       required_argument, NULL, 'S' },
+#if HOSHI_ENABLE_JIT
+		{ "jit-verify",  no_argument, NULL, 'J' },
+#endif
 #if HOSHI_ENABLE_NOP_MODE
 		{ "nop",         no_argument, NULL, 'N' },
 #endif
@@ -75,9 +106,9 @@ int main(int argc, char *argv[])
 		argc,
 		argv,
 #if HOSHI_ENABLE_NOP_MODE
-		":rdNh",
+		":rdnOFVS:JNh",
 #else
-		":rdH",
+		":rdnOFVS:Jh",
 #endif
 		longOptions,
 		NULL)) != -1) {
@@ -97,6 +128,34 @@ int main(int argc, char *argv[])
 				}
 				mode = DISASSEMBLE;
 				break;
+			/* Config */
+			case 'n':
+				optimize = false;
+				break;
+			case 'O':
+				printOptimizerStats = true;
+				break;
+			case 'F':
+				printFusionStats = true;
+				break;
+			case 'V':
+				printVerifierStats = true;
+				break;
+			case 'S':
+				sliceBudget = atoll(optarg);
+				if (sliceBudget <= 0) {
+					fputs("error: -S needs a budget above 0.\n", stderr);
+					quit(2);
+				}
+				break;
+			case 'J':
+#if HOSHI_ENABLE_JIT
+				jitVerify = true;
+#else
+				fputs("error: -J needs a Hoshi built with HOSHI_ENABLE_JIT.\n", stderr);
+				quit(2);
+#endif
+				break;
 #if HOSHI_ENABLE_NOP_MODE
 			case 'N':
 				if (mode) {
@@ -126,7 +185,7 @@ int main(int argc, char *argv[])
 	/* Get input file */
 	if (optind < argc) {
 		char **arg = &argv[optind];
-		int len = strlen(*arg);
+		int len = strlen(*arg) + 1;
 		inputFile = malloc(sizeof(char) * len);
 		memcpy(inputFile, *arg, len);
 #if HOSHI_ENABLE_NOP_MODE
@@ -143,6 +202,12 @@ int main(int argc, char *argv[])
 			fputs("error: no mode specified. pass --help for usage.\n", stderr);
 			quit(2);
 		case RUN:
+#if HOSHI_ENABLE_JIT
+			if (jitVerify) {
+				verifyFile(inputFile);
+				break;
+			}
+#endif
 			runFile(inputFile);
 			break;
 		case DISASSEMBLE:
@@ -173,7 +238,8 @@ static void handleError(hoshi_VM *vm)
 	quit(vm->exitCode);
 }
 
-static void runFile(const char *path)
+/* Reads a chunk for running it, quits if that fails. */
+static void loadFile(const char *path, hoshi_VM *vm, hoshi_Chunk *chunk)
 {
 	FILE *file = fopen(path, "rb");
 	if (!file) {
@@ -181,6 +247,67 @@ static void runFile(const char *path)
 		quit(1);
 	}
 
+	/* Load chunk */
+	bool readSuccess = hoshi_readChunkFromFile(vm, chunk, file, HOSHI_VERSION);
+	fclose(file);
+	if (!readSuccess) {
+		fputs("error: failed to read chunk (see above error)\n", stderr);
+		quit(1);
+	}
+
+	/* Optimize, this has to happen before fusing */
+	if (optimize) {
+		hoshi_OptimizerStats optimizerStats;
+		hoshi_initOptimizerStats(&optimizerStats);
+		hoshi_optimizeChunk(chunk, &optimizerStats);
+		if (printOptimizerStats) {
+			hoshi_printOptimizerStats(&optimizerStats, stderr);
+		}
+	}
+
+	/* Fuse superinstructions */
+	hoshi_FusionStats stats;
+	hoshi_initFusionStats(&stats);
+	hoshi_fuseChunk(chunk, &stats);
+	if (printFusionStats) {
+		hoshi_printFusionStats(&stats, stderr);
+	}
+
+	/* Verifying here instead of in hoshi_runChunk lets us report problems */
+	if (printVerifierStats) {
+		hoshi_verifyChunk(vm, chunk, stderr);
+		hoshi_printVerifierStats(chunk, stderr);
+	}
+}
+
+/* Runs the chunk, in slices of `sliceBudget` instructions when -S was given.
+ * There is no host here to wait on, so a YIELD gets the value it yielded right back. */
+static hoshi_InterpretResult runChunk(hoshi_VM *vm, hoshi_Chunk *chunk)
+{
+	hoshi_InterpretResult result = hoshi_enterChunk(vm, chunk);
+	if (result != HOSHI_INTERPRET_OK) {
+		return result;
+	}
+
+	int slices = 1;
+	for (;;) {
+		result = sliceBudget == 0 ? hoshi_runNext(vm) : hoshi_runSlice(vm, (hoshi_Budget){ sliceBudget, 0 });
+		if (result == HOSHI_INTERPRET_PAUSED) {
+			slices++;
+		} else if (result == HOSHI_INTERPRET_SUSPENDED) {
+			hoshi_resume(vm, vm->suspendValue);
+		} else {
+			break;
+		}
+	}
+	if (sliceBudget != 0) {
+		fprintf(stderr, "slices: %d\n", slices);
+	}
+	return result;
+}
+
+static void runFile(const char *path)
+{
 	/* Initialize VM */
 	hoshi_VM vm;
 	hoshi_initVM(&vm);
@@ -188,25 +315,59 @@ static void runFile(const char *path)
 
 	/* Load chunk */
 	hoshi_Chunk chunk;
-	hoshi_initChunk(&chunk);
-	bool readSuccess = hoshi_readChunkFromFile(&vm, &chunk, file, HOSHI_VERSION);
-	fclose(file);
-	if (!readSuccess) {
-		fputs("error: failed to read chunk (see above error)\n", stderr);
-		quit(1);
-	}
+	hoshi_initChunk(&chunk, &vm.allocator);
+	loadFile(path, &vm, &chunk);
 
 	/* Run chunk */
-	hoshi_runChunk(&vm, &chunk);
+	hoshi_InterpretResult result = runChunk(&vm, &chunk);
 
 	/* Cleanup */
-	int code = vm.exitCode;
+	int code = result == HOSHI_INTERPRET_COMPILE_ERROR ? 65 : vm.exitCode;
 	hoshi_freeChunk(&chunk);
 	hoshi_freeVM(&vm);
 
 	quit(code);
 }
 
+#if HOSHI_ENABLE_JIT
+static void verifyFile(const char *path)
+{
+	/* Both VMs get their own copy of the chunk, since running a chunk changes it (see HOSHI_ENABLE_QUICKENING).
+	 * Neither has an error handler, so a runtime error is compared like everything else instead of quitting. */
+	hoshi_VM interpreted;
+	hoshi_initVM(&interpreted);
+	interpreted.jit = false;
+	hoshi_Chunk interpretedChunk;
+	hoshi_initChunk(&interpretedChunk, &interpreted.allocator);
+	loadFile(path, &interpreted, &interpretedChunk);
+
+	hoshi_VM compiled;
+	hoshi_initVM(&compiled);
+	compiled.jitThreshold = 0;
+	hoshi_Chunk compiledChunk;
+	hoshi_initChunk(&compiledChunk, &compiled.allocator);
+	loadFile(path, &compiled, &compiledChunk);
+
+	hoshi_InterpretResult interpretedResult = hoshi_runChunk(&interpreted, &interpretedChunk);
+	hoshi_InterpretResult compiledResult = hoshi_runChunk(&compiled, &compiledChunk);
+
+	bool match = hoshi_jitCompareVMs(&interpreted, &compiled);
+	if (interpretedResult != compiledResult) {
+		fprintf(stderr, "jit-verify: result differs: interpreter has %d, jit has %d\n", interpretedResult, compiledResult);
+		match = false;
+	}
+	fputs(match ? "jit-verify: ok\n" : "jit-verify: mismatch\n", stderr);
+
+	/* Cleanup */
+	hoshi_freeChunk(&interpretedChunk);
+	hoshi_freeVM(&interpreted);
+	hoshi_freeChunk(&compiledChunk);
+	hoshi_freeVM(&compiled);
+
+	quit(match ? 0 : 1);
+}
+#endif
+
 static void disassembleFile(const char *path)
 {
 	printf("Disassembling file: %s\n", path);
@@ -226,7 +387,7 @@ static void disassembleFile(const char *path)
 	/* Load chunk */
 	puts("  | Loading");
 	hoshi_Chunk chunk;
-	hoshi_initChunk(&chunk);
+	hoshi_initChunk(&chunk, &vm.allocator);
 	bool readSuccess = hoshi_readChunkFromFile(&vm, &chunk, file, HOSHI_VERSION);
 	fclose(file);
 	if (!readSuccess) {
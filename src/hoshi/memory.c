@@ -3,11 +3,10 @@
 
 #include "memory.h"
 #include "config.h"
-#include <stdlib.h>
-
-#if HOSHI_TRACE_ALLOCATIONS
+#include <setjmp.h>
+#include <stdint.h>
 #include <stdio.h>
-#endif
+#include <stdlib.h>
 
 #if MEMWATCH
 #include "memwatch.h"
@@ -31,6 +30,8 @@
 	#define WHEN_COUNT_OR_TRACE(...) ;
 #endif
 
+/* Counters are shared by every VM in the process, and VMs can run on several threads at once (see program.h).
+ * They are only ever changed with atomic adds, which stay correct without needing a lock. */
 WHEN_COUNT(
 	size_t hoshi_leakedBytes = 0;
 );
@@ -39,12 +40,57 @@ WHEN_TRACE(
 	static size_t hoshi_newAllocations = 0, hoshi_freedAllocations = 0;
 );
 
-void *hoshi_realloc(void *pointer, size_t oldSize, size_t newSize) {
+static void *hoshi_libcAllocate(void *user, size_t size, size_t alignment)
+{
+	(void)user;
+	if (alignment <= HOSHI_DEFAULT_ALIGNMENT) {
+		return malloc(size);
+	}
+	/* aligned_alloc wants a size that is a multiple of the alignment */
+	return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+static void *hoshi_libcReallocate(void *user, void *pointer, size_t oldSize, size_t newSize)
+{
+	(void)user;
+	(void)oldSize;
+	return realloc(pointer, newSize);
+}
+
+static void hoshi_libcFree(void *user, void *pointer, size_t size)
+{
+	(void)user;
+	(void)size;
+	free(pointer);
+}
+
+const hoshi_Allocator hoshi_defaultAllocator = { hoshi_libcAllocate, hoshi_libcReallocate, hoshi_libcFree, NULL };
+
+/* Every thread has its own, since every thread runs its own VMs */
+static _Thread_local jmp_buf *hoshi_outOfMemoryJump = NULL;
+
+jmp_buf *hoshi_catchOutOfMemory(jmp_buf *jump)
+{
+	jmp_buf *previous = hoshi_outOfMemoryJump;
+	hoshi_outOfMemoryJump = jump;
+	return previous;
+}
+
+static void hoshi_outOfMemory(size_t size)
+{
+	if (hoshi_outOfMemoryJump != NULL) {
+		longjmp(*hoshi_outOfMemoryJump, 1);
+	}
+	fprintf(stderr, "hoshi: out of memory allocating %zu bytes\n", size);
+	abort();
+}
+
+void *hoshi_realloc(const hoshi_Allocator *allocator, void *pointer, size_t oldSize, size_t newSize) {
 	WHEN_COUNT(
 		if (newSize > oldSize) {
-			hoshi_leakedBytes += newSize - oldSize;
+			__atomic_fetch_add(&hoshi_leakedBytes, newSize - oldSize, __ATOMIC_RELAXED);
 		} else if (newSize < oldSize) {
-			hoshi_leakedBytes -= oldSize - newSize;
+			__atomic_fetch_sub(&hoshi_leakedBytes, oldSize - newSize, __ATOMIC_RELAXED);
 		}
 	);
 
@@ -69,24 +115,181 @@ void *hoshi_realloc(void *pointer, size_t oldSize, size_t newSize) {
 	);
 
 	if (newSize == 0) {
-		WHEN_TRACE(hoshi_freedAllocations++);
-		free(pointer);
+		WHEN_TRACE(__atomic_fetch_add(&hoshi_freedAllocations, 1, __ATOMIC_RELAXED));
+		if (pointer != NULL) {
+			allocator->free(allocator->user, pointer, oldSize);
+		}
 		return NULL;
 	}
 
 	WHEN_TRACE(
 		if (oldSize == 0) {
-			hoshi_newAllocations++;
+			__atomic_fetch_add(&hoshi_newAllocations, 1, __ATOMIC_RELAXED);
 		}
 	)
 
-	void *result = realloc(pointer, newSize);
+	void *result = pointer == NULL
+		? allocator->allocate(allocator->user, newSize, HOSHI_DEFAULT_ALIGNMENT)
+		: allocator->reallocate(allocator->user, pointer, oldSize, newSize);
 	if (result == NULL) {
-		exit(1); /* TODO: Throw a proper error message. */
+		WHEN_COUNT(__atomic_fetch_sub(&hoshi_leakedBytes, newSize - oldSize, __ATOMIC_RELAXED));
+		hoshi_outOfMemory(newSize);
 	}
 	return result;
 }
 
+const uint8_t hoshi_slabClassOf[HOSHI_SLAB_MAX_SIZE / 16 + 1] = {
+	0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7
+};
+const uint16_t hoshi_slabClassSizes[HOSHI_SLAB_CLASS_COUNT] = { 16, 32, 48, 64, 96, 128, 192, 256 };
+
+#if HOSHI_ENABLE_SLABS
+/* Pages are aligned to their size so hoshi_trackerOf can find them, which hoshi_realloc can not ask for, so they are counted here instead */
+static hoshi_SlabPage *hoshi_allocatePage(const hoshi_Allocator *allocator)
+{
+	hoshi_SlabPage *page = allocator->allocate(allocator->user, HOSHI_SLAB_PAGE_SIZE, HOSHI_SLAB_PAGE_SIZE);
+	if (page == NULL) {
+		hoshi_outOfMemory(HOSHI_SLAB_PAGE_SIZE);
+	}
+	WHEN_COUNT(__atomic_fetch_add(&hoshi_leakedBytes, HOSHI_SLAB_PAGE_SIZE, __ATOMIC_RELAXED));
+	return page;
+}
+
+static void hoshi_freePage(const hoshi_Allocator *allocator, hoshi_SlabPage *page)
+{
+	WHEN_COUNT(__atomic_fetch_sub(&hoshi_leakedBytes, HOSHI_SLAB_PAGE_SIZE, __ATOMIC_RELAXED));
+	allocator->free(allocator->user, page, HOSHI_SLAB_PAGE_SIZE);
+}
+#endif
+
+void hoshi_initTracker(hoshi_ObjectTracker *tracker, const hoshi_Allocator *allocator)
+{
+	tracker->allocator = allocator;
+	tracker->objects = NULL;
+	tracker->bump = NULL;
+	tracker->bumpEnd = NULL;
+	for (int i = 0; i < HOSHI_SLAB_CLASS_COUNT; i++) {
+		tracker->freeLists[i] = NULL;
+	}
+	tracker->pages = NULL;
+	tracker->large = NULL;
+	tracker->bytes = 0;
+}
+
+void hoshi_freeTracker(hoshi_ObjectTracker *tracker)
+{
+	hoshi_LargeBlock *block = tracker->large;
+	while (block != NULL) {
+		hoshi_LargeBlock *next = block->next;
+		hoshi_realloc(tracker->allocator, block, sizeof(hoshi_LargeBlock) + block->size, 0);
+		block = next;
+	}
+#if HOSHI_ENABLE_SLABS
+	hoshi_SlabPage *page = tracker->pages;
+	while (page != NULL) {
+		hoshi_SlabPage *next = page->next;
+		hoshi_freePage(tracker->allocator, page);
+		page = next;
+	}
+#endif
+	hoshi_initTracker(tracker, tracker->allocator);
+}
+
+void hoshi_resetTracker(hoshi_ObjectTracker *tracker)
+{
+	hoshi_LargeBlock *block = tracker->large;
+	while (block != NULL) {
+		hoshi_LargeBlock *next = block->next;
+		hoshi_realloc(tracker->allocator, block, sizeof(hoshi_LargeBlock) + block->size, 0);
+		block = next;
+	}
+	tracker->large = NULL;
+#if HOSHI_ENABLE_SLABS
+	/* The newest page is the one the tracker is bumping through, which is kept and bumped through again from its start */
+	hoshi_SlabPage *kept = tracker->pages;
+	if (kept != NULL) {
+		hoshi_SlabPage *page = kept->next;
+		while (page != NULL) {
+			hoshi_SlabPage *next = page->next;
+			hoshi_freePage(tracker->allocator, page);
+			page = next;
+		}
+		kept->next = NULL;
+		tracker->bump = (char *)kept + ((sizeof(hoshi_SlabPage) + 15) & ~(size_t)15);
+		tracker->bumpEnd = (char *)kept + HOSHI_SLAB_PAGE_SIZE;
+	}
+#endif
+	for (int i = 0; i < HOSHI_SLAB_CLASS_COUNT; i++) {
+		tracker->freeLists[i] = NULL;
+	}
+	tracker->objects = NULL;
+	tracker->bytes = 0;
+}
+
+void hoshi_moveTracker(hoshi_ObjectTracker *to, hoshi_ObjectTracker *from)
+{
+	*to = *from;
+	for (hoshi_SlabPage *page = to->pages; page != NULL; page = page->next) {
+		page->tracker = to;
+	}
+	for (hoshi_LargeBlock *block = to->large; block != NULL; block = block->next) {
+		block->tracker = to;
+	}
+	hoshi_initTracker(from, from->allocator);
+}
+
+void *hoshi_trackerAllocateSlow(hoshi_ObjectTracker *tracker, size_t size)
+{
+#if HOSHI_ENABLE_SLABS
+	if (size <= HOSHI_SLAB_MAX_SIZE) {
+		/* Whatever was left of the last page is too small for this class, and is not used again */
+		hoshi_SlabPage *page = hoshi_allocatePage(tracker->allocator);
+		page->next = tracker->pages;
+		page->tracker = tracker;
+		tracker->pages = page;
+		tracker->bump = (char *)page + ((sizeof(hoshi_SlabPage) + 15) & ~(size_t)15);
+		tracker->bumpEnd = (char *)page + HOSHI_SLAB_PAGE_SIZE;
+		/* hoshi_trackerAllocate already counted the block */
+		void *block = tracker->bump;
+		tracker->bump += hoshi_slabClassSizes[hoshi_slabClassOf[(size + 15) / 16]];
+		return block;
+	}
+#endif
+	hoshi_LargeBlock *block = hoshi_realloc(tracker->allocator, NULL, 0, sizeof(hoshi_LargeBlock) + size);
+	block->next = tracker->large;
+	block->previous = NULL;
+	block->tracker = tracker;
+	block->size = size;
+	if (tracker->large != NULL) {
+		tracker->large->previous = block;
+	}
+	tracker->large = block;
+	return block + 1;
+}
+
+void hoshi_trackerFree(hoshi_ObjectTracker *tracker, void *pointer, size_t size)
+{
+	tracker->bytes -= size;
+#if HOSHI_ENABLE_SLABS
+	if (size <= HOSHI_SLAB_MAX_SIZE) {
+		int sizeClass = hoshi_slabClassOf[(size + 15) / 16];
+		*(void **)pointer = tracker->freeLists[sizeClass];
+		tracker->freeLists[sizeClass] = pointer;
+		return;
+	}
+#endif
+	hoshi_LargeBlock *block = (hoshi_LargeBlock *)pointer - 1;
+	if (block->previous != NULL) {
+		block->previous->next = block->next;
+	} else {
+		tracker->large = block->next;
+	}
+	if (block->next != NULL) {
+		block->next->previous = block->previous;
+	}
+	hoshi_realloc(tracker->allocator, block, sizeof(hoshi_LargeBlock) + size, 0);
+}
+
 #ifdef WHEN_COUNT
 	#undef WHEN_COUNT
 #endif
@@ -1,33 +1,149 @@
 #ifndef __HOSHI_MEMORY_H__
 #define __HOSHI_MEMORY_H__
 
+#include "config.h"
+#include <setjmp.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/* Allocators.
+ * Everything libhoshi allocates goes through a hoshi_Allocator. Every VM has one of its own, and its chunks, tables, value arrays, trackers,
+ * and collector keep a pointer to it, so each VM can allocate out of an arena of its own, be capped, or be counted.
+ * hoshi_defaultAllocator uses libc. */
+typedef struct hoshi_Allocator {
+	/* Returns `size` bytes aligned to `alignment` (a power of two), or NULL if there is no memory left */
+	void *(*allocate)(void *user, size_t size, size_t alignment);
+	/* Resizes a block `allocate` gave out with HOSHI_DEFAULT_ALIGNMENT to `newSize` bytes, or returns NULL and leaves the block as it was */
+	void *(*reallocate)(void *user, void *pointer, size_t oldSize, size_t newSize);
+	/* Gives a block back, `size` is what it was allocated or last resized to */
+	void (*free)(void *user, void *pointer, size_t size);
+	void *user; /* Handed to all three, never touched by Hoshi */
+} hoshi_Allocator;
+
+/* What blocks are aligned to unless they ask for more, which is what malloc gives */
+#define HOSHI_DEFAULT_ALIGNMENT _Alignof(max_align_t)
+
+extern const hoshi_Allocator hoshi_defaultAllocator;
 
 /* Allocator macro */
-#define HOSHI_ALLOCATE(type, count) (type *)hoshi_realloc(NULL, 0, sizeof(type) * count)
+#define HOSHI_ALLOCATE(allocator, type, count) (type *)hoshi_realloc(allocator, NULL, 0, sizeof(type) * (count))
 
 /* Frees the given object. */
-#define HOSHI_FREE(type, pointer) hoshi_realloc(pointer, sizeof(type), 0)
+#define HOSHI_FREE(allocator, type, pointer) hoshi_realloc(allocator, pointer, sizeof(type), 0)
 
 /* Doubles the given capacity, used in dynamic arrays.
  * The growth factor can be modified by changing the `2` here. */
 #define HOSHI_GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
 /* Grows the array to `sizeof(type) * newCount` from `sizeof(type) * oldCount`. */
-#define HOSHI_GROW_ARRAY(type, pointer, oldCount, newCount) \
-	(type *)hoshi_realloc(pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
+#define HOSHI_GROW_ARRAY(allocator, type, pointer, oldCount, newCount) \
+	(type *)hoshi_realloc(allocator, pointer, sizeof(type) * (oldCount), sizeof(type) * (newCount))
 
 /* Frees the given array. */
-#define HOSHI_FREE_ARRAY(type, pointer, oldCount) \
-	(void)(hoshi_realloc(pointer, sizeof(type) * (oldCount), 0))
+#define HOSHI_FREE_ARRAY(allocator, type, pointer, oldCount) \
+	(void)(hoshi_realloc(allocator, pointer, sizeof(type) * (oldCount), 0))
+
+/* Blocks up to this size come out of slab pages, bigger ones are allocated on their own */
+#define HOSHI_SLAB_MAX_SIZE 256
+#define HOSHI_SLAB_CLASS_COUNT 8
 
 typedef struct hoshi_Object hoshi_Object;
+typedef struct hoshi_ObjectTracker hoshi_ObjectTracker;
 
-/* Big brother is watching. */
-typedef struct {
+/* The start of every slab page, the blocks come after it */
+typedef struct hoshi_SlabPage {
+	struct hoshi_SlabPage *next;
+	hoshi_ObjectTracker *tracker; /* Who the page belongs to */
+} hoshi_SlabPage;
+
+/* The start of every block that is too big for a slab page, the block comes right after it */
+typedef struct hoshi_LargeBlock {
+	struct hoshi_LargeBlock *next;
+	struct hoshi_LargeBlock *previous;
+	hoshi_ObjectTracker *tracker;
+	size_t size;
+} hoshi_LargeBlock;
+
+/* Big brother is watching.
+ * A tracker owns the objects of a VM (or a program) and everything they own, like the characters of strings, which are all freed at once with it
+ * unless the collector freed them before (see gc.h).
+ * Blocks of up to HOSHI_SLAB_MAX_SIZE bytes are rounded up to one of HOSHI_SLAB_CLASS_COUNT size classes and cut out of HOSHI_SLAB_PAGE_SIZE pages
+ * by bumping `bump` towards `bumpEnd`. A freed block goes on the free list of its class, which the next block of that class is taken from.
+ * Freeing a tracker frees its pages and big blocks, and never looks at the objects in them. */
+struct hoshi_ObjectTracker {
+	const hoshi_Allocator *allocator; /* What its pages and big blocks come from */
 	hoshi_Object *objects; /* Linked list of allocated objects */
-} hoshi_ObjectTracker;
+	char *bump;
+	char *bumpEnd;
+	void *freeLists[HOSHI_SLAB_CLASS_COUNT];
+	hoshi_SlabPage *pages;
+	hoshi_LargeBlock *large;
+	size_t bytes; /* Allocated and not freed yet, by the sizes asked for, which is what the collector paces itself by */
+};
+
+/* Which size class a block of `size` bytes is in, by `(size + 15) / 16`, and the size of each class */
+extern const uint8_t hoshi_slabClassOf[HOSHI_SLAB_MAX_SIZE / 16 + 1];
+extern const uint16_t hoshi_slabClassSizes[HOSHI_SLAB_CLASS_COUNT];
 
-void *hoshi_realloc(void *pointer, size_t oldSize, size_t newSize);
+/* Allocates, resizes (both when `pointer` is not NULL), or frees (when `newSize` is 0) a block with `allocator`. Never returns NULL for a new size
+ * that is not 0, see hoshi_catchOutOfMemory for what happens when the allocator fails. */
+void *hoshi_realloc(const hoshi_Allocator *allocator, void *pointer, size_t oldSize, size_t newSize);
+
+/* Failed allocations.
+ * Nothing that allocates has a way to report that it failed, so a failed allocation longjmp()s to the jump buffer set for the thread with this,
+ * which the VM does around entering and running chunks, the loader around loading them, and programs around being built and run,
+ * to turn it into a runtime error or a failed load.
+ * Returns the jump buffer that was set before, to put back once done. With none set, a failed allocation aborts the process. */
+jmp_buf *hoshi_catchOutOfMemory(jmp_buf *jump);
+
+void hoshi_initTracker(hoshi_ObjectTracker *tracker, const hoshi_Allocator *allocator);
+/* Frees everything that was allocated from the tracker and leaves it empty. */
+void hoshi_freeTracker(hoshi_ObjectTracker *tracker);
+/* Frees everything that was allocated from the tracker like hoshi_freeTracker, but keeps one slab page to allocate from again. */
+void hoshi_resetTracker(hoshi_ObjectTracker *tracker);
+/* Moves everything `from` owns over to `to`, leaving `from` empty. */
+void hoshi_moveTracker(hoshi_ObjectTracker *to, hoshi_ObjectTracker *from);
+/* The way hoshi_trackerAllocate goes when there is no free block of the size class and no room left in the page, or the block is too big for a page. */
+void *hoshi_trackerAllocateSlow(hoshi_ObjectTracker *tracker, size_t size);
+/* Gives a block back, `size` has to be what it was allocated with. */
+void hoshi_trackerFree(hoshi_ObjectTracker *tracker, void *pointer, size_t size);
+
+/* Allocates `size` bytes that belong to `tracker`, which is only a pointer bump most of the time.
+ * The bytes are only counted once there is a block, since a failed allocation in hoshi_trackerAllocateSlow never returns (see hoshi_catchOutOfMemory). */
+static inline void *hoshi_trackerAllocate(hoshi_ObjectTracker *tracker, size_t size)
+{
+#if HOSHI_ENABLE_SLABS
+	if (size <= HOSHI_SLAB_MAX_SIZE) {
+		int sizeClass = hoshi_slabClassOf[(size + 15) / 16];
+		void *block = tracker->freeLists[sizeClass];
+		if (block != NULL) {
+			tracker->freeLists[sizeClass] = *(void **)block;
+			tracker->bytes += size;
+			return block;
+		}
+		size_t classSize = hoshi_slabClassSizes[sizeClass];
+		if ((size_t)(tracker->bumpEnd - tracker->bump) >= classSize) {
+			block = tracker->bump;
+			tracker->bump += classSize;
+			tracker->bytes += size;
+			return block;
+		}
+	}
+#endif
+	void *block = hoshi_trackerAllocateSlow(tracker, size);
+	tracker->bytes += size;
+	return block;
+}
+
+/* Returns the tracker a block was allocated from, `size` has to be what it was allocated with. */
+static inline hoshi_ObjectTracker *hoshi_trackerOf(void *pointer, size_t size)
+{
+#if HOSHI_ENABLE_SLABS
+	if (size <= HOSHI_SLAB_MAX_SIZE) {
+		return ((hoshi_SlabPage *)((uintptr_t)pointer & ~(uintptr_t)(HOSHI_SLAB_PAGE_SIZE - 1)))->tracker;
+	}
+#endif
+	return ((hoshi_LargeBlock *)pointer - 1)->tracker;
+}
 
 #endif
@@ -2,8 +2,12 @@
 #define __HOSHI_OBJECT_C__
 
 #include "object.h"
+#include "common.h"
+#include "gc.h"
 #include "hash_table.h"
 #include "memory.h"
+#include "program.h"
+#include "siphash.h"
 #include "value.h"
 #include "vm.h"
 #include <stdint.h>
@@ -11,75 +15,294 @@
 #include <stdlib.h>
 #include <string.h>
 
-/* YOU ARE A BOZO!! */
-/*static char hoshi_siphashKey[16] = {
+#if !HOSHI_ENABLE_RANDOM_HASH_SEED
+/* YOU ARE A BOZO!! The hash key every VM gets when HOSHI_ENABLE_RANDOM_HASH_SEED is off */
+static const char hoshi_fixedHashKey[HOSHI_HASH_KEY_SIZE] = {
 	'Y', 'O', 'U', ' ',
 	'A', 'R', 'E', ' ',
 	'A', ' ',
 	'B', 'O', 'Z', 'O',
 	'!', '!'
-};*/
+};
+#endif
 
 hoshi_Object *hoshi_allocateObject(hoshi_ObjectTracker *tracker, size_t size, hoshi_ObjectType type)
 {
-	hoshi_Object *object = (hoshi_Object *)hoshi_realloc(NULL, 0, size);
+	hoshi_Object *object = (hoshi_Object *)hoshi_trackerAllocate(tracker, size);
 	object->type = type;
 	object->next = tracker->objects;
 	tracker->objects = object;
 	return object;
 }
 
+/* How big a string of `length` characters kept the given way is, with what comes after it */
+static size_t hoshi_stringSize(hoshi_StringStorage storage, int length)
+{
+	switch (storage) {
+		case HOSHI_STRING_INLINE: return sizeof(hoshi_ObjectString) + length + 1;
+		case HOSHI_STRING_BORROWED: return sizeof(hoshi_ObjectString);
+		case HOSHI_STRING_ROPE:
+		case HOSHI_STRING_FLATTENED: return sizeof(hoshi_ObjectString) + sizeof(hoshi_ObjectString *) * 2;
+	}
+	return sizeof(hoshi_ObjectString);
+}
+
 void hoshi_freeObject(hoshi_Object *object)
 {
 	switch (object->type) {
 		case HOSHI_OBJTYPE_STRING: {
 			hoshi_ObjectString *string = (hoshi_ObjectString *)object;
-			if (string->ownsChars) {
-				HOSHI_FREE_ARRAY(char, (char *)string->chars, string->length + 1);
+			size_t size = hoshi_stringSize(string->storage, string->length);
+			hoshi_ObjectTracker *tracker = hoshi_trackerOf(string, size);
+			if (string->storage == HOSHI_STRING_FLATTENED) {
+				hoshi_trackerFree(tracker, (char *)string->chars, string->length + 1);
 			}
-			HOSHI_FREE(hoshi_ObjectString, string);
+			hoshi_trackerFree(tracker, string, size);
 			break;
 		}
 	}
 }
 
-/* TODO: Switch to SipHash. Current implementation is FNV-1a */
-static uint32_t hoshi_hashString(const char *key, int length)
+void hoshi_makeHashKey(char key[HOSHI_HASH_KEY_SIZE])
+{
+#if HOSHI_ENABLE_RANDOM_HASH_SEED
+	hoshi_randomBytes(key, HOSHI_HASH_KEY_SIZE);
+#else
+	memcpy(key, hoshi_fixedHashKey, HOSHI_HASH_KEY_SIZE);
+#endif
+}
+
+#if HOSHI_STRING_HASH == HOSHI_HASH_WORDS
+#define HOSHI_HASH_MULTIPLIER UINT64_C(0x9e3779b97f4a7c15)
+
+/* Folds one word into the hash. Every step is a bijection of the hash, so two strings only collide if their words do somewhere. */
+static inline uint64_t hoshi_hashWord(uint64_t hash, uint64_t word)
+{
+	hash = (hash ^ word) * HOSHI_HASH_MULTIPLIER;
+	return hash ^ (hash >> 29);
+}
+#endif
+
+uint32_t hoshi_hashString(const char key[HOSHI_HASH_KEY_SIZE], const char *chars, int length)
 {
+#if HOSHI_STRING_HASH == HOSHI_HASH_WORDS
+	/* Reads the string 8 bytes at a time, seeded with the first half of the key, and mixes it all up at the end (MurmurHash3's finalizer)
+	 * since tables take the low 7 bits and the bits above them apart */
+	uint64_t seed;
+	memcpy(&seed, key, sizeof(seed));
+	uint64_t hash = seed ^ ((uint64_t)length * HOSHI_HASH_MULTIPLIER);
+	while (length >= 8) {
+		uint64_t word;
+		memcpy(&word, chars, sizeof(word));
+		hash = hoshi_hashWord(hash, word);
+		chars += 8;
+		length -= 8;
+	}
+	/* The last 1 to 7 bytes are read without a loop: two 4 byte reads that may overlap, or the first, middle, and last byte.
+	 * Both tell every string of the same length apart, and the length is already in the hash. */
+	if (length >= 4) {
+		uint32_t low, high;
+		memcpy(&low, chars, sizeof(low));
+		memcpy(&high, chars + length - 4, sizeof(high));
+		hash = hoshi_hashWord(hash, ((uint64_t)high << 32) | low);
+	} else if (length > 0) {
+		uint64_t word = (uint64_t)(uint8_t)chars[0] | ((uint64_t)(uint8_t)chars[length / 2] << 8) | ((uint64_t)(uint8_t)chars[length - 1] << 16);
+		hash = hoshi_hashWord(hash, word);
+	}
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+	hash ^= hash >> 33;
+	return (uint32_t)hash;
+#elif HOSHI_STRING_HASH == HOSHI_HASH_SIPHASH
+	return (uint32_t)siphash24(chars, length, key);
+#else
+	(void)key;
 	uint32_t hash = 2166136261u;
 	for (int i = 0; i < length; i++) {
-		hash ^= (uint8_t)key[i];
+		hash ^= (uint8_t)chars[i];
 		hash *= 16777619;
 	}
 	return hash;
+#endif
 }
 
-hoshi_ObjectString *hoshi_makeString(hoshi_VM *vm, bool ownsString, char *chars, int length)
+/* Looks for a string with the given characters among the ones the VM and its program have interned */
+static hoshi_ObjectString *hoshi_findInternedString(hoshi_VM *vm, const char *chars, int length, uint64_t hash)
 {
-	uint64_t hash = hoshi_hashString(chars, length);
+	/* Strings the VM's program already has must stay the same object, since strings are compared by pointer */
+	hoshi_ObjectString *interned = NULL;
+	if (vm->program != NULL) {
+		interned = hoshi_tableFindString(&vm->program->strings, chars, length, hash);
+	}
+	if (interned == NULL) {
+		interned = hoshi_tableFindString(&vm->strings, chars, length, hash);
+		/* The table does not keep its strings alive, so one the collector has not reached yet has to be kept from being swept now that it is used again */
+		if (interned != NULL && vm->gc.phase != HOSHI_GC_IDLE) {
+			hoshi_Object *object = &interned->object;
+			if (vm->gc.phase == HOSHI_GC_MARK && object->mark == vm->gc.white) {
+				object->mark = HOSHI_GC_BLACK;
+			} else if (vm->gc.phase == HOSHI_GC_SWEEP && object->mark == (vm->gc.white ^ 1)) {
+				object->mark = vm->gc.white;
+			}
+		}
+	}
+	return interned;
+}
+
+/* Allocates a string in `tracker` that is neither hashed nor interned, and leaves `chars` to the caller */
+static hoshi_ObjectString *hoshi_newString(hoshi_VM *vm, hoshi_ObjectTracker *tracker, hoshi_StringStorage storage, int length)
+{
+	hoshi_ObjectString *string = (hoshi_ObjectString *)hoshi_allocateObject(tracker, hoshi_stringSize(storage, length), HOSHI_OBJTYPE_STRING);
+	/* Strings in a scope's region are freed with it, never by the collector */
+	string->object.mark = tracker == &vm->tracker ? hoshi_gcNewMark(&vm->gc) : HOSHI_GC_PINNED;
+	string->hash = 0;
+	string->length = length;
+	string->storage = storage;
+	string->interned = false;
+	string->hashed = false;
+	return string;
+}
 
-	hoshi_ObjectString *interned = hoshi_tableFindString(&vm->strings, chars, length, hash);
+/* Makes an interned string of the characters, unless there is one already */
+static hoshi_ObjectString *hoshi_makeInternedString(hoshi_VM *vm, hoshi_StringStorage storage, const char *chars, int length)
+{
+	uint32_t hash = hoshi_hashString(vm->hashKey, chars, length);
+	hoshi_ObjectString *interned = hoshi_findInternedString(vm, chars, length, hash);
 	if (interned != NULL) {
-		if (ownsString) {
-			HOSHI_FREE_ARRAY(char, chars, length + 1);
-		}
 		return interned;
 	}
 
-	hoshi_ObjectString *string = HOSHI_ALLOCATE_OBJECT(&vm->tracker, hoshi_ObjectString, HOSHI_OBJTYPE_STRING);
-	string->ownsChars = ownsString;
-	string->length = length;
-	string->chars = chars;
-	// string->hash = siphash24(chars, length, hoshi_siphashKey);
+	hoshi_ObjectString *string = hoshi_newString(vm, &vm->tracker, storage, length);
+	if (storage == HOSHI_STRING_INLINE) {
+		memcpy(string->inlineChars, chars, length);
+		string->inlineChars[length] = '\0';
+		string->chars = string->inlineChars;
+	} else {
+		string->chars = chars;
+	}
+	string->interned = true;
+	string->hashed = true;
 	string->hash = hash;
 	hoshi_tableSet(&vm->strings, string, HOSHI_NIL);
 	return string;
 }
 
+hoshi_ObjectString *hoshi_makeString(hoshi_VM *vm, const char *chars, int length)
+{
+	return hoshi_makeInternedString(vm, HOSHI_STRING_INLINE, chars, length);
+}
+
+hoshi_ObjectString *hoshi_makeBorrowedString(hoshi_VM *vm, const char *chars, int length)
+{
+	return hoshi_makeInternedString(vm, HOSHI_STRING_BORROWED, chars, length);
+}
+
+hoshi_ObjectString *hoshi_allocateString(hoshi_VM *vm, int length, char **chars)
+{
+	return hoshi_allocateStringIn(vm, &vm->tracker, length, chars);
+}
+
+hoshi_ObjectString *hoshi_allocateStringIn(hoshi_VM *vm, hoshi_ObjectTracker *tracker, int length, char **chars)
+{
+	hoshi_ObjectString *string = hoshi_newString(vm, tracker, HOSHI_STRING_INLINE, length);
+	string->inlineChars[length] = '\0';
+	string->chars = string->inlineChars;
+	*chars = string->inlineChars;
+	return string;
+}
+
+hoshi_ObjectString *hoshi_makeRope(hoshi_VM *vm, hoshi_ObjectTracker *tracker, hoshi_ObjectString *left, hoshi_ObjectString *right)
+{
+	hoshi_ObjectString *rope = hoshi_newString(vm, tracker, HOSHI_STRING_ROPE, left->length + right->length);
+	rope->chars = NULL;
+	hoshi_ropePieces(rope)[0] = left;
+	hoshi_ropePieces(rope)[1] = right;
+	return rope;
+}
+
+const char *hoshi_flattenRope(hoshi_ObjectString *rope)
+{
+	/* Ropes are only ever made by a VM while it runs, so this is the VM's tracker or one of its regions */
+	hoshi_ObjectTracker *tracker = hoshi_trackerOf(rope, hoshi_stringSize(HOSHI_STRING_ROPE, rope->length));
+	char *chars = hoshi_trackerAllocate(tracker, rope->length + 1);
+	chars[rope->length] = '\0';
+
+	/* A string appended to in a loop is a rope nested as deep as the loop ran, so this keeps its own stack of pieces instead of recursing.
+	 * Pieces are copied from the end backwards, always taking the right side of a rope first. */
+	int capacity = 8;
+	int count = 0;
+	hoshi_ObjectString **pieces = HOSHI_ALLOCATE(tracker->allocator, hoshi_ObjectString *, capacity);
+	pieces[count++] = rope;
+	int end = rope->length;
+	while (count > 0) {
+		hoshi_ObjectString *piece = pieces[--count];
+		if (piece->chars != NULL) {
+			end -= piece->length;
+			memcpy(chars + end, piece->chars, piece->length);
+			continue;
+		}
+		if (count + 2 > capacity) {
+			int oldCapacity = capacity;
+			capacity = HOSHI_GROW_CAPACITY(oldCapacity);
+			pieces = HOSHI_GROW_ARRAY(tracker->allocator, hoshi_ObjectString *, pieces, oldCapacity, capacity);
+		}
+		pieces[count++] = hoshi_ropePieces(piece)[0];
+		pieces[count++] = hoshi_ropePieces(piece)[1];
+	}
+	HOSHI_FREE_ARRAY(tracker->allocator, hoshi_ObjectString *, pieces, capacity);
+
+	rope->storage = HOSHI_STRING_FLATTENED;
+	rope->chars = chars;
+	return chars;
+}
+
+uint32_t hoshi_stringHash(hoshi_VM *vm, hoshi_ObjectString *string)
+{
+	if (!string->hashed) {
+		string->hash = hoshi_hashString(vm->hashKey, hoshi_stringChars(string), string->length);
+		string->hashed = true;
+	}
+	return string->hash;
+}
+
+hoshi_ObjectString *hoshi_internString(hoshi_VM *vm, hoshi_ObjectString *string)
+{
+	if (string->interned) {
+		return string;
+	}
+
+	uint32_t hash = hoshi_stringHash(vm, string);
+	hoshi_ObjectString *interned = hoshi_findInternedString(vm, string->chars, string->length, hash);
+	if (interned != NULL) {
+		return interned;
+	}
+
+	string->interned = true;
+	hoshi_tableSet(&vm->strings, string, HOSHI_NIL);
+	return string;
+}
+
+bool hoshi_stringsEqual(hoshi_ObjectString *a, hoshi_ObjectString *b)
+{
+	if (a == b) {
+		return true;
+	}
+	if ((a->interned && b->interned) || a->length != b->length) {
+		return false;
+	}
+	/* Hashing just to compare would read the characters anyway, so hashes only help when both are known already */
+	if (a->hashed && b->hashed && a->hash != b->hash) {
+		return false;
+	}
+	return memcmp(hoshi_stringChars(a), hoshi_stringChars(b), a->length) == 0;
+}
+
 char *hoshi_formatString(hoshi_VM *vm, const char *string, int length)
 {
 	int formattedSize = length;
-	char *formatted = HOSHI_ALLOCATE(char, formattedSize);
+	char *formatted = HOSHI_ALLOCATE(&vm->allocator, char, formattedSize + 1);
 
 	char ch, prev = '\0';
 	int len = length;
@@ -126,7 +349,7 @@ char *hoshi_formatString(hoshi_VM *vm, const char *string, int length)
 	formatted[formattedSize] = '\0';
 
 	if (formattedSize != len) {
-		formatted = hoshi_realloc(formatted, sizeof(char) * len, sizeof(char) * formattedSize);
+		formatted = hoshi_realloc(&vm->allocator, formatted, sizeof(char) * (len + 1), sizeof(char) * (formattedSize + 1));
 	}
 
 	return formatted;
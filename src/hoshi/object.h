@@ -12,7 +12,7 @@
 #define HOSHI_IS_STRING(value) hoshi_isObjectType(value, HOSHI_OBJTYPE_STRING)
 
 #define HOSHI_AS_STRING(value) ((hoshi_ObjectString *)HOSHI_AS_OBJECT(value))
-#define HOSHI_AS_CSTRING(value) (((hoshi_ObjectString *)HOSHI_AS_OBJECT(value))->chars)
+#define HOSHI_AS_CSTRING(value) hoshi_stringChars((hoshi_ObjectString *)HOSHI_AS_OBJECT(value))
 
 #define HOSHI_ALLOCATE_OBJECT(tracker, type, objectType) (type *)hoshi_allocateObject(tracker, sizeof(type), objectType);
 
@@ -22,32 +22,93 @@ typedef enum {
 
 struct hoshi_Object {
 	hoshi_ObjectType type;
+	uint8_t mark; /* What the collector knows of the object, a white, HOSHI_GC_BLACK, or HOSHI_GC_PINNED (see gc.h) */
 	hoshi_Object *next; /* Pointer to the next object */
 };
 
+/* Where the characters of a string are */
+typedef enum {
+	HOSHI_STRING_INLINE, /* Right after the string, in `inlineChars`, so both are one allocation */
+	HOSHI_STRING_BORROWED, /* Somewhere that outlives the string and does not belong to it, like the source HIR identifiers point into */
+	HOSHI_STRING_ROPE, /* Nowhere yet, see hoshi_ropePieces */
+	HOSHI_STRING_FLATTENED, /* A rope's, in a buffer of their own that belongs to the rope */
+} hoshi_StringStorage;
+
+/* Strings from constants are interned, so equal ones are the same object. Strings made while running (by CONCAT) are not:
+ * they are only hashed once something asks for their hash (see hoshi_stringHash), and only interned when they are used as a table key.
+ * Longer ones start out as ropes: `chars` is NULL and the string is the two strings hoshi_ropePieces returns, one after the other,
+ * until something needs its characters and flattens it into `chars` (see hoshi_stringChars). */
 struct hoshi_ObjectString {
 	hoshi_Object object;
-	bool ownsChars;
-	int length; /* TODO: LEB128 */
-	const char *chars;
 	uint32_t hash;
+	int length; /* TODO: LEB128 */
+	uint8_t storage; /* A hoshi_StringStorage */
+	bool interned; /* Whether this is the one string with these characters in the VM's or its program's table, which can be compared by pointer */
+	bool hashed; /* Whether `hash` is set, which interned strings always are */
+	const char *chars; /* Points at `inlineChars` for inline strings */
+	char inlineChars[]; /* `length` characters and a '\0' for inline strings, the pieces of ropes */
 };
 
 /* Allocates an object of the given size and type. */
 hoshi_Object *hoshi_allocateObject(hoshi_ObjectTracker *tracker, size_t size, hoshi_ObjectType type);
 
-/* Frees an object, you typically do not need to call this manually and can leave it to the VM to clean up itself. */
+/* Frees an object, you typically do not need to call this manually and can leave it to the VM to clean up itself.
+ * It is not taken off its tracker's list of objects. */
 void hoshi_freeObject(hoshi_Object *object);
 
-/* Helper function to allocate a string with the given characters and length.
- * Set `ownsChars` to true when the characters are owned by the object, and false when they are heap allocated and not owned by the object. */
-hoshi_ObjectString *hoshi_makeString(hoshi_VM *vm, bool ownsChars, char *chars, int length);
+/* Hashes characters with the hash HOSHI_STRING_HASH picks, under `key`. Strings are hashed under the key of the VM that made them. */
+uint32_t hoshi_hashString(const char key[HOSHI_HASH_KEY_SIZE], const char *chars, int length);
+
+/* Fills in a new hash key, which is random unless HOSHI_ENABLE_RANDOM_HASH_SEED is off. */
+void hoshi_makeHashKey(char key[HOSHI_HASH_KEY_SIZE]);
+
+/* Returns the interned string with the given characters, copying them into a new inline string if there is none yet. */
+hoshi_ObjectString *hoshi_makeString(hoshi_VM *vm, const char *chars, int length);
+
+/* Like hoshi_makeString, but a new string points at `chars` instead of copying them, so they have to outlive the VM (or its program). */
+hoshi_ObjectString *hoshi_makeBorrowedString(hoshi_VM *vm, const char *chars, int length);
+
+/* Allocates an inline string of `length` characters that is neither hashed nor interned. `chars` is set to where the characters go,
+ * which the caller fills in, the '\0' after them is already there. */
+hoshi_ObjectString *hoshi_allocateString(hoshi_VM *vm, int length, char **chars);
+
+/* Like hoshi_allocateString, but allocates in `tracker`. Strings in any tracker but the VM's own are pinned, the collector never frees them. */
+hoshi_ObjectString *hoshi_allocateStringIn(hoshi_VM *vm, hoshi_ObjectTracker *tracker, int length, char **chars);
+
+/* Makes a rope in `tracker` of `left` followed by `right`, neither of which is copied. */
+hoshi_ObjectString *hoshi_makeRope(hoshi_VM *vm, hoshi_ObjectTracker *tracker, hoshi_ObjectString *left, hoshi_ObjectString *right);
 
+/* Copies the characters of a rope into one buffer, which the rope then owns. Use hoshi_stringChars instead, which only does this once. */
+const char *hoshi_flattenRope(hoshi_ObjectString *rope);
+
+/* Returns the hash of a string's characters, working it out with the VM's hash key first if it was not hashed yet. */
+uint32_t hoshi_stringHash(hoshi_VM *vm, hoshi_ObjectString *string);
+
+/* Returns the interned string with the same characters as `string`, which is `string` itself if there was none yet. */
+hoshi_ObjectString *hoshi_internString(hoshi_VM *vm, hoshi_ObjectString *string);
+
+/* Whether two strings have the same characters. Interned strings are compared by pointer, everything else by comparing characters. */
+bool hoshi_stringsEqual(hoshi_ObjectString *a, hoshi_ObjectString *b);
+
+/* Replaces the escape sequences in a string literal with the characters they stand for.
+ * The result is the caller's to free, with HOSHI_FREE_ARRAY(&vm->allocator, char, result, strlen(result) + 1). */
 char *hoshi_formatString(hoshi_VM *vm, const char *string, int length);
 
 /* Prints an object value. */
 void hoshi_printObject(hoshi_Value value);
 
+/* Returns the two strings a rope is made of, which are kept where an inline string's characters would be. */
+static inline hoshi_ObjectString **hoshi_ropePieces(hoshi_ObjectString *rope)
+{
+	return (hoshi_ObjectString **)rope->inlineChars;
+}
+
+/* Returns the characters of a string, flattening it first if it is a rope. */
+static inline const char *hoshi_stringChars(hoshi_ObjectString *string)
+{
+	return string->chars != NULL ? string->chars : hoshi_flattenRope(string);
+}
+
 static inline bool hoshi_isObjectType(hoshi_Value value, hoshi_ObjectType type)
 {
 	return HOSHI_IS_OBJECT(value) && HOSHI_AS_OBJECT(value)->type == type;
@@ -0,0 +1,709 @@
+#ifndef __HOSHI_OPTIMIZER_C__
+#define __HOSHI_OPTIMIZER_C__
+
+#include "optimizer.h"
+#include "chunk.h"
+#include "memory.h"
+#include "ssa.h"
+#include "value.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if MEMWATCH
+#include "memwatch.h"
+#endif
+
+void hoshi_initOptimizerStats(hoshi_OptimizerStats *stats)
+{
+	stats->folded = 0;
+	stats->branches = 0;
+	stats->threaded = 0;
+	stats->removed = 0;
+	stats->redundant = 0;
+	stats->hoisted = 0;
+	stats->deadStores = 0;
+	stats->bytesBefore = 0;
+	stats->bytesAfter = 0;
+}
+
+static bool hoshi_isJump(hoshi_OpCode op)
+{
+	return op == HOSHI_OP_GOTO || op == HOSHI_OP_GOTO_IF;
+}
+
+static bool hoshi_pushesConstant(hoshi_OpCode op)
+{
+	return op == HOSHI_OP_CONSTANT || op == HOSHI_OP_TRUE || op == HOSHI_OP_FALSE || op == HOSHI_OP_NIL;
+}
+
+/* Turns an instruction into one that pushes `value` */
+static void hoshi_setConstant(hoshi_OptInstruction *instruction, hoshi_Value value)
+{
+	instruction->value = value;
+	instruction->length = 1;
+	if (HOSHI_IS_BOOL(value)) {
+		instruction->op = HOSHI_AS_BOOL(value) ? HOSHI_OP_TRUE : HOSHI_OP_FALSE;
+	} else if (HOSHI_IS_NIL(value)) {
+		instruction->op = HOSHI_OP_NIL;
+	} else {
+		instruction->op = HOSHI_OP_CONSTANT;
+		instruction->constant = -1;
+	}
+}
+
+/* Returns the first instruction from `index` on that has not been removed, or the instruction count for the end of the chunk */
+static int hoshi_liveFrom(hoshi_Optimizer *optimizer, int index)
+{
+	while (index < optimizer->count && optimizer->instructions[index].removed) {
+		index++;
+	}
+	return index;
+}
+
+/* Reads the chunk's code into `optimizer->instructions`. Returns false if an instruction is cut off or unknown to us,
+ * or if a jump lands in the middle of an instruction, in which case we leave the chunk alone and let hoshi_decodeChunk report it. */
+static bool hoshi_readInstructions(hoshi_Optimizer *optimizer)
+{
+	hoshi_Chunk *chunk = optimizer->chunk;
+
+	/* `indices` maps each offset to the instruction starting there, or -1 if it is in the middle of one */
+	int *indices = HOSHI_ALLOCATE(chunk->allocator, int, (chunk->count + 1));
+	for (int offset = 0; offset <= chunk->count; offset++) {
+		indices[offset] = -1;
+	}
+	int count = 0;
+	for (int offset = 0; offset < chunk->count; offset += hoshi_instructionLength(chunk->code[offset])) {
+		hoshi_OpCode op = chunk->code[offset];
+		if (hoshi_genericOpcode(op) != op || offset + hoshi_instructionLength(op) > chunk->count) {
+			HOSHI_FREE_ARRAY(chunk->allocator, int, indices, chunk->count + 1);
+			return false;
+		}
+		indices[offset] = count++;
+	}
+	indices[chunk->count] = count;
+
+	hoshi_OptInstruction *instructions = HOSHI_ALLOCATE(chunk->allocator, hoshi_OptInstruction, (count + 1));
+	bool success = true;
+	for (int offset = 0; offset < chunk->count && success; offset += hoshi_instructionLength(chunk->code[offset])) {
+		hoshi_OptInstruction *instruction = &instructions[indices[offset]];
+		hoshi_OpCode op = chunk->code[offset];
+		uint8_t *operands = &chunk->code[offset + 1];
+		instruction->op = op;
+		instruction->length = hoshi_instructionLength(op);
+		memset(instruction->operands, 0, sizeof(instruction->operands));
+		memcpy(instruction->operands, operands, instruction->length - 1 < 3 ? instruction->length - 1 : 3);
+		instruction->line = chunk->lineCount > 0 ? hoshi_getLine(chunk, offset) : 0;
+		instruction->target = -1;
+		instruction->absolute = false;
+		instruction->constant = -1;
+		instruction->value = HOSHI_NIL;
+		instruction->isTarget = false;
+		instruction->removed = false;
+		instruction->offset = offset;
+
+		switch (op) {
+			case HOSHI_OP_CONSTANT:
+			case HOSHI_OP_CONSTANT_LONG: {
+				int constant = operands[0];
+				if (op == HOSHI_OP_CONSTANT_LONG) {
+					constant |= (operands[1] << 8) | (operands[2] << 16);
+				}
+				if (constant >= chunk->constants.count) {
+					success = false;
+					break;
+				}
+				instruction->op = HOSHI_OP_CONSTANT;
+				instruction->constant = constant;
+				instruction->value = chunk->constants.values[constant];
+				break;
+			}
+			case HOSHI_OP_TRUE: instruction->value = HOSHI_BOOL(true); break;
+			case HOSHI_OP_FALSE: instruction->value = HOSHI_BOOL(false); break;
+			case HOSHI_OP_NIL: instruction->value = HOSHI_NIL; break;
+			case HOSHI_OP_JUMP:
+			case HOSHI_OP_BACK_JUMP:
+			case HOSHI_OP_GOTO:
+			case HOSHI_OP_JUMP_IF:
+			case HOSHI_OP_BACK_JUMP_IF:
+			case HOSHI_OP_GOTO_IF: {
+				int64_t target = hoshi_jumpTarget(chunk, offset);
+				if (target < 0 || target > chunk->count || indices[target] == -1) {
+					success = false;
+					break;
+				}
+				bool conditional = op == HOSHI_OP_JUMP_IF || op == HOSHI_OP_BACK_JUMP_IF || op == HOSHI_OP_GOTO_IF;
+				instruction->op = conditional ? HOSHI_OP_GOTO_IF : HOSHI_OP_GOTO;
+				instruction->absolute = op == HOSHI_OP_GOTO || op == HOSHI_OP_GOTO_IF;
+				instruction->target = indices[target];
+				if (indices[target] < count) {
+					instructions[indices[target]].isTarget = true;
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	HOSHI_FREE_ARRAY(chunk->allocator, int, indices, chunk->count + 1);
+	if (!success) {
+		HOSHI_FREE_ARRAY(chunk->allocator, hoshi_OptInstruction, instructions, count + 1);
+		return false;
+	}
+	optimizer->instructions = instructions;
+	optimizer->count = count;
+	return true;
+}
+
+/* How many constants `op` takes when it can be folded, 0 when it can not be */
+static int hoshi_foldArity(hoshi_OpCode op)
+{
+	switch (op) {
+		case HOSHI_OP_POP:
+		case HOSHI_OP_GOTO_IF:
+		case HOSHI_OP_NEGATE:
+		case HOSHI_OP_NOT:
+		case HOSHI_OP_BNOT:
+		case HOSHI_OP_TOINT:
+		case HOSHI_OP_TONUM:
+			return 1;
+		case HOSHI_OP_ADD:
+		case HOSHI_OP_SUB:
+		case HOSHI_OP_MUL:
+		case HOSHI_OP_DIV:
+		case HOSHI_OP_AND:
+		case HOSHI_OP_OR:
+		case HOSHI_OP_XOR:
+		case HOSHI_OP_EQ:
+		case HOSHI_OP_NEQ:
+		case HOSHI_OP_GT:
+		case HOSHI_OP_LT:
+		case HOSHI_OP_GTEQ:
+		case HOSHI_OP_LTEQ:
+		case HOSHI_OP_MOD:
+		case HOSHI_OP_BAND:
+		case HOSHI_OP_BOR:
+		case HOSHI_OP_BXOR:
+		case HOSHI_OP_SHL:
+		case HOSHI_OP_SHR:
+			return 2;
+		default:
+			return 0;
+	}
+}
+
+/* Macro shorthands for hoshi_foldValues, these get #undef'd after it.
+ * Each one returns false wherever the VM would panic, so that the panic still happens at runtime. */
+#define BOTH_INTEGERS() (HOSHI_IS_INTEGER(a) && HOSHI_IS_INTEGER(b))
+#define BOTH_NUMBERS() (HOSHI_IS_NUMBER(a) && HOSHI_IS_NUMBER(b))
+#define BOTH_BOOLS() (HOSHI_IS_BOOL(a) && HOSHI_IS_BOOL(b))
+#define ARITHMETIC(op, overflow) \
+	do { \
+		if (BOTH_INTEGERS()) { \
+			int64_t integer; \
+			if (overflow(HOSHI_AS_INTEGER(a), HOSHI_AS_INTEGER(b), &integer) || !HOSHI_INTEGER_FITS(integer)) { \
+				return false; \
+			} \
+			*result = HOSHI_INTEGER(integer); \
+			return true; \
+		} \
+		if (BOTH_NUMBERS()) { \
+			*result = HOSHI_NUMBER(HOSHI_AS_NUMBER(a) op HOSHI_AS_NUMBER(b)); \
+			return true; \
+		} \
+		return false; \
+	} while (0)
+#define COMPARISON(op) \
+	do { \
+		if (BOTH_INTEGERS()) { \
+			*result = HOSHI_BOOL(HOSHI_AS_INTEGER(a) op HOSHI_AS_INTEGER(b)); \
+			return true; \
+		} \
+		if (BOTH_NUMBERS()) { \
+			*result = HOSHI_BOOL(HOSHI_AS_NUMBER(a) op HOSHI_AS_NUMBER(b)); \
+			return true; \
+		} \
+		return false; \
+	} while (0)
+#define BOOLEAN(op) \
+	do { \
+		if (!BOTH_BOOLS()) { \
+			return false; \
+		} \
+		*result = HOSHI_BOOL(HOSHI_AS_BOOL(a) op HOSHI_AS_BOOL(b)); \
+		return true; \
+	} while (0)
+#define BITWISE(op) \
+	do { \
+		if (!BOTH_INTEGERS()) { \
+			return false; \
+		} \
+		*result = HOSHI_INTEGER(HOSHI_AS_INTEGER(a) op HOSHI_AS_INTEGER(b)); \
+		return true; \
+	} while (0)
+
+/* Works out what `op` leaves on the stack, the same way hoshi_runNext would. Unary operations only use `a`.
+ * Returns false if the operation would panic, or if it is not worth folding. */
+static bool hoshi_foldValues(hoshi_OpCode op, hoshi_Value a, hoshi_Value b, hoshi_Value *result)
+{
+	switch (op) {
+		case HOSHI_OP_ADD: ARITHMETIC(+, __builtin_add_overflow);
+		case HOSHI_OP_SUB: ARITHMETIC(-, __builtin_sub_overflow);
+		case HOSHI_OP_MUL: ARITHMETIC(*, __builtin_mul_overflow);
+		case HOSHI_OP_DIV:
+			if (BOTH_NUMBERS()) {
+				*result = HOSHI_NUMBER(HOSHI_AS_NUMBER(a) / HOSHI_AS_NUMBER(b));
+				return true;
+			}
+			if (!BOTH_INTEGERS() || HOSHI_AS_INTEGER(b) == 0 || (HOSHI_AS_INTEGER(b) == -1 && HOSHI_AS_INTEGER(a) == HOSHI_INTEGER_MIN)) {
+				return false;
+			}
+			*result = HOSHI_INTEGER(HOSHI_AS_INTEGER(a) / HOSHI_AS_INTEGER(b));
+			return true;
+		case HOSHI_OP_NEGATE:
+			if (HOSHI_IS_INTEGER(a) && HOSHI_AS_INTEGER(a) != HOSHI_INTEGER_MIN) {
+				*result = HOSHI_INTEGER(-HOSHI_AS_INTEGER(a));
+				return true;
+			}
+			if (HOSHI_IS_NUMBER(a)) {
+				*result = HOSHI_NUMBER(-HOSHI_AS_NUMBER(a));
+				return true;
+			}
+			return false;
+		case HOSHI_OP_NOT:
+			if (!HOSHI_IS_BOOL(a)) {
+				return false;
+			}
+			*result = HOSHI_BOOL(!HOSHI_AS_BOOL(a));
+			return true;
+		case HOSHI_OP_AND: BOOLEAN(&&);
+		case HOSHI_OP_OR: BOOLEAN(||);
+		case HOSHI_OP_XOR: BOOLEAN(^);
+		/* Objects are compared by identity, which only the VM that owns them knows about */
+		case HOSHI_OP_EQ:
+		case HOSHI_OP_NEQ:
+			if (HOSHI_IS_OBJECT(a) || HOSHI_IS_OBJECT(b)) {
+				return false;
+			}
+			*result = HOSHI_BOOL(hoshi_valuesEqual(a, b) == (op == HOSHI_OP_EQ));
+			return true;
+		case HOSHI_OP_GT: COMPARISON(>);
+		case HOSHI_OP_LT: COMPARISON(<);
+		case HOSHI_OP_GTEQ: COMPARISON(>=);
+		case HOSHI_OP_LTEQ: COMPARISON(<=);
+		case HOSHI_OP_MOD:
+			if (!BOTH_INTEGERS() || HOSHI_AS_INTEGER(b) == 0) {
+				return false;
+			}
+			*result = HOSHI_INTEGER(HOSHI_AS_INTEGER(b) == -1 ? 0 : HOSHI_AS_INTEGER(a) % HOSHI_AS_INTEGER(b));
+			return true;
+		case HOSHI_OP_BAND: BITWISE(&);
+		case HOSHI_OP_BOR: BITWISE(|);
+		case HOSHI_OP_BXOR: BITWISE(^);
+		case HOSHI_OP_BNOT:
+			if (!HOSHI_IS_INTEGER(a)) {
+				return false;
+			}
+			*result = HOSHI_INTEGER(~HOSHI_AS_INTEGER(a));
+			return true;
+		case HOSHI_OP_SHL:
+		case HOSHI_OP_SHR: {
+			if (!BOTH_INTEGERS() || HOSHI_AS_INTEGER(b) < 0 || HOSHI_AS_INTEGER(b) > 63) {
+				return false;
+			}
+			int64_t shifted;
+			if (op == HOSHI_OP_SHR) {
+				shifted = HOSHI_AS_INTEGER(a) >> HOSHI_AS_INTEGER(b);
+			} else {
+				shifted = (int64_t)((uint64_t)HOSHI_AS_INTEGER(a) << HOSHI_AS_INTEGER(b));
+				if (shifted >> HOSHI_AS_INTEGER(b) != HOSHI_AS_INTEGER(a) || !HOSHI_INTEGER_FITS(shifted)) {
+					return false;
+				}
+			}
+			*result = HOSHI_INTEGER(shifted);
+			return true;
+		}
+		case HOSHI_OP_TOINT: {
+			if (HOSHI_IS_INTEGER(a)) {
+				*result = a;
+				return true;
+			}
+			if (!HOSHI_IS_NUMBER(a)) {
+				return false;
+			}
+			double number = HOSHI_AS_NUMBER(a);
+			if (!(number >= -9223372036854775808.0 && number < 9223372036854775808.0) || !HOSHI_INTEGER_FITS((int64_t)number)) {
+				return false;
+			}
+			*result = HOSHI_INTEGER((int64_t)number);
+			return true;
+		}
+		case HOSHI_OP_TONUM:
+			if (HOSHI_IS_NUMBER(a)) {
+				*result = a;
+				return true;
+			}
+			if (!HOSHI_IS_INTEGER(a)) {
+				return false;
+			}
+			*result = HOSHI_NUMBER((double)HOSHI_AS_INTEGER(a));
+			return true;
+		default:
+			return false;
+	}
+}
+
+#undef BOTH_INTEGERS
+#undef BOTH_NUMBERS
+#undef BOTH_BOOLS
+#undef ARITHMETIC
+#undef COMPARISON
+#undef BOOLEAN
+#undef BITWISE
+
+/* Folds operations on constants into the first of those constants, removing the rest, and decides conditional jumps on constants.
+ * This keeps a stack of the constants on top of the VM's stack, which only holds for straight-line code, so it starts over at every jump target. */
+static void hoshi_foldConstants(hoshi_Optimizer *optimizer)
+{
+	/* Instructions whose value is on top of the stack, newest last. Only removed instructions sit between them. */
+	int *known = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (optimizer->count + 1));
+	int knownCount = 0;
+
+	for (int i = 0; i < optimizer->count; i++) {
+		hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+		/* Whatever jumped here may have left something else on the stack */
+		if (instruction->isTarget) {
+			knownCount = 0;
+		}
+		if (hoshi_pushesConstant(instruction->op)) {
+			known[knownCount++] = i;
+			continue;
+		}
+
+		int arity = hoshi_foldArity(instruction->op);
+		if (arity == 0 || knownCount < arity) {
+			knownCount = 0;
+			continue;
+		}
+		hoshi_OptInstruction *first = &optimizer->instructions[known[knownCount - arity]];
+		hoshi_OptInstruction *last = &optimizer->instructions[known[knownCount - 1]];
+
+		if (instruction->op == HOSHI_OP_POP) {
+			first->removed = true;
+			instruction->removed = true;
+			knownCount--;
+			optimizer->stats->folded++;
+			continue;
+		}
+
+		if (instruction->op == HOSHI_OP_GOTO_IF) {
+			/* Only `true` jumps, anything else falls through */
+			last->removed = true;
+			knownCount--;
+			if (HOSHI_IS_BOOL(last->value) && HOSHI_AS_BOOL(last->value)) {
+				instruction->op = HOSHI_OP_GOTO;
+				knownCount = 0;
+			} else {
+				instruction->removed = true;
+			}
+			optimizer->stats->branches++;
+			continue;
+		}
+
+		hoshi_Value result;
+		if (!hoshi_foldValues(instruction->op, first->value, last->value, &result)) {
+			knownCount = 0;
+			continue;
+		}
+		hoshi_setConstant(first, result);
+		if (arity == 2) {
+			last->removed = true;
+		}
+		instruction->removed = true;
+		knownCount -= arity - 1;
+		optimizer->stats->folded++;
+	}
+
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, known, optimizer->count + 1);
+}
+
+/* Sends jumps that land on an unconditional jump straight to where that one goes */
+static void hoshi_threadJumps(hoshi_Optimizer *optimizer)
+{
+	for (int i = 0; i < optimizer->count; i++) {
+		hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+		if (instruction->removed || !hoshi_isJump(instruction->op)) {
+			continue;
+		}
+		int start = hoshi_liveFrom(optimizer, instruction->target);
+		int target = start;
+		/* Jumps can go around in circles, but never through more jumps than there are instructions */
+		for (int hops = 0; hops < optimizer->count && target < optimizer->count && optimizer->instructions[target].op == HOSHI_OP_GOTO; hops++) {
+			target = hoshi_liveFrom(optimizer, optimizer->instructions[target].target);
+		}
+		if (target != start) {
+			optimizer->stats->threaded++;
+		}
+		instruction->target = target;
+	}
+}
+
+/* Removes everything no path from the start of the chunk reaches */
+static void hoshi_removeUnreachable(hoshi_Optimizer *optimizer)
+{
+	bool *reached = HOSHI_ALLOCATE(optimizer->chunk->allocator, bool, (optimizer->count + 1));
+	memset(reached, 0, sizeof(bool) * (optimizer->count + 1));
+	/* Each instruction is only walked through once, so there can never be more jumps left to follow than instructions */
+	int *pending = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (optimizer->count + 1));
+	int pendingCount = 0;
+	if (optimizer->count > 0) {
+		pending[pendingCount++] = 0;
+	}
+
+	while (pendingCount > 0) {
+		for (int i = pending[--pendingCount]; i < optimizer->count && !reached[i]; i++) {
+			hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+			reached[i] = true;
+			if (instruction->removed) {
+				continue;
+			}
+			if (hoshi_isJump(instruction->op) && instruction->target < optimizer->count && !reached[instruction->target]) {
+				pending[pendingCount++] = instruction->target;
+			}
+			if (instruction->op == HOSHI_OP_GOTO || instruction->op == HOSHI_OP_RETURN || instruction->op == HOSHI_OP_EXIT) {
+				break;
+			}
+		}
+	}
+
+	for (int i = 0; i < optimizer->count; i++) {
+		if (!reached[i] && !optimizer->instructions[i].removed) {
+			optimizer->instructions[i].removed = true;
+			optimizer->stats->removed++;
+		}
+	}
+
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, bool, reached, optimizer->count + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, pending, optimizer->count + 1);
+}
+
+/* Removes jumps that land on the instruction right after them. Conditional ones still pop their condition, so they become a POP. */
+static void hoshi_removeJumpsToNext(hoshi_Optimizer *optimizer)
+{
+	/* Removing one jump can put another one right in front of where it lands */
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int i = 0; i < optimizer->count; i++) {
+			hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+			if (instruction->removed || !hoshi_isJump(instruction->op)) {
+				continue;
+			}
+			if (hoshi_liveFrom(optimizer, instruction->target) != hoshi_liveFrom(optimizer, i + 1)) {
+				continue;
+			}
+			if (instruction->op == HOSHI_OP_GOTO) {
+				instruction->removed = true;
+			} else {
+				instruction->op = HOSHI_OP_POP;
+				instruction->length = 1;
+			}
+			optimizer->stats->removed++;
+			changed = true;
+		}
+	}
+}
+
+/* The size `instruction` is written out with */
+static int hoshi_optInstructionLength(hoshi_OptInstruction *instruction)
+{
+	switch (instruction->op) {
+		case HOSHI_OP_CONSTANT:
+			return instruction->constant <= UINT8_MAX ? 2 : 4;
+		case HOSHI_OP_GOTO:
+		case HOSHI_OP_GOTO_IF:
+			return instruction->absolute ? 5 : 3;
+		default:
+			return instruction->length;
+	}
+}
+
+/* Gives every instruction its new offset. Jumps are written as relative jumps wherever they reach, and as GOTO or GOTO_IF where they do not.
+ * Turning a relative jump into a GOTO makes it longer, which can push other jumps out of reach, so this goes on until nothing changes. */
+static int hoshi_layoutInstructions(hoshi_Optimizer *optimizer)
+{
+	for (;;) {
+		int offset = 0;
+		for (int i = 0; i < optimizer->count; i++) {
+			hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+			/* Removed instructions get the offset of the next instruction, so jumps to them land there */
+			instruction->offset = offset;
+			if (!instruction->removed) {
+				offset += hoshi_optInstructionLength(instruction);
+			}
+		}
+
+		bool grew = false;
+		for (int i = 0; i < optimizer->count; i++) {
+			hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+			if (instruction->removed || !hoshi_isJump(instruction->op) || instruction->absolute) {
+				continue;
+			}
+			int target = instruction->target < optimizer->count ? optimizer->instructions[instruction->target].offset : offset;
+			int next = instruction->offset + 3;
+			int distance = target >= next ? target - next : next - target;
+			if (distance > UINT16_MAX) {
+				instruction->absolute = true;
+				grew = true;
+			}
+		}
+		if (!grew) {
+			return offset;
+		}
+	}
+}
+
+/* Writes the optimized instructions into `out`, which starts out empty */
+static void hoshi_writeInstructions(hoshi_Optimizer *optimizer, hoshi_Chunk *out)
+{
+	/* Constants go into a new pool in the order they are first used, so ones nothing uses anymore are left behind */
+	hoshi_ValueArray *constants = &optimizer->chunk->constants;
+	int *remapped = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (constants->count + 1));
+	for (int i = 0; i < constants->count; i++) {
+		remapped[i] = -1;
+	}
+	for (int i = 0; i < optimizer->count; i++) {
+		hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+		if (instruction->removed || instruction->op != HOSHI_OP_CONSTANT) {
+			continue;
+		}
+		if (instruction->constant == -1) {
+			instruction->constant = hoshi_addConstant(out, instruction->value);
+		} else {
+			if (remapped[instruction->constant] == -1) {
+				remapped[instruction->constant] = hoshi_addConstant(out, constants->values[instruction->constant]);
+			}
+			instruction->constant = remapped[instruction->constant];
+		}
+	}
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, remapped, constants->count + 1);
+
+	int end = hoshi_layoutInstructions(optimizer);
+	for (int i = 0; i < optimizer->count; i++) {
+		hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+		if (instruction->removed) {
+			continue;
+		}
+		int line = instruction->line;
+		switch (instruction->op) {
+			case HOSHI_OP_CONSTANT: {
+				int constant = instruction->constant;
+				if (constant <= UINT8_MAX) {
+					hoshi_writeChunk(out, HOSHI_OP_CONSTANT, line);
+					hoshi_writeChunk(out, constant, line);
+				} else {
+					hoshi_writeChunk(out, HOSHI_OP_CONSTANT_LONG, line);
+					hoshi_writeChunk(out, constant & 0xFF, line);
+					hoshi_writeChunk(out, (constant >> 8) & 0xFF, line);
+					hoshi_writeChunk(out, (constant >> 16) & 0xFF, line);
+				}
+				break;
+			}
+			case HOSHI_OP_GOTO:
+			case HOSHI_OP_GOTO_IF: {
+				bool conditional = instruction->op == HOSHI_OP_GOTO_IF;
+				int target = instruction->target < optimizer->count ? optimizer->instructions[instruction->target].offset : end;
+				if (instruction->absolute) {
+					hoshi_writeChunk(out, instruction->op, line);
+					for (int shift = 0; shift < 32; shift += 8) {
+						hoshi_writeChunk(out, (target >> shift) & 0xFF, line);
+					}
+					break;
+				}
+				int next = instruction->offset + 3;
+				int distance;
+				if (target >= next) {
+					hoshi_writeChunk(out, conditional ? HOSHI_OP_JUMP_IF : HOSHI_OP_JUMP, line);
+					distance = target - next;
+				} else {
+					hoshi_writeChunk(out, conditional ? HOSHI_OP_BACK_JUMP_IF : HOSHI_OP_BACK_JUMP, line);
+					distance = next - target;
+				}
+				hoshi_writeChunk(out, distance & 0xFF, line);
+				hoshi_writeChunk(out, (distance >> 8) & 0xFF, line);
+				break;
+			}
+			default:
+				hoshi_writeChunk(out, instruction->op, line);
+				for (int operand = 0; operand < instruction->length - 1; operand++) {
+					hoshi_writeChunk(out, instruction->operands[operand], line);
+				}
+				break;
+		}
+	}
+}
+
+bool hoshi_optimizeChunk(hoshi_Chunk *chunk, hoshi_OptimizerStats *stats)
+{
+	/* Decoded instructions point into `code` and the constant pool, which we are about to replace */
+	if (chunk->instructions != NULL) {
+		return false;
+	}
+
+	hoshi_OptimizerStats unused;
+	hoshi_Optimizer optimizer;
+	optimizer.chunk = chunk;
+	optimizer.instructions = NULL;
+	optimizer.count = 0;
+	optimizer.stats = stats != NULL ? stats : &unused;
+	if (!hoshi_readInstructions(&optimizer)) {
+		return false;
+	}
+
+	hoshi_foldConstants(&optimizer);
+	hoshi_optimizeSsa(&optimizer);
+	/* The SSA passes turn dead DEFLOCALs into POPs, which might pop a constant */
+	hoshi_foldConstants(&optimizer);
+	hoshi_threadJumps(&optimizer);
+	hoshi_removeUnreachable(&optimizer);
+	hoshi_removeJumpsToNext(&optimizer);
+
+	hoshi_Chunk out;
+	hoshi_initChunk(&out, chunk->allocator);
+	hoshi_writeInstructions(&optimizer, &out);
+	optimizer.stats->bytesBefore += chunk->count;
+	optimizer.stats->bytesAfter += out.count;
+
+	/* Swap the optimized code, lines, and constants in */
+	HOSHI_FREE_ARRAY(chunk->allocator, uint8_t, chunk->code, chunk->capacity);
+	hoshi_freeValueArray(&chunk->constants);
+	HOSHI_FREE_ARRAY(chunk->allocator, hoshi_LineStart, chunk->lines, chunk->lineCapacity);
+	chunk->count = out.count;
+	chunk->capacity = out.capacity;
+	chunk->code = out.code;
+	chunk->constants = out.constants;
+	chunk->lineCount = out.lineCount;
+	chunk->lineCapacity = out.lineCapacity;
+	chunk->lines = out.lines;
+
+	HOSHI_FREE_ARRAY(chunk->allocator, hoshi_OptInstruction, optimizer.instructions, optimizer.count + 1);
+	return true;
+}
+
+void hoshi_printOptimizerStats(hoshi_OptimizerStats *stats, FILE *file)
+{
+	fputs("-- Optimizer Stats --\n", file);
+	fprintf(file, "  %6d  operations folded\n", stats->folded);
+	fprintf(file, "  %6d  branches decided\n", stats->branches);
+	fprintf(file, "  %6d  jumps threaded\n", stats->threaded);
+	fprintf(file, "  %6d  instructions removed\n", stats->removed);
+	fprintf(file, "  %6d  redundant operations reused\n", stats->redundant);
+	fprintf(file, "  %6d  operations hoisted out of loops\n", stats->hoisted);
+	fprintf(file, "  %6d  dead stores removed\n", stats->deadStores);
+	fprintf(file, "  %6d  bytes before\n", stats->bytesBefore);
+	fprintf(file, "  %6d  bytes after\n", stats->bytesAfter);
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __HOSHI_OPTIMIZER_H__
+#define __HOSHI_OPTIMIZER_H__
+
+#include "chunk.h"
+#include "value.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Bytecode optimizer.
+ * hoshi_optimizeChunk rewrites a chunk's `code` before it first runs: constant subexpressions are folded into a single constant,
+ * conditional jumps on a constant are decided, jumps to jumps go straight to where the chain ends, and code nothing can reach is removed.
+ * In between, the passes in ssa.c reuse values that were already worked out, move work that is the same on every iteration out of loops,
+ * and drop stores to locals nothing reads.
+ * Unlike hoshi_fuseChunk the result is plain bytecode, so optimized chunks can be written to files. */
+
+typedef struct {
+	int folded; /* Operations folded into a constant, or into nothing for POP */
+	int branches; /* Conditional jumps on a constant, turned into an unconditional jump or removed */
+	int threaded; /* Jumps sent straight past a jump they landed on */
+	int removed; /* Unreachable instructions, and jumps to the next instruction */
+	int redundant; /* Operations whose value was already worked out, and now comes out of a local instead */
+	int hoisted; /* Operations moved out of a loop */
+	int deadStores; /* SETLOCALs and DEFLOCALs whose value nothing reads */
+	int bytesBefore;
+	int bytesAfter;
+} hoshi_OptimizerStats;
+
+/* The optimizer works on a list of instructions instead of the raw bytes, so instructions can change size, go away, or be added
+ * without moving anything else until the chunk is written back out.
+ * Jumps are kept as GOTO and GOTO_IF with the instruction they land on, and only become relative jumps again when written out. */
+typedef struct {
+	uint8_t op;
+	uint8_t operands[3]; /* Copied back out as they were, for everything but constants and jumps */
+	int length;
+	int line;
+	int target; /* Jumps: the instruction they land on, or the instruction count for the end of the chunk */
+	bool absolute; /* Jumps: written out as GOTO or GOTO_IF even if a relative jump would reach */
+	int constant; /* CONSTANT: the index in the constant pool, -1 for folded values until they get one */
+	hoshi_Value value; /* CONSTANT, TRUE, FALSE, and NIL: what they push */
+	bool isTarget; /* Some jump lands here */
+	bool removed;
+	int offset; /* Where the instruction starts in the optimized code */
+} hoshi_OptInstruction;
+
+typedef struct {
+	hoshi_Chunk *chunk;
+	hoshi_OptInstruction *instructions; /* `count + 1` of them are allocated */
+	int count;
+	hoshi_OptimizerStats *stats;
+} hoshi_Optimizer;
+
+void hoshi_initOptimizerStats(hoshi_OptimizerStats *stats);
+
+/* Optimizes the chunk's code, then fixes up jump targets, the line table, and the constant pool (dropping constants nothing uses anymore).
+ * Only operations that can not fail are folded, so a runtime error still happens at runtime, on the line it always did.
+ * This has to happen before hoshi_fuseChunk and hoshi_decodeChunk. `stats` may be NULL.
+ * Returns false and leaves the chunk as it was if the chunk is malformed, already decoded, or already has superinstructions in it. */
+bool hoshi_optimizeChunk(hoshi_Chunk *chunk, hoshi_OptimizerStats *stats);
+
+/* Prints what the optimizer did. */
+void hoshi_printOptimizerStats(hoshi_OptimizerStats *stats, FILE *file);
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef __HOSHI_PROGRAM_C__
+#define __HOSHI_PROGRAM_C__
+
+#include "program.h"
+#include "chunk.h"
+#include "chunk_loader.h"
+#include "common.h"
+#include "config.h"
+#include "fusion.h"
+#include "gc.h"
+#include "hash_table.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "verifier.h"
+#include "vm.h"
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if HOSHI_ENABLE_JIT
+#include "jit.h"
+#endif
+
+#if MEMWATCH
+#include "memwatch.h"
+#endif
+
+bool hoshi_initProgram(hoshi_Program *program, hoshi_VM *vm, hoshi_Chunk *chunk)
+{
+	/* Everything that allocates happens before anything is taken over, so running out of memory leaves the VM and chunk as they were */
+	jmp_buf outOfMemory;
+	jmp_buf *outer = hoshi_catchOutOfMemory(&outOfMemory);
+	if (setjmp(outOfMemory) != 0) {
+		hoshi_catchOutOfMemory(outer);
+		fprintf(stderr, "error: failed to build program: out of memory\n");
+		return false;
+	}
+	if (chunk->instructions == NULL && !hoshi_decodeChunk(chunk)) {
+		hoshi_catchOutOfMemory(outer);
+		return false;
+	}
+	hoshi_verifyChunk(vm, chunk, NULL);
+	/* Objects left on the list to sweep would not be pinned, and VMs running the program must never mark its objects */
+	hoshi_finishCollection(vm);
+	hoshi_catchOutOfMemory(outer);
+
+	/* The VM may go before the program, so whatever was allocated with its allocator now points at the program's copy */
+	program->allocator = vm->allocator;
+	program->chunk = *chunk;
+	if (program->chunk.allocator == &vm->allocator) {
+		program->chunk.allocator = &program->allocator;
+		program->chunk.constants.allocator = &program->allocator;
+	}
+#if HOSHI_ENABLE_JIT
+	/* Machine code belongs to whichever VM made it */
+	hoshi_freeJitCode(program->chunk.jit);
+	program->chunk.jit = NULL;
+	program->chunk.hotness = 0;
+#endif
+	hoshi_initChunk(chunk, chunk->allocator);
+
+	program->strings = vm->strings;
+	program->strings.allocator = &program->allocator;
+	memcpy(program->hashKey, vm->hashKey, HOSHI_HASH_KEY_SIZE);
+	program->globalNames = vm->globalNames;
+	program->globalNames.allocator = &program->allocator;
+	program->globalCount = vm->globalValues.count;
+	hoshi_moveTracker(&program->tracker, &vm->tracker);
+	program->tracker.allocator = &program->allocator;
+	hoshi_pinObjects(&program->tracker);
+	hoshi_initTable(&vm->strings, &vm->allocator);
+	hoshi_initTable(&vm->globalNames, &vm->allocator);
+	return true;
+}
+
+bool hoshi_readProgramFromFile(hoshi_Program *program, FILE *file, bool fuse)
+{
+	/* The loader works on a VM, so we load through one that only lives for this and then take its strings and names over */
+	hoshi_VM vm;
+	hoshi_initVM(&vm);
+	hoshi_Chunk chunk;
+
+	bool success = hoshi_readChunkFromFile(&vm, &chunk, file, HOSHI_VERSION);
+	if (success) {
+		if (fuse) {
+			hoshi_fuseChunk(&chunk, NULL);
+		}
+		success = hoshi_initProgram(program, &vm, &chunk);
+	}
+
+	hoshi_freeChunk(&chunk);
+	hoshi_freeVM(&vm);
+	return success;
+}
+
+void hoshi_freeProgram(hoshi_Program *program)
+{
+	hoshi_freeChunk(&program->chunk);
+	hoshi_freeTable(&program->strings);
+	hoshi_freeTable(&program->globalNames);
+
+	hoshi_freeTracker(&program->tracker);
+}
+
+bool hoshi_initVMForProgram(hoshi_VM *vm, hoshi_Program *program)
+{
+	return hoshi_initVMForProgramWithAllocator(vm, program, &hoshi_defaultAllocator);
+}
+
+bool hoshi_initVMForProgramWithAllocator(hoshi_VM *vm, hoshi_Program *program, const hoshi_Allocator *allocator)
+{
+	hoshi_initVMWithAllocator(vm, allocator);
+	memcpy(vm->hashKey, program->hashKey, HOSHI_HASH_KEY_SIZE);
+
+	/* The VM only runs the program once its view has instructions, until then hoshi_freeVM frees it like any other VM */
+	jmp_buf outOfMemory;
+	jmp_buf *outer = hoshi_catchOutOfMemory(&outOfMemory);
+	if (setjmp(outOfMemory) != 0) {
+		hoshi_catchOutOfMemory(outer);
+		hoshi_freeVM(vm);
+		return false;
+	}
+
+	/* Global names are shared, their values are not */
+	hoshi_tableCopyAllFrom(&program->globalNames, &vm->globalNames);
+	for (int i = 0; i < program->globalCount; i++) {
+		hoshi_writeValueArray(&vm->globalValues, HOSHI_NIL);
+	}
+	hoshi_Instruction *instructions = HOSHI_ALLOCATE(&vm->allocator, hoshi_Instruction, (program->chunk.instructionCount));
+	hoshi_catchOutOfMemory(outer);
+
+	/* The view shares everything with the program's chunk except for the decoded instructions */
+	vm->program = program;
+	hoshi_Chunk *view = &vm->programChunk;
+	hoshi_Instruction *shared = program->chunk.instructions;
+	*view = program->chunk;
+	view->allocator = &vm->allocator;
+	view->instructions = instructions;
+	memcpy(view->instructions, shared, sizeof(hoshi_Instruction) * view->instructionCount);
+
+	/* Jumps point into the array they were decoded into, so they are moved over into the copy */
+	for (int i = 0; i < view->instructionCount; i++) {
+		switch (hoshi_genericOpcode(shared[i].op)) {
+			case HOSHI_OP_JUMP:
+			case HOSHI_OP_BACK_JUMP:
+			case HOSHI_OP_JUMP_IF:
+			case HOSHI_OP_BACK_JUMP_IF:
+			case HOSHI_OP_GOTO:
+			case HOSHI_OP_GOTO_IF:
+				view->instructions[i].as.target = view->instructions + (shared[i].as.target - shared);
+				break;
+			default:
+				break;
+		}
+	}
+	return true;
+}
+
+void hoshi_freeProgramView(hoshi_Chunk *view)
+{
+	HOSHI_FREE_ARRAY(view->allocator, hoshi_Instruction, view->instructions, view->instructionCount);
+#if HOSHI_ENABLE_JIT
+	hoshi_freeJitCode(view->jit);
+#endif
+	/* Everything else belongs to the program */
+	hoshi_initChunk(view, view->allocator);
+}
+
+hoshi_InterpretResult hoshi_runProgram(hoshi_VM *vm)
+{
+	return hoshi_runChunk(vm, &vm->programChunk);
+}
+
+/* Shared between the threads of one hoshi_runParallel call */
+typedef struct {
+	hoshi_Program *program;
+	hoshi_RunResult *results;
+	int runs;
+	int next; /* The next run to hand out, only ever taken with an atomic add */
+	int failed; /* Runs there was not enough memory to start, also only ever added to atomically */
+} hoshi_ParallelRuns;
+
+/* Allocates `size` bytes with hoshi_defaultAllocator, or returns NULL if there is not enough memory. */
+static void *hoshi_tryAllocate(size_t size)
+{
+	jmp_buf outOfMemory;
+	jmp_buf *outer = hoshi_catchOutOfMemory(&outOfMemory);
+	if (setjmp(outOfMemory) != 0) {
+		hoshi_catchOutOfMemory(outer);
+		return NULL;
+	}
+	void *block = hoshi_realloc(&hoshi_defaultAllocator, NULL, 0, size);
+	hoshi_catchOutOfMemory(outer);
+	return block;
+}
+
+static void *hoshi_runWorker(void *argument)
+{
+	hoshi_ParallelRuns *parallel = argument;
+	/* VMs are too big to keep on every thread's stack. A thread that can not get one still takes runs, and fails them. */
+	hoshi_VM *vm = hoshi_tryAllocate(sizeof(hoshi_VM));
+
+	for (;;) {
+		int run = __atomic_fetch_add(&parallel->next, 1, __ATOMIC_RELAXED);
+		if (run >= parallel->runs) {
+			break;
+		}
+
+		hoshi_RunResult result = { HOSHI_INTERPRET_RUNTIME_ERROR, 1 };
+		if (vm != NULL && hoshi_initVMForProgram(vm, parallel->program)) {
+			result.result = hoshi_runProgram(vm);
+			result.exitCode = vm->exitCode;
+			hoshi_freeVM(vm);
+		} else {
+			__atomic_fetch_add(&parallel->failed, 1, __ATOMIC_RELAXED);
+		}
+		if (parallel->results != NULL) {
+			parallel->results[run] = result;
+		}
+	}
+
+	if (vm != NULL) {
+		HOSHI_FREE(&hoshi_defaultAllocator, hoshi_VM, vm);
+	}
+	return NULL;
+}
+
+bool hoshi_runParallel(hoshi_Program *program, int runs, int threads, hoshi_RunResult *results)
+{
+	hoshi_ParallelRuns parallel = { program, results, runs, 0, 0 };
+
+	/* The calling thread is one of the workers, so one less thread is started. Without room to keep track of them, none are. */
+	int extra = threads > 1 ? threads - 1 : 0;
+	pthread_t *workers = extra > 0 ? hoshi_tryAllocate(sizeof(pthread_t) * extra) : NULL;
+	if (workers == NULL) {
+		extra = 0;
+	}
+	int started = 0;
+	while (started < extra && pthread_create(&workers[started], NULL, hoshi_runWorker, &parallel) == 0) {
+		started++;
+	}
+
+	hoshi_runWorker(&parallel);
+
+	for (int i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	HOSHI_FREE_ARRAY(&hoshi_defaultAllocator, pthread_t, workers, extra);
+	return parallel.failed == 0;
+}
+
+#endif
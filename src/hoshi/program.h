@@ -0,0 +1,59 @@
+#ifndef __HOSHI_PROGRAM_H__
+#define __HOSHI_PROGRAM_H__
+
+#include "chunk.h"
+#include "hash_table.h"
+#include "memory.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Shared programs.
+ * A program is everything about a chunk that stays the same while it runs: its code, constants, the interned strings of those constants,
+ * and the layout of its globals. Once built it is never written to again, so any amount of VMs on any amount of threads can run it at once.
+ * Everything a run changes belongs to the VM running it: the stack, locals, global values, strings made while running, and its own copy
+ * of the decoded instructions, since quickening and the JIT rewrite those. */
+
+typedef struct hoshi_Program {
+	hoshi_Allocator allocator; /* A copy of the allocator of the VM the program was built from, which everything below is freed with */
+	hoshi_Chunk chunk; /* Decoded and verified. VMs run their own view of it, never the chunk itself. */
+	hoshi_Table strings; /* Interned strings of the constants and global names */
+	char hashKey[HOSHI_HASH_KEY_SIZE]; /* What `strings` were hashed under, which every VM running the program hashes under too */
+	hoshi_Table globalNames; /* Name -> index, like `hoshi_VM.globalNames` */
+	int globalCount;
+	hoshi_ObjectTracker tracker; /* Owns every string in `strings` */
+} hoshi_Program;
+
+/* How one run of hoshi_runParallel ended. Runs there was not enough memory to start end in HOSHI_INTERPRET_RUNTIME_ERROR with exit code 1. */
+typedef struct {
+	hoshi_InterpretResult result;
+	int exitCode;
+} hoshi_RunResult;
+
+/* Builds a program out of a chunk and the VM it was compiled or loaded into, decoding and verifying the chunk if that has not happened yet.
+ * The program takes the chunk and the VM's strings and global names over, so the chunk is left empty and the VM should only be freed afterwards.
+ * Strings that do not own their characters (i.e, HIR's identifiers, which point into the source) still have to outlive the program.
+ * Returns false if the chunk can not be decoded or there is not enough memory to decode and verify it, nothing is taken over then. */
+bool hoshi_initProgram(hoshi_Program *program, hoshi_VM *vm, hoshi_Chunk *chunk);
+/* Reads a compiled file straight into a program, fusing superinstructions first if `fuse` is true. */
+bool hoshi_readProgramFromFile(hoshi_Program *program, FILE *file, bool fuse);
+void hoshi_freeProgram(hoshi_Program *program);
+
+/* Sets `vm` up to run `program`. Use it instead of hoshi_initVM, and free the VM with hoshi_freeVM before freeing the program.
+ * The VM allocates with hoshi_defaultAllocator, the program's own allocator is only ever used to free the program.
+ * Returns false if there is not enough memory for the VM's globals and instructions, the VM is already freed then. */
+bool hoshi_initVMForProgram(hoshi_VM *vm, hoshi_Program *program);
+/* hoshi_initVMForProgram, with the VM allocating with `allocator` instead, like hoshi_initVMWithAllocator. */
+bool hoshi_initVMForProgramWithAllocator(hoshi_VM *vm, hoshi_Program *program, const hoshi_Allocator *allocator);
+/* Frees a VM's view of its program's chunk, hoshi_freeVM calls this. */
+void hoshi_freeProgramView(hoshi_Chunk *view);
+/* Runs the VM's program from the start. To run it in slices, use hoshi_enterChunk(vm, &vm->programChunk) and hoshi_runSlice. */
+hoshi_InterpretResult hoshi_runProgram(hoshi_VM *vm);
+
+/* Runs `program` `runs` times on `threads` threads (the calling thread being one of them), each run in a fresh VM.
+ * Every thread takes the next run that is left until there are none, so uneven runs still keep every thread busy.
+ * `results` may be NULL, otherwise it gets one entry per run. If threads can not be started, the calling thread does their runs.
+ * Returns false if there was not enough memory to start some of the runs. */
+bool hoshi_runParallel(hoshi_Program *program, int runs, int threads, hoshi_RunResult *results);
+
+#endif
@@ -30,6 +30,7 @@
 */
 
 #include <stdint.h>
+#include <string.h>
 
 #if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && \
 	__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
@@ -75,11 +76,13 @@
 
 
 uint64_t siphash24(const void *src, unsigned long src_sz, const char key[16]) {
-	const uint64_t *_key = (uint64_t *)key;
+	/* Neither the key nor the characters are necessarily aligned, so words are read with memcpy */
+	uint64_t _key[2];
+	memcpy(_key, key, sizeof(_key));
 	uint64_t k0 = _le64toh(_key[0]);
 	uint64_t k1 = _le64toh(_key[1]);
 	uint64_t b = (uint64_t)src_sz << 56;
-	const uint64_t *in = (uint64_t*)src;
+	const uint8_t *in = (const uint8_t *)src;
 
 	uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
 	uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
@@ -87,8 +90,10 @@ uint64_t siphash24(const void *src, unsigned long src_sz, const char key[16]) {
 	uint64_t v3 = k1 ^ 0x7465646279746573ULL;
 
 	while (src_sz >= 8) {
-		uint64_t mi = _le64toh(*in);
-		in += 1; src_sz -= 8;
+		uint64_t mi;
+		memcpy(&mi, in, sizeof(mi));
+		mi = _le64toh(mi);
+		in += 8; src_sz -= 8;
 		v3 ^= mi;
 		DOUBLE_ROUND(v0,v1,v2,v3);
 		v0 ^= mi;
@@ -99,7 +104,7 @@ uint64_t siphash24(const void *src, unsigned long src_sz, const char key[16]) {
 	case 7: pt[6] = m[6];
 	case 6: pt[5] = m[5];
 	case 5: pt[4] = m[4];
-	case 4: *((uint32_t*)&pt[0]) = *((uint32_t*)&m[0]); break;
+	case 4: memcpy(pt, m, 4); break;
 	case 3: pt[2] = m[2];
 	case 2: pt[1] = m[1];
 	case 1: pt[0] = m[0];
@@ -0,0 +1,1472 @@
+#ifndef __HOSHI_SSA_C__
+#define __HOSHI_SSA_C__
+
+#include "ssa.h"
+#include "chunk.h"
+#include "config.h"
+#include "memory.h"
+#include "optimizer.h"
+#include "value.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if MEMWATCH
+#include "memwatch.h"
+#endif
+
+/* The opcode of an instruction and the local, global, or host function it uses, looking through WIDE.
+ * A WIDE in front of anything that has no wide form comes back as WIDE, which nothing here knows what to do with. */
+static hoshi_OpCode hoshi_ssaOpcode(hoshi_OptInstruction *instruction, int *index)
+{
+	if (instruction->op != HOSHI_OP_WIDE) {
+		*index = instruction->operands[0];
+		return instruction->op;
+	}
+	*index = instruction->operands[1] | (instruction->operands[2] << 8);
+	switch (instruction->operands[0]) {
+		case HOSHI_OP_DEFGLOBAL:
+		case HOSHI_OP_SETGLOBAL:
+		case HOSHI_OP_GETGLOBAL:
+		case HOSHI_OP_DEFLOCAL:
+		case HOSHI_OP_SETLOCAL:
+		case HOSHI_OP_GETLOCAL:
+			return instruction->operands[0];
+		default:
+			return HOSHI_OP_WIDE;
+	}
+}
+
+/* A GETLOCAL, SETLOCAL, or DEFLOCAL of `slot`, with a WIDE prefix if the slot needs one */
+static hoshi_OptInstruction hoshi_ssaLocalInstruction(hoshi_OpCode op, int slot, int line)
+{
+	hoshi_OptInstruction instruction;
+	memset(&instruction, 0, sizeof(instruction));
+	instruction.line = line;
+	instruction.target = -1;
+	instruction.constant = -1;
+	instruction.value = HOSHI_NIL;
+	if (slot <= UINT8_MAX) {
+		instruction.op = op;
+		instruction.operands[0] = slot;
+		instruction.length = 2;
+	} else {
+		instruction.op = HOSHI_OP_WIDE;
+		instruction.operands[0] = op;
+		instruction.operands[1] = slot & 0xFF;
+		instruction.operands[2] = (slot >> 8) & 0xFF;
+		instruction.length = 4;
+	}
+	return instruction;
+}
+
+/* How many values an instruction pops and pushes. Returns false for instructions the SSA form has no place for. */
+static bool hoshi_ssaStackEffect(hoshi_OpCode op, int *pops, int *pushes)
+{
+	switch (op) {
+		case HOSHI_OP_CONSTANT:
+		case HOSHI_OP_TRUE:
+		case HOSHI_OP_FALSE:
+		case HOSHI_OP_NIL:
+		case HOSHI_OP_GETGLOBAL:
+		case HOSHI_OP_GETLOCAL:
+			*pops = 0;
+			*pushes = 1;
+			return true;
+		case HOSHI_OP_POP:
+		case HOSHI_OP_DEFGLOBAL:
+		case HOSHI_OP_DEFLOCAL:
+		case HOSHI_OP_GOTO_IF:
+		case HOSHI_OP_PRINT:
+		case HOSHI_OP_EXIT:
+			*pops = 1;
+			*pushes = 0;
+			return true;
+		case HOSHI_OP_SETGLOBAL:
+		case HOSHI_OP_SETLOCAL:
+		case HOSHI_OP_NEGATE:
+		case HOSHI_OP_NOT:
+		case HOSHI_OP_BNOT:
+		case HOSHI_OP_TOINT:
+		case HOSHI_OP_TONUM:
+		case HOSHI_OP_YIELD:
+		case HOSHI_OP_HOSTCALL:
+			*pops = 1;
+			*pushes = 1;
+			return true;
+		case HOSHI_OP_NEWSCOPE:
+		case HOSHI_OP_ENDSCOPE:
+		case HOSHI_OP_CLEARLOCALS:
+		case HOSHI_OP_GOTO:
+		case HOSHI_OP_RETURN:
+			*pops = 0;
+			*pushes = 0;
+			return true;
+		case HOSHI_OP_ADD:
+		case HOSHI_OP_SUB:
+		case HOSHI_OP_MUL:
+		case HOSHI_OP_DIV:
+		case HOSHI_OP_AND:
+		case HOSHI_OP_OR:
+		case HOSHI_OP_XOR:
+		case HOSHI_OP_EQ:
+		case HOSHI_OP_NEQ:
+		case HOSHI_OP_GT:
+		case HOSHI_OP_LT:
+		case HOSHI_OP_GTEQ:
+		case HOSHI_OP_LTEQ:
+		case HOSHI_OP_CONCAT:
+		case HOSHI_OP_SCOPED_CONCAT:
+		case HOSHI_OP_MOD:
+		case HOSHI_OP_BAND:
+		case HOSHI_OP_BOR:
+		case HOSHI_OP_BXOR:
+		case HOSHI_OP_SHL:
+		case HOSHI_OP_SHR:
+			*pops = 2;
+			*pushes = 1;
+			return true;
+		/* PUSH is not implemented yet */
+		default:
+			return false;
+	}
+}
+
+/* Instructions that push a value without reading anything off the stack */
+static bool hoshi_ssaIsLeaf(hoshi_OpCode op)
+{
+	switch (op) {
+		case HOSHI_OP_CONSTANT:
+		case HOSHI_OP_TRUE:
+		case HOSHI_OP_FALSE:
+		case HOSHI_OP_NIL:
+		case HOSHI_OP_GETGLOBAL:
+		case HOSHI_OP_GETLOCAL:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Operations whose only effect is the value they push, so running them once or twice makes no difference. Some of them can still panic.
+ * SCOPED_CONCAT is not one, its string is only good until the ENDSCOPE of the scope it ran in, which the SSA form knows nothing of. */
+static bool hoshi_ssaIsOperation(hoshi_OpCode op)
+{
+	int pops, pushes;
+	return op != HOSHI_OP_SETGLOBAL && op != HOSHI_OP_SETLOCAL && op != HOSHI_OP_YIELD && op != HOSHI_OP_HOSTCALL && op != HOSHI_OP_SCOPED_CONCAT
+		&& hoshi_ssaStackEffect(op, &pops, &pushes) && pops > 0 && pushes == 1;
+}
+
+static bool hoshi_ssaIsPure(hoshi_OpCode op)
+{
+	return hoshi_ssaIsLeaf(op) || hoshi_ssaIsOperation(op);
+}
+
+/* Operations that give the same result with their operands swapped, panics included */
+static bool hoshi_ssaIsCommutative(hoshi_OpCode op)
+{
+	switch (op) {
+		case HOSHI_OP_ADD:
+		case HOSHI_OP_MUL:
+		case HOSHI_OP_AND:
+		case HOSHI_OP_OR:
+		case HOSHI_OP_XOR:
+		case HOSHI_OP_EQ:
+		case HOSHI_OP_NEQ:
+		case HOSHI_OP_BAND:
+		case HOSHI_OP_BOR:
+		case HOSHI_OP_BXOR:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Instructions that can neither panic nor do anything the host or the output could see */
+static bool hoshi_ssaIsQuiet(hoshi_OpCode op)
+{
+	switch (op) {
+		case HOSHI_OP_CONSTANT:
+		case HOSHI_OP_TRUE:
+		case HOSHI_OP_FALSE:
+		case HOSHI_OP_NIL:
+		case HOSHI_OP_GETLOCAL:
+		case HOSHI_OP_SETLOCAL:
+		case HOSHI_OP_DEFLOCAL:
+		case HOSHI_OP_POP:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool hoshi_ssaIsJump(hoshi_OpCode op)
+{
+	return op == HOSHI_OP_GOTO || op == HOSHI_OP_GOTO_IF;
+}
+
+/* Recomputes `isTarget` for every instruction */
+static void hoshi_markSsaTargets(hoshi_Optimizer *optimizer)
+{
+	for (int i = 0; i < optimizer->count; i++) {
+		optimizer->instructions[i].isTarget = false;
+	}
+	for (int i = 0; i < optimizer->count; i++) {
+		hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+		if (hoshi_ssaIsJump(instruction->op) && instruction->target < optimizer->count) {
+			optimizer->instructions[instruction->target].isTarget = true;
+		}
+	}
+}
+
+/* Drops removed instructions from the list, so that every instruction left is one the SSA form has to account for */
+static void hoshi_dropRemovedInstructions(hoshi_Optimizer *optimizer)
+{
+	int *indices = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (optimizer->count + 1));
+	int count = 0;
+	for (int i = 0; i < optimizer->count; i++) {
+		indices[i] = count;
+		if (!optimizer->instructions[i].removed) {
+			count++;
+		}
+	}
+	indices[optimizer->count] = count;
+
+	hoshi_OptInstruction *instructions = HOSHI_ALLOCATE(optimizer->chunk->allocator, hoshi_OptInstruction, (count + 1));
+	for (int i = 0; i < optimizer->count; i++) {
+		hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+		if (instruction->removed) {
+			continue;
+		}
+		instructions[indices[i]] = *instruction;
+		if (hoshi_ssaIsJump(instruction->op)) {
+			instructions[indices[i]].target = indices[instruction->target];
+		}
+	}
+
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, indices, optimizer->count + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, hoshi_OptInstruction, optimizer->instructions, optimizer->count + 1);
+	optimizer->instructions = instructions;
+	optimizer->count = count;
+	hoshi_markSsaTargets(optimizer);
+}
+
+static int hoshi_newSsaValue(hoshi_Ssa *ssa, hoshi_SsaKind kind, int block, int instruction, int operandCount)
+{
+	if (ssa->valueCount == ssa->valueCapacity) {
+		int oldCapacity = ssa->valueCapacity;
+		ssa->valueCapacity = HOSHI_GROW_CAPACITY(oldCapacity);
+		ssa->values = HOSHI_GROW_ARRAY(ssa->optimizer->chunk->allocator, hoshi_SsaValue, ssa->values, oldCapacity, ssa->valueCapacity);
+	}
+	hoshi_SsaValue *value = &ssa->values[ssa->valueCount];
+	value->kind = kind;
+	value->block = block;
+	value->instruction = instruction;
+	value->operands = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (operandCount + 1));
+	for (int i = 0; i < operandCount; i++) {
+		value->operands[i] = -1;
+	}
+	value->operandCount = operandCount;
+	value->replacement = -1;
+	value->number = -1;
+	return ssa->valueCount++;
+}
+
+int hoshi_resolveSsaValue(hoshi_Ssa *ssa, int value)
+{
+	while (ssa->values[value].replacement != -1) {
+		value = ssa->values[value].replacement;
+	}
+	return value;
+}
+
+bool hoshi_ssaDominates(hoshi_Ssa *ssa, int a, int b)
+{
+	/* -1 is where the values variables start out with live, before the first block */
+	if (a == -1 || b == -1) {
+		return a == -1;
+	}
+	return ssa->blocks[a].enter <= ssa->blocks[b].enter && ssa->blocks[b].exit <= ssa->blocks[a].exit;
+}
+
+/* Whether instruction `a` runs before instruction `b` on every path to `b` */
+static bool hoshi_ssaInstructionDominates(hoshi_Ssa *ssa, int a, int b)
+{
+	if (ssa->blockOf[a] == ssa->blockOf[b]) {
+		return a < b;
+	}
+	return hoshi_ssaDominates(ssa, ssa->blockOf[a], ssa->blockOf[b]);
+}
+
+static void hoshi_addSsaSuccessor(hoshi_Ssa *ssa, hoshi_SsaBlock *block, int target)
+{
+	/* Jumps to the end of the chunk lead out of it */
+	int successor = ssa->blockOf[target];
+	if (successor == -1) {
+		return;
+	}
+	for (int i = 0; i < block->successorCount; i++) {
+		if (block->successors[i] == successor) {
+			return;
+		}
+	}
+	block->successors[block->successorCount++] = successor;
+}
+
+/* Splits the code into blocks, which start at the start of the chunk, at jump targets, and after jumps, RETURN, and EXIT */
+static void hoshi_findSsaBlocks(hoshi_Ssa *ssa)
+{
+	hoshi_Optimizer *optimizer = ssa->optimizer;
+	int count = optimizer->count;
+	bool *leaders = HOSHI_ALLOCATE(optimizer->chunk->allocator, bool, (count + 1));
+	memset(leaders, 0, sizeof(bool) * (count + 1));
+	leaders[0] = true;
+	for (int i = 0; i < count; i++) {
+		hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+		if (hoshi_ssaIsJump(instruction->op)) {
+			leaders[instruction->target] = true;
+		}
+		if (hoshi_ssaIsJump(instruction->op) || instruction->op == HOSHI_OP_RETURN || instruction->op == HOSHI_OP_EXIT) {
+			leaders[i + 1] = true;
+		}
+	}
+
+	ssa->blockCount = 0;
+	for (int i = 0; i < count; i++) {
+		if (leaders[i]) {
+			ssa->blockCount++;
+		}
+	}
+	ssa->blocks = HOSHI_ALLOCATE(optimizer->chunk->allocator, hoshi_SsaBlock, (ssa->blockCount + 1));
+	ssa->blockOf = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (count + 1));
+	int current = -1;
+	for (int i = 0; i < count; i++) {
+		if (leaders[i]) {
+			hoshi_SsaBlock *block = &ssa->blocks[++current];
+			block->start = i;
+			block->successorCount = 0;
+			block->predecessors = NULL;
+			block->predecessorCount = 0;
+			block->depth = -1;
+			block->entryStack = NULL;
+			block->entryVariables = NULL;
+			block->exitStack = NULL;
+			block->exitDepth = 0;
+			block->exitVariables = NULL;
+			block->order = -1;
+			block->dominator = -1;
+			block->enter = 0;
+			block->exit = 0;
+		}
+		ssa->blockOf[i] = current;
+		ssa->blocks[current].end = i + 1;
+	}
+	ssa->blockOf[count] = -1;
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, bool, leaders, count + 1);
+
+	for (int b = 0; b < ssa->blockCount; b++) {
+		hoshi_SsaBlock *block = &ssa->blocks[b];
+		hoshi_OptInstruction *last = &optimizer->instructions[block->end - 1];
+		switch (last->op) {
+			case HOSHI_OP_GOTO:
+				hoshi_addSsaSuccessor(ssa, block, last->target);
+				break;
+			case HOSHI_OP_GOTO_IF:
+				hoshi_addSsaSuccessor(ssa, block, last->target);
+				hoshi_addSsaSuccessor(ssa, block, block->end);
+				break;
+			case HOSHI_OP_RETURN:
+			case HOSHI_OP_EXIT:
+				break;
+			default:
+				hoshi_addSsaSuccessor(ssa, block, block->end);
+				break;
+		}
+	}
+}
+
+/* Puts the blocks a path from the start of the chunk reaches in reverse postorder, and links up their predecessors */
+static void hoshi_orderSsaBlocks(hoshi_Ssa *ssa)
+{
+	int count = ssa->blockCount;
+	int *stack = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	int *next = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	int *postorder = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	bool *visited = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, bool, (count + 1));
+	memset(visited, 0, sizeof(bool) * (count + 1));
+	int stackCount = 0;
+	int postorderCount = 0;
+
+	stack[stackCount++] = 0;
+	visited[0] = true;
+	next[0] = 0;
+	while (stackCount > 0) {
+		hoshi_SsaBlock *block = &ssa->blocks[stack[stackCount - 1]];
+		if (next[stack[stackCount - 1]] < block->successorCount) {
+			int successor = block->successors[next[stack[stackCount - 1]]++];
+			if (!visited[successor]) {
+				visited[successor] = true;
+				next[successor] = 0;
+				stack[stackCount++] = successor;
+			}
+			continue;
+		}
+		postorder[postorderCount++] = stack[--stackCount];
+	}
+
+	ssa->order = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (postorderCount + 1));
+	ssa->orderCount = postorderCount;
+	for (int i = 0; i < postorderCount; i++) {
+		ssa->order[i] = postorder[postorderCount - 1 - i];
+		ssa->blocks[ssa->order[i]].order = i;
+	}
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, stack, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, next, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, postorder, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, bool, visited, count + 1);
+
+	/* The start of the chunk counts as one more way into the first block */
+	ssa->blocks[0].predecessorCount = 1;
+	for (int i = 0; i < ssa->orderCount; i++) {
+		hoshi_SsaBlock *block = &ssa->blocks[ssa->order[i]];
+		for (int s = 0; s < block->successorCount; s++) {
+			ssa->blocks[block->successors[s]].predecessorCount++;
+		}
+	}
+	for (int i = 0; i < ssa->orderCount; i++) {
+		hoshi_SsaBlock *block = &ssa->blocks[ssa->order[i]];
+		block->predecessors = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (block->predecessorCount + 1));
+		block->predecessorCount = 0;
+	}
+	ssa->blocks[0].predecessors[ssa->blocks[0].predecessorCount++] = -1;
+	for (int i = 0; i < ssa->orderCount; i++) {
+		hoshi_SsaBlock *block = &ssa->blocks[ssa->order[i]];
+		for (int s = 0; s < block->successorCount; s++) {
+			hoshi_SsaBlock *successor = &ssa->blocks[block->successors[s]];
+			successor->predecessors[successor->predecessorCount++] = ssa->order[i];
+		}
+	}
+}
+
+/* Works out how deep the stack is on entry to every block, into `depth`, and the deepest it gets anywhere, into `maxDepth`.
+ * Returns false if an instruction is unknown, pops more than there is, or if two paths into a block disagree. */
+static bool hoshi_measureSsaStack(hoshi_Ssa *ssa, int *maxDepth)
+{
+	*maxDepth = 0;
+	ssa->blocks[0].depth = 0;
+	for (int i = 0; i < ssa->orderCount; i++) {
+		hoshi_SsaBlock *block = &ssa->blocks[ssa->order[i]];
+		/* Some path that is not a loop back to the block comes first in reverse postorder, so the depth is known by now */
+		if (block->depth == -1) {
+			return false;
+		}
+		int depth = block->depth;
+		for (int j = block->start; j < block->end; j++) {
+			int index, pops, pushes;
+			if (!hoshi_ssaStackEffect(hoshi_ssaOpcode(&ssa->optimizer->instructions[j], &index), &pops, &pushes) || depth < pops) {
+				return false;
+			}
+			depth += pushes - pops;
+			if (depth > *maxDepth) {
+				*maxDepth = depth;
+			}
+		}
+		block->exitDepth = depth;
+		for (int s = 0; s < block->successorCount; s++) {
+			hoshi_SsaBlock *successor = &ssa->blocks[block->successors[s]];
+			if (successor->depth == -1) {
+				successor->depth = depth;
+			} else if (successor->depth != depth) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static int hoshi_intersectSsaDominators(hoshi_Ssa *ssa, int a, int b)
+{
+	while (a != b) {
+		while (ssa->blocks[a].order > ssa->blocks[b].order) {
+			a = ssa->blocks[a].dominator;
+		}
+		while (ssa->blocks[b].order > ssa->blocks[a].order) {
+			b = ssa->blocks[b].dominator;
+		}
+	}
+	return a;
+}
+
+/* Finds every block's immediate dominator, as in "A Simple, Fast Dominance Algorithm" by Cooper, Harvey, and Kennedy,
+ * then numbers the dominator tree so that hoshi_ssaDominates is two comparisons */
+static void hoshi_findSsaDominators(hoshi_Ssa *ssa)
+{
+	ssa->blocks[0].dominator = 0;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int i = 1; i < ssa->orderCount; i++) {
+			hoshi_SsaBlock *block = &ssa->blocks[ssa->order[i]];
+			int dominator = -1;
+			for (int p = 0; p < block->predecessorCount; p++) {
+				int predecessor = block->predecessors[p];
+				if (predecessor == -1 || ssa->blocks[predecessor].dominator == -1) {
+					continue;
+				}
+				dominator = dominator == -1 ? predecessor : hoshi_intersectSsaDominators(ssa, predecessor, dominator);
+			}
+			if (dominator != block->dominator) {
+				block->dominator = dominator;
+				changed = true;
+			}
+		}
+	}
+
+	int count = ssa->blockCount;
+	int *children = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	int *siblings = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	int *stack = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	for (int b = 0; b < count; b++) {
+		children[b] = -1;
+		siblings[b] = -1;
+	}
+	for (int i = ssa->orderCount - 1; i > 0; i--) {
+		int b = ssa->order[i];
+		int dominator = ssa->blocks[b].dominator;
+		siblings[b] = children[dominator];
+		children[dominator] = b;
+	}
+	int number = 0;
+	int stackCount = 0;
+	stack[stackCount++] = 0;
+	ssa->blocks[0].enter = number++;
+	while (stackCount > 0) {
+		int b = stack[stackCount - 1];
+		int child = children[b];
+		if (child == -1) {
+			ssa->blocks[b].exit = number++;
+			stackCount--;
+			continue;
+		}
+		children[b] = siblings[child];
+		ssa->blocks[child].enter = number++;
+		stack[stackCount++] = child;
+	}
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, children, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, siblings, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, stack, count + 1);
+}
+
+/* The variable an instruction uses, -1 if it uses none */
+static int hoshi_ssaVariable(hoshi_Ssa *ssa, hoshi_OpCode op, int index)
+{
+	switch (op) {
+		case HOSHI_OP_DEFLOCAL:
+		case HOSHI_OP_SETLOCAL:
+		case HOSHI_OP_GETLOCAL:
+			return index;
+		case HOSHI_OP_DEFGLOBAL:
+		case HOSHI_OP_SETGLOBAL:
+		case HOSHI_OP_GETGLOBAL:
+			return ssa->localCount + index;
+		default:
+			return -1;
+	}
+}
+
+/* Steps through a block, turning what every instruction pushes and stores into values.
+ * `stack` and `variables` hold what the block is entered with, and are left holding what it exits with. */
+static void hoshi_simulateSsaBlock(hoshi_Ssa *ssa, int b, int *stack, int *depth, int *variables)
+{
+	hoshi_SsaBlock *block = &ssa->blocks[b];
+	for (int i = block->start; i < block->end; i++) {
+		int index, pops, pushes;
+		hoshi_OpCode op = hoshi_ssaOpcode(&ssa->optimizer->instructions[i], &index);
+		hoshi_ssaStackEffect(op, &pops, &pushes);
+		int variable = hoshi_ssaVariable(ssa, op, index);
+		switch (op) {
+			case HOSHI_OP_GETLOCAL:
+			case HOSHI_OP_GETGLOBAL: {
+				int value = hoshi_newSsaValue(ssa, HOSHI_SSA_PUSH, b, i, 1);
+				ssa->values[value].operands[0] = variables[variable];
+				ssa->variable[i] = variables[variable];
+				ssa->pushed[i] = value;
+				stack[(*depth)++] = value;
+				break;
+			}
+			case HOSHI_OP_DEFLOCAL:
+			case HOSHI_OP_SETLOCAL:
+			case HOSHI_OP_DEFGLOBAL:
+			case HOSHI_OP_SETGLOBAL: {
+				int store = hoshi_newSsaValue(ssa, HOSHI_SSA_STORE, b, i, 1);
+				ssa->values[store].operands[0] = stack[*depth - 1];
+				variables[variable] = store;
+				ssa->variable[i] = store;
+				/* SETLOCAL and SETGLOBAL leave the value on the stack */
+				*depth -= pops - pushes;
+				break;
+			}
+			case HOSHI_OP_YIELD:
+			case HOSHI_OP_HOSTCALL: {
+				/* The host hands back a value nothing is known about, and may have changed any global while it was at it */
+				(*depth)--;
+				int value = hoshi_newSsaValue(ssa, HOSHI_SSA_PUSH, b, i, 0);
+				ssa->pushed[i] = value;
+				stack[(*depth)++] = value;
+				for (int global = 0; global < ssa->globalCount; global++) {
+					variables[ssa->localCount + global] = hoshi_newSsaValue(ssa, HOSHI_SSA_INITIAL, b, i, 0);
+				}
+				break;
+			}
+			case HOSHI_OP_ENDSCOPE:
+			case HOSHI_OP_CLEARLOCALS: {
+				/* The locals it clears do not hold what was stored in them before any more */
+				hoshi_OptInstruction *instruction = &ssa->optimizer->instructions[i];
+				int first = index | (instruction->operands[1] << 8);
+				for (int slot = first; slot < first + instruction->operands[2]; slot++) {
+					variables[slot] = hoshi_newSsaValue(ssa, HOSHI_SSA_INITIAL, b, i, 0);
+				}
+				break;
+			}
+			default: {
+				if (pushes == 0) {
+					*depth -= pops;
+					break;
+				}
+				int value = hoshi_newSsaValue(ssa, HOSHI_SSA_PUSH, b, i, pops);
+				for (int operand = 0; operand < pops; operand++) {
+					ssa->values[value].operands[operand] = stack[*depth - pops + operand];
+				}
+				*depth -= pops;
+				ssa->pushed[i] = value;
+				stack[(*depth)++] = value;
+				break;
+			}
+		}
+	}
+}
+
+/* Replaces phis that only ever see one value besides themselves with that value, until there are none left */
+static void hoshi_removeTrivialPhis(hoshi_Ssa *ssa)
+{
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int v = 0; v < ssa->valueCount; v++) {
+			hoshi_SsaValue *value = &ssa->values[v];
+			if (value->kind != HOSHI_SSA_PHI || value->replacement != -1) {
+				continue;
+			}
+			int same = -1;
+			bool trivial = true;
+			for (int i = 0; i < value->operandCount; i++) {
+				int operand = hoshi_resolveSsaValue(ssa, value->operands[i]);
+				if (operand == v || operand == same) {
+					continue;
+				}
+				if (same != -1) {
+					trivial = false;
+					break;
+				}
+				same = operand;
+			}
+			if (trivial && same != -1) {
+				value->replacement = same;
+				changed = true;
+			}
+		}
+	}
+}
+
+bool hoshi_buildSsa(hoshi_Ssa *ssa, hoshi_Optimizer *optimizer)
+{
+	ssa->optimizer = optimizer;
+	ssa->instructionCount = optimizer->count;
+	ssa->blocks = NULL;
+	ssa->blockCount = 0;
+	ssa->blockOf = NULL;
+	ssa->order = NULL;
+	ssa->orderCount = 0;
+	ssa->values = NULL;
+	ssa->valueCount = 0;
+	ssa->valueCapacity = 0;
+	ssa->pushed = NULL;
+	ssa->variable = NULL;
+	ssa->localCount = 0;
+	ssa->globalCount = 0;
+	ssa->variableCount = 0;
+	ssa->initial = NULL;
+	if (optimizer->count == 0) {
+		return false;
+	}
+
+	for (int i = 0; i < optimizer->count; i++) {
+		int index;
+		hoshi_OpCode op = hoshi_ssaOpcode(&optimizer->instructions[i], &index);
+		if (op == HOSHI_OP_DEFLOCAL || op == HOSHI_OP_SETLOCAL || op == HOSHI_OP_GETLOCAL) {
+			ssa->localCount = index + 1 > ssa->localCount ? index + 1 : ssa->localCount;
+		} else if (op == HOSHI_OP_ENDSCOPE || op == HOSHI_OP_CLEARLOCALS) {
+			/* Slots ENDSCOPE and CLEARLOCALS clear can not be given to temporaries, even if nothing else uses them any more */
+			int end = (index | (optimizer->instructions[i].operands[1] << 8)) + optimizer->instructions[i].operands[2];
+			ssa->localCount = end > ssa->localCount ? end : ssa->localCount;
+		} else if (op == HOSHI_OP_DEFGLOBAL || op == HOSHI_OP_SETGLOBAL || op == HOSHI_OP_GETGLOBAL) {
+			ssa->globalCount = index + 1 > ssa->globalCount ? index + 1 : ssa->globalCount;
+		}
+	}
+	ssa->variableCount = ssa->localCount + ssa->globalCount;
+
+	hoshi_findSsaBlocks(ssa);
+	hoshi_orderSsaBlocks(ssa);
+	int maxDepth;
+	if (!hoshi_measureSsaStack(ssa, &maxDepth) || (int64_t)ssa->orderCount * (ssa->variableCount + maxDepth + 1) > HOSHI_SSA_MAX_CELLS) {
+		hoshi_freeSsa(ssa);
+		return false;
+	}
+	hoshi_findSsaDominators(ssa);
+
+	ssa->pushed = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (optimizer->count + 1));
+	ssa->variable = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (optimizer->count + 1));
+	for (int i = 0; i <= optimizer->count; i++) {
+		ssa->pushed[i] = -1;
+		ssa->variable[i] = -1;
+	}
+	ssa->initial = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (ssa->variableCount + 1));
+	for (int v = 0; v < ssa->variableCount; v++) {
+		ssa->initial[v] = hoshi_newSsaValue(ssa, HOSHI_SSA_INITIAL, -1, -1, 0);
+	}
+
+	/* A block with a single predecessor picks up where it left off, which reverse postorder guarantees has been stepped through already.
+	 * Every other block gets a phi for every stack slot and variable, and the ones that turn out not to be needed are removed afterwards. */
+	int *stack = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (maxDepth + 1));
+	for (int i = 0; i < ssa->orderCount; i++) {
+		int b = ssa->order[i];
+		hoshi_SsaBlock *block = &ssa->blocks[b];
+		int *variables = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (ssa->variableCount + 1));
+		int depth = block->depth;
+		if (block->predecessorCount != 1) {
+			block->entryStack = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (depth + 1));
+			block->entryVariables = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (ssa->variableCount + 1));
+			for (int slot = 0; slot < depth; slot++) {
+				stack[slot] = block->entryStack[slot] = hoshi_newSsaValue(ssa, HOSHI_SSA_PHI, b, -1, block->predecessorCount);
+			}
+			for (int v = 0; v < ssa->variableCount; v++) {
+				variables[v] = block->entryVariables[v] = hoshi_newSsaValue(ssa, HOSHI_SSA_PHI, b, -1, block->predecessorCount);
+			}
+		} else if (block->predecessors[0] == -1) {
+			memcpy(variables, ssa->initial, sizeof(int) * ssa->variableCount);
+		} else {
+			hoshi_SsaBlock *predecessor = &ssa->blocks[block->predecessors[0]];
+			memcpy(stack, predecessor->exitStack, sizeof(int) * depth);
+			memcpy(variables, predecessor->exitVariables, sizeof(int) * ssa->variableCount);
+		}
+		hoshi_simulateSsaBlock(ssa, b, stack, &depth, variables);
+		block->exitStack = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (depth + 1));
+		memcpy(block->exitStack, stack, sizeof(int) * depth);
+		block->exitVariables = variables;
+	}
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, stack, maxDepth + 1);
+
+	for (int i = 0; i < ssa->orderCount; i++) {
+		hoshi_SsaBlock *block = &ssa->blocks[ssa->order[i]];
+		if (block->entryVariables == NULL) {
+			continue;
+		}
+		for (int p = 0; p < block->predecessorCount; p++) {
+			int predecessor = block->predecessors[p];
+			for (int slot = 0; slot < block->depth; slot++) {
+				/* Only the first block has the start of the chunk as a predecessor, and its stack starts out empty */
+				ssa->values[block->entryStack[slot]].operands[p] = ssa->blocks[predecessor].exitStack[slot];
+			}
+			for (int v = 0; v < ssa->variableCount; v++) {
+				int operand = predecessor == -1 ? ssa->initial[v] : ssa->blocks[predecessor].exitVariables[v];
+				ssa->values[block->entryVariables[v]].operands[p] = operand;
+			}
+		}
+	}
+	hoshi_removeTrivialPhis(ssa);
+	return true;
+}
+
+void hoshi_freeSsa(hoshi_Ssa *ssa)
+{
+	int count = ssa->instructionCount;
+	for (int b = 0; b < ssa->blockCount; b++) {
+		hoshi_SsaBlock *block = &ssa->blocks[b];
+		if (block->predecessors != NULL) {
+			HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, block->predecessors, block->predecessorCount + 1);
+		}
+		if (block->entryStack != NULL) {
+			HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, block->entryStack, block->depth + 1);
+			HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, block->entryVariables, ssa->variableCount + 1);
+		}
+		if (block->exitStack != NULL) {
+			HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, block->exitStack, block->exitDepth + 1);
+			HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, block->exitVariables, ssa->variableCount + 1);
+		}
+	}
+	if (ssa->blocks != NULL) {
+		HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, hoshi_SsaBlock, ssa->blocks, ssa->blockCount + 1);
+		HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, ssa->blockOf, count + 1);
+	}
+	if (ssa->order != NULL) {
+		HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, ssa->order, ssa->orderCount + 1);
+	}
+	for (int v = 0; v < ssa->valueCount; v++) {
+		HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, ssa->values[v].operands, ssa->values[v].operandCount + 1);
+	}
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, hoshi_SsaValue, ssa->values, ssa->valueCapacity);
+	if (ssa->pushed != NULL) {
+		HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, ssa->pushed, count + 1);
+		HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, ssa->variable, count + 1);
+	}
+	if (ssa->initial != NULL) {
+		HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, ssa->initial, ssa->variableCount + 1);
+	}
+	ssa->blocks = NULL;
+	ssa->order = NULL;
+	ssa->values = NULL;
+	ssa->valueCount = 0;
+	ssa->valueCapacity = 0;
+	ssa->pushed = NULL;
+	ssa->initial = NULL;
+}
+
+/* What value numbering looks values up by: an operation and the numbers of its operands, or a constant */
+typedef struct {
+	int op; /* -1 for constants */
+	int index; /* GETGLOBAL: the global. Constants: their type. */
+	int a;
+	int b;
+	uint64_t bits; /* Constants: their value */
+	int number; /* -1 for empty slots in hoshi_SsaNumbering */
+} hoshi_SsaKey;
+
+typedef struct {
+	const hoshi_Allocator *allocator;
+	hoshi_SsaKey *keys;
+	int count;
+	int capacity;
+	int next; /* The next number to hand out */
+} hoshi_SsaNumbering;
+
+static uint32_t hoshi_hashSsaKey(hoshi_SsaKey *key)
+{
+	/* FNV-1a, one field at a time */
+	uint64_t fields[5] = {(uint32_t)key->op, (uint32_t)key->index, (uint32_t)key->a, (uint32_t)key->b, key->bits};
+	uint64_t hash = 14695981039346656037u;
+	for (int i = 0; i < 5; i++) {
+		hash ^= fields[i];
+		hash *= 1099511628211u;
+	}
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static bool hoshi_ssaKeysEqual(hoshi_SsaKey *a, hoshi_SsaKey *b)
+{
+	return a->op == b->op && a->index == b->index && a->a == b->a && a->b == b->b && a->bits == b->bits;
+}
+
+/* The number for `key`, which is a new one if nothing had that key yet */
+static int hoshi_ssaKeyNumber(hoshi_SsaNumbering *numbering, hoshi_SsaKey key)
+{
+	if ((numbering->count + 1) * 2 > numbering->capacity) {
+		int oldCapacity = numbering->capacity;
+		hoshi_SsaKey *oldKeys = numbering->keys;
+		numbering->capacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+		numbering->keys = HOSHI_ALLOCATE(numbering->allocator, hoshi_SsaKey, numbering->capacity);
+		for (int i = 0; i < numbering->capacity; i++) {
+			numbering->keys[i].number = -1;
+		}
+		for (int i = 0; i < oldCapacity; i++) {
+			if (oldKeys[i].number == -1) {
+				continue;
+			}
+			uint32_t slot = hoshi_hashSsaKey(&oldKeys[i]) & (numbering->capacity - 1);
+			while (numbering->keys[slot].number != -1) {
+				slot = (slot + 1) & (numbering->capacity - 1);
+			}
+			numbering->keys[slot] = oldKeys[i];
+		}
+		if (oldKeys != NULL) {
+			HOSHI_FREE_ARRAY(numbering->allocator, hoshi_SsaKey, oldKeys, oldCapacity);
+		}
+	}
+
+	uint32_t slot = hoshi_hashSsaKey(&key) & (numbering->capacity - 1);
+	while (numbering->keys[slot].number != -1) {
+		if (hoshi_ssaKeysEqual(&numbering->keys[slot], &key)) {
+			return numbering->keys[slot].number;
+		}
+		slot = (slot + 1) & (numbering->capacity - 1);
+	}
+	key.number = numbering->next++;
+	numbering->keys[slot] = key;
+	numbering->count++;
+	return key.number;
+}
+
+/* The bits of a constant, which together with its type tell it apart from every other constant */
+static uint64_t hoshi_ssaConstantBits(hoshi_Value value)
+{
+	if (HOSHI_IS_NUMBER(value)) {
+		double number = HOSHI_AS_NUMBER(value);
+		uint64_t bits;
+		memcpy(&bits, &number, sizeof(bits));
+		return bits;
+	}
+	if (HOSHI_IS_INTEGER(value)) {
+		return (uint64_t)HOSHI_AS_INTEGER(value);
+	}
+	if (HOSHI_IS_BOOL(value)) {
+		return HOSHI_AS_BOOL(value);
+	}
+	if (HOSHI_IS_OBJECT(value)) {
+		return (uint64_t)(uintptr_t)HOSHI_AS_OBJECT(value);
+	}
+	return 0;
+}
+
+static int hoshi_ssaValueNumber(hoshi_Ssa *ssa, hoshi_SsaNumbering *numbering, int v)
+{
+	v = hoshi_resolveSsaValue(ssa, v);
+	if (ssa->values[v].number != -1) {
+		return ssa->values[v].number;
+	}
+
+	hoshi_SsaValue *value = &ssa->values[v];
+	int number = -1;
+	int index;
+	hoshi_OpCode op = value->instruction != -1 ? hoshi_ssaOpcode(&ssa->optimizer->instructions[value->instruction], &index) : HOSHI_OP_RETURN;
+	if (value->kind == HOSHI_SSA_STORE && (op == HOSHI_OP_SETLOCAL || op == HOSHI_OP_DEFLOCAL)) {
+		/* A local holds exactly what was stored in it. Globals do not: getting one that holds nil panics. */
+		number = hoshi_ssaValueNumber(ssa, numbering, value->operands[0]);
+	} else if (value->kind == HOSHI_SSA_PUSH && op == HOSHI_OP_GETLOCAL) {
+		number = hoshi_ssaValueNumber(ssa, numbering, value->operands[0]);
+	} else if (value->kind == HOSHI_SSA_PUSH && (hoshi_ssaIsPure(op))) {
+		hoshi_SsaKey key = {op, 0, -1, -1, 0, -1};
+		if (op == HOSHI_OP_CONSTANT || op == HOSHI_OP_TRUE || op == HOSHI_OP_FALSE || op == HOSHI_OP_NIL) {
+			hoshi_Value constant = ssa->optimizer->instructions[value->instruction].value;
+			key.op = -1;
+			key.index = HOSHI_VALUE_TYPE(constant);
+			key.bits = hoshi_ssaConstantBits(constant);
+		} else {
+			if (op == HOSHI_OP_GETGLOBAL) {
+				key.index = index;
+			}
+			key.a = hoshi_ssaValueNumber(ssa, numbering, value->operands[0]);
+			if (value->operandCount == 2) {
+				key.b = hoshi_ssaValueNumber(ssa, numbering, value->operands[1]);
+			}
+			if (hoshi_ssaIsCommutative(op) && key.a > key.b) {
+				int swap = key.a;
+				key.a = key.b;
+				key.b = swap;
+			}
+		}
+		number = hoshi_ssaKeyNumber(numbering, key);
+	} else {
+		/* Phis, the values variables start out with, what the host hands back, and stores to globals are only equal to themselves */
+		number = numbering->next++;
+	}
+	ssa->values[v].number = number;
+	return number;
+}
+
+void hoshi_numberSsaValues(hoshi_Ssa *ssa)
+{
+	hoshi_SsaNumbering numbering;
+	numbering.allocator = ssa->optimizer->chunk->allocator;
+	numbering.keys = NULL;
+	numbering.count = 0;
+	numbering.capacity = 0;
+	numbering.next = 0;
+	/* Values only refer back to values created before them, except for phis, so going in order keeps the recursion shallow */
+	for (int v = 0; v < ssa->valueCount; v++) {
+		ssa->values[v].number = hoshi_ssaValueNumber(ssa, &numbering, v);
+	}
+	if (numbering.keys != NULL) {
+		HOSHI_FREE_ARRAY(numbering.allocator, hoshi_SsaKey, numbering.keys, numbering.capacity);
+	}
+}
+
+/* Finds where the code that pushes the operands of the instruction at `root` starts, when all of it is pure and inside the same block.
+ * Replacing everything from there to `root` with a single push then leaves the stack just as it was. Returns -1 if there is no such start. */
+static int hoshi_ssaRangeStart(hoshi_Ssa *ssa, int root)
+{
+	hoshi_OptInstruction *instructions = ssa->optimizer->instructions;
+	int start = ssa->blocks[ssa->blockOf[root]].start;
+	int index, pops, pushes;
+	hoshi_ssaStackEffect(hoshi_ssaOpcode(&instructions[root], &index), &pops, &pushes);
+	int needed = pops;
+	int i = root;
+	while (needed > 0) {
+		if (--i < start) {
+			return -1;
+		}
+		hoshi_OpCode op = hoshi_ssaOpcode(&instructions[i], &index);
+		if (!hoshi_ssaIsPure(op)) {
+			return -1;
+		}
+		hoshi_ssaStackEffect(op, &pops, &pushes);
+		needed += pops - 1;
+	}
+	return i;
+}
+
+/* The edits a pass makes to the instruction list, applied all at once by hoshi_applySsaEdits */
+typedef struct {
+	bool *skipped; /* Per instruction: left out */
+	int *loads; /* Per instruction: a local to GETLOCAL in its place, -1 for none */
+	int *saves; /* Per instruction: a local to SETLOCAL right after it, -1 for none */
+	int *hoisted; /* Per instruction: the start of the first range of instructions to copy in front of it, -1 for none */
+	int *hoistedEnd; /* Per range start: the last instruction of the range, */
+	int *hoistedSlot; /* the local the range's value goes into, */
+	int *hoistedNext; /* and the start of the next range copied in front of the same instruction, -1 for none */
+	bool **loops; /* Per block: the blocks of the loop it heads, if anything was hoisted out of that loop */
+	int slot; /* The next spare local */
+	bool changed;
+} hoshi_SsaEdits;
+
+static void hoshi_initSsaEdits(hoshi_SsaEdits *edits, hoshi_Ssa *ssa)
+{
+	int count = ssa->instructionCount;
+	edits->skipped = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, bool, (count + 1));
+	edits->loads = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	edits->saves = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	edits->hoisted = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	edits->hoistedEnd = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	edits->hoistedSlot = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	edits->hoistedNext = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, int, (count + 1));
+	for (int i = 0; i <= count; i++) {
+		edits->skipped[i] = false;
+		edits->loads[i] = -1;
+		edits->saves[i] = -1;
+		edits->hoisted[i] = -1;
+		edits->hoistedEnd[i] = -1;
+		edits->hoistedSlot[i] = -1;
+		edits->hoistedNext[i] = -1;
+	}
+	edits->loops = HOSHI_ALLOCATE(ssa->optimizer->chunk->allocator, bool *, (ssa->blockCount + 1));
+	for (int b = 0; b <= ssa->blockCount; b++) {
+		edits->loops[b] = NULL;
+	}
+	/* Locals past every one the chunk uses are free for values the passes want to keep around */
+	edits->slot = ssa->localCount;
+	edits->changed = false;
+}
+
+static void hoshi_freeSsaEdits(hoshi_SsaEdits *edits, hoshi_Ssa *ssa)
+{
+	int count = ssa->instructionCount;
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, bool, edits->skipped, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, edits->loads, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, edits->saves, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, edits->hoisted, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, edits->hoistedEnd, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, edits->hoistedSlot, count + 1);
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, int, edits->hoistedNext, count + 1);
+	for (int b = 0; b < ssa->blockCount; b++) {
+		if (edits->loops[b] != NULL) {
+			HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, bool, edits->loops[b], ssa->blockCount + 1);
+		}
+	}
+	HOSHI_FREE_ARRAY(ssa->optimizer->chunk->allocator, bool *, edits->loops, ssa->blockCount + 1);
+}
+
+/* Rebuilds the optimizer's instruction list with the edits made. Hoisted ranges go in front of the start of their loop,
+ * where jumps from outside the loop land, while jumps from inside the loop still land on its first instruction. */
+static void hoshi_applySsaEdits(hoshi_Ssa *ssa, hoshi_SsaEdits *edits)
+{
+	hoshi_Optimizer *optimizer = ssa->optimizer;
+	hoshi_OptInstruction *old = optimizer->instructions;
+	int count = optimizer->count;
+
+	int newCount = 0;
+	for (int i = 0; i < count; i++) {
+		for (int range = edits->hoisted[i]; range != -1; range = edits->hoistedNext[range]) {
+			newCount += edits->hoistedEnd[range] - range + 2;
+		}
+		newCount += (edits->loads[i] != -1) + !edits->skipped[i] + (edits->saves[i] != -1);
+	}
+
+	hoshi_OptInstruction *instructions = HOSHI_ALLOCATE(optimizer->chunk->allocator, hoshi_OptInstruction, (newCount + 1));
+	/* Where each new instruction came from, -1 for the ones the edits added */
+	int *origins = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (newCount + 1));
+	/* Where jumps to each old instruction land, from outside and from inside the loop it might start */
+	int *outside = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (count + 1));
+	int *inside = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (count + 1));
+	int n = 0;
+	for (int i = 0; i <= count; i++) {
+		outside[i] = n;
+		if (i < count) {
+			for (int range = edits->hoisted[i]; range != -1; range = edits->hoistedNext[range]) {
+				for (int j = range; j <= edits->hoistedEnd[range]; j++) {
+					origins[n] = j;
+					instructions[n++] = old[j];
+				}
+				origins[n] = -1;
+				instructions[n++] = hoshi_ssaLocalInstruction(HOSHI_OP_DEFLOCAL, edits->hoistedSlot[range], old[edits->hoistedEnd[range]].line);
+			}
+		}
+		inside[i] = n;
+		if (i == count) {
+			break;
+		}
+		if (edits->loads[i] != -1) {
+			origins[n] = -1;
+			instructions[n++] = hoshi_ssaLocalInstruction(HOSHI_OP_GETLOCAL, edits->loads[i], old[i].line);
+		}
+		if (!edits->skipped[i]) {
+			origins[n] = i;
+			instructions[n++] = old[i];
+		}
+		if (edits->saves[i] != -1) {
+			origins[n] = -1;
+			instructions[n++] = hoshi_ssaLocalInstruction(HOSHI_OP_SETLOCAL, edits->saves[i], old[i].line);
+		}
+	}
+
+	for (int j = 0; j < n; j++) {
+		hoshi_OptInstruction *instruction = &instructions[j];
+		if (!hoshi_ssaIsJump(instruction->op)) {
+			continue;
+		}
+		int target = instruction->target;
+		int block = target < count ? ssa->blockOf[target] : -1;
+		bool fromInside = block != -1 && edits->loops[block] != NULL && edits->loops[block][ssa->blockOf[origins[j]]];
+		instruction->target = fromInside ? inside[target] : outside[target];
+	}
+
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, origins, newCount + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, outside, count + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, inside, count + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, hoshi_OptInstruction, old, count + 1);
+	optimizer->instructions = instructions;
+	optimizer->count = n;
+	hoshi_markSsaTargets(optimizer);
+}
+
+/* Value numbering. An operation whose value number matches one that ran earlier on every path to it gets the same value,
+ * and running it could not panic since the earlier one did not. So the earlier one saves its value into a spare local,
+ * and the later one, along with everything that pushed its operands, becomes a GETLOCAL of that local. */
+static void hoshi_reuseSsaValues(hoshi_Optimizer *optimizer)
+{
+	hoshi_Ssa ssa;
+	if (!hoshi_buildSsa(&ssa, optimizer)) {
+		return;
+	}
+	hoshi_numberSsaValues(&ssa);
+	int count = optimizer->count;
+	int numbers = 0;
+	for (int v = 0; v < ssa.valueCount; v++) {
+		numbers = ssa.values[v].number + 1 > numbers ? ssa.values[v].number + 1 : numbers;
+	}
+
+	/* `same` holds an earlier instruction that always pushed the same value, and `firsts` the instructions nothing earlier pushed the value of,
+	 * linked up by value number through `heads` and `nexts` */
+	int *same = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (count + 1));
+	int *nexts = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (count + 1));
+	int *starts = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (count + 1));
+	int *heads = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (numbers + 1));
+	bool *covered = HOSHI_ALLOCATE(optimizer->chunk->allocator, bool, (count + 1));
+	for (int i = 0; i <= count; i++) {
+		same[i] = -1;
+		nexts[i] = -1;
+		starts[i] = -1;
+		covered[i] = false;
+	}
+	for (int n = 0; n <= numbers; n++) {
+		heads[n] = -1;
+	}
+
+	for (int k = 0; k < ssa.orderCount; k++) {
+		hoshi_SsaBlock *block = &ssa.blocks[ssa.order[k]];
+		for (int i = block->start; i < block->end; i++) {
+			int index;
+			if (ssa.pushed[i] == -1 || !hoshi_ssaIsOperation(hoshi_ssaOpcode(&optimizer->instructions[i], &index))) {
+				continue;
+			}
+			int number = ssa.values[ssa.pushed[i]].number;
+			for (int first = heads[number]; first != -1 && same[i] == -1; first = nexts[first]) {
+				if (hoshi_ssaInstructionDominates(&ssa, first, i)) {
+					same[i] = first;
+				}
+			}
+			if (same[i] == -1) {
+				nexts[i] = heads[number];
+				heads[number] = i;
+			}
+		}
+	}
+
+	/* Going backwards picks the biggest operation first, the smaller ones that push its operands go away with it */
+	for (int k = 0; k < ssa.orderCount; k++) {
+		hoshi_SsaBlock *block = &ssa.blocks[ssa.order[k]];
+		for (int i = block->end - 1; i >= block->start; i--) {
+			if (same[i] == -1) {
+				continue;
+			}
+			int start = hoshi_ssaRangeStart(&ssa, i);
+			if (start == -1) {
+				continue;
+			}
+			starts[i] = start;
+			for (int j = start; j <= i; j++) {
+				covered[j] = true;
+			}
+			i = start;
+		}
+	}
+	/* An earlier instruction that went away itself can not save its value for anyone */
+	for (int i = 0; i < count; i++) {
+		if (starts[i] != -1 && covered[same[i]]) {
+			for (int j = starts[i]; j <= i; j++) {
+				covered[j] = false;
+			}
+			starts[i] = -1;
+		}
+	}
+
+	hoshi_SsaEdits edits;
+	hoshi_initSsaEdits(&edits, &ssa);
+	for (int i = 0; i < count; i++) {
+		if (starts[i] == -1) {
+			continue;
+		}
+		int first = same[i];
+		if (edits.saves[first] == -1) {
+			if (edits.slot >= HOSHI_LOCALS_SIZE) {
+				continue;
+			}
+			edits.saves[first] = edits.slot++;
+		}
+		edits.loads[starts[i]] = edits.saves[first];
+		for (int j = starts[i]; j <= i; j++) {
+			edits.skipped[j] = true;
+		}
+		optimizer->stats->redundant++;
+		edits.changed = true;
+	}
+	if (edits.changed) {
+		hoshi_applySsaEdits(&ssa, &edits);
+	}
+
+	hoshi_freeSsaEdits(&edits, &ssa);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, same, count + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, nexts, count + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, starts, count + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, heads, numbers + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, bool, covered, count + 1);
+	hoshi_freeSsa(&ssa);
+}
+
+/* Whether the instructions from `start` to `end` push the same value on every iteration of the loop made of the blocks in `loop` */
+static bool hoshi_ssaIsInvariant(hoshi_Ssa *ssa, int start, int end, bool *loop)
+{
+	for (int i = start; i <= end; i++) {
+		int index;
+		hoshi_OpCode op = hoshi_ssaOpcode(&ssa->optimizer->instructions[i], &index);
+		if (op != HOSHI_OP_GETLOCAL && op != HOSHI_OP_GETGLOBAL) {
+			continue;
+		}
+		int block = ssa->values[hoshi_resolveSsaValue(ssa, ssa->variable[i])].block;
+		if (block != -1 && loop[block]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Loop-invariant code motion. A block that dominates a block jumping back to it starts a loop.
+ * Operations at the start of the loop that read nothing the loop changes move in front of it, into a spare local.
+ * Those that could panic only move if nothing but moved or quiet instructions comes before them in the first block,
+ * so a panic still comes before anything the loop would have printed or stored, and on the same line. */
+static void hoshi_hoistSsaInvariants(hoshi_Optimizer *optimizer)
+{
+	hoshi_Ssa ssa;
+	if (!hoshi_buildSsa(&ssa, optimizer)) {
+		return;
+	}
+	int count = optimizer->count;
+	hoshi_SsaEdits edits;
+	hoshi_initSsaEdits(&edits, &ssa);
+	int *ends = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (count + 1));
+	int *pending = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (ssa.blockCount + 1));
+	for (int i = 0; i <= count; i++) {
+		ends[i] = -1;
+	}
+
+	for (int k = 0; k < ssa.orderCount; k++) {
+		int header = ssa.order[k];
+		hoshi_SsaBlock *block = &ssa.blocks[header];
+
+		/* The loop is every block that reaches a jump back to the header without going through the header */
+		bool *loop = NULL;
+		for (int p = 0; p < block->predecessorCount; p++) {
+			int latch = block->predecessors[p];
+			if (latch == -1 || !hoshi_ssaDominates(&ssa, header, latch)) {
+				continue;
+			}
+			if (loop == NULL) {
+				loop = HOSHI_ALLOCATE(optimizer->chunk->allocator, bool, (ssa.blockCount + 1));
+				memset(loop, 0, sizeof(bool) * (ssa.blockCount + 1));
+				loop[header] = true;
+			}
+			int pendingCount = 0;
+			if (!loop[latch]) {
+				loop[latch] = true;
+				pending[pendingCount++] = latch;
+			}
+			while (pendingCount > 0) {
+				hoshi_SsaBlock *member = &ssa.blocks[pending[--pendingCount]];
+				for (int q = 0; q < member->predecessorCount; q++) {
+					int predecessor = member->predecessors[q];
+					if (predecessor != -1 && !loop[predecessor]) {
+						loop[predecessor] = true;
+						pending[pendingCount++] = predecessor;
+					}
+				}
+			}
+		}
+		if (loop == NULL) {
+			continue;
+		}
+
+		/* Biggest invariant operations first, going backwards like value numbering does */
+		for (int i = block->end - 1; i >= block->start; i--) {
+			int index;
+			hoshi_OpCode op = hoshi_ssaOpcode(&optimizer->instructions[i], &index);
+			if (ssa.pushed[i] == -1 || !hoshi_ssaIsPure(op)) {
+				continue;
+			}
+			int start = hoshi_ssaRangeStart(&ssa, i);
+			if (start == -1 || !hoshi_ssaIsInvariant(&ssa, start, i, loop)) {
+				continue;
+			}
+			/* Moving a constant or a GETLOCAL only trades it for another GETLOCAL */
+			if (op == HOSHI_OP_GETGLOBAL || hoshi_ssaIsOperation(op)) {
+				ends[start] = i;
+			}
+			i = start;
+		}
+
+		int *last = &edits.hoisted[block->start];
+		bool hoisted = false;
+		for (int i = block->start; i < block->end; i++) {
+			int index;
+			if (ends[i] != -1) {
+				if (edits.slot >= HOSHI_LOCALS_SIZE) {
+					break;
+				}
+				edits.hoistedEnd[i] = ends[i];
+				edits.hoistedSlot[i] = edits.slot;
+				*last = i;
+				last = &edits.hoistedNext[i];
+				edits.loads[i] = edits.slot++;
+				for (int j = i; j <= ends[i]; j++) {
+					edits.skipped[j] = true;
+				}
+				optimizer->stats->hoisted++;
+				hoisted = true;
+				i = ends[i];
+				continue;
+			}
+			if (!hoshi_ssaIsQuiet(hoshi_ssaOpcode(&optimizer->instructions[i], &index))) {
+				break;
+			}
+		}
+		if (hoisted) {
+			edits.loops[header] = loop;
+			edits.changed = true;
+		} else {
+			HOSHI_FREE_ARRAY(optimizer->chunk->allocator, bool, loop, ssa.blockCount + 1);
+		}
+	}
+	if (edits.changed) {
+		hoshi_applySsaEdits(&ssa, &edits);
+	}
+
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, ends, count + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, pending, ssa.blockCount + 1);
+	hoshi_freeSsaEdits(&edits, &ssa);
+	hoshi_freeSsa(&ssa);
+}
+
+/* Dead store elimination. A store to a local is dead when no GETLOCAL reads it, directly or through a phi.
+ * SETLOCAL leaves its value on the stack, so a dead one just goes away. A dead DEFLOCAL still has to pop its value. */
+static void hoshi_removeDeadSsaStores(hoshi_Optimizer *optimizer)
+{
+	hoshi_Ssa ssa;
+	if (!hoshi_buildSsa(&ssa, optimizer)) {
+		return;
+	}
+	int count = optimizer->count;
+	bool *read = HOSHI_ALLOCATE(optimizer->chunk->allocator, bool, (ssa.valueCount + 1));
+	memset(read, 0, sizeof(bool) * (ssa.valueCount + 1));
+	/* Every value gets marked once at most, so there can never be more pending than there are values */
+	int *pending = HOSHI_ALLOCATE(optimizer->chunk->allocator, int, (ssa.valueCount + 1));
+	int pendingCount = 0;
+
+	for (int i = 0; i < count; i++) {
+		int index;
+		if (hoshi_ssaOpcode(&optimizer->instructions[i], &index) != HOSHI_OP_GETLOCAL || ssa.variable[i] == -1) {
+			continue;
+		}
+		int value = hoshi_resolveSsaValue(&ssa, ssa.variable[i]);
+		if (!read[value]) {
+			read[value] = true;
+			pending[pendingCount++] = value;
+		}
+	}
+	while (pendingCount > 0) {
+		hoshi_SsaValue *phi = &ssa.values[pending[--pendingCount]];
+		if (phi->kind != HOSHI_SSA_PHI) {
+			continue;
+		}
+		for (int i = 0; i < phi->operandCount; i++) {
+			int value = hoshi_resolveSsaValue(&ssa, phi->operands[i]);
+			if (!read[value]) {
+				read[value] = true;
+				pending[pendingCount++] = value;
+			}
+		}
+	}
+
+	hoshi_SsaEdits edits;
+	hoshi_initSsaEdits(&edits, &ssa);
+	for (int i = 0; i < count; i++) {
+		hoshi_OptInstruction *instruction = &optimizer->instructions[i];
+		int index;
+		hoshi_OpCode op = hoshi_ssaOpcode(instruction, &index);
+		if ((op != HOSHI_OP_SETLOCAL && op != HOSHI_OP_DEFLOCAL) || ssa.variable[i] == -1 || read[ssa.variable[i]]) {
+			continue;
+		}
+		if (op == HOSHI_OP_SETLOCAL) {
+			edits.skipped[i] = true;
+			edits.changed = true;
+		} else {
+			instruction->op = HOSHI_OP_POP;
+			instruction->length = 1;
+		}
+		optimizer->stats->deadStores++;
+	}
+	if (edits.changed) {
+		hoshi_applySsaEdits(&ssa, &edits);
+	}
+
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, bool, read, ssa.valueCount + 1);
+	HOSHI_FREE_ARRAY(optimizer->chunk->allocator, int, pending, ssa.valueCount + 1);
+	hoshi_freeSsaEdits(&edits, &ssa);
+	hoshi_freeSsa(&ssa);
+}
+
+void hoshi_optimizeSsa(hoshi_Optimizer *optimizer)
+{
+	hoshi_dropRemovedInstructions(optimizer);
+	/* Hoisting first leaves the copies value numbering makes in front of loops instead of inside them */
+	hoshi_hoistSsaInvariants(optimizer);
+	hoshi_reuseSsaValues(optimizer);
+	hoshi_removeDeadSsaStores(optimizer);
+}
+
+#endif
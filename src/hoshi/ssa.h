@@ -0,0 +1,96 @@
+#ifndef __HOSHI_SSA_H__
+#define __HOSHI_SSA_H__
+
+#include "optimizer.h"
+#include <stdbool.h>
+
+/* SSA form of a chunk, for the optimizer passes that need to know where a value came from.
+ * The code is split into basic blocks at jump targets and after jumps, and every value on the stack, in a local, or in a global
+ * becomes a hoshi_SsaValue that is defined exactly once. Where blocks meet, a phi stands for whichever value the block was entered with.
+ * The passes never build code from the SSA form alone, they use it to decide how to edit the instruction list it was built from,
+ * which keeps everything they leave alone exactly as it was. A frontend gets the same passes by handing its bytecode to hoshi_optimizeChunk. */
+
+typedef enum {
+	HOSHI_SSA_INITIAL, /* What a variable holds before the chunk runs, or a global after YIELD or HOSTCALL let the host change it */
+	HOSHI_SSA_PHI,
+	HOSHI_SSA_PUSH, /* Pushed by an instruction */
+	HOSHI_SSA_STORE, /* Written to a local or global by an instruction */
+} hoshi_SsaKind;
+
+typedef struct {
+	hoshi_SsaKind kind;
+	int block; /* Where the value is defined, -1 for the values variables start out with */
+	int instruction; /* PUSH and STORE: the instruction that defines the value, -1 otherwise */
+	/* PUSH: the values the instruction pops, deepest first, or for GETLOCAL and GETGLOBAL the value of the variable it reads.
+	 * STORE: the value stored. PHI: one per predecessor of `block`, in the same order. */
+	int *operands;
+	int operandCount;
+	int replacement; /* Phis that only ever see one value are replaced by it, -1 otherwise */
+	int number; /* Values that are known to be equal get the same number */
+} hoshi_SsaValue;
+
+typedef struct {
+	int start; /* First instruction */
+	int end; /* One past the last instruction */
+	int successors[2];
+	int successorCount;
+	int *predecessors; /* -1 stands for the start of the chunk */
+	int predecessorCount;
+	int depth; /* Stack depth on entry, -1 until known */
+	int *entryStack; /* Phis for the stack and variables on entry, for blocks with more or less than one predecessor */
+	int *entryVariables;
+	int *exitStack; /* The stack and variables on exit, `depth` and `variableCount` long when there are none */
+	int exitDepth;
+	int *exitVariables;
+	int order; /* Position in reverse postorder, -1 if no path from the start of the chunk reaches the block */
+	int dominator; /* Immediate dominator, the start block is its own */
+	int enter; /* Dominator tree preorder and postorder numbers, for hoshi_ssaDominates */
+	int exit;
+} hoshi_SsaBlock;
+
+typedef struct {
+	hoshi_Optimizer *optimizer;
+	int instructionCount; /* What the optimizer's instruction count was when the SSA form was built */
+	hoshi_SsaBlock *blocks;
+	int blockCount;
+	int *blockOf; /* Per instruction */
+	int *order; /* Blocks a path reaches, in reverse postorder */
+	int orderCount;
+	hoshi_SsaValue *values;
+	int valueCount;
+	int valueCapacity;
+	int *pushed; /* Per instruction, the value it pushes, -1 for none. SETLOCAL and SETGLOBAL leave their value where it was. */
+	int *variable; /* Per instruction, the value GETLOCAL and GETGLOBAL read, or the STORE that SETLOCAL, DEFLOCAL, SETGLOBAL, and DEFGLOBAL make */
+	int localCount; /* Locals are variables 0 to localCount - 1, globals come after them */
+	int globalCount;
+	int variableCount;
+	int *initial; /* HOSHI_SSA_INITIAL value per variable */
+} hoshi_Ssa;
+
+/* Builds the SSA form of the optimizer's instructions, which must not have removed instructions among them.
+ * Returns false, with nothing left to free, if the code does something the SSA form has no place for:
+ * an unknown instruction, a stack that is not equally deep on every path into a block, or more variables than HOSHI_SSA_MAX_CELLS allows. */
+bool hoshi_buildSsa(hoshi_Ssa *ssa, hoshi_Optimizer *optimizer);
+
+void hoshi_freeSsa(hoshi_Ssa *ssa);
+
+/* Follows replaced phis to the value that stands in for them */
+int hoshi_resolveSsaValue(hoshi_Ssa *ssa, int value);
+
+/* Whether every path from the start of the chunk to block `b` goes through block `a` */
+bool hoshi_ssaDominates(hoshi_Ssa *ssa, int a, int b);
+
+/* Gives every value its `number`. Values get the same number when they are the same constant, the same local,
+ * or the same pure operation on values with the same numbers. */
+void hoshi_numberSsaValues(hoshi_Ssa *ssa);
+
+/* Runs the SSA passes over the optimizer's instructions, in order:
+ * - Loop-invariant code motion: operations at the start of a loop whose operands do not change inside the loop, such as a GETGLOBAL
+ *   of a global the loop never sets, are worked out once in front of the loop, into a spare local.
+ * - Value numbering: an operation that was already worked out on every path to it is replaced by a GETLOCAL of a spare local,
+ *   which the first one fills in with a SETLOCAL.
+ * - Dead store elimination: SETLOCALs nothing reads the value of are removed, and such DEFLOCALs become POPs.
+ * Removed instructions are dropped from the list first. Nothing is changed where the SSA form can not be built. */
+void hoshi_optimizeSsa(hoshi_Optimizer *optimizer);
+
+#endif
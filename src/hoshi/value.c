@@ -3,11 +3,12 @@
 
 #include "value.h"
 #include "object.h"
+#include <inttypes.h>
 #include <stdio.h>
 
 void hoshi_printValue(hoshi_Value value)
 {
-	switch (value.type) {
+	switch (HOSHI_VALUE_TYPE(value)) {
 		case HOSHI_TYPE_NUMBER:
 			printf("%g", HOSHI_AS_NUMBER(value));
 			break;
@@ -20,15 +21,19 @@ void hoshi_printValue(hoshi_Value value)
 		case HOSHI_TYPE_OBJECT:
 			hoshi_printObject(value);
 			break;
+		case HOSHI_TYPE_INTEGER:
+			printf("%" PRId64, HOSHI_AS_INTEGER(value));
+			break;
         }
 }
 
+/* Values of different types are never equal, not even an integer and a number with the same value */
 bool hoshi_valuesEqual(hoshi_Value a, hoshi_Value b)
 {
-	if (a.type != b.type) {
+	if (HOSHI_VALUE_TYPE(a) != HOSHI_VALUE_TYPE(b)) {
 		return false;
 	}
-	switch (a.type) {
+	switch (HOSHI_VALUE_TYPE(a)) {
 		case HOSHI_TYPE_NUMBER:
 			return HOSHI_AS_NUMBER(a) == HOSHI_AS_NUMBER(b);
 		case HOSHI_TYPE_NIL:
@@ -36,7 +41,12 @@ bool hoshi_valuesEqual(hoshi_Value a, hoshi_Value b)
 		case HOSHI_TYPE_BOOL:
 			return HOSHI_AS_BOOL(a) == HOSHI_AS_BOOL(b);
 		case HOSHI_TYPE_OBJECT:
+			if (HOSHI_IS_STRING(a) && HOSHI_IS_STRING(b)) {
+				return hoshi_stringsEqual(HOSHI_AS_STRING(a), HOSHI_AS_STRING(b));
+			}
 			return HOSHI_AS_OBJECT(a) == HOSHI_AS_OBJECT(b);
+		case HOSHI_TYPE_INTEGER:
+			return HOSHI_AS_INTEGER(a) == HOSHI_AS_INTEGER(b);
 	}
 	return false;
 }
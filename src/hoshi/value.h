@@ -1,21 +1,10 @@
 #ifndef __HOSHI_VALUE_H__
 #define __HOSHI_VALUE_H__
 
+#include "config.h"
 #include <stdbool.h>
-
-#define HOSHI_NUMBER(value) ((hoshi_Value){ HOSHI_TYPE_NUMBER, { .number = value } })
-#define HOSHI_BOOL(value) ((hoshi_Value){ HOSHI_TYPE_BOOL, { .boolean = value } })
-#define HOSHI_NIL ((hoshi_Value){ HOSHI_TYPE_NIL, { .number = 0 } })
-#define HOSHI_OBJECT(value) ((hoshi_Value){ HOSHI_TYPE_OBJECT, { .object = (hoshi_Object *)value } })
-
-#define HOSHI_AS_NUMBER(value) ((value).as.number)
-#define HOSHI_AS_BOOL(value) ((value).as.boolean)
-#define HOSHI_AS_OBJECT(value) ((value).as.object)
-
-#define HOSHI_IS_NUMBER(value) ((value).type == HOSHI_TYPE_NUMBER)
-#define HOSHI_IS_BOOL(value) ((value).type == HOSHI_TYPE_BOOL)
-#define HOSHI_IS_NIL(value) ((value).type == HOSHI_TYPE_NIL)
-#define HOSHI_IS_OBJECT(value) ((value).type == HOSHI_TYPE_OBJECT)
+#include <stdint.h>
+#include <string.h>
 
 typedef struct hoshi_Object hoshi_Object;
 typedef struct hoshi_ObjectString hoshi_ObjectString;
@@ -25,17 +14,116 @@ typedef enum {
 	HOSHI_TYPE_BOOL,
 	HOSHI_TYPE_NIL,
 	HOSHI_TYPE_OBJECT,
+	HOSHI_TYPE_INTEGER,
 } hoshi_ValueType;
 
+#if HOSHI_ENABLE_NAN_BOXING
+
+/* NaN-boxed values. A value is 8 bytes: numbers are stored as they are, and everything else hides in the payload of a quiet NaN,
+ * which arithmetic never produces on its own. Objects also set the sign bit and keep their pointer in the low 48 bits, nil and bools are small tags.
+ * Integers set HOSHI_INTEGER_BIT and keep a 49-bit two's complement integer in the bits below it, so they only go from HOSHI_INTEGER_MIN to HOSHI_INTEGER_MAX. */
+typedef uint64_t hoshi_Value;
+
+#define HOSHI_QNAN ((uint64_t)0x7ffc000000000000)
+#define HOSHI_SIGN_BIT ((uint64_t)0x8000000000000000)
+#define HOSHI_TAG_NIL 1
+#define HOSHI_TAG_FALSE 2
+#define HOSHI_TAG_TRUE 3
+
+#define HOSHI_FALSE_VALUE ((hoshi_Value)(HOSHI_QNAN | HOSHI_TAG_FALSE))
+#define HOSHI_TRUE_VALUE ((hoshi_Value)(HOSHI_QNAN | HOSHI_TAG_TRUE))
+
+#define HOSHI_INTEGER_BIT ((uint64_t)0x0002000000000000)
+#define HOSHI_INTEGER_MASK ((uint64_t)0x0001ffffffffffff)
+#define HOSHI_INTEGER_MIN (-(INT64_C(1) << 48))
+#define HOSHI_INTEGER_MAX ((INT64_C(1) << 48) - 1)
+
+static inline hoshi_Value hoshi_numberToValue(double number)
+{
+	hoshi_Value value;
+	memcpy(&value, &number, sizeof(double));
+	return value;
+}
+
+static inline double hoshi_valueToNumber(hoshi_Value value)
+{
+	double number;
+	memcpy(&number, &value, sizeof(double));
+	return number;
+}
+
+#define HOSHI_NUMBER(value) hoshi_numberToValue(value)
+#define HOSHI_BOOL(value) ((value) ? HOSHI_TRUE_VALUE : HOSHI_FALSE_VALUE)
+#define HOSHI_NIL ((hoshi_Value)(HOSHI_QNAN | HOSHI_TAG_NIL))
+#define HOSHI_OBJECT(value) ((hoshi_Value)(HOSHI_SIGN_BIT | HOSHI_QNAN | (uint64_t)(uintptr_t)(value)))
+#define HOSHI_INTEGER(value) ((hoshi_Value)(HOSHI_QNAN | HOSHI_INTEGER_BIT | ((uint64_t)(int64_t)(value) & HOSHI_INTEGER_MASK)))
+
+#define HOSHI_AS_NUMBER(value) hoshi_valueToNumber(value)
+#define HOSHI_AS_BOOL(value) ((value) == HOSHI_TRUE_VALUE)
+#define HOSHI_AS_OBJECT(value) ((hoshi_Object *)(uintptr_t)((value) & ~(HOSHI_SIGN_BIT | HOSHI_QNAN)))
+/* Shifting the integer's sign bit up to bit 63 and back down again sign-extends it */
+#define HOSHI_AS_INTEGER(value) ((int64_t)((value) << 15) >> 15)
+
+#define HOSHI_IS_NUMBER(value) (((value) & HOSHI_QNAN) != HOSHI_QNAN)
+#define HOSHI_IS_BOOL(value) (((value) | 1) == HOSHI_TRUE_VALUE)
+#define HOSHI_IS_NIL(value) ((value) == HOSHI_NIL)
+#define HOSHI_IS_OBJECT(value) (((value) & (HOSHI_SIGN_BIT | HOSHI_QNAN)) == (HOSHI_SIGN_BIT | HOSHI_QNAN))
+#define HOSHI_IS_INTEGER(value) (((value) & (HOSHI_SIGN_BIT | HOSHI_QNAN | HOSHI_INTEGER_BIT)) == (HOSHI_QNAN | HOSHI_INTEGER_BIT))
+
+/* Whether an int64_t can be stored as an integer value */
+#define HOSHI_INTEGER_FITS(value) ((value) >= HOSHI_INTEGER_MIN && (value) <= HOSHI_INTEGER_MAX)
+
+static inline hoshi_ValueType hoshi_valueType(hoshi_Value value)
+{
+	if (HOSHI_IS_NUMBER(value)) return HOSHI_TYPE_NUMBER;
+	if (HOSHI_IS_OBJECT(value)) return HOSHI_TYPE_OBJECT;
+	if (HOSHI_IS_INTEGER(value)) return HOSHI_TYPE_INTEGER;
+	if (HOSHI_IS_NIL(value)) return HOSHI_TYPE_NIL;
+	return HOSHI_TYPE_BOOL;
+}
+
+#define HOSHI_VALUE_TYPE(value) hoshi_valueType(value)
+
+#else
+
+/* Tagged values, a type next to a union of what each type holds. Takes 16 bytes, but any double is a number (see HOSHI_ENABLE_NAN_BOXING). */
 typedef struct {
 	hoshi_ValueType type;
 	union {
 		bool boolean;
 		double number;
 		hoshi_Object *object;
+		int64_t integer;
 	} as;
 } hoshi_Value;
 
+#define HOSHI_INTEGER_MIN INT64_MIN
+#define HOSHI_INTEGER_MAX INT64_MAX
+
+#define HOSHI_NUMBER(value) ((hoshi_Value){ HOSHI_TYPE_NUMBER, { .number = value } })
+#define HOSHI_BOOL(value) ((hoshi_Value){ HOSHI_TYPE_BOOL, { .boolean = value } })
+#define HOSHI_NIL ((hoshi_Value){ HOSHI_TYPE_NIL, { .number = 0 } })
+#define HOSHI_OBJECT(value) ((hoshi_Value){ HOSHI_TYPE_OBJECT, { .object = (hoshi_Object *)value } })
+#define HOSHI_INTEGER(value) ((hoshi_Value){ HOSHI_TYPE_INTEGER, { .integer = value } })
+
+#define HOSHI_AS_NUMBER(value) ((value).as.number)
+#define HOSHI_AS_BOOL(value) ((value).as.boolean)
+#define HOSHI_AS_OBJECT(value) ((value).as.object)
+#define HOSHI_AS_INTEGER(value) ((value).as.integer)
+
+#define HOSHI_IS_NUMBER(value) ((value).type == HOSHI_TYPE_NUMBER)
+#define HOSHI_IS_BOOL(value) ((value).type == HOSHI_TYPE_BOOL)
+#define HOSHI_IS_NIL(value) ((value).type == HOSHI_TYPE_NIL)
+#define HOSHI_IS_OBJECT(value) ((value).type == HOSHI_TYPE_OBJECT)
+#define HOSHI_IS_INTEGER(value) ((value).type == HOSHI_TYPE_INTEGER)
+
+/* Every int64_t fits */
+#define HOSHI_INTEGER_FITS(value) ((void)(value), true)
+
+#define HOSHI_VALUE_TYPE(value) ((value).type)
+
+#endif
+
 void hoshi_printValue(hoshi_Value value);
 bool hoshi_valuesEqual(hoshi_Value a, hoshi_Value b);
 
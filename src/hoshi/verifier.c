@@ -0,0 +1,397 @@
+#ifndef __HOSHI_VERIFIER_C__
+#define __HOSHI_VERIFIER_C__
+
+#include "verifier.h"
+#include "chunk.h"
+#include "config.h"
+#include "memory.h"
+#include "value.h"
+#include "vm.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if MEMWATCH
+#include "memwatch.h"
+#endif
+
+#define BITSET_WORDS(bits) (((bits) + 63) / 64)
+/* Every instruction has its own bit for each global, which adds up quickly, so only the globals a narrow instruction can reach are tracked.
+ * Using any other one keeps the chunk's runtime checks. */
+#define TRACKED_GLOBALS (UINT8_MAX + 1)
+#define GLOBAL_WORDS BITSET_WORDS(TRACKED_GLOBALS)
+#define STACK_WORDS BITSET_WORDS(HOSHI_STACK_SIZE)
+
+/* What is known right before an instruction runs, merged over every path that reaches it */
+typedef struct {
+	bool reached;
+	int depth; /* Stack depth, relative to the depth when the chunk started */
+	int scopes; /* Scopes opened since the chunk started */
+	uint64_t defined[GLOBAL_WORDS]; /* Globals that hold something other than nil on every path here */
+	uint64_t maybeNil[STACK_WORDS]; /* Stack slots that might hold nil on some path here */
+} hoshi_VerifierState;
+
+typedef struct {
+	hoshi_VM *vm;
+	hoshi_Chunk *chunk;
+	FILE *errors;
+	hoshi_VerifierState *states;
+	/* Instructions whose state changed since they were last looked at */
+	int *worklist;
+	int worklistCount;
+	bool *queued;
+	/* False once a global might be used while it is undefined. The chunk is still sound, but it has to keep its nil checks. */
+	bool globalsDefined;
+	int maxStack;
+	int maxScopes;
+} hoshi_Verifier;
+
+static bool hoshi_testBit(const uint64_t *bits, int bit)
+{
+	return (bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void hoshi_setBit(uint64_t *bits, int bit, bool value)
+{
+	if (value) {
+		bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+	} else {
+		bits[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+	}
+}
+
+/* Prints a problem with `instruction` and returns false, so callers can `return hoshi_verifyError(...)`. */
+static bool hoshi_verifyError(hoshi_Verifier *verifier, hoshi_Instruction *instruction, const char *format, ...)
+{
+	if (verifier->errors == NULL) {
+		return false;
+	}
+
+	fputs("error: failed to verify chunk: ", verifier->errors);
+	va_list args;
+	va_start(args, format);
+	vfprintf(verifier->errors, format, args);
+	va_end(args);
+	fprintf(verifier->errors, " (offset %d, line %d)\n", (int)instruction->offset, hoshi_getLine(verifier->chunk, instruction->offset));
+	return false;
+}
+
+static void hoshi_verifyUndefinedGlobal(hoshi_Verifier *verifier, hoshi_Instruction *instruction)
+{
+	if (verifier->globalsDefined && verifier->errors != NULL) {
+		fprintf(
+			verifier->errors,
+			instruction->index < TRACKED_GLOBALS
+				? "note: global %d might be undefined at offset %d (line %d), so the chunk keeps its runtime checks\n"
+				: "note: global %d at offset %d (line %d) is past the globals the verifier tracks, so the chunk keeps its runtime checks\n",
+			instruction->index,
+			(int)instruction->offset,
+			hoshi_getLine(verifier->chunk, instruction->offset)
+		);
+	}
+	verifier->globalsDefined = false;
+}
+
+/* Merges `state` into the state of instruction `index`, queuing it if that told us something new. */
+static bool hoshi_verifyMerge(hoshi_Verifier *verifier, hoshi_Instruction *from, int index, hoshi_VerifierState *state)
+{
+	hoshi_VerifierState *into = &verifier->states[index];
+	bool changed = false;
+
+	if (!into->reached) {
+		*into = *state;
+		changed = true;
+	} else if (into->depth != state->depth || into->scopes != state->scopes) {
+		return hoshi_verifyError(
+			verifier,
+			from,
+			"paths into offset %d disagree on the stack (%d and %d values) or scopes (%d and %d)",
+			(int)verifier->chunk->instructions[index].offset,
+			into->depth,
+			state->depth,
+			into->scopes,
+			state->scopes
+		);
+	} else {
+		for (int i = 0; i < GLOBAL_WORDS; i++) {
+			uint64_t defined = into->defined[i] & state->defined[i];
+			changed |= defined != into->defined[i];
+			into->defined[i] = defined;
+		}
+		for (int i = 0; i < STACK_WORDS; i++) {
+			uint64_t maybeNil = into->maybeNil[i] | state->maybeNil[i];
+			changed |= maybeNil != into->maybeNil[i];
+			into->maybeNil[i] = maybeNil;
+		}
+	}
+
+	if (changed && !verifier->queued[index]) {
+		verifier->queued[index] = true;
+		verifier->worklist[verifier->worklistCount++] = index;
+	}
+	return true;
+}
+
+/* Stack helpers for the state being stepped through an instruction */
+
+static bool hoshi_verifyPop(hoshi_Verifier *verifier, hoshi_Instruction *instruction, hoshi_VerifierState *state, int count)
+{
+	if (state->depth < count) {
+		return hoshi_verifyError(verifier, instruction, "needs %d values on the stack but might only have %d", count, state->depth);
+	}
+	state->depth -= count;
+	return true;
+}
+
+static bool hoshi_verifyPush(hoshi_Verifier *verifier, hoshi_Instruction *instruction, hoshi_VerifierState *state, bool maybeNil)
+{
+	if (state->depth >= HOSHI_STACK_SIZE) {
+		return hoshi_verifyError(verifier, instruction, "might grow the stack past HOSHI_STACK_SIZE (%d)", HOSHI_STACK_SIZE);
+	}
+	hoshi_setBit(state->maybeNil, state->depth, maybeNil);
+	state->depth++;
+	if (state->depth > verifier->maxStack) {
+		verifier->maxStack = state->depth;
+	}
+	return true;
+}
+
+/* Steps `state` through the instruction at `index` and merges the result into every instruction that can run next. */
+static bool hoshi_verifyInstruction(hoshi_Verifier *verifier, int index)
+{
+	hoshi_Instruction *instruction = &verifier->chunk->instructions[index];
+	hoshi_VerifierState state = verifier->states[index];
+	/* Jumps go to `target`, everything but unconditional jumps and returns also falls through into the next instruction */
+	int target = -1;
+	bool fallsThrough = true;
+
+	switch (hoshi_genericOpcode(instruction->op)) {
+		/* Stack ops */
+		case HOSHI_OP_POP:
+			if (!hoshi_verifyPop(verifier, instruction, &state, 1)) return false;
+			break;
+		case HOSHI_OP_CONSTANT:
+		case HOSHI_OP_CONSTANT_LONG:
+			if (!hoshi_verifyPush(verifier, instruction, &state, HOSHI_IS_NIL(*instruction->as.constant))) return false;
+			break;
+		case HOSHI_OP_TRUE:
+		case HOSHI_OP_FALSE:
+			if (!hoshi_verifyPush(verifier, instruction, &state, false)) return false;
+			break;
+		case HOSHI_OP_NIL:
+			if (!hoshi_verifyPush(verifier, instruction, &state, true)) return false;
+			break;
+		/* Globals. A global is undefined for as long as it holds nil. */
+		case HOSHI_OP_DEFGLOBAL:
+		case HOSHI_OP_SETGLOBAL:
+		case HOSHI_OP_GETGLOBAL: {
+			hoshi_OpCode op = hoshi_genericOpcode(instruction->op);
+			if (instruction->index >= verifier->vm->globalValues.count) {
+				return hoshi_verifyError(verifier, instruction, "uses global %d, but there are only %d", instruction->index, verifier->vm->globalValues.count);
+			}
+			bool tracked = instruction->index < TRACKED_GLOBALS;
+			if (op != HOSHI_OP_DEFGLOBAL && (!tracked || !hoshi_testBit(state.defined, instruction->index))) {
+				hoshi_verifyUndefinedGlobal(verifier, instruction);
+			}
+			if (op == HOSHI_OP_GETGLOBAL) {
+				/* Getting an undefined global panics, so whatever gets pushed is not nil */
+				if (!hoshi_verifyPush(verifier, instruction, &state, false)) return false;
+				break;
+			}
+			if (!hoshi_verifyPop(verifier, instruction, &state, 1)) return false;
+			if (tracked) {
+				hoshi_setBit(state.defined, instruction->index, !hoshi_testBit(state.maybeNil, state.depth));
+			}
+			if (op == HOSHI_OP_SETGLOBAL) {
+				state.depth++;
+			}
+			break;
+		}
+		/* Locals */
+		case HOSHI_OP_DEFLOCAL:
+		case HOSHI_OP_SETLOCAL:
+		case HOSHI_OP_GETLOCAL: {
+			hoshi_OpCode op = hoshi_genericOpcode(instruction->op);
+			if (instruction->index >= HOSHI_LOCALS_SIZE) {
+				return hoshi_verifyError(verifier, instruction, "uses local %d, but HOSHI_LOCALS_SIZE is %d", instruction->index, HOSHI_LOCALS_SIZE);
+			}
+			if (op == HOSHI_OP_GETLOCAL) {
+				if (!hoshi_verifyPush(verifier, instruction, &state, true)) return false;
+			} else {
+				if (!hoshi_verifyPop(verifier, instruction, &state, 1)) return false;
+				if (op == HOSHI_OP_SETLOCAL) {
+					state.depth++;
+				}
+			}
+			break;
+		}
+		case HOSHI_OP_NEWSCOPE:
+			if (state.scopes + 1 >= HOSHI_MAX_SCOPE_DEPTH) {
+				return hoshi_verifyError(verifier, instruction, "might nest scopes deeper than HOSHI_MAX_SCOPE_DEPTH (%d)", HOSHI_MAX_SCOPE_DEPTH);
+			}
+			state.scopes++;
+			if (state.scopes > verifier->maxScopes) {
+				verifier->maxScopes = state.scopes;
+			}
+			break;
+		case HOSHI_OP_ENDSCOPE:
+			if (state.scopes == 0) {
+				return hoshi_verifyError(verifier, instruction, "ends a scope that the chunk never started");
+			}
+			if (instruction->index + instruction->as.count > HOSHI_LOCALS_SIZE) {
+				return hoshi_verifyError(verifier, instruction, "clears locals up to %d, but HOSHI_LOCALS_SIZE is %d", instruction->index + instruction->as.count - 1, HOSHI_LOCALS_SIZE);
+			}
+			state.scopes--;
+			break;
+		case HOSHI_OP_CLEARLOCALS:
+			if (instruction->index + instruction->as.count > HOSHI_LOCALS_SIZE) {
+				return hoshi_verifyError(verifier, instruction, "clears locals up to %d, but HOSHI_LOCALS_SIZE is %d", instruction->index + instruction->as.count - 1, HOSHI_LOCALS_SIZE);
+			}
+			break;
+		/* Control flow */
+		case HOSHI_OP_JUMP:
+		case HOSHI_OP_BACK_JUMP:
+		case HOSHI_OP_GOTO:
+			target = instruction->as.target - verifier->chunk->instructions;
+			fallsThrough = false;
+			break;
+		case HOSHI_OP_JUMP_IF:
+		case HOSHI_OP_BACK_JUMP_IF:
+		case HOSHI_OP_GOTO_IF:
+			if (!hoshi_verifyPop(verifier, instruction, &state, 1)) return false;
+			target = instruction->as.target - verifier->chunk->instructions;
+			break;
+		/* Operations on the top two values, which always leave a number, integer, bool, or string behind */
+		case HOSHI_OP_ADD:
+		case HOSHI_OP_SUB:
+		case HOSHI_OP_MUL:
+		case HOSHI_OP_DIV:
+		case HOSHI_OP_AND:
+		case HOSHI_OP_OR:
+		case HOSHI_OP_XOR:
+		case HOSHI_OP_EQ:
+		case HOSHI_OP_NEQ:
+		case HOSHI_OP_GT:
+		case HOSHI_OP_LT:
+		case HOSHI_OP_GTEQ:
+		case HOSHI_OP_LTEQ:
+		case HOSHI_OP_CONCAT:
+		case HOSHI_OP_MOD:
+		case HOSHI_OP_BAND:
+		case HOSHI_OP_BOR:
+		case HOSHI_OP_BXOR:
+		case HOSHI_OP_SHL:
+		case HOSHI_OP_SHR:
+			if (!hoshi_verifyPop(verifier, instruction, &state, 2)) return false;
+			if (!hoshi_verifyPush(verifier, instruction, &state, false)) return false;
+			break;
+		case HOSHI_OP_SCOPED_CONCAT:
+			if (state.scopes == 0) {
+				return hoshi_verifyError(verifier, instruction, "allocates in a scope, but none is open");
+			}
+			if (!hoshi_verifyPop(verifier, instruction, &state, 2)) return false;
+			if (!hoshi_verifyPush(verifier, instruction, &state, false)) return false;
+			break;
+		/* Operations on the top value */
+		case HOSHI_OP_NEGATE:
+		case HOSHI_OP_NOT:
+		case HOSHI_OP_BNOT:
+		case HOSHI_OP_TOINT:
+		case HOSHI_OP_TONUM:
+			if (!hoshi_verifyPop(verifier, instruction, &state, 1)) return false;
+			if (!hoshi_verifyPush(verifier, instruction, &state, false)) return false;
+			break;
+		/* Misc */
+		case HOSHI_OP_PRINT:
+			if (!hoshi_verifyPop(verifier, instruction, &state, 1)) return false;
+			break;
+		case HOSHI_OP_RETURN:
+			fallsThrough = false;
+			break;
+		case HOSHI_OP_EXIT:
+			if (!hoshi_verifyPop(verifier, instruction, &state, 1)) return false;
+			fallsThrough = false;
+			break;
+		/* Suspension. The host hands back whatever it likes, nil included. */
+		case HOSHI_OP_YIELD:
+		case HOSHI_OP_HOSTCALL:
+			if (!hoshi_verifyPop(verifier, instruction, &state, 1)) return false;
+			if (!hoshi_verifyPush(verifier, instruction, &state, true)) return false;
+			break;
+		/* PUSH is not implemented yet, so it is as unknown as anything else here */
+		default:
+			return hoshi_verifyError(verifier, instruction, "unknown opcode %d", instruction->op);
+	}
+
+	/* hoshi_decodeChunk ends every chunk with a RETURN, so there always is a next instruction to fall into */
+	if (fallsThrough && !hoshi_verifyMerge(verifier, instruction, index + 1, &state)) {
+		return false;
+	}
+	if (target != -1 && !hoshi_verifyMerge(verifier, instruction, target, &state)) {
+		return false;
+	}
+	return true;
+}
+
+bool hoshi_verifyChunk(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *errors)
+{
+	if (chunk->instructions == NULL && !hoshi_decodeChunk(chunk)) {
+		return false;
+	}
+
+	int count = chunk->instructionCount;
+	hoshi_Verifier verifier;
+	verifier.vm = vm;
+	verifier.chunk = chunk;
+	verifier.errors = errors;
+	/* One block for all three, so running out of memory can not leave some of them allocated. States are made of uint64_t, so the rest stays aligned. */
+	size_t scratchSize = (sizeof(hoshi_VerifierState) + sizeof(int) + sizeof(bool)) * count;
+	char *scratch = HOSHI_ALLOCATE(chunk->allocator, char, scratchSize);
+	verifier.states = (hoshi_VerifierState *)scratch;
+	verifier.worklist = (int *)(scratch + sizeof(hoshi_VerifierState) * count);
+	verifier.worklistCount = 0;
+	verifier.queued = (bool *)(scratch + (sizeof(hoshi_VerifierState) + sizeof(int)) * count);
+	verifier.globalsDefined = true;
+	verifier.maxStack = 0;
+	verifier.maxScopes = 0;
+	memset(verifier.states, 0, sizeof(hoshi_VerifierState) * count);
+	memset(verifier.queued, 0, sizeof(bool) * count);
+
+	/* Every global starts out undefined, and the chunk starts with an empty stack of its own */
+	hoshi_VerifierState entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.reached = true;
+	bool success = hoshi_verifyMerge(&verifier, &chunk->instructions[0], 0, &entry);
+
+	/* Run until nothing changes anymore. Merging only ever clears `defined` bits and sets `maybeNil` bits, so this always ends. */
+	while (success && verifier.worklistCount > 0) {
+		int index = verifier.worklist[--verifier.worklistCount];
+		verifier.queued[index] = false;
+		success = hoshi_verifyInstruction(&verifier, index);
+	}
+
+	chunk->verified = success && verifier.globalsDefined;
+	chunk->maxStack = verifier.maxStack;
+	chunk->maxScopes = verifier.maxScopes;
+
+	HOSHI_FREE_ARRAY(chunk->allocator, char, scratch, scratchSize);
+	return success;
+}
+
+void hoshi_printVerifierStats(hoshi_Chunk *chunk, FILE *file)
+{
+	if (chunk->verified) {
+		fprintf(file, "verify: ok, runs without runtime checks (max stack depth %d, max scope depth %d)\n", chunk->maxStack, chunk->maxScopes);
+	} else {
+		fputs("verify: not verified, runs with runtime checks\n", file);
+	}
+}
+
+#undef BITSET_WORDS
+#undef TRACKED_GLOBALS
+#undef GLOBAL_WORDS
+#undef STACK_WORDS
+
+#endif
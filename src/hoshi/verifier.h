@@ -0,0 +1,22 @@
+#ifndef __HOSHI_VERIFIER_H__
+#define __HOSHI_VERIFIER_H__
+
+#include "chunk.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Bytecode verifier.
+ * hoshi_verifyChunk walks every path through a decoded chunk once, ahead of time, and proves what hoshi_runNext would otherwise check on every instruction:
+ * that indices are in range, that the stack never underflows and how deep it gets, that scopes are balanced, and that globals are defined before they are used.
+ * Chunks that pass run in a copy of the interpreter loop with those checks compiled out (see vm_loop.h). */
+
+/* Verifies the chunk, decoding it first if needed, and stores the result in `chunk->verified`, `chunk->maxStack`, and `chunk->maxScopes`.
+ * Globals must already be registered with the VM (which loading and compiling do).
+ * The first problem found is printed to `errors`, which may be NULL.
+ * Returns false when the chunk is malformed. A chunk can be well-formed and still not verified, if a global might be used before it is defined. */
+bool hoshi_verifyChunk(hoshi_VM *vm, hoshi_Chunk *chunk, FILE *errors);
+/* Prints whether a verified chunk runs without runtime checks, and how much room it needs on the stack and for scopes. */
+void hoshi_printVerifierStats(hoshi_Chunk *chunk, FILE *file);
+
+#endif
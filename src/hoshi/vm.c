@@ -1,6 +1,9 @@
 #ifndef __HOSHI_VM_C__
 #define __HOSHI_VM_C__
 
+/* clock_gettime is POSIX and not C11, so this has to come before anything includes a system header */
+#define _POSIX_C_SOURCE 199309L
+
 #include "vm.h"
 #include "chunk.h"
 #include "config.h"
@@ -8,49 +11,90 @@
 #include "memory.h"
 #include "value.h"
 #include "object.h"
+#include "program.h"
+#include "verifier.h"
+#include <inttypes.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #if HOSHI_ENABLE_TRACE_EXECUTION_DEBUGGING
 #include "debug.h"
 #endif
 
-void hoshi_initScope(hoshi_Scope *scope)
-{
-	scope->localCount = 0;
-}
+#if HOSHI_ENABLE_JIT
+#include "jit.h"
+#endif
 
 static void hoshi_resetStack(hoshi_VM *vm)
 {
-	vm->stackTop = vm->stack;
+	vm->stack[0] = HOSHI_NIL;
+	vm->stackTop = HOSHI_STACK_BOTTOM(vm);
 }
 
 void hoshi_freeAllObjects(hoshi_VM *vm)
 {
-	hoshi_Object *object = vm->tracker.objects;
-	while (object != NULL) {
-		hoshi_Object *next = object->next;
-		hoshi_freeObject(object);
-		object = next;
+	hoshi_freeTracker(&vm->tracker);
+	hoshi_freeCollector(&vm->gc);
+	for (int i = 0; i < vm->regionCount; i++) {
+		hoshi_freeTracker(vm->regions[i]);
+		HOSHI_FREE(&vm->allocator, hoshi_ObjectTracker, vm->regions[i]);
 	}
+	HOSHI_FREE_ARRAY(&vm->allocator, hoshi_ObjectTracker *, vm->regions, vm->regionCapacity);
+	vm->regions = NULL;
+	vm->regionCount = 0;
+	vm->regionCapacity = 0;
 }
 
 void hoshi_initVM(hoshi_VM *vm)
 {
+	hoshi_initVMWithAllocator(vm, &hoshi_defaultAllocator);
+}
+
+void hoshi_initVMWithAllocator(hoshi_VM *vm, const hoshi_Allocator *allocator)
+{
+	vm->ip = NULL;
+	vm->chunk = NULL;
 	hoshi_resetStack(vm);
 	vm->exitCode = 0;
-	vm->tracker.objects = NULL;
-	hoshi_initTable(&vm->strings);
-	hoshi_initTable(&vm->globalNames);
-	hoshi_initValueArray(&vm->globalValues);
-	vm->localsTop = 0;
-	vm->topScope = &vm->scopes[0];
+#if HOSHI_ENABLE_INSTRUCTION_COUNTING
+	vm->instructionCount = 0;
+#endif
+#if HOSHI_ENABLE_JIT
+	vm->jit = true;
+	vm->jitThreshold = HOSHI_JIT_THRESHOLD;
+#endif
+	vm->budget = HOSHI_BUDGET_UNLIMITED;
+	vm->deadline = 0;
+	vm->slicing = false;
+	vm->resumeUnchecked = NULL;
+	vm->suspended = false;
+	vm->suspendValue = HOSHI_NIL;
+	vm->hostData = NULL;
+	vm->allocator = *allocator;
+	hoshi_initTracker(&vm->tracker, &vm->allocator);
+	hoshi_initCollector(&vm->gc, &vm->allocator);
+	hoshi_initTable(&vm->strings, &vm->allocator);
+	hoshi_makeHashKey(vm->hashKey);
+	hoshi_initTable(&vm->globalNames, &vm->allocator);
+	hoshi_initValueArray(&vm->globalValues, &vm->allocator);
+	vm->scopeDepth = 0;
+	vm->regions = NULL;
+	vm->regionCount = 0;
+	vm->regionCapacity = 0;
 	vm->errorHandler = NULL;
+	vm->program = NULL;
+	hoshi_initChunk(&vm->programChunk, &vm->allocator);
+
+	for (int i = 0; i <= UINT8_MAX; i++) {
+		vm->hostFunctions[i] = NULL;
+	}
 
 	for (int i = 0; i < HOSHI_LOCALS_SIZE; i++) {
-		vm->locals[i] = (hoshi_LocalValue){ 0, HOSHI_NIL };
+		vm->locals[i] = HOSHI_NIL;
 	}
 }
 
@@ -62,6 +106,9 @@ void hoshi_freeVM(hoshi_VM *vm)
 	hoshi_freeTable(&vm->globalNames);
 	hoshi_freeValueArray(&vm->globalValues);
 	hoshi_freeAllObjects(vm);
+	if (vm->program != NULL) {
+		hoshi_freeProgramView(&vm->programChunk);
+	}
 
 	#if HOSHI_COUNT_LEAKED_BYTES
 	printf("Leaked bytes: %zu\n", hoshi_leakedBytes);
@@ -76,9 +123,11 @@ void hoshi_panic(hoshi_VM *vm, const char *format, ...)
 	va_end(args);
 	fputs("\n", stderr);
 
-	size_t instruction = vm->ip - vm->chunk->code - 1;
-	int line = hoshi_getLine(vm->chunk, instruction);
-	fprintf(stderr, "[line %d] in script\n", line);
+	/* Panics from outside of a running chunk (i.e, while compiling) have no line to report */
+	if (vm->ip != NULL) {
+		int line = hoshi_getLine(vm->chunk, vm->ip[-1].offset);
+		fprintf(stderr, "[line %d] in script\n", line);
+	}
 
 	if (vm->errorHandler != NULL) {
 		fprintf(stderr, "delegating to error handler\n");
@@ -88,332 +137,282 @@ void hoshi_panic(hoshi_VM *vm, const char *format, ...)
 	}
 }
 
-void hoshi_push(hoshi_VM *vm, hoshi_Value value)
+hoshi_ObjectString *hoshi_concatenate(hoshi_VM *vm, hoshi_ObjectString *a, hoshi_ObjectString *b)
+{
+	hoshi_ObjectString *string = hoshi_concatenateIn(vm, &vm->tracker, a, b);
+#if HOSHI_ENABLE_ROPES
+	return string;
+#else
+	hoshi_ObjectString *interned = hoshi_internString(vm, string);
+	if (interned != string) {
+		/* Nothing has seen the new string, which is still the last object the VM made */
+		vm->tracker.objects = string->object.next;
+		hoshi_freeObject(&string->object);
+	}
+	return interned;
+#endif
+}
+
+hoshi_ObjectString *hoshi_concatenateIn(hoshi_VM *vm, hoshi_ObjectTracker *tracker, hoshi_ObjectString *a, hoshi_ObjectString *b)
+{
+	int length = a->length + b->length;
+#if HOSHI_ENABLE_ROPES
+	if (a->length == 0) {
+		return b;
+	}
+	if (b->length == 0) {
+		return a;
+	}
+	if (length >= HOSHI_ROPE_MIN_LENGTH) {
+		return hoshi_makeRope(vm, tracker, a, b);
+	}
+#endif
+
+	char *chars;
+	hoshi_ObjectString *string = hoshi_allocateStringIn(vm, tracker, length, &chars);
+	memcpy(chars, hoshi_stringChars(a), a->length);
+	memcpy(chars + a->length, hoshi_stringChars(b), b->length);
+	return string;
+}
+
+uint64_t hoshi_clockNanos(void)
 {
-	*vm->stackTop = value;
-	vm->stackTop++;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
 }
 
-hoshi_Value hoshi_pop(hoshi_VM *vm)
+/* Hands the interpreter loop its next part of the slice's budget, which it counts down at backwards jumps.
+ * With a deadline, the parts are at most HOSHI_SLICE_CLOCK_INTERVAL instructions so that the clock gets looked at every now and then. */
+static int64_t hoshi_takeBudget(hoshi_VM *vm)
 {
-	vm->stackTop--;
-	return *vm->stackTop;
+	int64_t budget = vm->budget;
+	if (vm->deadline != 0 && budget > HOSHI_SLICE_CLOCK_INTERVAL) {
+		budget = HOSHI_SLICE_CLOCK_INTERVAL;
+	}
+	vm->budget -= budget;
+	return budget;
 }
 
-hoshi_Value hoshi_peek(hoshi_VM *vm, int distance)
+/* Called by the interpreter loop once its part of the budget is used up (`*budget <= 0`).
+ * Returns false when the slice is over, otherwise `*budget` gets the next part. */
+static bool hoshi_refillBudget(hoshi_VM *vm, int64_t *budget)
 {
-	return vm->stackTop[-1 - distance];
+	/* Whatever the loop went over by comes out of what is left */
+	vm->budget += *budget;
+	if (vm->budget <= 0 || (vm->deadline != 0 && hoshi_clockNanos() >= vm->deadline)) {
+		return false;
+	}
+	*budget = hoshi_takeBudget(vm);
+	return true;
 }
 
-static void hoshi_concatenate(hoshi_VM *vm)
+/* Two copies of the interpreter loop, see vm_loop.h. hoshi_runLoop picks one. */
+#define HOSHI_LOOP_NAME hoshi_runChecked
+#define HOSHI_LOOP_CHECKED 1
+#include "vm_loop.h"
+
+#define HOSHI_LOOP_NAME hoshi_runUnchecked
+#define HOSHI_LOOP_CHECKED 0
+#include "vm_loop.h"
+
+static hoshi_InterpretResult hoshi_runLoop(hoshi_VM *vm)
 {
-	hoshi_ObjectString *b = HOSHI_AS_STRING(hoshi_pop(vm));
-	hoshi_ObjectString *a = HOSHI_AS_STRING(hoshi_pop(vm));
+	if (vm->suspended) {
+		return HOSHI_INTERPRET_SUSPENDED;
+	}
 
-	int length = a->length + b->length;
-	char *chars = HOSHI_ALLOCATE(char, length + 1);
-	memcpy(chars, a->chars, a->length);
-	memcpy(chars + a->length, b->chars, b->length);
-	chars[length] = '\0';
+	/* A run the unchecked loop paused or suspended can go on in it, it is still the same run from the start of the chunk */
+	bool resume = vm->ip == vm->resumeUnchecked;
+	vm->resumeUnchecked = NULL;
+
+	/* What the verifier proved only holds for runs from the start of the chunk, with enough room left on the stack and for scopes. */
+	hoshi_Chunk *chunk = vm->chunk;
+	bool unchecked = resume || (
+		chunk->verified &&
+		vm->ip == chunk->instructions &&
+		(vm->stackTop - vm->stack) + chunk->maxStack <= HOSHI_STACK_SIZE &&
+		vm->scopeDepth + chunk->maxScopes < HOSHI_MAX_SCOPE_DEPTH
+	);
+
+	/* A failed allocation jumps back here. The loop keeps `ip` and the stack to itself, so there is no telling which instruction it was. */
+	jmp_buf outOfMemory;
+	jmp_buf *outer = hoshi_catchOutOfMemory(&outOfMemory);
+	if (setjmp(outOfMemory) != 0) {
+		hoshi_catchOutOfMemory(outer);
+		vm->gc.running = false;
+		vm->ip = NULL;
+		hoshi_panic(vm, "out of memory");
+		return HOSHI_INTERPRET_RUNTIME_ERROR;
+	}
 
-	hoshi_ObjectString *result = hoshi_makeString(vm, true, chars, length);
-	hoshi_push(vm, HOSHI_OBJECT(result));
+	/* Only objects made while running are collected, see gc.h */
+	vm->gc.running = true;
+	hoshi_InterpretResult result = unchecked ? hoshi_runUnchecked(vm) : hoshi_runChecked(vm);
+	vm->gc.running = false;
+	hoshi_catchOutOfMemory(outer);
+	return result;
 }
 
 /* TODO: Rename to hoshi_run(hoshi_VM *vm) */
 hoshi_InterpretResult hoshi_runNext(hoshi_VM *vm)
 {
-/* Macro shorthands. These get #undef'ed from existence after the for loop below. */
-#define READ_BYTE() (*vm->ip++)
-#define READ_SHORT() (*vm->ip += 2, (uint16_t)((vm->ip[-2] << 8) | vm->ip[-1]))
-#define READ_LONG() (*vm->ip += 4, (uint64_t)((vm->ip[-4] << 24) | (vm->ip[-3] << 16) | (vm->ip[-2] << 8) | vm->ip[-1]))
-#define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()])
-#define READ_STRING() HOSHI_AS_STRING(READ_CONSTANT())
-#define BINARY_OP(valueType, op)\
-	do { \
-		if (!HOSHI_IS_NUMBER(hoshi_peek(vm, 0)) || !HOSHI_IS_NUMBER(hoshi_peek(vm, 1))) {\
-			hoshi_panic(vm, "operands must be numbers."); \
-			return HOSHI_INTERPRET_RUNTIME_ERROR; \
-		} \
-		double b = HOSHI_AS_NUMBER(hoshi_pop(vm)); \
-		double a = HOSHI_AS_NUMBER(hoshi_pop(vm)); \
-		hoshi_push(vm, valueType(a op b)); \
-	} while (0)
-#define BINARY_BOOL_OP(op)\
-	do { \
-		if (!HOSHI_IS_BOOL(hoshi_peek(vm, 0)) || !HOSHI_IS_BOOL(hoshi_peek(vm, 1))) {\
-			hoshi_panic(vm, "operands must be booleans."); \
-			return HOSHI_INTERPRET_RUNTIME_ERROR; \
-		} \
-		bool b = HOSHI_AS_BOOL(hoshi_pop(vm)); \
-		bool a = HOSHI_AS_BOOL(hoshi_pop(vm)); \
-		hoshi_push(vm, HOSHI_BOOL(a op b)); \
-	} while (0)
-
-	for (;;) {
-#if HOSHI_ENABLE_TRACE_EXECUTION_DEBUGGING
-		/* Print the stack */
-		hoshi_printStack(vm);
-		/* Print the instruction */
-		hoshi_disassembleInstruction(vm->chunk, (int)(vm->ip - vm->chunk->code));
-#endif
+	vm->budget = HOSHI_BUDGET_UNLIMITED;
+	vm->deadline = 0;
+	vm->slicing = false;
+	return hoshi_runLoop(vm);
+}
 
-		uint8_t instruction;
-
-		/* Here's a switch statement in its natural habitat. They're found in all interpreters somewhere. */
-		switch (instruction = READ_BYTE()) {
-			/* Stack ops */
-			case HOSHI_OP_PUSH: {
-				hoshi_panic(vm, "push unimplemented.");
-			// 	hoshi_Value it = READ_BYTE();
-			// 	hoshi_push(vm, );
-				break;
-			}
-			case HOSHI_OP_POP: {
-				if (vm->stackTop == vm->stack) {
-					hoshi_panic(vm, "error: attempted to pop but stack was empty");
-					return HOSHI_INTERPRET_RUNTIME_ERROR;
-				}
-				vm->stackTop--;
-				break;
-			}
-			case HOSHI_OP_CONSTANT: {
-				hoshi_Value constant = READ_CONSTANT();
-				hoshi_push(vm, constant);
-				break;
-			}
-			case HOSHI_OP_CONSTANT_LONG: {
-				hoshi_Value constant = READ_CONSTANT();
-				hoshi_push(vm, constant);
-				break;
-			}
-			case HOSHI_OP_TRUE: hoshi_push(vm, HOSHI_BOOL(true)); break;
-			case HOSHI_OP_FALSE: hoshi_push(vm, HOSHI_BOOL(false)); break;
-			case HOSHI_OP_NIL: hoshi_push(vm, HOSHI_NIL); break;
-			/* Variables */
-			case HOSHI_OP_DEFGLOBAL: {
-				vm->globalValues.values[READ_BYTE()] = hoshi_pop(vm);
-				// hoshi_ObjectString *name = READ_STRING();
-				// hoshi_tableSet(&vm->globals, name, hoshi_peek(vm, 0));
-				// hoshi_pop(vm);
-				break;
-			}
-			case HOSHI_OP_SETGLOBAL: {
-				uint8_t index = READ_BYTE();
-				if (HOSHI_IS_NIL(vm->globalValues.values[index])) {
-					hoshi_panic(vm, "undefined variable: `%.*s`", vm->globalNames.entries[index].key->length, vm->globalNames.entries[index].key->chars);
-					return HOSHI_INTERPRET_RUNTIME_ERROR;
-				}
-				vm->globalValues.values[READ_BYTE()] = hoshi_peek(vm, 0);
-				// hoshi_ObjectString *name = READ_STRING();
-				// if (hoshi_tableSet(&vm->globals, name, hoshi_peek(vm, 0))) {
-				// 	hoshi_tableDelete(&vm->globals, name); /* delete the zombie value */
-				// 	hoshi_panic(vm, "undefined variable: `%s`", name->chars);
-				// 	return HOSHI_INTERPRET_RUNTIME_ERROR;
-				// }
-				break;
-			}
-			case HOSHI_OP_GETGLOBAL: {
-				uint8_t index = READ_BYTE();
-				hoshi_Value value = vm->globalValues.values[index];
-				if (HOSHI_IS_NIL(value)) {
-					hoshi_panic(vm, "undefined variable: `%.*s`", vm->globalNames.entries[index].key->length, vm->globalNames.entries[index].key->chars);
-					return HOSHI_INTERPRET_RUNTIME_ERROR;
-				}
-				hoshi_push(vm, value);
-				// hoshi_ObjectString *name = READ_STRING();
-				// hoshi_Value value;
-				// if (!hoshi_tableGet(&vm->globals, name, &value)) {
-				// 	hoshi_panic(vm, "undefined variable: \"%.*s\"", name->length, name->chars);
-				// 	return HOSHI_INTERPRET_RUNTIME_ERROR;
-				// }
-				// hoshi_push(vm, value);
-				break;
-			}
-			case HOSHI_OP_DEFLOCAL: {
-				uint8_t index = READ_BYTE();
-				vm->locals[index].value = hoshi_pop(vm);
-				vm->locals[index].depth = vm->scopes - vm->topScope;
-				break;
-			}
-			case HOSHI_OP_SETLOCAL: {
-				vm->locals[READ_BYTE()].value = hoshi_peek(vm, 0);
-				break;
-			}
-			case HOSHI_OP_GETLOCAL: {
-				hoshi_push(vm, vm->locals[READ_BYTE()].value);
-				break;
-			}
-			case HOSHI_OP_NEWSCOPE: hoshi_pushScope(vm); break;
-			case HOSHI_OP_ENDSCOPE: hoshi_popScope(vm); break;
-			/* Control flow */
-			case HOSHI_OP_JUMP: vm->ip += READ_SHORT(); break;
-			case HOSHI_OP_BACK_JUMP: vm->ip -= READ_SHORT(); break;
-			case HOSHI_OP_JUMP_IF: {
-				hoshi_Value value = hoshi_pop(vm);
-				uint16_t offset = READ_SHORT();
-				if (HOSHI_IS_BOOL(value) && HOSHI_AS_BOOL(value)) {
-					vm->ip += offset;
-				}
-				break;
-			}
-			case HOSHI_OP_BACK_JUMP_IF: {
-				hoshi_Value value = hoshi_pop(vm);
-				uint16_t offset = READ_SHORT();
-				if (HOSHI_IS_BOOL(value) && HOSHI_AS_BOOL(value)) {
-					vm->ip -= offset;
-				}
-				break;
-			}
-			case HOSHI_OP_GOTO: {
-				vm->ip = &vm->chunk->code[READ_LONG()];
-				break;
-			}
-			case HOSHI_OP_GOTO_IF: {
-				hoshi_Value value = hoshi_pop(vm);
-				uint64_t pos = READ_LONG();
-				if (HOSHI_IS_BOOL(value) && HOSHI_AS_BOOL(value)) {
-					vm->ip = &vm->chunk->code[pos];
-				}
-				break;
-			}
-			/* Math */
-			case HOSHI_OP_ADD: BINARY_OP(HOSHI_NUMBER, +); break;
-			case HOSHI_OP_SUB: BINARY_OP(HOSHI_NUMBER, -); break;
-			case HOSHI_OP_MUL: BINARY_OP(HOSHI_NUMBER, *); break;
-			case HOSHI_OP_DIV: BINARY_OP(HOSHI_NUMBER, /); break;
-			case HOSHI_OP_NEGATE: {
-				if (!HOSHI_IS_NUMBER(hoshi_peek(vm, 0))) {
-					hoshi_panic(vm, "operand must be a number");
-					return HOSHI_INTERPRET_RUNTIME_ERROR;
-				}
-				*(vm->stackTop - 1) = HOSHI_NUMBER(-HOSHI_AS_NUMBER(*(vm->stackTop - 1)));
-				break;
-			}
-			/* Boolean ops */
-			case HOSHI_OP_NOT: {
-				if (!HOSHI_IS_BOOL(hoshi_peek(vm, 0))) {
-					hoshi_panic(vm, "operand must be a boolean");
-					return HOSHI_INTERPRET_RUNTIME_ERROR;
-				}
-				*(vm->stackTop - 1) = HOSHI_BOOL(!HOSHI_AS_BOOL(*(vm->stackTop - 1)));
-				break;
-			}
-			case HOSHI_OP_AND: BINARY_BOOL_OP(&&); break;
-			case HOSHI_OP_OR: BINARY_BOOL_OP(||); break;
-			case HOSHI_OP_XOR: BINARY_BOOL_OP(^); break;
-			/* Comparisons */
-			case HOSHI_OP_EQ: {
-				hoshi_push(vm, HOSHI_BOOL(hoshi_valuesEqual(hoshi_pop(vm), hoshi_pop(vm))));
-				break;
-			}
-			case HOSHI_OP_NEQ: {
-				hoshi_push(vm, HOSHI_BOOL(!hoshi_valuesEqual(hoshi_pop(vm), hoshi_pop(vm))));
-				break;
-			}
-			case HOSHI_OP_GT: BINARY_OP(HOSHI_BOOL, >); break;
-			case HOSHI_OP_LT: BINARY_OP(HOSHI_BOOL, <); break;
-			case HOSHI_OP_GTEQ: BINARY_OP(HOSHI_BOOL, >=); break;
-			case HOSHI_OP_LTEQ: BINARY_OP(HOSHI_BOOL, <=); break;
-			/* String ops */
-			case HOSHI_OP_CONCAT: {
-				if (!HOSHI_IS_STRING(hoshi_peek(vm, 0)) || !HOSHI_IS_STRING(hoshi_peek(vm, 1))) {
-					hoshi_panic(vm, "operands must be strings");
-				}
-				hoshi_concatenate(vm);
-				break;
-			}
-			/* Misc */
-			case HOSHI_OP_PRINT: {
-				hoshi_printValue(hoshi_pop(vm));
-				break;
-			}
-			case HOSHI_OP_RETURN: {
-				return HOSHI_INTERPRET_OK;
-			}
-			case HOSHI_OP_EXIT: {
-				if (!HOSHI_IS_NUMBER(hoshi_peek(vm, 0))) {
-					hoshi_panic(vm, "operand must be a number");
-					return HOSHI_INTERPRET_RUNTIME_ERROR;
-				}
-				vm->exitCode = HOSHI_AS_NUMBER(hoshi_pop(vm));
-				return HOSHI_INTERPRET_OK;
-			};
+hoshi_InterpretResult hoshi_runSlice(hoshi_VM *vm, hoshi_Budget budget)
+{
+	vm->budget = budget.instructions;
+	vm->deadline = budget.deadline;
+	vm->slicing = true;
+	return hoshi_runLoop(vm);
+}
+
+hoshi_InterpretResult hoshi_enterChunk(hoshi_VM *vm, hoshi_Chunk *chunk)
+{
+	/* Decoding and verifying allocate a single block each, so a failed allocation leaves nothing behind.
+	 * A chunk decoded here is undecoded again, so the next try verifies it too. */
+	volatile bool decoded = false;
+	jmp_buf outOfMemory;
+	jmp_buf *outer = hoshi_catchOutOfMemory(&outOfMemory);
+	if (setjmp(outOfMemory) != 0) {
+		hoshi_catchOutOfMemory(outer);
+		if (decoded) {
+			HOSHI_FREE_ARRAY(chunk->allocator, hoshi_Instruction, chunk->instructions, chunk->instructionCount);
+			chunk->instructions = NULL;
+			chunk->instructionCount = 0;
 		}
+		vm->ip = NULL;
+		hoshi_panic(vm, "out of memory");
+		return HOSHI_INTERPRET_RUNTIME_ERROR;
 	}
 
-	return HOSHI_INTERPRET_OK;
-
-#undef READ_BYTE
-#undef READ_SHORT
-#undef READ_CONSTANT
-#undef READ_STRING
-#undef BINARY_OP
-#undef BINARY_BOOL_OP
-}
+	if (chunk->instructions == NULL) {
+		if (!hoshi_decodeChunk(chunk)) {
+			hoshi_catchOutOfMemory(outer);
+			return HOSHI_INTERPRET_COMPILE_ERROR;
+		}
+		decoded = true;
+		/* Chunks that fail verification still run, just with every check in place */
+		hoshi_verifyChunk(vm, chunk, NULL);
+	}
 
-hoshi_InterpretResult hoshi_runChunk(hoshi_VM *vm, hoshi_Chunk *chunk)
-{
 	vm->chunk = chunk;
-	vm->ip = vm->chunk->code;
+	vm->ip = chunk->instructions;
+	vm->resumeUnchecked = NULL;
+	vm->suspended = false;
 
 #if HOSHI_ENABLE_GLOBAL_NAME_DUMP
-	puts("-- Global Dump --");
-	for (int i = 0; i < vm->globalNames.count; i++) {
-		if (vm->globalNames.entries[i].key != NULL) {
-			printf("  [%d] = %.*s\n", i, vm->globalNames.entries[i].key->length, vm->globalNames.entries[i].key->chars);
+	/* The table is turned around once like in hoshi_writeChunkToFile, looking each index up would be quadratic */
+	int globalCount = vm->globalValues.count;
+	hoshi_ObjectString **names = HOSHI_ALLOCATE(&vm->allocator, hoshi_ObjectString *, (globalCount > 0 ? globalCount : 1));
+	for (int i = 0; i < vm->globalNames.capacity; i++) {
+		if (vm->globalNames.keys[i] != NULL) {
+			names[(int)HOSHI_AS_NUMBER(vm->globalNames.values[i])] = vm->globalNames.keys[i];
 		}
 	}
+	puts("-- Global Dump --");
+	for (int i = 0; i < globalCount; i++) {
+		printf("  [%d] = %.*s\n", i, names[i]->length, names[i]->chars);
+	}
+	HOSHI_FREE_ARRAY(&vm->allocator, hoshi_ObjectString *, names, (globalCount > 0 ? globalCount : 1));
 #endif
 
+	hoshi_catchOutOfMemory(outer);
+	return HOSHI_INTERPRET_OK;
+}
+
+void hoshi_resume(hoshi_VM *vm, hoshi_Value value)
+{
+	if (!vm->suspended) {
+		return;
+	}
+	/* Suspending popped the argument, so there is always room for the result */
+	vm->suspended = false;
+	vm->suspendValue = HOSHI_NIL;
+	hoshi_push(vm, value);
+}
+
+void hoshi_setHostFunction(hoshi_VM *vm, uint8_t index, hoshi_HostFunction function)
+{
+	vm->hostFunctions[index] = function;
+}
+
+hoshi_InterpretResult hoshi_runChunk(hoshi_VM *vm, hoshi_Chunk *chunk)
+{
+	hoshi_InterpretResult result = hoshi_enterChunk(vm, chunk);
+	if (result != HOSHI_INTERPRET_OK) {
+		return result;
+	}
 	return hoshi_runNext(vm);
 }
 
-uint8_t hoshi_addGlobal(hoshi_VM *vm, hoshi_ObjectString *name)
+int hoshi_addGlobal(hoshi_VM *vm, hoshi_ObjectString *name)
 {
+	/* Table keys are compared by pointer */
+	name = hoshi_internString(vm, name);
+
 	hoshi_Value index;
 	if (hoshi_tableGet(&vm->globalNames, name, &index)) {
-		return (uint8_t)HOSHI_AS_NUMBER(index);
+		return (int)HOSHI_AS_NUMBER(index);
 	}
 
-	uint8_t newIndex = (uint8_t)vm->globalValues.count;
+	/* Global indices are two bytes at most, see HOSHI_OP_WIDE */
+	if (vm->globalValues.count > UINT16_MAX) {
+		return -1;
+	}
+	int newIndex = vm->globalValues.count;
 	hoshi_writeValueArray(&vm->globalValues, HOSHI_NIL);
 	hoshi_tableSet(&vm->globalNames, name, HOSHI_NUMBER((double)newIndex));
 	return newIndex;
 }
 
-uint8_t hoshi_addLocal(hoshi_VM *vm)
+hoshi_ObjectString *hoshi_globalName(hoshi_VM *vm, int index)
 {
-	return vm->localsTop++;
+	/* Names map to indices and not the other way around, this is only used for errors and writing files so a scan is fine */
+	for (int i = 0; i < vm->globalNames.capacity; i++) {
+		if (vm->globalNames.keys[i] != NULL && HOSHI_AS_NUMBER(vm->globalNames.values[i]) == index) {
+			return vm->globalNames.keys[i];
+		}
+	}
+	return NULL;
 }
 
+/* Regions are only made the first time a scope this deep is entered, and kept for the next scope that deep once it ends.
+ * Each one is allocated on its own, since the pages and blocks in it point back at it. */
 void hoshi_pushScope(hoshi_VM *vm)
 {
-	vm->topScope++;
-	hoshi_initScope(vm->topScope);
+	if (vm->scopeDepth == vm->regionCount) {
+		if (vm->regionCount + 1 > vm->regionCapacity) {
+			int oldCapacity = vm->regionCapacity;
+			int capacity = HOSHI_GROW_CAPACITY(oldCapacity);
+			vm->regions = HOSHI_GROW_ARRAY(&vm->allocator, hoshi_ObjectTracker *, vm->regions, oldCapacity, capacity);
+			vm->regionCapacity = capacity;
+		}
+		/* There is room for the tracker before it is allocated, so once it is, nothing can fail before `regions` holds it */
+		hoshi_ObjectTracker *region = HOSHI_ALLOCATE(&vm->allocator, hoshi_ObjectTracker, 1);
+		hoshi_initTracker(region, &vm->allocator);
+		vm->regions[vm->regionCount++] = region;
+	}
+	vm->scopeDepth++;
 }
 
-void hoshi_popScope(hoshi_VM *vm)
+void hoshi_popScope(hoshi_VM *vm, int first, int count)
 {
-	int depth = vm->topScope - vm->scopes;
-	// printf("popscope %d, %d\n", vm->topScope->localCount, depth);
-	for (int i = 0; i < HOSHI_LOCALS_SIZE-1; i++) {
-		// printf("  i: %d/%d, %d\n", i, HOSHI_LOCALS_SIZE-1, vm->locals[i].depth);
-		if (vm->locals[i].depth > depth) {
-			hoshi_LocalValue *value = &vm->locals[i];
-			value->depth = 0;
-
-			// if (HOSHI_IS_OBJECT(value->value)) {
-			// 	hoshi_freeObject(HOSHI_AS_OBJECT(value->value));
-			// }
-			value->value = HOSHI_NIL;
-			// value->value.as.number = 0;
-			// value->value.type = HOSHI_TYPE_NIL;
-		}
-	}
+	/* The locals are cleared first, so no local is left pointing into the region once it is gone */
+	hoshi_clearLocals(vm, first, count);
+	hoshi_resetTracker(vm->regions[vm->scopeDepth - 1]);
+	vm->scopeDepth--;
+}
 
-	vm->localsTop -= vm->topScope->localCount;
-	vm->topScope--;
+void hoshi_clearLocals(hoshi_VM *vm, int first, int count)
+{
+	for (int i = first; i < first + count; i++) {
+		vm->locals[i] = HOSHI_NIL;
+	}
 }
 
 #endif
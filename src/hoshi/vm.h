@@ -3,12 +3,17 @@
 
 #include "chunk.h"
 #include "config.h"
+#include "gc.h"
 #include "hash_table.h"
 #include "memory.h"
 #include "value.h"
 #include <stdint.h>
 
+/* The first real slot of the VM's stack, see the comment on `hoshi_VM.stack`. */
+#define HOSHI_STACK_BOTTOM(vm) (&(vm)->stack[1])
+
 struct hoshi_VM;
+struct hoshi_Program;
 
 typedef void (*hoshi_ErrorHandler)(struct hoshi_VM *vm);
 
@@ -16,54 +21,156 @@ typedef enum {
 	HOSHI_INTERPRET_OK,
 	HOSHI_INTERPRET_COMPILE_ERROR,
 	HOSHI_INTERPRET_RUNTIME_ERROR,
+	HOSHI_INTERPRET_PAUSED, /* hoshi_runSlice ran out of budget, call it again to continue */
+	HOSHI_INTERPRET_SUSPENDED, /* A YIELD or host call is waiting on the host, call hoshi_resume and then run again to continue */
 } hoshi_InterpretResult;
 
-typedef struct {
-	int localCount;
-} hoshi_Scope;
+/* What a host function wants the VM to do next */
+typedef enum {
+	HOSHI_HOST_OK, /* `*result` is pushed and the chunk keeps running */
+	HOSHI_HOST_SUSPEND, /* The result is not ready yet, the VM suspends until hoshi_resume hands it over */
+	HOSHI_HOST_ERROR, /* The call failed, the host function should have called hoshi_panic already */
+} hoshi_HostResult;
+
+/* A function HOSTCALL can call. It gets the value on top of the stack, which has already been popped. */
+typedef hoshi_HostResult (*hoshi_HostFunction)(struct hoshi_VM *vm, hoshi_Value argument, hoshi_Value *result);
+
+#define HOSHI_BUDGET_UNLIMITED INT64_MAX
 
+/* How long hoshi_runSlice may run for. Whichever of the two runs out first ends the slice. */
 typedef struct {
-	int depth;
-	hoshi_Value value;
-} hoshi_LocalValue;
+	int64_t instructions; /* Roughly how many instructions to run, or HOSHI_BUDGET_UNLIMITED */
+	uint64_t deadline; /* hoshi_clockNanos() time to stop at, or 0 for none */
+} hoshi_Budget;
 
+/* The fields are ordered by how hot they are. Everything hoshi_runNext touches on a typical instruction is packed together at the top,
+ * well away from the big `stack` and `locals` arrays at the bottom. */
 typedef struct hoshi_VM {
 	/* Code */
+	hoshi_Instruction *ip; /* Instruction Pointer, into `chunk->instructions` */
 	hoshi_Chunk *chunk;
-	uint8_t *ip; /* Instruction Pointer */
 	/* Stack */
-	hoshi_Value stack[HOSHI_STACK_SIZE];
 	hoshi_Value *stackTop;
-	/* Strings */
-	hoshi_Table strings;
 	/* Globals */
-	hoshi_Table globalNames;
 	hoshi_ValueArray globalValues;
-	/* Locals */
-	hoshi_LocalValue locals[HOSHI_LOCALS_SIZE];
-	int localsTop;
-	hoshi_Scope scopes[HOSHI_MAX_SCOPE_DEPTH];
-	hoshi_Scope *topScope;
+	/* Locals. The compiler gives every local its own slot in `locals`, so scopes only need counting, and a region each (see `regions`). */
+	int scopeDepth;
 	/* Exit */
 	int exitCode;
-	/* Memory management */
+#if HOSHI_ENABLE_INSTRUCTION_COUNTING
+	/* Statistics */
+	uint64_t instructionCount;
+#endif
+#if HOSHI_ENABLE_JIT
+	/* JIT. Set `jit` to false to only ever interpret, and lower `jitThreshold` to compile chunks sooner (0 compiles on the first backwards jump). */
+	bool jit;
+	uint32_t jitThreshold;
+#endif
+	/* Time slicing, see hoshi_runSlice */
+	int64_t budget; /* Instructions left in the slice that the interpreter loop has not taken yet */
+	uint64_t deadline;
+	bool slicing;
+	hoshi_Instruction *resumeUnchecked; /* Where the unchecked loop paused or suspended, it may continue from there */
+	/* Suspension, see hoshi_resume */
+	bool suspended;
+	hoshi_Value suspendValue; /* What YIELD yielded, or the argument of the host call that suspended */
+	void *hostData; /* Never touched by Hoshi, for host functions to find their way back to whatever owns the VM */
+	/* Strings */
+	hoshi_Table strings;
+	char hashKey[HOSHI_HASH_KEY_SIZE]; /* What strings are hashed under (see hoshi_hashString), random for every VM unless it runs a program */
+	/* Global names */
+	hoshi_Table globalNames;
+	/* Memory management. Everything the VM allocates comes from `allocator` (see memory.h), which hoshi_initVMWithAllocator sets. */
+	hoshi_Allocator allocator;
 	hoshi_ObjectTracker tracker;
+	hoshi_Collector gc; /* Set its tuning fields to collect sooner or later than the HOSHI_GC_* defaults */
+	/* What SCOPED_CONCAT allocates in, one for each scope that is open (`regions[scopeDepth - 1]` is the innermost one) and the ones
+	 * deeper scopes had before, for the next ones to reuse. ENDSCOPE frees everything in its scope's region at once. */
+	hoshi_ObjectTracker **regions;
+	int regionCount;
+	int regionCapacity;
 	/* Error handling */
 	hoshi_ErrorHandler errorHandler;
+	/* The shared program this VM runs, or NULL (see program.h). `programChunk` is this VM's own view of the program's chunk. */
+	struct hoshi_Program *program;
+	hoshi_Chunk programChunk;
+	/* Host functions by HOSTCALL index, NULL when unbound */
+	hoshi_HostFunction hostFunctions[UINT8_MAX + 1];
+	/* Stack storage. `stack[0]` is a sentinel that never holds a real value: hoshi_runNext keeps the top of the stack in a register
+	 * and spills it into the slot below the top, which is the sentinel while the stack is empty. Use HOSHI_STACK_BOTTOM() for the first real slot. */
+	hoshi_Value stack[HOSHI_STACK_SIZE + 1];
+	/* Locals storage, by slot */
+	hoshi_Value locals[HOSHI_LOCALS_SIZE];
 } hoshi_VM;
 
-void hoshi_initScope(hoshi_Scope *scope);
+/* Sets up a VM that allocates with hoshi_defaultAllocator. */
 void hoshi_initVM(hoshi_VM *vm);
+/* Sets up a VM that allocates everything with a copy of `allocator`. Its chunks, tables, and trackers point at the copy, so the VM can not be moved afterwards. */
+void hoshi_initVMWithAllocator(hoshi_VM *vm, const hoshi_Allocator *allocator);
 void hoshi_freeAllObjects(hoshi_VM *vm);
 void hoshi_freeVM(hoshi_VM *vm);
 void hoshi_panic(hoshi_VM *vm, const char *format, ...);
-void hoshi_push(hoshi_VM *vm, hoshi_Value value);
-hoshi_Value hoshi_pop(hoshi_VM *vm);
 hoshi_InterpretResult hoshi_runNext(hoshi_VM *vm);
+/* Runs like hoshi_runNext, but returns HOSHI_INTERPRET_PAUSED once `budget` runs out. `ip`, the stack, and scopes are left as they are,
+ * so the next hoshi_runNext or hoshi_runSlice continues where this one stopped. Budgets are only counted at backwards jumps,
+ * by the length of the loop being closed, so a slice may run a little over. The JIT is not used while slicing. */
+hoshi_InterpretResult hoshi_runSlice(hoshi_VM *vm, hoshi_Budget budget);
+/* Points the VM at the start of `chunk`, decoding and verifying it first if needed. Run it with hoshi_runNext or hoshi_runSlice.
+ * Returns HOSHI_INTERPRET_COMPILE_ERROR if the chunk can not be decoded, and HOSHI_INTERPRET_RUNTIME_ERROR if there is not enough memory for it. */
+hoshi_InterpretResult hoshi_enterChunk(hoshi_VM *vm, hoshi_Chunk *chunk);
+/* hoshi_enterChunk, then hoshi_runNext. */
 hoshi_InterpretResult hoshi_runChunk(hoshi_VM *vm, hoshi_Chunk *chunk);
-uint8_t hoshi_addGlobal(hoshi_VM *vm, hoshi_ObjectString *name);
-uint8_t hoshi_addLocal(hoshi_VM *vm);
+/* Hands the value a suspended YIELD or host call is waiting for to the VM. The next hoshi_runNext or hoshi_runSlice continues from there,
+ * with `value` on top of the stack. Running a VM that is still suspended returns HOSHI_INTERPRET_SUSPENDED straight away. */
+void hoshi_resume(hoshi_VM *vm, hoshi_Value value);
+/* Binds `function` to HOSTCALL `index`, NULL unbinds it. */
+void hoshi_setHostFunction(hoshi_VM *vm, uint8_t index, hoshi_HostFunction function);
+/* Monotonic time in nanoseconds, for hoshi_Budget.deadline. */
+uint64_t hoshi_clockNanos(void);
+/* Returns `a` followed by `b`, which is not interned, and is a rope when it is at least HOSHI_ROPE_MIN_LENGTH long (see object.h). */
+hoshi_ObjectString *hoshi_concatenate(hoshi_VM *vm, hoshi_ObjectString *a, hoshi_ObjectString *b);
+/* Like hoshi_concatenate, but a new string is allocated in `tracker` and never interned, even without ropes. */
+hoshi_ObjectString *hoshi_concatenateIn(hoshi_VM *vm, hoshi_ObjectTracker *tracker, hoshi_ObjectString *a, hoshi_ObjectString *b);
+/* Returns the index of the global called `name`, adding it if there is none yet. Returns -1 once there are UINT16_MAX + 1 globals. */
+int hoshi_addGlobal(hoshi_VM *vm, hoshi_ObjectString *name);
+/* Returns the name of the global at `index`, or NULL if there is none. */
+hoshi_ObjectString *hoshi_globalName(hoshi_VM *vm, int index);
 void hoshi_pushScope(hoshi_VM *vm);
-void hoshi_popScope(hoshi_VM *vm);
+/* Ends the innermost scope: sets `count` locals from `first` on to nil, and frees everything in the scope's region. */
+void hoshi_popScope(hoshi_VM *vm, int first, int count);
+/* Sets `count` locals from `first` on to nil. */
+void hoshi_clearLocals(hoshi_VM *vm, int first, int count);
+
+/* Takes a step of the collector once enough has been allocated since the last one. Only call this where everything the VM may still use
+ * is in one of its roots (see gc.h), the interpreter loop does after CONCAT and host calls. */
+static inline void hoshi_collectIfDue(hoshi_VM *vm)
+{
+#if HOSHI_ENABLE_GC
+	if (vm->tracker.bytes >= vm->gc.stepAt) {
+		hoshi_collectStep(vm);
+	}
+#else
+	(void)vm;
+#endif
+}
+
+/* Stack helpers for code running outside of hoshi_runNext (the interpreter loop keeps its own copy of the stack pointer). */
+
+static inline void hoshi_push(hoshi_VM *vm, hoshi_Value value)
+{
+	*vm->stackTop = value;
+	vm->stackTop++;
+}
+
+static inline hoshi_Value hoshi_pop(hoshi_VM *vm)
+{
+	vm->stackTop--;
+	return *vm->stackTop;
+}
+
+static inline hoshi_Value hoshi_peek(hoshi_VM *vm, int distance)
+{
+	return vm->stackTop[-1 - distance];
+}
 
 #endif
@@ -0,0 +1,897 @@
+/* The interpreter loop. This file has no include guard, vm.c includes it twice to build two copies of the loop:
+ *   HOSHI_LOOP_NAME    - the name of the function to define.
+ *   HOSHI_LOOP_CHECKED - `1` to check everything at runtime, `0` to leave out the checks the verifier (verifier.c) already proved.
+ * Type checks are kept in both copies, the verifier does not track types. */
+
+#ifndef HOSHI_LOOP_NAME
+#error "vm_loop.h: define HOSHI_LOOP_NAME before including this file"
+#endif
+
+#ifndef HOSHI_LOOP_CHECKED
+#error "vm_loop.h: define HOSHI_LOOP_CHECKED before including this file"
+#endif
+
+static hoshi_InterpretResult HOSHI_LOOP_NAME(hoshi_VM *vm)
+{
+	/* The interpreter's hot state lives in locals for the whole loop, so the compiler can keep it in registers:
+	 *   ip  - the instruction pointer. It moves past an instruction as soon as it is dispatched, so handlers find their own instruction at ip[-1].
+	 *   sp  - points at the slot of the top of the stack. That slot is stale, the real value is cached in `tos`.
+	 *         When the stack is empty, sp points at the `stack[0]` sentinel.
+	 *   tos - the top of the stack.
+	 * They are only written back to the VM (SAVE_STATE) before anything that looks at the VM from the outside: panics, returns, host calls, and collector steps. */
+	hoshi_Instruction *ip;
+	hoshi_Value *sp;
+	hoshi_Value tos;
+#if HOSHI_ENABLE_INSTRUCTION_COUNTING
+	uint64_t instructionCount = 0;
+#endif
+
+/* Macro shorthands. These get #undef'ed from existence after the interpreter loop below. */
+#if HOSHI_ENABLE_INSTRUCTION_COUNTING
+	#define SAVE_COUNT() (vm->instructionCount += instructionCount, instructionCount = 0)
+#else
+	#define SAVE_COUNT() ((void)0)
+#endif
+#define LOAD_STATE() (ip = vm->ip, sp = vm->stackTop - 1, tos = *sp)
+#define SAVE_STATE() (vm->ip = ip, *sp = tos, vm->stackTop = sp + 1, SAVE_COUNT())
+#define PUSH(value) \
+	do { \
+		CHECK(sp - vm->stack < HOSHI_STACK_SIZE, "stack overflow"); \
+		hoshi_Value pushed = (value); \
+		*sp++ = tos; \
+		tos = pushed; \
+	} while (0)
+#define DROP() (tos = *--sp)
+#define PEEK(distance) ((distance) == 0 ? tos : sp[-(distance)])
+#define PANIC(...) \
+	do { \
+		SAVE_STATE(); \
+		hoshi_panic(vm, __VA_ARGS__); \
+		return HOSHI_INTERPRET_RUNTIME_ERROR; \
+	} while (0)
+/* Runtime checks for what the verifier proves. CHECK(condition, ...) panics with the message when `condition` is false, and compiles to nothing in the unchecked loop. */
+#if HOSHI_LOOP_CHECKED
+	#define CHECK(condition, ...) \
+		do { \
+			if (!(condition)) { \
+				PANIC(__VA_ARGS__); \
+			} \
+		} while (0)
+#else
+	#define CHECK(condition, ...) do { } while (0)
+#endif
+/* Checks that there are at least `count` values on the stack */
+#define NEED(count) CHECK(sp - vm->stack >= (count), "stack underflow")
+/* Operands of the instruction being run, hoshi_decodeChunk has already read them */
+#define READ_INDEX() (ip[-1].index)
+#define READ_CONSTANT() (*ip[-1].as.constant)
+#define READ_TARGET() (ip[-1].as.target)
+#define READ_COUNT() (ip[-1].as.count)
+#define BINARY_OP(valueType, op)\
+	do { \
+		if (!HOSHI_IS_NUMBER(tos) || !HOSHI_IS_NUMBER(sp[-1])) {\
+			PANIC("operands must be two numbers or two integers."); \
+		} \
+		double b = HOSHI_AS_NUMBER(tos); \
+		sp--; \
+		tos = valueType(HOSHI_AS_NUMBER(*sp) op b); \
+	} while (0)
+#define BINARY_BOOL_OP(op)\
+	do { \
+		NEED(2); \
+		if (!HOSHI_IS_BOOL(tos) || !HOSHI_IS_BOOL(sp[-1])) {\
+			PANIC("operands must be booleans."); \
+		} \
+		bool b = HOSHI_AS_BOOL(tos); \
+		sp--; \
+		tos = HOSHI_BOOL(HOSHI_AS_BOOL(*sp) op b); \
+	} while (0)
+
+#define BOTH_NUMBERS() (HOSHI_IS_NUMBER(tos) && HOSHI_IS_NUMBER(sp[-1]))
+#define BOTH_INTEGERS() (HOSHI_IS_INTEGER(tos) && HOSHI_IS_INTEGER(sp[-1]))
+/* Integer versions of BINARY_OP, for when both operands are known to be integers.
+ * Arithmetic goes through one of the __builtin_*_overflow functions and panics instead of wrapping, or when the result does not fit (see HOSHI_INTEGER_FITS). */
+#define INTEGER_ARITHMETIC(overflow) \
+	do { \
+		int64_t result; \
+		if (overflow(HOSHI_AS_INTEGER(sp[-1]), HOSHI_AS_INTEGER(tos), &result) || !HOSHI_INTEGER_FITS(result)) { \
+			PANIC("integer overflow"); \
+		} \
+		sp--; \
+		tos = HOSHI_INTEGER(result); \
+	} while (0)
+#define INTEGER_BINARY(valueType, op) \
+	do { \
+		int64_t b = HOSHI_AS_INTEGER(tos); \
+		sp--; \
+		tos = valueType(HOSHI_AS_INTEGER(*sp) op b); \
+	} while (0)
+/* There are no implicit conversions between numbers and integers, these take two of either and panic on anything else */
+#define ARITHMETIC_OP(op, overflow) \
+	do { \
+		if (BOTH_INTEGERS()) { \
+			INTEGER_ARITHMETIC(overflow); \
+		} else { \
+			BINARY_OP(HOSHI_NUMBER, op); \
+		} \
+	} while (0)
+#define COMPARISON_OP(op) \
+	do { \
+		if (BOTH_INTEGERS()) { \
+			INTEGER_BINARY(HOSHI_BOOL, op); \
+		} else { \
+			BINARY_OP(HOSHI_BOOL, op); \
+		} \
+	} while (0)
+/* Bitwise ops only take integers */
+#define BITWISE_OP(op) \
+	do { \
+		NEED(2); \
+		if (!BOTH_INTEGERS()) { \
+			PANIC("operands must be integers."); \
+		} \
+		INTEGER_BINARY(HOSHI_INTEGER, op); \
+	} while (0)
+/* Quickened version of BINARY_OP. If either operand is not a number, the instruction is turned back into `name` and we run that instead. */
+#define NUMBER_OP(name, valueType, op) \
+	do { \
+		NEED(2); \
+		if (!BOTH_NUMBERS()) { \
+			QUICKEN(HOSHI_OP_##name); \
+			FALLBACK(name); \
+		} \
+		double b = HOSHI_AS_NUMBER(tos); \
+		sp--; \
+		tos = valueType(HOSHI_AS_NUMBER(*sp) op b); \
+	} while (0)
+/* Quickened integer ops, `operation` is INTEGER_ARITHMETIC or INTEGER_BINARY. Falls back to `name` like NUMBER_OP does. */
+#define INTEGER_OP(name, operation) \
+	do { \
+		NEED(2); \
+		if (!BOTH_INTEGERS()) { \
+			QUICKEN(HOSHI_OP_##name); \
+			FALLBACK(name); \
+		} \
+		operation; \
+	} while (0)
+
+#if HOSHI_ENABLE_QUICKENING
+	/* Rewrites the opcode of the instruction we are in */
+	#define QUICKEN(opcode) (ip[-1].op = (opcode))
+	/* Specializes `name` for numbers when both operands are numbers. */
+	#define QUICKEN_NUMBER_OP(name) \
+		do { \
+			if (BOTH_NUMBERS()) { \
+				QUICKEN(HOSHI_OP_##name##_NUM_NUM); \
+			} \
+		} while (0)
+	/* Specializes `name` for integers when both operands are integers. */
+	#define QUICKEN_INTEGER_OP(name) \
+		do { \
+			if (BOTH_INTEGERS()) { \
+				QUICKEN(HOSHI_OP_##name##_INT_INT); \
+			} \
+		} while (0)
+#else
+	#define QUICKEN(opcode) do { } while (0)
+	#define QUICKEN_NUMBER_OP(name) do { } while (0)
+	#define QUICKEN_INTEGER_OP(name) do { } while (0)
+#endif
+
+#if HOSHI_ENABLE_TRACE_EXECUTION_DEBUGGING
+	#define TRACE_INSTRUCTION() \
+		do { \
+			SAVE_STATE(); \
+			hoshi_printStack(vm); \
+			hoshi_disassembleInstruction(vm->chunk, (int)ip->offset); \
+		} while (0)
+#else
+	#define TRACE_INSTRUCTION() do { } while (0)
+#endif
+
+#if HOSHI_ENABLE_INSTRUCTION_COUNTING
+	#define COUNT_INSTRUCTION() (instructionCount++)
+#else
+	#define COUNT_INSTRUCTION() do { } while (0)
+#endif
+
+/* Backwards jumps count the slice's budget down by the length of the loop they close (see hoshi_runSlice), and pause the run once it is gone.
+ * Only counting here keeps straight-line code free of any budget work, and a run without a slice never gets anywhere near running out. */
+#define CHARGE_BUDGET(from) \
+	do { \
+		if ((budget -= (from) - ip) <= 0 && !hoshi_refillBudget(vm, &budget)) { \
+			vm->resumeUnchecked = HOSHI_LOOP_CHECKED ? NULL : ip; \
+			SAVE_STATE(); \
+			return HOSHI_INTERPRET_PAUSED; \
+		} \
+	} while (0)
+
+/* Parks the VM until the host calls hoshi_resume. Like a pause, a suspended unchecked run may continue in the unchecked loop,
+ * the verifier already counted the value hoshi_resume pushes. */
+#define SUSPEND() \
+	do { \
+		vm->suspended = true; \
+		vm->resumeUnchecked = HOSHI_LOOP_CHECKED ? NULL : ip; \
+		SAVE_STATE(); \
+		return HOSHI_INTERPRET_SUSPENDED; \
+	} while (0)
+
+/* A safepoint: takes a step of the collector once one is due. The stack is written back first, since it is one of the roots,
+ * and everything in flight has to be on it already (see gc.h). Nothing is moved, so the cached state stays good. */
+#if HOSHI_ENABLE_GC
+	#define COLLECT() \
+		do { \
+			if (vm->tracker.bytes >= vm->gc.stepAt) { \
+				SAVE_STATE(); \
+				hoshi_collectStep(vm); \
+			} \
+		} while (0)
+#else
+	#define COLLECT() do { } while (0)
+#endif
+
+/* Every jump goes through JUMP_TO. With the JIT enabled, backwards jumps count towards compiling the chunk,
+ * and once it has been compiled they continue in machine code until it hands control back to us.
+ * Machine code does no checks of its own and knows nothing of budgets, so only the unchecked loop enters it, and never while slicing. */
+#if HOSHI_ENABLE_JIT && !HOSHI_LOOP_CHECKED
+	#define JUMP_TO(target) \
+		do { \
+			hoshi_Instruction *from = ip; \
+			ip = (target); \
+			if (ip < from) { \
+				CHARGE_BUDGET(from); \
+				if (vm->jit && !vm->slicing && (vm->chunk->jit != NULL || ++vm->chunk->hotness >= vm->jitThreshold)) { \
+					SAVE_STATE(); \
+					hoshi_jitRun(vm); \
+					LOAD_STATE(); \
+				} \
+			} \
+		} while (0)
+#else
+	#define JUMP_TO(target) \
+		do { \
+			hoshi_Instruction *from = ip; \
+			ip = (target); \
+			if (ip < from) { \
+				CHARGE_BUDGET(from); \
+			} \
+		} while (0)
+#endif
+
+/* Dispatch macros. With computed gotos, every handler jumps straight to the next handler through `dispatchTable`.
+ * Otherwise we fall back to a plain `switch` inside of a loop. */
+#if HOSHI_ENABLE_COMPUTED_GOTO
+	static void *dispatchTable[UINT8_MAX + 1] = {
+		[0 ... UINT8_MAX] = &&op_UNKNOWN,
+		/* Stack ops */
+		[HOSHI_OP_PUSH] = &&op_PUSH,
+		[HOSHI_OP_POP] = &&op_POP,
+		[HOSHI_OP_CONSTANT] = &&op_CONSTANT,
+		[HOSHI_OP_CONSTANT_LONG] = &&op_CONSTANT_LONG,
+		[HOSHI_OP_TRUE] = &&op_TRUE,
+		[HOSHI_OP_FALSE] = &&op_FALSE,
+		[HOSHI_OP_NIL] = &&op_NIL,
+		/* Variables */
+		[HOSHI_OP_DEFGLOBAL] = &&op_DEFGLOBAL,
+		[HOSHI_OP_SETGLOBAL] = &&op_SETGLOBAL,
+		[HOSHI_OP_GETGLOBAL] = &&op_GETGLOBAL,
+		[HOSHI_OP_DEFLOCAL] = &&op_DEFLOCAL,
+		[HOSHI_OP_SETLOCAL] = &&op_SETLOCAL,
+		[HOSHI_OP_GETLOCAL] = &&op_GETLOCAL,
+		[HOSHI_OP_NEWSCOPE] = &&op_NEWSCOPE,
+		[HOSHI_OP_ENDSCOPE] = &&op_ENDSCOPE,
+		[HOSHI_OP_CLEARLOCALS] = &&op_CLEARLOCALS,
+		/* Control flow */
+		[HOSHI_OP_JUMP] = &&op_JUMP,
+		[HOSHI_OP_BACK_JUMP] = &&op_BACK_JUMP,
+		[HOSHI_OP_JUMP_IF] = &&op_JUMP_IF,
+		[HOSHI_OP_BACK_JUMP_IF] = &&op_BACK_JUMP_IF,
+		[HOSHI_OP_GOTO] = &&op_GOTO,
+		[HOSHI_OP_GOTO_IF] = &&op_GOTO_IF,
+		/* Math */
+		[HOSHI_OP_ADD] = &&op_ADD,
+		[HOSHI_OP_SUB] = &&op_SUB,
+		[HOSHI_OP_MUL] = &&op_MUL,
+		[HOSHI_OP_DIV] = &&op_DIV,
+		[HOSHI_OP_NEGATE] = &&op_NEGATE,
+		/* Boolean ops */
+		[HOSHI_OP_NOT] = &&op_NOT,
+		[HOSHI_OP_AND] = &&op_AND,
+		[HOSHI_OP_OR] = &&op_OR,
+		[HOSHI_OP_XOR] = &&op_XOR,
+		/* Comparisons */
+		[HOSHI_OP_EQ] = &&op_EQ,
+		[HOSHI_OP_NEQ] = &&op_NEQ,
+		[HOSHI_OP_GT] = &&op_GT,
+		[HOSHI_OP_LT] = &&op_LT,
+		[HOSHI_OP_GTEQ] = &&op_GTEQ,
+		[HOSHI_OP_LTEQ] = &&op_LTEQ,
+		/* String ops */
+		[HOSHI_OP_CONCAT] = &&op_CONCAT,
+		[HOSHI_OP_SCOPED_CONCAT] = &&op_SCOPED_CONCAT,
+		/* Misc */
+		[HOSHI_OP_PRINT] = &&op_PRINT,
+		[HOSHI_OP_RETURN] = &&op_RETURN,
+		[HOSHI_OP_EXIT] = &&op_EXIT,
+		/* Suspension */
+		[HOSHI_OP_YIELD] = &&op_YIELD,
+		[HOSHI_OP_HOSTCALL] = &&op_HOSTCALL,
+		/* Modulo and bitwise ops */
+		[HOSHI_OP_MOD] = &&op_MOD,
+		[HOSHI_OP_BAND] = &&op_BAND,
+		[HOSHI_OP_BOR] = &&op_BOR,
+		[HOSHI_OP_BXOR] = &&op_BXOR,
+		[HOSHI_OP_BNOT] = &&op_BNOT,
+		[HOSHI_OP_SHL] = &&op_SHL,
+		[HOSHI_OP_SHR] = &&op_SHR,
+		/* Conversions */
+		[HOSHI_OP_TOINT] = &&op_TOINT,
+		[HOSHI_OP_TONUM] = &&op_TONUM,
+		/* Superinstructions */
+		[HOSHI_OP_GETLOCAL_CONSTANT_ADD_SETLOCAL] = &&op_GETLOCAL_CONSTANT_ADD_SETLOCAL,
+		[HOSHI_OP_CONSTANT_EQ_GOTO_IF] = &&op_CONSTANT_EQ_GOTO_IF,
+		[HOSHI_OP_CONSTANT_NEQ_GOTO_IF] = &&op_CONSTANT_NEQ_GOTO_IF,
+		[HOSHI_OP_CONSTANT_LT_GOTO_IF] = &&op_CONSTANT_LT_GOTO_IF,
+		[HOSHI_OP_GETLOCAL_GETLOCAL_CONCAT] = &&op_GETLOCAL_GETLOCAL_CONCAT,
+		/* Quickened instructions */
+		[HOSHI_OP_ADD_NUM_NUM] = &&op_ADD_NUM_NUM,
+		[HOSHI_OP_SUB_NUM_NUM] = &&op_SUB_NUM_NUM,
+		[HOSHI_OP_MUL_NUM_NUM] = &&op_MUL_NUM_NUM,
+		[HOSHI_OP_DIV_NUM_NUM] = &&op_DIV_NUM_NUM,
+		[HOSHI_OP_EQ_NUM_NUM] = &&op_EQ_NUM_NUM,
+		[HOSHI_OP_NEQ_NUM_NUM] = &&op_NEQ_NUM_NUM,
+		[HOSHI_OP_GT_NUM_NUM] = &&op_GT_NUM_NUM,
+		[HOSHI_OP_LT_NUM_NUM] = &&op_LT_NUM_NUM,
+		[HOSHI_OP_GTEQ_NUM_NUM] = &&op_GTEQ_NUM_NUM,
+		[HOSHI_OP_LTEQ_NUM_NUM] = &&op_LTEQ_NUM_NUM,
+		[HOSHI_OP_ADD_INT_INT] = &&op_ADD_INT_INT,
+		[HOSHI_OP_SUB_INT_INT] = &&op_SUB_INT_INT,
+		[HOSHI_OP_MUL_INT_INT] = &&op_MUL_INT_INT,
+		[HOSHI_OP_EQ_INT_INT] = &&op_EQ_INT_INT,
+		[HOSHI_OP_NEQ_INT_INT] = &&op_NEQ_INT_INT,
+		[HOSHI_OP_GT_INT_INT] = &&op_GT_INT_INT,
+		[HOSHI_OP_LT_INT_INT] = &&op_LT_INT_INT,
+		[HOSHI_OP_GTEQ_INT_INT] = &&op_GTEQ_INT_INT,
+		[HOSHI_OP_LTEQ_INT_INT] = &&op_LTEQ_INT_INT,
+	};
+
+	#define DISPATCH() \
+		do { \
+			TRACE_INSTRUCTION(); \
+			COUNT_INSTRUCTION(); \
+			goto *dispatchTable[instruction = (ip++)->op]; \
+		} while (0)
+	#define INTERPRET_LOOP DISPATCH();
+	#define CASE(name) op_##name
+	#define CASE_UNKNOWN op_UNKNOWN
+	#define FALLBACK(name) goto op_##name
+#else
+	#define DISPATCH() goto loop
+	#define INTERPRET_LOOP \
+		loop: \
+			TRACE_INSTRUCTION(); \
+			COUNT_INSTRUCTION(); \
+			instruction = (ip++)->op; \
+		fallback: \
+			switch (instruction)
+	#define CASE(name) case HOSHI_OP_##name
+	#define CASE_UNKNOWN default
+	#define FALLBACK(name) do { instruction = HOSHI_OP_##name; goto fallback; } while (0)
+#endif
+
+/* FALLBACK(name) runs the handler of `name` for the instruction we are currently in, without reading another one.
+ * Superinstructions use it to fall back to the first instruction of their sequence when a fast path does not apply.
+ * This only works because superinstructions are decoded with the operands of that first instruction (see hoshi_decodeChunk). */
+
+	uint8_t instruction;
+	/* This loop's part of the slice's budget, see CHARGE_BUDGET */
+	int64_t budget = hoshi_takeBudget(vm);
+
+	LOAD_STATE();
+
+	/* Here's a switch statement in its natural habitat. They're found in all interpreters somewhere.
+	 * (Unless HOSHI_ENABLE_COMPUTED_GOTO is set, then it's a jump table wearing a switch statement's clothes.) */
+	INTERPRET_LOOP {
+		/* Stack ops */
+		CASE(PUSH): {
+			PANIC("push unimplemented.");
+		// 	hoshi_Value it = READ_INDEX();
+		// 	PUSH();
+			DISPATCH();
+		}
+		CASE(POP): {
+			CHECK(sp != vm->stack, "error: attempted to pop but stack was empty");
+			DROP();
+			DISPATCH();
+		}
+		CASE(CONSTANT): {
+			PUSH(READ_CONSTANT());
+			DISPATCH();
+		}
+		CASE(CONSTANT_LONG): {
+			PUSH(READ_CONSTANT());
+			DISPATCH();
+		}
+		CASE(TRUE): PUSH(HOSHI_BOOL(true)); DISPATCH();
+		CASE(FALSE): PUSH(HOSHI_BOOL(false)); DISPATCH();
+		CASE(NIL): PUSH(HOSHI_NIL); DISPATCH();
+		/* Variables */
+		CASE(DEFGLOBAL): {
+			NEED(1);
+			CHECK(READ_INDEX() < vm->globalValues.count, "undefined global index: %d", READ_INDEX());
+			vm->globalValues.values[READ_INDEX()] = tos;
+			DROP();
+			// hoshi_ObjectString *name = READ_STRING();
+			// hoshi_tableSet(&vm->globals, name, hoshi_peek(vm, 0));
+			// hoshi_pop(vm);
+			DISPATCH();
+		}
+		CASE(SETGLOBAL): {
+			int index = READ_INDEX();
+			NEED(1);
+			CHECK(index < vm->globalValues.count, "undefined global index: %d", index);
+			CHECK(!HOSHI_IS_NIL(vm->globalValues.values[index]), "undefined variable: `%.*s`", hoshi_globalName(vm, index)->length, hoshi_globalName(vm, index)->chars);
+			vm->globalValues.values[index] = tos;
+			// hoshi_ObjectString *name = READ_STRING();
+			// if (hoshi_tableSet(&vm->globals, name, hoshi_peek(vm, 0))) {
+			// 	hoshi_tableDelete(&vm->globals, name); /* delete the zombie value */
+			// 	hoshi_panic(vm, "undefined variable: `%s`", name->chars);
+			// 	return HOSHI_INTERPRET_RUNTIME_ERROR;
+			// }
+			DISPATCH();
+		}
+		CASE(GETGLOBAL): {
+			int index = READ_INDEX();
+			CHECK(index < vm->globalValues.count, "undefined global index: %d", index);
+			hoshi_Value value = vm->globalValues.values[index];
+			CHECK(!HOSHI_IS_NIL(value), "undefined variable: `%.*s`", hoshi_globalName(vm, index)->length, hoshi_globalName(vm, index)->chars);
+			PUSH(value);
+			// hoshi_ObjectString *name = READ_STRING();
+			// hoshi_Value value;
+			// if (!hoshi_tableGet(&vm->globals, name, &value)) {
+			// 	hoshi_panic(vm, "undefined variable: \"%.*s\"", name->length, name->chars);
+			// 	return HOSHI_INTERPRET_RUNTIME_ERROR;
+			// }
+			// hoshi_push(vm, value);
+			DISPATCH();
+		}
+		CASE(DEFLOCAL): {
+			int index = READ_INDEX();
+			NEED(1);
+			CHECK(index < HOSHI_LOCALS_SIZE, "undefined local index: %d", index);
+			vm->locals[index] = tos;
+			DROP();
+			DISPATCH();
+		}
+		CASE(SETLOCAL): {
+			NEED(1);
+			CHECK(READ_INDEX() < HOSHI_LOCALS_SIZE, "undefined local index: %d", READ_INDEX());
+			vm->locals[READ_INDEX()] = tos;
+			DISPATCH();
+		}
+		CASE(GETLOCAL): {
+			CHECK(READ_INDEX() < HOSHI_LOCALS_SIZE, "undefined local index: %d", READ_INDEX());
+			PUSH(vm->locals[READ_INDEX()]);
+			DISPATCH();
+		}
+		CASE(NEWSCOPE): {
+			CHECK(vm->scopeDepth + 1 < HOSHI_MAX_SCOPE_DEPTH, "scopes nested too deeply");
+			hoshi_pushScope(vm);
+			DISPATCH();
+		}
+		CASE(ENDSCOPE): {
+			CHECK(vm->scopeDepth != 0, "attempted to end a scope but none was open");
+			CHECK(READ_INDEX() + READ_COUNT() <= HOSHI_LOCALS_SIZE, "undefined local index: %d", READ_INDEX() + READ_COUNT() - 1);
+			hoshi_popScope(vm, READ_INDEX(), READ_COUNT());
+			DISPATCH();
+		}
+		CASE(CLEARLOCALS): {
+			CHECK(READ_INDEX() + READ_COUNT() <= HOSHI_LOCALS_SIZE, "undefined local index: %d", READ_INDEX() + READ_COUNT() - 1);
+			hoshi_clearLocals(vm, READ_INDEX(), READ_COUNT());
+			DISPATCH();
+		}
+		/* Control flow. Relative and absolute jumps look the same once decoded. */
+		CASE(JUMP):
+		CASE(BACK_JUMP):
+		CASE(GOTO): {
+			JUMP_TO(READ_TARGET());
+			DISPATCH();
+		}
+		CASE(JUMP_IF):
+		CASE(BACK_JUMP_IF):
+		CASE(GOTO_IF): {
+			NEED(1);
+			hoshi_Value value = tos;
+			DROP();
+			if (HOSHI_IS_BOOL(value) && HOSHI_AS_BOOL(value)) {
+				JUMP_TO(READ_TARGET());
+			}
+			DISPATCH();
+		}
+		/* Math */
+		CASE(ADD): NEED(2); QUICKEN_NUMBER_OP(ADD); QUICKEN_INTEGER_OP(ADD); ARITHMETIC_OP(+, __builtin_add_overflow); DISPATCH();
+		CASE(SUB): NEED(2); QUICKEN_NUMBER_OP(SUB); QUICKEN_INTEGER_OP(SUB); ARITHMETIC_OP(-, __builtin_sub_overflow); DISPATCH();
+		CASE(MUL): NEED(2); QUICKEN_NUMBER_OP(MUL); QUICKEN_INTEGER_OP(MUL); ARITHMETIC_OP(*, __builtin_mul_overflow); DISPATCH();
+		CASE(DIV): {
+			NEED(2);
+			QUICKEN_NUMBER_OP(DIV);
+			if (!BOTH_INTEGERS()) {
+				BINARY_OP(HOSHI_NUMBER, /);
+				DISPATCH();
+			}
+			/* Integer division truncates towards zero, like C's */
+			int64_t b = HOSHI_AS_INTEGER(tos);
+			if (b == 0) {
+				PANIC("division by zero");
+			}
+			if (b == -1 && HOSHI_AS_INTEGER(sp[-1]) == HOSHI_INTEGER_MIN) {
+				PANIC("integer overflow");
+			}
+			sp--;
+			tos = HOSHI_INTEGER(HOSHI_AS_INTEGER(*sp) / b);
+			DISPATCH();
+		}
+		CASE(NEGATE): {
+			NEED(1);
+			if (HOSHI_IS_INTEGER(tos)) {
+				if (HOSHI_AS_INTEGER(tos) == HOSHI_INTEGER_MIN) {
+					PANIC("integer overflow");
+				}
+				tos = HOSHI_INTEGER(-HOSHI_AS_INTEGER(tos));
+				DISPATCH();
+			}
+			if (!HOSHI_IS_NUMBER(tos)) {
+				PANIC("operand must be a number or an integer");
+			}
+			tos = HOSHI_NUMBER(-HOSHI_AS_NUMBER(tos));
+			DISPATCH();
+		}
+		/* Boolean ops */
+		CASE(NOT): {
+			NEED(1);
+			if (!HOSHI_IS_BOOL(tos)) {
+				PANIC("operand must be a boolean");
+			}
+			tos = HOSHI_BOOL(!HOSHI_AS_BOOL(tos));
+			DISPATCH();
+		}
+		CASE(AND): BINARY_BOOL_OP(&&); DISPATCH();
+		CASE(OR): BINARY_BOOL_OP(||); DISPATCH();
+		CASE(XOR): BINARY_BOOL_OP(^); DISPATCH();
+		/* Comparisons */
+		CASE(EQ): {
+			NEED(2);
+			QUICKEN_NUMBER_OP(EQ);
+			QUICKEN_INTEGER_OP(EQ);
+			hoshi_Value b = tos;
+			sp--;
+			tos = HOSHI_BOOL(hoshi_valuesEqual(*sp, b));
+			DISPATCH();
+		}
+		CASE(NEQ): {
+			NEED(2);
+			QUICKEN_NUMBER_OP(NEQ);
+			QUICKEN_INTEGER_OP(NEQ);
+			hoshi_Value b = tos;
+			sp--;
+			tos = HOSHI_BOOL(!hoshi_valuesEqual(*sp, b));
+			DISPATCH();
+		}
+		CASE(GT): NEED(2); QUICKEN_NUMBER_OP(GT); QUICKEN_INTEGER_OP(GT); COMPARISON_OP(>); DISPATCH();
+		CASE(LT): NEED(2); QUICKEN_NUMBER_OP(LT); QUICKEN_INTEGER_OP(LT); COMPARISON_OP(<); DISPATCH();
+		CASE(GTEQ): NEED(2); QUICKEN_NUMBER_OP(GTEQ); QUICKEN_INTEGER_OP(GTEQ); COMPARISON_OP(>=); DISPATCH();
+		CASE(LTEQ): NEED(2); QUICKEN_NUMBER_OP(LTEQ); QUICKEN_INTEGER_OP(LTEQ); COMPARISON_OP(<=); DISPATCH();
+		/* String ops */
+		CASE(CONCAT): {
+			NEED(2);
+			if (!HOSHI_IS_STRING(tos) || !HOSHI_IS_STRING(sp[-1])) {
+				PANIC("operands must be strings");
+			}
+			hoshi_ObjectString *b = HOSHI_AS_STRING(tos);
+			sp--;
+			tos = HOSHI_OBJECT(hoshi_concatenate(vm, HOSHI_AS_STRING(*sp), b));
+			COLLECT();
+			DISPATCH();
+		}
+		CASE(SCOPED_CONCAT): {
+			NEED(2);
+			CHECK(vm->scopeDepth != 0, "attempted to allocate in a scope but none was open");
+			if (!HOSHI_IS_STRING(tos) || !HOSHI_IS_STRING(sp[-1])) {
+				PANIC("operands must be strings");
+			}
+			hoshi_ObjectString *b = HOSHI_AS_STRING(tos);
+			sp--;
+			/* Nothing is allocated on the heap, so there is no collector step to take */
+			tos = HOSHI_OBJECT(hoshi_concatenateIn(vm, vm->regions[vm->scopeDepth - 1], HOSHI_AS_STRING(*sp), b));
+			DISPATCH();
+		}
+		/* Misc */
+		CASE(PRINT): {
+			NEED(1);
+			hoshi_printValue(tos);
+			DROP();
+			DISPATCH();
+		}
+		CASE(RETURN): {
+			SAVE_STATE();
+			return HOSHI_INTERPRET_OK;
+		}
+		CASE(EXIT): {
+			NEED(1);
+			if (HOSHI_IS_INTEGER(tos)) {
+				vm->exitCode = HOSHI_AS_INTEGER(tos);
+			} else if (HOSHI_IS_NUMBER(tos)) {
+				vm->exitCode = HOSHI_AS_NUMBER(tos);
+			} else {
+				PANIC("operand must be an integer or a number");
+			}
+			DROP();
+			SAVE_STATE();
+			return HOSHI_INTERPRET_OK;
+		}
+		/* Suspension */
+		CASE(YIELD): {
+			NEED(1);
+			vm->suspendValue = tos;
+			DROP();
+			SUSPEND();
+		}
+		CASE(HOSTCALL): {
+			NEED(1);
+			hoshi_HostFunction function = vm->hostFunctions[READ_INDEX()];
+			if (function == NULL) {
+				PANIC("no host function bound to index %d", READ_INDEX());
+			}
+			hoshi_Value argument = tos;
+			DROP();
+			/* The host function may look at or panic the VM, so it has to see the same state we do */
+			SAVE_STATE();
+			hoshi_Value result = HOSHI_NIL;
+			switch (function(vm, argument, &result)) {
+				case HOSHI_HOST_OK:
+					break;
+				case HOSHI_HOST_SUSPEND:
+					vm->suspendValue = argument;
+					SUSPEND();
+				case HOSHI_HOST_ERROR:
+					return HOSHI_INTERPRET_RUNTIME_ERROR;
+			}
+			LOAD_STATE();
+			PUSH(result);
+			COLLECT();
+			DISPATCH();
+		}
+		/* Modulo and bitwise ops. These only take integers. */
+		CASE(MOD): {
+			NEED(2);
+			if (!BOTH_INTEGERS()) {
+				PANIC("operands must be integers.");
+			}
+			/* The result has the sign of the dividend, like C's `%` */
+			int64_t b = HOSHI_AS_INTEGER(tos);
+			if (b == 0) {
+				PANIC("division by zero");
+			}
+			sp--;
+			/* INT64_MIN % -1 overflows in C, even though the answer is 0 */
+			tos = HOSHI_INTEGER(b == -1 ? 0 : HOSHI_AS_INTEGER(*sp) % b);
+			DISPATCH();
+		}
+		CASE(BAND): BITWISE_OP(&); DISPATCH();
+		CASE(BOR): BITWISE_OP(|); DISPATCH();
+		CASE(BXOR): BITWISE_OP(^); DISPATCH();
+		CASE(BNOT): {
+			NEED(1);
+			if (!HOSHI_IS_INTEGER(tos)) {
+				PANIC("operand must be an integer");
+			}
+			tos = HOSHI_INTEGER(~HOSHI_AS_INTEGER(tos));
+			DISPATCH();
+		}
+		CASE(SHL):
+		CASE(SHR): {
+			NEED(2);
+			if (!BOTH_INTEGERS()) {
+				PANIC("operands must be integers.");
+			}
+			int64_t b = HOSHI_AS_INTEGER(tos);
+			if (b < 0 || b > 63) {
+				PANIC("shift amount out of range: %" PRId64, b);
+			}
+			int64_t a = HOSHI_AS_INTEGER(sp[-1]);
+			int64_t result;
+			if (instruction == HOSHI_OP_SHR) {
+				/* Arithmetic shift, the sign is kept */
+				result = a >> b;
+			} else {
+				/* Shifting bits out, the sign bit included, is an overflow like any other */
+				result = (int64_t)((uint64_t)a << b);
+				if (result >> b != a || !HOSHI_INTEGER_FITS(result)) {
+					PANIC("integer overflow");
+				}
+			}
+			sp--;
+			tos = HOSHI_INTEGER(result);
+			DISPATCH();
+		}
+		/* Conversions, the only way between numbers and integers */
+		CASE(TOINT): {
+			NEED(1);
+			if (HOSHI_IS_INTEGER(tos)) {
+				DISPATCH();
+			}
+			if (!HOSHI_IS_NUMBER(tos)) {
+				PANIC("operand must be a number or an integer");
+			}
+			/* Truncates towards zero. NaN fails both comparisons. */
+			double number = HOSHI_AS_NUMBER(tos);
+			if (!(number >= -9223372036854775808.0 && number < 9223372036854775808.0) || !HOSHI_INTEGER_FITS((int64_t)number)) {
+				PANIC("number does not fit in an integer: %g", number);
+			}
+			tos = HOSHI_INTEGER((int64_t)number);
+			DISPATCH();
+		}
+		CASE(TONUM): {
+			NEED(1);
+			if (HOSHI_IS_NUMBER(tos)) {
+				DISPATCH();
+			}
+			if (!HOSHI_IS_INTEGER(tos)) {
+				PANIC("operand must be a number or an integer");
+			}
+			/* Rounds to the nearest double past 2^53 */
+			tos = HOSHI_NUMBER((double)HOSHI_AS_INTEGER(tos));
+			DISPATCH();
+		}
+		/* Superinstructions. Every instruction of the sequence is decoded on its own, `ip[-1]` is the first and the comments show where the rest sit. */
+		CASE(GETLOCAL_CONSTANT_ADD_SETLOCAL): {
+			/* [-1] = GETLOCAL, [0] = CONSTANT, [1] = ADD, [2] = SETLOCAL */
+			CHECK(ip[-1].index < HOSHI_LOCALS_SIZE && ip[2].index < HOSHI_LOCALS_SIZE, "undefined local index");
+			hoshi_Value a = vm->locals[ip[-1].index];
+			hoshi_Value b = *ip[0].as.constant;
+			/* Each type gets its own copy of the tail, a shared one makes the compiler move integers through a floating point register */
+			int64_t sum;
+			if (HOSHI_IS_INTEGER(a) && HOSHI_IS_INTEGER(b) && !__builtin_add_overflow(HOSHI_AS_INTEGER(a), HOSHI_AS_INTEGER(b), &sum) && HOSHI_INTEGER_FITS(sum)) {
+				hoshi_Value result = HOSHI_INTEGER(sum);
+				vm->locals[ip[2].index] = result;
+				PUSH(result);
+				ip += 3;
+				DISPATCH();
+			}
+			if (!HOSHI_IS_NUMBER(a) || !HOSHI_IS_NUMBER(b)) {
+				/* Includes integer overflows, so ADD can panic about them */
+				FALLBACK(GETLOCAL);
+			}
+			hoshi_Value result = HOSHI_NUMBER(HOSHI_AS_NUMBER(a) + HOSHI_AS_NUMBER(b));
+			vm->locals[ip[2].index] = result;
+			PUSH(result);
+			ip += 3;
+			DISPATCH();
+		}
+		CASE(CONSTANT_EQ_GOTO_IF): {
+			/* [-1] = CONSTANT, [0] = EQ, [1] = GOTO_IF */
+			NEED(1);
+			bool equal = hoshi_valuesEqual(tos, *ip[-1].as.constant);
+			DROP();
+			if (equal) {
+				JUMP_TO(ip[1].as.target);
+			} else {
+				ip += 2;
+			}
+			DISPATCH();
+		}
+		CASE(CONSTANT_NEQ_GOTO_IF): {
+			/* [-1] = CONSTANT, [0] = NEQ, [1] = GOTO_IF */
+			NEED(1);
+			bool equal = hoshi_valuesEqual(tos, *ip[-1].as.constant);
+			DROP();
+			if (!equal) {
+				JUMP_TO(ip[1].as.target);
+			} else {
+				ip += 2;
+			}
+			DISPATCH();
+		}
+		CASE(CONSTANT_LT_GOTO_IF): {
+			/* [-1] = CONSTANT, [0] = LT, [1] = GOTO_IF */
+			NEED(1);
+			hoshi_Value b = *ip[-1].as.constant;
+			bool less;
+			if (HOSHI_IS_INTEGER(tos) && HOSHI_IS_INTEGER(b)) {
+				less = HOSHI_AS_INTEGER(tos) < HOSHI_AS_INTEGER(b);
+			} else if (HOSHI_IS_NUMBER(tos) && HOSHI_IS_NUMBER(b)) {
+				less = HOSHI_AS_NUMBER(tos) < HOSHI_AS_NUMBER(b);
+			} else {
+				FALLBACK(CONSTANT);
+			}
+			DROP();
+			if (less) {
+				JUMP_TO(ip[1].as.target);
+			} else {
+				ip += 2;
+			}
+			DISPATCH();
+		}
+		CASE(GETLOCAL_GETLOCAL_CONCAT): {
+			/* [-1] = GETLOCAL, [0] = GETLOCAL, [1] = CONCAT */
+			CHECK(ip[-1].index < HOSHI_LOCALS_SIZE && ip[0].index < HOSHI_LOCALS_SIZE, "undefined local index");
+			hoshi_Value a = vm->locals[ip[-1].index];
+			hoshi_Value b = vm->locals[ip[0].index];
+			if (!HOSHI_IS_STRING(a) || !HOSHI_IS_STRING(b)) {
+				FALLBACK(GETLOCAL);
+			}
+			PUSH(HOSHI_OBJECT(hoshi_concatenate(vm, HOSHI_AS_STRING(a), HOSHI_AS_STRING(b))));
+			ip += 2;
+			COLLECT();
+			DISPATCH();
+		}
+		/* Quickened instructions */
+		CASE(ADD_NUM_NUM): NUMBER_OP(ADD, HOSHI_NUMBER, +); DISPATCH();
+		CASE(SUB_NUM_NUM): NUMBER_OP(SUB, HOSHI_NUMBER, -); DISPATCH();
+		CASE(MUL_NUM_NUM): NUMBER_OP(MUL, HOSHI_NUMBER, *); DISPATCH();
+		CASE(DIV_NUM_NUM): NUMBER_OP(DIV, HOSHI_NUMBER, /); DISPATCH();
+		CASE(EQ_NUM_NUM): NUMBER_OP(EQ, HOSHI_BOOL, ==); DISPATCH();
+		CASE(NEQ_NUM_NUM): NUMBER_OP(NEQ, HOSHI_BOOL, !=); DISPATCH();
+		CASE(GT_NUM_NUM): NUMBER_OP(GT, HOSHI_BOOL, >); DISPATCH();
+		CASE(LT_NUM_NUM): NUMBER_OP(LT, HOSHI_BOOL, <); DISPATCH();
+		CASE(GTEQ_NUM_NUM): NUMBER_OP(GTEQ, HOSHI_BOOL, >=); DISPATCH();
+		CASE(LTEQ_NUM_NUM): NUMBER_OP(LTEQ, HOSHI_BOOL, <=); DISPATCH();
+		CASE(ADD_INT_INT): INTEGER_OP(ADD, INTEGER_ARITHMETIC(__builtin_add_overflow)); DISPATCH();
+		CASE(SUB_INT_INT): INTEGER_OP(SUB, INTEGER_ARITHMETIC(__builtin_sub_overflow)); DISPATCH();
+		CASE(MUL_INT_INT): INTEGER_OP(MUL, INTEGER_ARITHMETIC(__builtin_mul_overflow)); DISPATCH();
+		CASE(EQ_INT_INT): INTEGER_OP(EQ, INTEGER_BINARY(HOSHI_BOOL, ==)); DISPATCH();
+		CASE(NEQ_INT_INT): INTEGER_OP(NEQ, INTEGER_BINARY(HOSHI_BOOL, !=)); DISPATCH();
+		CASE(GT_INT_INT): INTEGER_OP(GT, INTEGER_BINARY(HOSHI_BOOL, >)); DISPATCH();
+		CASE(LT_INT_INT): INTEGER_OP(LT, INTEGER_BINARY(HOSHI_BOOL, <)); DISPATCH();
+		CASE(GTEQ_INT_INT): INTEGER_OP(GTEQ, INTEGER_BINARY(HOSHI_BOOL, >=)); DISPATCH();
+		CASE(LTEQ_INT_INT): INTEGER_OP(LTEQ, INTEGER_BINARY(HOSHI_BOOL, <=)); DISPATCH();
+		CASE_UNKNOWN: {
+			PANIC("unknown opcode: %d", instruction);
+		}
+	}
+
+	SAVE_STATE();
+	return HOSHI_INTERPRET_OK;
+
+#undef SAVE_COUNT
+#undef LOAD_STATE
+#undef SAVE_STATE
+#undef PUSH
+#undef DROP
+#undef PEEK
+#undef PANIC
+#undef CHECK
+#undef NEED
+#undef READ_INDEX
+#undef READ_CONSTANT
+#undef READ_TARGET
+#undef READ_COUNT
+#undef BINARY_OP
+#undef BINARY_BOOL_OP
+#undef BOTH_NUMBERS
+#undef BOTH_INTEGERS
+#undef INTEGER_ARITHMETIC
+#undef INTEGER_BINARY
+#undef ARITHMETIC_OP
+#undef COMPARISON_OP
+#undef BITWISE_OP
+#undef NUMBER_OP
+#undef INTEGER_OP
+#undef QUICKEN
+#undef QUICKEN_NUMBER_OP
+#undef QUICKEN_INTEGER_OP
+#undef TRACE_INSTRUCTION
+#undef COUNT_INSTRUCTION
+#undef CHARGE_BUDGET
+#undef SUSPEND
+#undef COLLECT
+#undef JUMP_TO
+#undef DISPATCH
+#undef INTERPRET_LOOP
+#undef CASE
+#undef CASE_UNKNOWN
+#undef FALLBACK
+}
+
+#undef HOSHI_LOOP_NAME
+#undef HOSHI_LOOP_CHECKED
@@ -0,0 +1,230 @@
+/* Out of memory test: builds and runs HIR programs with a capped allocator, raising the cap a little at a time from less than anything needs,
+ * and checks that every cap that is too small fails with an error instead of aborting, and leaves nothing allocated behind.
+ * It covers hoshi_enterChunk (decoding and verifying), hoshi_initProgram, and hoshi_initVMForProgramWithAllocator.
+ * tests/hoshi/test.sh builds it and runs it on every test in tests/hir.
+ * Results are written to stderr, so the programs' own output can be thrown away. */
+
+#include "../../src/hir/compiler.h"
+#include "../../src/hoshi/chunk.h"
+#include "../../src/hoshi/memory.h"
+#include "../../src/hoshi/program.h"
+#include "../../src/hoshi/vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* How much the cap goes up between tries */
+#define TEST_CAP_STEP 256
+
+typedef struct {
+	size_t live;
+	size_t cap;
+} test_Cap;
+
+static void *test_allocate(void *user, size_t size, size_t alignment)
+{
+	test_Cap *cap = user;
+	if (cap->live + size > cap->cap) {
+		return NULL;
+	}
+	/* aligned_alloc wants the size to be a multiple of the alignment */
+	void *block = alignment <= HOSHI_DEFAULT_ALIGNMENT ? malloc(size) : aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+	if (block != NULL) {
+		cap->live += size;
+	}
+	return block;
+}
+
+static void *test_reallocate(void *user, void *pointer, size_t oldSize, size_t newSize)
+{
+	test_Cap *cap = user;
+	if (newSize > oldSize && cap->live + (newSize - oldSize) > cap->cap) {
+		return NULL;
+	}
+	void *block = realloc(pointer, newSize);
+	if (block != NULL) {
+		cap->live = cap->live - oldSize + newSize;
+	}
+	return block;
+}
+
+static void test_free(void *user, void *pointer, size_t size)
+{
+	test_Cap *cap = user;
+	cap->live -= size;
+	free(pointer);
+}
+
+static char *test_readFile(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "error: could not open file: %s\n", path);
+		exit(74);
+	}
+
+	fseek(file, 0L, SEEK_END);
+	size_t size = ftell(file);
+	rewind(file);
+
+	char *buffer = malloc(size + 1);
+	if (buffer == NULL || fread(buffer, sizeof(char), size, file) < size) {
+		fprintf(stderr, "error: could not read file: %s\n", path);
+		exit(74);
+	}
+	buffer[size] = '\0';
+
+	fclose(file);
+	return buffer;
+}
+
+/* Compiles `source` into `chunk` with a VM capped at `cap`, which starts out with no cap so compiling never fails. */
+static void test_compile(hoshi_VM *vm, hoshi_Chunk *chunk, test_Cap *cap, const char *source)
+{
+	hoshi_Allocator allocator = { test_allocate, test_reallocate, test_free, cap };
+	cap->live = 0;
+	cap->cap = SIZE_MAX;
+	hoshi_initVMWithAllocator(vm, &allocator);
+	hoshi_initChunk(chunk, &vm->allocator);
+	if (!hir_compileString(vm, chunk, source)) {
+		fputs("error: failed to compile\n", stderr);
+		exit(1);
+	}
+}
+
+/* Enters the chunk with a cap that starts at what compiling it left allocated. Returns how many caps were too small. */
+static int test_enterChunk(const char *path, const char *source, hoshi_InterpretResult expected, int *failures)
+{
+	test_Cap cap;
+	hoshi_VM vm;
+	hoshi_Chunk chunk;
+	test_compile(&vm, &chunk, &cap, source);
+
+	size_t compiled = cap.live;
+	int tooSmall = 0;
+	hoshi_InterpretResult result;
+	for (cap.cap = compiled; (result = hoshi_enterChunk(&vm, &chunk)) == HOSHI_INTERPRET_RUNTIME_ERROR; cap.cap += TEST_CAP_STEP) {
+		tooSmall++;
+		if (cap.live != compiled || chunk.instructions != NULL) {
+			fprintf(stderr, "FAIL %s: entering with a cap of %zu left %zu bytes behind\n", path, cap.cap - compiled, cap.live - compiled);
+			(*failures)++;
+			break;
+		}
+	}
+	cap.cap = SIZE_MAX;
+	if (result == HOSHI_INTERPRET_OK) {
+		result = hoshi_runNext(&vm);
+	}
+	if (result != expected) {
+		fprintf(stderr, "FAIL %s: ended with %d once entered, not %d\n", path, result, expected);
+		(*failures)++;
+	}
+
+	hoshi_freeChunk(&chunk);
+	hoshi_freeVM(&vm);
+	if (cap.live != 0) {
+		fprintf(stderr, "FAIL %s: %zu bytes are still allocated after freeing the VM\n", path, cap.live);
+		(*failures)++;
+	}
+	return tooSmall;
+}
+
+/* Builds a program with a cap too small to decode the chunk, then again without one, and then sets VMs up for it with caps from 0 on. */
+static int test_program(const char *path, const char *source, hoshi_InterpretResult expected, int *failures)
+{
+	test_Cap programCap;
+	hoshi_VM vm;
+	hoshi_Chunk chunk;
+	test_compile(&vm, &chunk, &programCap, source);
+
+	hoshi_Program program;
+	programCap.cap = programCap.live;
+	if (hoshi_initProgram(&program, &vm, &chunk)) {
+		fprintf(stderr, "FAIL %s: built a program without room to decode it\n", path);
+		(*failures)++;
+		hoshi_freeProgram(&program);
+		hoshi_freeChunk(&chunk);
+		hoshi_freeVM(&vm);
+		return 0;
+	}
+	programCap.cap = SIZE_MAX;
+	if (!hoshi_initProgram(&program, &vm, &chunk)) {
+		fprintf(stderr, "FAIL %s: failed to build a program without a cap\n", path);
+		exit(1);
+	}
+	hoshi_freeChunk(&chunk);
+	hoshi_freeVM(&vm);
+
+	test_Cap cap = { 0, 0 };
+	hoshi_Allocator allocator = { test_allocate, test_reallocate, test_free, &cap };
+	int tooSmall = 0;
+	while (!hoshi_initVMForProgramWithAllocator(&vm, &program, &allocator)) {
+		tooSmall++;
+		if (cap.live != 0) {
+			fprintf(stderr, "FAIL %s: setting a VM up with a cap of %zu left %zu bytes behind\n", path, cap.cap, cap.live);
+			(*failures)++;
+			break;
+		}
+		cap.cap += TEST_CAP_STEP;
+	}
+	cap.cap = SIZE_MAX;
+	hoshi_InterpretResult result = hoshi_runProgram(&vm);
+	if (result != expected) {
+		fprintf(stderr, "FAIL %s: program ended with %d, not %d\n", path, result, expected);
+		(*failures)++;
+	}
+	hoshi_freeVM(&vm);
+	if (cap.live != 0) {
+		fprintf(stderr, "FAIL %s: %zu bytes are still allocated after freeing the program's VM\n", path, cap.live);
+		(*failures)++;
+	}
+
+	hoshi_freeProgram(&program);
+	return tooSmall;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fputs("usage: out_of_memory <file.hir>...\n", stderr);
+		return 1;
+	}
+
+	int failures = 0;
+	for (int i = 1; i < argc; i++) {
+		/* The source has to outlive the program, HIR's identifiers point into it */
+		char *source = test_readFile(argv[i]);
+
+		/* What the program ends with when nothing is capped, every run that got going has to end the same way */
+		hoshi_VM vm;
+		hoshi_initVM(&vm);
+		hoshi_Chunk chunk;
+		hoshi_initChunk(&chunk, &vm.allocator);
+		if (!hir_compileString(&vm, &chunk, source)) {
+			fprintf(stderr, "error: failed to compile %s\n", argv[i]);
+			return 1;
+		}
+		hoshi_InterpretResult expected = hoshi_runChunk(&vm, &chunk);
+		hoshi_freeChunk(&chunk);
+		hoshi_freeVM(&vm);
+
+		int entering = test_enterChunk(argv[i], source, expected, &failures);
+		int settingUp = test_program(argv[i], source, expected, &failures);
+		if (entering == 0 || settingUp == 0) {
+			fprintf(stderr, "FAIL %s: no cap was too small\n", argv[i]);
+			failures++;
+		}
+		fprintf(stderr, "%s: %d caps too small to enter, %d too small to set a VM up\n", argv[i], entering, settingUp);
+
+		free(source);
+	}
+
+	if (failures > 0) {
+		fprintf(stderr, "%d failures\n", failures);
+		return 1;
+	}
+	fputs("ok\n", stderr);
+	return 0;
+}
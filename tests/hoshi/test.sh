@@ -0,0 +1,43 @@
+#!/usr/bin/env sh
+
+# Builds and runs the libhoshi tests. Run it from the repository's root:
+#   sh tests/hoshi/test.sh [cflags...]
+# The flags are passed on to gcc, i.e, to test a build with -DHOSHI_ENABLE_SLABS=0.
+
+set -e
+
+mkdir -p target/tests
+
+libhoshi_sources="
+	src/hoshi/binio/binio.c
+	src/hoshi/chunk_loader.c
+	src/hoshi/chunk_writer.c
+	src/hoshi/chunk.c
+	src/hoshi/common.c
+	src/hoshi/debug.c
+	src/hoshi/fusion.c
+	src/hoshi/gc.c
+	src/hoshi/hash_table.c
+	src/hoshi/jit.c
+	src/hoshi/memory.c
+	src/hoshi/object.c
+	src/hoshi/optimizer.c
+	src/hoshi/program.c
+	src/hoshi/siphash.c
+	src/hoshi/ssa.c
+	src/hoshi/value.c
+	src/hoshi/verifier.c
+	src/hoshi/vm.c"
+hir_sources="
+	src/hir/compiler.c
+	src/hir/regions.c
+	src/hir/lexer.c"
+test_flags="-Wall -pthread"
+
+cc () {
+	echo "-> gcc $@"
+	gcc $@
+}
+
+cc "-o target/tests/out_of_memory $test_flags $@ tests/hoshi/out_of_memory.c $libhoshi_sources $hir_sources -lm"
+./target/tests/out_of_memory tests/hir/*.hir > /dev/null